@@ -75,6 +75,9 @@
 
 #define MADV_MERGEABLE   12		/* KSM may merge identical pages */
 #define MADV_UNMERGEABLE 13		/* KSM may not merge identical pages */
+
+#define MADV_HUGEPAGE	14		/* Worth backing with hugepages */
+#define MADV_NOHUGEPAGE	15		/* Not worth using hugepages */
 #define MADV_HWPOISON    100		/* poison a page for testing */
 
 /* compatibility flags */
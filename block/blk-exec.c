@@ -7,6 +7,7 @@
 #include <linux/blkdev.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 /*
  * for max sense size
@@ -53,6 +54,12 @@ void blk_execute_rq_nowait(struct request_queue *q, struct gendisk *bd_disk,
 	rq->rq_disk = bd_disk;
 	rq->end_io = done;
 	WARN_ON(irqs_disabled());
+
+	if (q->mq_ops) {
+		blk_mq_insert_request(rq, at_head, true);
+		return;
+	}
+
 	spin_lock_irq(q->queue_lock);
 	__elv_add_request(q, rq, where, 1);
 	__generic_unplug_device(q);
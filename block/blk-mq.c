@@ -0,0 +1,689 @@
+/*
+ * Multi-queue request path.
+ *
+ * Queues set up with blk_mq_init_queue() bypass the elevator and the single
+ * queue_lock.  Every CPU submits into its own software queue (struct
+ * blk_mq_ctx), where requests are merged and plugged under a per-cpu lock.
+ * Each software queue is mapped onto one of the hardware queues the driver
+ * registered; running a hardware queue collects the requests of its
+ * software queues and hands them to the driver's ->queue_rq().
+ *
+ * Requests are preallocated per hardware queue and identified by a tag, a
+ * bit in the hardware queue's tag map, so allocating and freeing one is a
+ * lockless bit operation.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/writeback.h>
+#include <linux/workqueue.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+/* How far back a software queue is searched for a merge candidate */
+#define BLK_MQ_MERGE_DEPTH	8
+
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return per_cpu_ptr(q->queue_ctx, get_cpu());
+}
+
+static void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+static struct blk_mq_hw_ctx *blk_mq_ctx_to_hctx(struct blk_mq_ctx *ctx)
+{
+	return ctx->queue->queue_hw_ctx[ctx->index_hw];
+}
+
+/*
+ * Grab a free tag, starting the search at the ctx hint so that CPUs
+ * sharing a hardware queue mostly work on different words of the map.
+ */
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      struct blk_mq_ctx *ctx,
+					      unsigned int rw_flags)
+{
+	struct request_queue *q = hctx->queue;
+	unsigned int start = ctx->last_tag;
+	unsigned int tag;
+	struct request *rq;
+
+	for (;;) {
+		tag = find_next_zero_bit(hctx->tag_map, hctx->queue_depth,
+					 start);
+		if (tag >= hctx->queue_depth) {
+			if (!start)
+				return NULL;
+			start = 0;
+			continue;
+		}
+		if (!test_and_set_bit(tag, hctx->tag_map))
+			break;
+		start = tag + 1;
+	}
+
+	ctx->last_tag = tag + 1 < hctx->queue_depth ? tag + 1 : 0;
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+static bool blk_mq_tags_full(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_zero_bit(hctx->tag_map, hctx->queue_depth) >=
+		hctx->queue_depth;
+}
+
+/*
+ * Sleep until a tag frees up.  Returns with the ctx of the request held,
+ * the caller must drop it with blk_mq_put_ctx().
+ */
+static struct request *blk_mq_alloc_request_wait(struct request_queue *q,
+						 unsigned int rw_flags)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	DEFINE_WAIT(wait);
+
+	for (;;) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = blk_mq_ctx_to_hctx(ctx);
+		rq = __blk_mq_alloc_request(hctx, ctx, rw_flags);
+		if (rq)
+			return rq;
+		blk_mq_put_ctx(ctx);
+
+		/* the requests sitting in the software queues hold tags too */
+		blk_mq_run_hw_queue(hctx, false);
+
+		prepare_to_wait(&hctx->wait, &wait, TASK_UNINTERRUPTIBLE);
+		if (blk_mq_tags_full(hctx)) {
+			trace_block_sleeprq(q, NULL, rw_flags & 1);
+			io_schedule();
+		}
+		finish_wait(&hctx->wait, &wait);
+	}
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request on a multi-queue queue
+ * @q:		the queue
+ * @rw:		READ or WRITE
+ * @gfp:	allocation flags, only __GFP_WAIT is looked at
+ *
+ * Used by blk_get_request() for multi-queue queues.  Without __GFP_WAIT,
+ * returns %NULL if the hardware queue of the current CPU has no free tag.
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	if (gfp & __GFP_WAIT) {
+		rq = blk_mq_alloc_request_wait(q, rw);
+		ctx = rq->mq_ctx;
+	} else {
+		ctx = blk_mq_get_ctx(q);
+		rq = __blk_mq_alloc_request(blk_mq_ctx_to_hctx(ctx), ctx, rw);
+	}
+	blk_mq_put_ctx(ctx);
+
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_free_request - release a request
+ * @rq:		the request
+ *
+ * Drops a reference to @rq and returns its tag once the last one is gone.
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(rq->mq_ctx);
+	unsigned int tag = rq->tag;
+
+	if (unlikely(--rq->ref_count))
+		return;
+
+	/* this is a bio leak */
+	WARN_ON(rq->bio != NULL);
+
+	clear_bit(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->wait))
+		wake_up(&hctx->wait);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+/**
+ * blk_mq_end_io - complete a request
+ * @rq:		the request
+ * @error:	%0 for success, < %0 for error
+ *
+ * Ends I/O on all of @rq and releases it, or hands it to its ->end_io()
+ * callback.  May be called from any context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	if (unlikely(laptop_mode) && rq->cmd_type == REQ_TYPE_FS)
+		laptop_io_completion(&rq->q->backing_dev_info);
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+/*
+ * Move the requests of all software queues mapped to @hctx to the driver,
+ * behind the ones it previously returned BUSY for.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	unsigned int i;
+	int ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (test_and_clear_bit(BLK_MQ_S_PLUGGED, &hctx->state))
+		trace_block_unplug_io(q);
+
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	for (i = 0; i < hctx->nr_ctx; i++) {
+		ctx = hctx->ctxs[i];
+		if (list_empty_careful(&ctx->rq_list))
+			continue;
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		ctx->nr_queued = 0;
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/*
+	 * The driver is out of resources; it is expected to have stopped
+	 * the queue and to restart it from its completion path.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the requests queued on a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	run it from kblockd instead of the current context
+ *
+ * Runs from kblockd regardless of @async in interrupt context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async || in_interrupt())
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+/**
+ * blk_mq_run_queues - run all hardware queues of a queue
+ * @q:		the queue
+ * @async:	run them from kblockd instead of the current context
+ */
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Like blk_stop_queue(), for drivers that run out of resources in
+ * ->queue_rq().  Requests keep being queued, but are not dispatched until
+ * the queue is restarted with blk_mq_start_stopped_hw_queues().
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	cancel_delayed_work(&hctx->delay_work);
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart stopped hardware queues
+ * @q:		the queue
+ * @async:	run the queues from kblockd instead of the current context
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	__blk_mq_run_hw_queue(hctx);
+}
+
+static void blk_mq_delay_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, delay_work.work);
+
+	trace_block_unplug_timer(hctx->queue);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/*
+ * Hold back dispatching for up to unplug_delay, so that more requests
+ * can be merged in the software queues.
+ */
+static void blk_mq_plug_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+
+	if (test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		return;
+
+	if (!test_and_set_bit(BLK_MQ_S_PLUGGED, &hctx->state)) {
+		trace_block_plug(q);
+		kblockd_schedule_delayed_work(q, &hctx->delay_work,
+					      q->unplug_delay);
+	}
+}
+
+/*
+ * ->unplug_fn of multi-queue queues, called when someone waits on the
+ * queue: flush everything still plugged.
+ */
+static void blk_mq_unplug(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (test_bit(BLK_MQ_S_PLUGGED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, false);
+	}
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request
+ * @rq:		request from blk_mq_alloc_request()
+ * @at_head:	queue it in front of the requests already waiting
+ * @run_queue:	dispatch right away
+ *
+ * Used by blk_execute_rq_nowait() for multi-queue queues.
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+
+	trace_block_rq_insert(rq->q, rq);
+
+	spin_lock(&ctx->lock);
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	ctx->nr_queued++;
+	spin_unlock(&ctx->lock);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, false);
+	else
+		blk_mq_plug_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Try to merge @bio into one of the last requests queued on @ctx.
+ * Called with the ctx lock held.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = BLK_MQ_MERGE_DEPTH;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+
+		if (!elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (blk_rq_pos(rq) + blk_rq_sectors(rq) == bio->bi_sector) {
+			if (bio_attempt_back_merge(q, rq, bio))
+				return true;
+		} else if (blk_rq_pos(rq) - bio_sectors(bio) == bio->bi_sector) {
+			if (bio_attempt_front_merge(q, rq, bio))
+				return true;
+		}
+		break;
+	}
+
+	return false;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	bool run = rw_is_sync(bio->bi_rw) || (bio->bi_rw & REQ_UNPLUG);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	unsigned int rw_flags;
+
+	blk_queue_bounce(q, &bio);
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = blk_mq_ctx_to_hctx(ctx);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) && !blk_queue_nomerges(q) &&
+	    !(bio->bi_rw & (REQ_FLUSH | REQ_FUA))) {
+		spin_lock(&ctx->lock);
+		if (blk_mq_attempt_merge(q, ctx, bio)) {
+			spin_unlock(&ctx->lock);
+			goto out;
+		}
+		spin_unlock(&ctx->lock);
+	}
+
+	rw_flags = bio_data_dir(bio);
+	if (bio->bi_rw & REQ_SYNC)
+		rw_flags |= REQ_SYNC;
+
+	rq = __blk_mq_alloc_request(hctx, ctx, rw_flags);
+	if (unlikely(!rq)) {
+		blk_mq_put_ctx(ctx);
+		rq = blk_mq_alloc_request_wait(q, rw_flags);
+		ctx = rq->mq_ctx;
+		hctx = blk_mq_ctx_to_hctx(ctx);
+	}
+	trace_block_getrq(q, bio, rw_flags & 1);
+
+	init_request_from_bio(rq, bio);
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+	    bio_flagged(bio, BIO_CPU_AFFINE))
+		rq->cpu = blk_cpu_to_group(ctx->cpu);
+	drive_stat_acct(rq, 1);
+	trace_block_rq_insert(q, rq);
+
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	/* enough queued on this CPU, don't wait for the plug timer */
+	if (++ctx->nr_queued >= q->unplug_thresh)
+		run = true;
+	spin_unlock(&ctx->lock);
+out:
+	blk_mq_put_ctx(ctx);
+
+	if (run)
+		blk_mq_run_hw_queue(hctx, false);
+	else
+		blk_mq_plug_hw_queue(hctx);
+	return 0;
+}
+
+static void blk_mq_free_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+	}
+	kfree(hctx->tag_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hw_queue(struct request_queue *q,
+						   struct blk_mq_reg *reg,
+						   unsigned int queue_num)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+	if (!hctx)
+		return NULL;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	INIT_DELAYED_WORK(&hctx->delay_work, blk_mq_delay_work_fn);
+	init_waitqueue_head(&hctx->wait);
+	hctx->queue = q;
+	hctx->queue_num = queue_num;
+	hctx->flags = reg->flags;
+	hctx->queue_depth = reg->queue_depth;
+	hctx->numa_node = reg->numa_node;
+
+	hctx->ctxs = kcalloc(nr_cpu_ids, sizeof(*hctx->ctxs), GFP_KERNEL);
+	hctx->tag_map = kcalloc(BITS_TO_LONGS(hctx->queue_depth),
+				sizeof(unsigned long), GFP_KERNEL);
+	hctx->rqs = kcalloc(hctx->queue_depth, sizeof(*hctx->rqs), GFP_KERNEL);
+	if (!hctx->ctxs || !hctx->tag_map || !hctx->rqs)
+		goto fail;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(sizeof(struct request) +
+					    reg->cmd_size, GFP_KERNEL,
+					    reg->numa_node);
+		if (!hctx->rqs[i])
+			goto fail;
+	}
+
+	return hctx;
+
+fail:
+	blk_mq_free_hw_queue(hctx);
+	return NULL;
+}
+
+/*
+ * Spread the possible CPUs over the hardware queues in contiguous ranges,
+ * so that neighbouring CPUs (usually sharing caches) share a queue.
+ */
+static void blk_mq_map_ctxs(struct request_queue *q)
+{
+	unsigned int nr_cpus = num_possible_cpus();
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ctx = per_cpu_ptr(q->queue_ctx, cpu);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->queue = q;
+		ctx->index_hw = i++ * q->nr_hw_queues / nr_cpus;
+
+		hctx = q->queue_hw_ctx[ctx->index_hw];
+		ctx->last_tag = (hctx->nr_ctx * BITS_PER_LONG) %
+				hctx->queue_depth;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	queue parameters and driver operations
+ * @driver_data: passed to ->init_hctx() for each hardware queue
+ *
+ * Returns the queue, or %NULL on failure.  The queue is released with
+ * blk_cleanup_queue() like any other.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct request_queue *q;
+	unsigned int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->queue_depth || reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kcalloc(reg->nr_hw_queues, sizeof(*q->queue_hw_ctx),
+				  GFP_KERNEL);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		q->queue_hw_ctx[i] = blk_mq_alloc_hw_queue(q, reg, i);
+		if (!q->queue_hw_ctx[i])
+			goto fail;
+	}
+
+	blk_mq_map_ctxs(q);
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			goto fail_exit;
+	}
+
+	q->node = reg->numa_node;
+	q->queue_flags = QUEUE_FLAG_DEFAULT;
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	q->nr_requests = reg->queue_depth * reg->nr_hw_queues;
+	q->mq_ops = reg->ops;
+
+	return q;
+
+fail_exit:
+	while (i--)
+		if (reg->ops->exit_hctx)
+			reg->ops->exit_hctx(q->queue_hw_ctx[i], i);
+fail:
+	/* not a multi-queue queue yet, blk_mq_free_queue() won't run */
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < reg->nr_hw_queues; i++)
+			if (q->queue_hw_ctx[i])
+				blk_mq_free_hw_queue(q->queue_hw_ctx[i]);
+		kfree(q->queue_hw_ctx);
+	}
+	free_percpu(q->queue_ctx);
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_sync_queue(): wait for queue runs scheduled on kblockd.
+ */
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_delayed_work_sync(&hctx->delay_work);
+		cancel_work_sync(&hctx->run_work);
+	}
+}
+
+/*
+ * Called when the last reference to the queue is dropped.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+		blk_mq_free_hw_queue(hctx);
+	}
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+}
@@ -0,0 +1,26 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+#include <linux/blk-mq.h>
+
+/*
+ * Per-cpu software queue.  Submitters queue and merge requests here under
+ * the ctx lock only, the hardware queue the ctx is mapped onto collects
+ * them when it runs.
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		nr_queued;	/* since the last run */
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* hardware queue number */
+	unsigned int		last_tag;	/* tag allocation hint */
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+void blk_mq_sync_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+
+#endif
@@ -9,6 +9,7 @@
 #include <linux/blktrace_api.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 struct queue_sysfs_entry {
 	struct attribute attr;
@@ -473,6 +474,9 @@ static void blk_release_queue(struct kobject *kobj)
 
 	blk_throtl_exit(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
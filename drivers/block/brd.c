@@ -26,12 +26,20 @@
 #define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
 
+/* Radix tree tag of chunks handed out by ->direct_access */
+#define BRD_TAG_MAPPED		0
+
 /*
- * Each block ramdisk device has a radix_tree brd_pages of pages that stores
- * the pages containing the block device's contents. A brd page's ->index is
- * its offset in PAGE_SIZE units. This is similar to, but in no way connected
- * with, the kernel's pagecache or buffer cache (which sit above our block
- * device).
+ * Each block ramdisk device has a radix_tree brd_pages of chunks that store
+ * the block device's contents.  A chunk is a block of 1 << brd_chunk_order
+ * contiguous pages (a compound page for orders above 0), allocated on
+ * brd_node when possible.  The ->index of a chunk's first page is its offset
+ * in chunk units.  When no whole chunk can be allocated, smaller blocks of
+ * pages back its range instead, each page in radix_tree brd_small_pages with
+ * its offset in PAGE_SIZE units as index and ->index.  A chunk's range is in
+ * one tree or the other, never in both.  This is similar to, but in no way
+ * connected with, the kernel's pagecache or buffer cache (which sit above our
+ * block device).
  */
 struct brd_device {
 	int		brd_number;
@@ -39,63 +47,76 @@ struct brd_device {
 	loff_t		brd_offset;
 	loff_t		brd_sizelimit;
 	unsigned	brd_blocksize;
+	unsigned int	brd_chunk_order;
+	int		brd_node;
 
 	struct request_queue	*brd_queue;
 	struct gendisk		*brd_disk;
 	struct list_head	brd_list;
 
 	/*
-	 * Backing store of pages and lock to protect it. This is the contents
-	 * of the block device.
+	 * Backing store of chunks and lock to protect it. This is the
+	 * contents of the block device.
 	 */
 	spinlock_t		brd_lock;
 	struct radix_tree_root	brd_pages;
+	struct radix_tree_root	brd_small_pages;
 };
 
 /*
- * Look up and return a brd's page for a given sector.
+ * Largest order of the blocks used when a whole chunk cannot be allocated.
+ * The pages of such a block all go in one radix tree node, so that once the
+ * first is inserted, inserting the others needs no memory.
  */
-static DEFINE_MUTEX(brd_mutex);
-static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
-{
-	pgoff_t idx;
-	struct page *page;
+#define BRD_SMALL_MAX_ORDER	4
 
-	/*
-	 * The page lifetime is protected by the fact that we have opened the
-	 * device node -- brd pages will never be deleted under us, so we
-	 * don't need any further locking or refcounting.
-	 *
-	 * This is strictly true for the radix-tree nodes as well (ie. we
-	 * don't actually need the rcu_read_lock()), however that is not a
-	 * documented feature of the radix-tree API so it is better to be
-	 * safe here (we don't have total exclusion from radix tree updates
-	 * here, only deletes).
-	 */
-	rcu_read_lock();
-	idx = sector >> PAGE_SECTORS_SHIFT; /* sector to page index */
-	page = radix_tree_lookup(&brd->brd_pages, idx);
-	rcu_read_unlock();
+#define FREE_BATCH 16
+
+static inline unsigned int brd_chunk_sectors(struct brd_device *brd)
+{
+	return PAGE_SECTORS << brd->brd_chunk_order;
+}
 
-	BUG_ON(page && page->index != idx);
+static inline pgoff_t brd_chunk_index(struct brd_device *brd, sector_t sector)
+{
+	return sector >> (PAGE_SECTORS_SHIFT + brd->brd_chunk_order);
+}
 
-	return page;
+static inline pgoff_t brd_page_index(sector_t sector)
+{
+	return sector >> PAGE_SECTORS_SHIFT;
 }
 
 /*
  * Look up and return a brd's page for a given sector.
- * If one does not exist, allocate an empty page, and insert that. Then
- * return it.
+ *
+ * Discard frees chunks, so the caller must hold rcu_read_lock() (or
+ * brd_lock) for as long as it uses the page.
  */
-static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
+static DEFINE_MUTEX(brd_mutex);
+static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 {
 	pgoff_t idx;
-	struct page *page;
-	gfp_t gfp_flags;
-
-	page = brd_lookup_page(brd, sector);
-	if (page)
+	struct page *chunk, *page;
+
+	idx = brd_chunk_index(brd, sector);
+	chunk = radix_tree_lookup(&brd->brd_pages, idx);
+	if (!chunk) {
+		idx = brd_page_index(sector);
+		page = radix_tree_lookup(&brd->brd_small_pages, idx);
+		BUG_ON(page && page->index != idx);
 		return page;
+	}
+
+	BUG_ON(chunk->index != idx);
+
+	return chunk + ((sector >> PAGE_SECTORS_SHIFT) &
+			((1 << brd->brd_chunk_order) - 1));
+}
+
+static struct page *brd_alloc_chunk(struct brd_device *brd, int order)
+{
+	gfp_t gfp_flags;
 
 	/*
 	 * Must use NOIO because we don't want to recurse back into the
@@ -110,88 +131,260 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 #ifndef CONFIG_BLK_DEV_XIP
 	gfp_flags |= __GFP_HIGHMEM;
 #endif
-	page = alloc_page(gfp_flags);
-	if (!page)
-		return NULL;
+	/* fail quickly, there are smaller blocks to fall back to */
+	if (order)
+		gfp_flags |= __GFP_COMP | __GFP_NORETRY | __GFP_NOWARN;
+
+	return alloc_pages_node(brd->brd_node, gfp_flags, order);
+}
+
+/*
+ * Insert a chunk, or a smaller block of 1 << order pages, for the range
+ * holding a given sector.  Returns -EEXIST, if some of that range is backed
+ * already.  The pages are freed on failure.
+ */
+static int brd_add_chunk(struct brd_device *brd, sector_t sector,
+			 struct page *chunk, int order)
+{
+	pgoff_t idx = brd_chunk_index(brd, sector);
+	pgoff_t first = brd_page_index(sector) & ~((1UL << order) - 1);
+	struct page *page;
+	int i, err = -EEXIST;
 
 	if (radix_tree_preload(GFP_NOIO)) {
-		__free_page(page);
-		return NULL;
+		__free_pages(chunk, order);
+		return -ENOMEM;
 	}
 
+	/* lookups are lockless, the indices must be right before insertion */
+	if (order == brd->brd_chunk_order)
+		chunk->index = idx;
+	else
+		for (i = 0; i < 1 << order; i++)
+			chunk[i].index = first + i;
+
 	spin_lock(&brd->brd_lock);
-	idx = sector >> PAGE_SECTORS_SHIFT;
-	if (radix_tree_insert(&brd->brd_pages, idx, page)) {
-		__free_page(page);
-		page = radix_tree_lookup(&brd->brd_pages, idx);
-		BUG_ON(!page);
-		BUG_ON(page->index != idx);
-	} else
-		page->index = idx;
-	spin_unlock(&brd->brd_lock);
+	if (radix_tree_lookup(&brd->brd_pages, idx))
+		goto out;
+	if (radix_tree_gang_lookup(&brd->brd_small_pages, (void **)&page,
+				   first, 1) &&
+	    page->index < first + (1UL << order))
+		goto out;
 
+	if (order == brd->brd_chunk_order) {
+		err = radix_tree_insert(&brd->brd_pages, idx, chunk);
+		goto out;
+	}
+
+	err = radix_tree_insert(&brd->brd_small_pages, first, chunk);
+	for (i = 1; !err && i < 1 << order; i++) {
+		err = radix_tree_insert(&brd->brd_small_pages, first + i,
+					chunk + i);
+		/* same tree node as the first page, nothing to allocate */
+		BUG_ON(err);
+	}
+out:
+	spin_unlock(&brd->brd_lock);
 	radix_tree_preload_end();
 
-	return page;
+	if (err)
+		__free_pages(chunk, order);
+	return err;
+}
+
+/*
+ * Make sure the page holding a given sector exists, allocating an empty
+ * chunk for it if needed.  If that fails, or some of the chunk's range got
+ * backed by smaller blocks meanwhile, retry with smaller blocks, down to
+ * single pages.
+ */
+static int brd_insert_chunk(struct brd_device *brd, sector_t sector)
+{
+	struct page *chunk;
+	int order, err;
+
+	for (order = brd->brd_chunk_order; order >= 0;
+	     order = min(order - 1, BRD_SMALL_MAX_ORDER)) {
+		rcu_read_lock();
+		chunk = brd_lookup_page(brd, sector);
+		rcu_read_unlock();
+		if (chunk)
+			return 0;
+
+		chunk = brd_alloc_chunk(brd, order);
+		if (!chunk)
+			continue;
+
+		err = brd_add_chunk(brd, sector, chunk, order);
+		if (err != -EEXIST)
+			return err;
+		/* a single page's range is backed: that is our page */
+		if (!order)
+			return 0;
+	}
+
+	return -ENOMEM;
 }
 
-static void brd_free_page(struct brd_device *brd, sector_t sector)
+static void brd_free_chunk_rcu(struct rcu_head *head)
 {
-	struct page *page;
+	struct page *chunk = container_of((struct list_head *)head,
+					  struct page, lru);
+
+	__free_pages(chunk, compound_order(chunk));
+}
+
+/*
+ * Free the blocks of small pages in the range of nr pages from first, a
+ * whole number of chunks.  Blocks with pages mapped through ->direct_access
+ * are zeroed instead.  Called with brd_lock held.
+ */
+static void brd_free_small_pages(struct brd_device *brd, pgoff_t first,
+				 unsigned long nr)
+{
+	struct page *pages[FREE_BATCH];
+	pgoff_t pos = first;
+	int nr_pages, i, j, n;
+
+	do {
+		nr_pages = radix_tree_gang_lookup(&brd->brd_small_pages,
+				(void **)pages, pos, FREE_BATCH);
+
+		/* the pages of a block come in a row, starting with its head */
+		for (i = 0; i < nr_pages; i += n) {
+			struct page *block = pages[i];
+			bool mapped = false;
+
+			if (block->index >= first + nr)
+				return;
+			n = 1 << compound_order(block);
+			pos = block->index + n;
+
+			for (j = 0; j < n; j++)
+				if (radix_tree_tag_get(&brd->brd_small_pages,
+						block->index + j,
+						BRD_TAG_MAPPED))
+					mapped = true;
+			if (mapped) {
+				for (j = 0; j < n; j++)
+					clear_highpage(block + j);
+				continue;
+			}
+
+			for (j = 0; j < n; j++)
+				radix_tree_delete(&brd->brd_small_pages,
+						  block->index + j);
+			call_rcu((struct rcu_head *)&block->lru,
+				 brd_free_chunk_rcu);
+		}
+	} while (nr_pages == FREE_BATCH);
+}
+
+/*
+ * Free the chunk holding a given sector.  Chunks mapped through
+ * ->direct_access are zeroed instead, their users still reference them.
+ */
+static void brd_free_chunk(struct brd_device *brd, sector_t sector)
+{
+	struct page *chunk;
+	bool mapped = false;
 	pgoff_t idx;
+	int i;
 
 	spin_lock(&brd->brd_lock);
-	idx = sector >> PAGE_SECTORS_SHIFT;
-	page = radix_tree_delete(&brd->brd_pages, idx);
+	idx = brd_chunk_index(brd, sector);
+	chunk = radix_tree_lookup(&brd->brd_pages, idx);
+	if (chunk) {
+		mapped = radix_tree_tag_get(&brd->brd_pages, idx,
+					    BRD_TAG_MAPPED);
+		if (!mapped)
+			radix_tree_delete(&brd->brd_pages, idx);
+	} else
+		brd_free_small_pages(brd, brd_page_index(sector),
+				     1UL << brd->brd_chunk_order);
 	spin_unlock(&brd->brd_lock);
-	if (page)
-		__free_page(page);
+
+	if (!chunk)
+		return;
+
+	if (mapped) {
+		for (i = 0; i < 1 << brd->brd_chunk_order; i++)
+			clear_highpage(chunk + i);
+		return;
+	}
+
+	/* lockless readers and writers may still be copying from or to it */
+	BUILD_BUG_ON(sizeof(struct rcu_head) > sizeof(chunk->lru));
+	call_rcu((struct rcu_head *)&chunk->lru, brd_free_chunk_rcu);
 }
 
 static void brd_zero_page(struct brd_device *brd, sector_t sector)
 {
 	struct page *page;
 
+	rcu_read_lock();
 	page = brd_lookup_page(brd, sector);
 	if (page)
 		clear_highpage(page);
+	rcu_read_unlock();
 }
 
 /*
- * Free all backing store pages and radix tree. This must only be called when
- * there are no other users of the device.
+ * Free all backing store chunks and radix tree. This must only be called
+ * when there are no other users of the device.
  */
-#define FREE_BATCH 16
 static void brd_free_pages(struct brd_device *brd)
 {
 	unsigned long pos = 0;
-	struct page *pages[FREE_BATCH];
-	int nr_pages;
+	struct page *chunks[FREE_BATCH];
+	int nr_chunks;
 
 	do {
 		int i;
 
-		nr_pages = radix_tree_gang_lookup(&brd->brd_pages,
-				(void **)pages, pos, FREE_BATCH);
+		nr_chunks = radix_tree_gang_lookup(&brd->brd_pages,
+				(void **)chunks, pos, FREE_BATCH);
 
-		for (i = 0; i < nr_pages; i++) {
+		for (i = 0; i < nr_chunks; i++) {
 			void *ret;
 
-			BUG_ON(pages[i]->index < pos);
-			pos = pages[i]->index;
+			BUG_ON(chunks[i]->index < pos);
+			pos = chunks[i]->index;
 			ret = radix_tree_delete(&brd->brd_pages, pos);
-			BUG_ON(!ret || ret != pages[i]);
-			__free_page(pages[i]);
+			BUG_ON(!ret || ret != chunks[i]);
+			__free_pages(chunks[i], brd->brd_chunk_order);
 		}
 
 		pos++;
 
 		/*
 		 * This assumes radix_tree_gang_lookup always returns as
-		 * many pages as possible. If the radix-tree code changes,
+		 * many chunks as possible. If the radix-tree code changes,
 		 * so will this have to.
 		 */
-	} while (nr_pages == FREE_BATCH);
+	} while (nr_chunks == FREE_BATCH);
+
+	pos = 0;
+	do {
+		int i, j, n;
+
+		nr_chunks = radix_tree_gang_lookup(&brd->brd_small_pages,
+				(void **)chunks, pos, FREE_BATCH);
+
+		/* the pages of a block come in a row, starting with its head */
+		for (i = 0; i < nr_chunks; i += n) {
+			struct page *block = chunks[i];
+			unsigned int order = compound_order(block);
+
+			BUG_ON(block->index < pos);
+			n = 1 << order;
+			pos = block->index + n;
+			for (j = 0; j < n; j++)
+				radix_tree_delete(&brd->brd_small_pages,
+						  block->index + j);
+			__free_pages(block, order);
+		}
+	} while (nr_chunks == FREE_BATCH);
 }
 
 /*
@@ -203,29 +396,36 @@ static int copy_to_brd_setup(struct brd_device *brd, sector_t sector, size_t n)
 	size_t copy;
 
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
-	if (!brd_insert_page(brd, sector))
+	if (brd_insert_chunk(brd, sector))
 		return -ENOMEM;
 	if (copy < n) {
 		sector += copy >> SECTOR_SHIFT;
-		if (!brd_insert_page(brd, sector))
+		if (brd_insert_chunk(brd, sector))
 			return -ENOMEM;
 	}
 	return 0;
 }
 
+/*
+ * Free the chunks the range covers entirely, zero the pages of the others.
+ * Writes to freed chunks allocate new ones with GFP_NOIO, like writes to
+ * never written ranges, and fail with -ENOMEM if memory is that tight.
+ */
 static void discard_from_brd(struct brd_device *brd,
 			sector_t sector, size_t n)
 {
+	unsigned int chunk_sectors = brd_chunk_sectors(brd);
+
 	while (n >= PAGE_SIZE) {
-		/*
-		 * Don't want to actually discard pages here because
-		 * re-allocating the pages can result in writeback
-		 * deadlocks under heavy load.
-		 */
-		if (0)
-			brd_free_page(brd, sector);
-		else
-			brd_zero_page(brd, sector);
+		if (!(sector & (chunk_sectors - 1)) &&
+		    n >= chunk_sectors << SECTOR_SHIFT) {
+			brd_free_chunk(brd, sector);
+			sector += chunk_sectors;
+			n -= chunk_sectors << SECTOR_SHIFT;
+			continue;
+		}
+
+		brd_zero_page(brd, sector);
 		sector += PAGE_SIZE >> SECTOR_SHIFT;
 		n -= PAGE_SIZE;
 	}
@@ -233,18 +433,23 @@ static void discard_from_brd(struct brd_device *brd,
 
 /*
  * Copy n bytes from src to the brd starting at sector. Does not sleep.
+ * Returns -EAGAIN if a concurrent discard freed the destination after
+ * copy_to_brd_setup.
  */
-static void copy_to_brd(struct brd_device *brd, const void *src,
+static int copy_to_brd(struct brd_device *brd, const void *src,
 			sector_t sector, size_t n)
 {
 	struct page *page;
 	void *dst;
 	unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
 	size_t copy;
+	int ret = -EAGAIN;
 
+	rcu_read_lock();
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
 	page = brd_lookup_page(brd, sector);
-	BUG_ON(!page);
+	if (!page)
+		goto out;
 
 	dst = kmap_atomic(page, KM_USER1);
 	memcpy(dst + offset, src, copy);
@@ -255,12 +460,17 @@ static void copy_to_brd(struct brd_device *brd, const void *src,
 		sector += copy >> SECTOR_SHIFT;
 		copy = n - copy;
 		page = brd_lookup_page(brd, sector);
-		BUG_ON(!page);
+		if (!page)
+			goto out;
 
 		dst = kmap_atomic(page, KM_USER1);
 		memcpy(dst, src, copy);
 		kunmap_atomic(dst, KM_USER1);
 	}
+	ret = 0;
+out:
+	rcu_read_unlock();
+	return ret;
 }
 
 /*
@@ -274,6 +484,7 @@ static void copy_from_brd(void *dst, struct brd_device *brd,
 	unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
 	size_t copy;
 
+	rcu_read_lock();
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
 	page = brd_lookup_page(brd, sector);
 	if (page) {
@@ -295,6 +506,7 @@ static void copy_from_brd(void *dst, struct brd_device *brd,
 		} else
 			memset(dst, 0, copy);
 	}
+	rcu_read_unlock();
 }
 
 /*
@@ -307,6 +519,7 @@ static int brd_do_bvec(struct brd_device *brd, struct page *page,
 	void *mem;
 	int err = 0;
 
+again:
 	if (rw != READ) {
 		err = copy_to_brd_setup(brd, sector, len);
 		if (err)
@@ -319,10 +532,12 @@ static int brd_do_bvec(struct brd_device *brd, struct page *page,
 		flush_dcache_page(page);
 	} else {
 		flush_dcache_page(page);
-		copy_to_brd(brd, mem + off, sector, len);
+		err = copy_to_brd(brd, mem + off, sector, len);
 	}
 	kunmap_atomic(mem, KM_USER0);
 
+	if (err == -EAGAIN)
+		goto again;
 out:
 	return err;
 }
@@ -380,9 +595,30 @@ static int brd_direct_access(struct block_device *bdev, sector_t sector,
 		return -EINVAL;
 	if (sector + PAGE_SECTORS > get_capacity(bdev->bd_disk))
 		return -ERANGE;
-	page = brd_insert_page(brd, sector);
-	if (!page)
-		return -ENOMEM;
+
+	/*
+	 * The caller maps the page for as long as it likes, so tag the
+	 * chunk, or the small page, to keep discard from freeing it.
+	 * Retry if a discard freed it between insertion and tagging.
+	 */
+	do {
+		if (brd_insert_chunk(brd, sector))
+			return -ENOMEM;
+
+		spin_lock(&brd->brd_lock);
+		page = brd_lookup_page(brd, sector);
+		if (page && radix_tree_lookup(&brd->brd_pages,
+					      brd_chunk_index(brd, sector)))
+			radix_tree_tag_set(&brd->brd_pages,
+					   brd_chunk_index(brd, sector),
+					   BRD_TAG_MAPPED);
+		else if (page)
+			radix_tree_tag_set(&brd->brd_small_pages,
+					   brd_page_index(sector),
+					   BRD_TAG_MAPPED);
+		spin_unlock(&brd->brd_lock);
+	} while (!page);
+
 	*kaddr = page_address(page);
 	*pfn = page_to_pfn(page);
 
@@ -440,12 +676,18 @@ static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
 static int max_part;
 static int part_shift;
+static unsigned int rd_chunk_order;
+static int rd_node = -1;
 module_param(rd_nr, int, 0);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+module_param(rd_chunk_order, uint, 0);
+MODULE_PARM_DESC(rd_chunk_order, "Allocation order of backing store chunks");
+module_param(rd_node, int, 0);
+MODULE_PARM_DESC(rd_node, "NUMA node to allocate RAM disks on, -1 for any");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -472,26 +714,30 @@ static struct brd_device *brd_alloc(int i)
 	struct brd_device *brd;
 	struct gendisk *disk;
 
-	brd = kzalloc(sizeof(*brd), GFP_KERNEL);
+	brd = kzalloc_node(sizeof(*brd), GFP_KERNEL, rd_node);
 	if (!brd)
 		goto out;
 	brd->brd_number		= i;
+	brd->brd_chunk_order	= rd_chunk_order;
+	brd->brd_node		= rd_node;
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
+	INIT_RADIX_TREE(&brd->brd_small_pages, GFP_ATOMIC);
 
-	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
+	brd->brd_queue = blk_alloc_queue_node(GFP_KERNEL, rd_node);
 	if (!brd->brd_queue)
 		goto out_free_dev;
 	blk_queue_make_request(brd->brd_queue, brd_make_request);
 	blk_queue_max_hw_sectors(brd->brd_queue, 1024);
 	blk_queue_bounce_limit(brd->brd_queue, BLK_BOUNCE_ANY);
 
-	brd->brd_queue->limits.discard_granularity = PAGE_SIZE;
+	brd->brd_queue->limits.discard_granularity =
+					PAGE_SIZE << brd->brd_chunk_order;
 	brd->brd_queue->limits.max_discard_sectors = UINT_MAX;
 	brd->brd_queue->limits.discard_zeroes_data = 1;
 	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, brd->brd_queue);
 
-	disk = brd->brd_disk = alloc_disk(1 << part_shift);
+	disk = brd->brd_disk = alloc_disk_node(1 << part_shift, rd_node);
 	if (!disk)
 		goto out_free_queue;
 	disk->major		= RAMDISK_MAJOR;
@@ -588,6 +834,13 @@ static int __init brd_init(void)
 	if (rd_nr > 1UL << (MINORBITS - part_shift))
 		return -EINVAL;
 
+	if (rd_chunk_order >= MAX_ORDER)
+		return -EINVAL;
+
+	if (rd_node != -1 &&
+	    (rd_node < 0 || rd_node >= MAX_NUMNODES || !node_online(rd_node)))
+		return -EINVAL;
+
 	if (rd_nr) {
 		nr = rd_nr;
 		range = rd_nr;
@@ -637,6 +890,9 @@ static void __exit brd_exit(void)
 	list_for_each_entry_safe(brd, next, &brd_devices, brd_list)
 		brd_del_one(brd);
 
+	/* wait for the chunks discard freed */
+	rcu_barrier();
+
 	blk_unregister_region(MKDEV(RAMDISK_MAJOR, 0), range);
 	unregister_blkdev(RAMDISK_MAJOR, "ramdisk");
 }
@@ -43,6 +43,9 @@
  * operations write_begin is not available on the backing filesystem.
  * Anton Altaparmakov, 16 Feb 2005
  *
+ * Direct mapping of the backing file blocks (LO_FLAGS_DIRECT_MAP), so that
+ * bios are remapped and submitted straight to the underlying device.
+ *
  * Still To Fix:
  * - Advisory locking is ignored here.
  * - Should use an own CAP_* category instead of CAP_SYS_ADMIN
@@ -75,6 +78,8 @@
 #include <linux/kthread.h>
 #include <linux/splice.h>
 #include <linux/sysfs.h>
+#include <linux/mempool.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
@@ -519,6 +524,282 @@ static struct bio *loop_get_bio(struct loop_device *lo)
 	return bio_list_pop(&lo->lo_bio_list);
 }
 
+/*
+ * Direct mapping.
+ *
+ * With LO_FLAGS_DIRECT_MAP set, the blocks of the backing file are mapped
+ * once, with fiemap or else with bmap() the same way as for a swap file, and
+ * bios are remapped to the underlying block device. A bio which maps to one
+ * contiguous run of blocks is remapped to a single bio and submitted from
+ * loop_make_request(). Any other bio goes to the loop thread, so that
+ * make_request never needs more than one bio from lo_bio_set: the bios it
+ * submits are only issued once it returns, and could not be waited for.
+ * The loop thread splits bios where the backing file is discontiguous.
+ *
+ * The mapping is done a page of the backing file at a time. Pages with a
+ * hole (of a sparse file) or an unwritten extent are not mapped: a write
+ * to the device would leave the filesystem unaware that an unwritten
+ * extent now holds data, and it would keep reading back as zeroes. The
+ * loop thread reads and writes these pages through the page cache, like
+ * without direct mapping, which fills the holes and converts the unwritten
+ * extents. It then writes back and drops that range of the page cache, as
+ * the mapped pages in it may be written around the page cache next.
+ *
+ * Pages filled that way are not added to the mapping, which make_request
+ * reads without locking, so they keep going through the loop thread until
+ * direct mapping is switched off and on again. Preallocate and write the
+ * whole backing file first for all of it to be mapped.
+ *
+ * Mapped pages do not go through the page cache of the backing file. It is
+ * written back and dropped when the mapping is set up and when it is torn
+ * down, but while the device is mapped, the page cache is not coherent
+ * with the loop device: other users of the backing file may see stale
+ * data. The backing file is marked S_SWAPFILE while mapped, so it cannot
+ * be truncated from under us.
+ */
+struct loop_extent {
+	sector_t	start;		/* first block in the backing file */
+	sector_t	nr;		/* number of blocks */
+	sector_t	block;		/* first block on the device */
+};
+
+/* One per bio submitted to the loop device */
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;
+	atomic_t		pending;
+	int			error;
+};
+
+#define LOOP_DIO_POOL_SIZE	16
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t block)
+{
+	unsigned int lo_idx = 0, hi_idx = lo->lo_nr_extents;
+
+	while (lo_idx < hi_idx) {
+		unsigned int mid = (lo_idx + hi_idx) / 2;
+		struct loop_extent *ext = &lo->lo_extents[mid];
+
+		if (block < ext->start)
+			hi_idx = mid;
+		else if (block >= ext->start + ext->nr)
+			lo_idx = mid + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+/*
+ * Map a position in the backing file to a sector of the underlying device.
+ * Returns how many bytes are contiguous on the device from there, or zero
+ * if the position is beyond the mapped extents.
+ */
+static loff_t loop_map_pos(struct loop_device *lo, unsigned int blkbits,
+			   loff_t pos, sector_t *sector)
+{
+	sector_t block = pos >> blkbits;
+	struct loop_extent *ext = loop_find_extent(lo, block);
+
+	if (!ext)
+		return 0;
+
+	*sector = (ext->block + block - ext->start) << (blkbits - 9);
+	*sector += (pos & ((1 << blkbits) - 1)) >> 9;
+	return ((loff_t)(ext->start + ext->nr) << blkbits) - pos;
+}
+
+static void loop_dio_done(struct loop_device *lo)
+{
+	if (atomic_dec_and_test(&lo->lo_dio_pending))
+		wake_up(&lo->lo_event);
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->pending))
+		return;
+
+	bio_endio(dio->bio, dio->error);
+	mempool_free(dio, lo->lo_dio_pool);
+	loop_dio_done(lo);
+}
+
+static void loop_dio_end_io(struct bio *bio, int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (error)
+		dio->error = error;
+	bio_put(bio);
+	loop_dio_put(dio);
+}
+
+static struct bio *loop_dio_alloc(struct loop_dio *dio,
+				  struct block_device *bdev, sector_t sector,
+				  unsigned long rw, int nr_vecs)
+{
+	struct bio *bio;
+
+	bio = bio_alloc_bioset(GFP_NOIO, nr_vecs, dio->lo->lo_bio_set);
+	bio->bi_bdev = bdev;
+	bio->bi_sector = sector;
+	bio->bi_rw = rw;
+	bio->bi_end_io = loop_dio_end_io;
+	bio->bi_private = dio;
+	return bio;
+}
+
+static void loop_dio_submit(struct loop_dio *dio, struct bio *bio)
+{
+	atomic_inc(&dio->pending);
+	generic_make_request(bio);
+}
+
+/*
+ * Returns non-zero if all of the bio is in mapped pages of the backing file.
+ */
+static int loop_bio_mapped(struct loop_device *lo, struct bio *bio)
+{
+	unsigned int blkbits = lo->lo_backing_file->f_mapping->host->i_blkbits;
+	loff_t pos = ((loff_t)bio->bi_sector << 9) + lo->lo_offset;
+	loff_t avail, len = bio->bi_size;
+	sector_t sector;
+
+	while (len > 0) {
+		avail = loop_map_pos(lo, blkbits, pos, &sector);
+		if (!avail)
+			return 0;
+		pos += avail;
+		len -= avail;
+	}
+	return 1;
+}
+
+/*
+ * Remap a bio which is contiguous on the underlying device to a single bio,
+ * from loop_make_request(). Returns zero, having done nothing, if the bio is
+ * not contiguous or does not fit into one bio of the underlying device; it
+ * then has to go to the loop thread.
+ */
+static int loop_direct_one(struct loop_device *lo, struct bio *bio)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	struct block_device *bdev = inode->i_sb->s_bdev;
+	loff_t pos = ((loff_t)bio->bi_sector << 9) + lo->lo_offset;
+	struct bio *child;
+	struct bio_vec *bvec;
+	struct loop_dio *dio;
+	sector_t sector = 0;
+	int i;
+
+	if (bio->bi_size &&
+	    loop_map_pos(lo, inode->i_blkbits, pos, &sector) < bio->bi_size)
+		return 0;
+
+	dio = mempool_alloc(lo->lo_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->pending, 1);
+
+	child = loop_dio_alloc(dio, bdev, sector, bio->bi_rw, bio->bi_vcnt);
+	bio_for_each_segment(bvec, bio, i) {
+		if (bio_add_page(child, bvec->bv_page, bvec->bv_len,
+				 bvec->bv_offset) < bvec->bv_len) {
+			bio_put(child);
+			mempool_free(dio, lo->lo_dio_pool);
+			return 0;
+		}
+	}
+
+	loop_dio_submit(dio, child);
+	loop_dio_put(dio);
+	return 1;
+}
+
+/*
+ * Remap a bio to the underlying device, splitting it where the backing file
+ * is discontiguous. Only the first piece carries REQ_FLUSH, the flush is
+ * only needed once. Called from the loop thread, as it may need several
+ * bios from lo_bio_set.
+ */
+static void loop_direct_request(struct loop_device *lo, struct bio *bio)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	struct block_device *bdev = inode->i_sb->s_bdev;
+	unsigned int blkbits = inode->i_blkbits;
+	unsigned long rw = bio->bi_rw;
+	loff_t pos = ((loff_t)bio->bi_sector << 9) + lo->lo_offset;
+	sector_t next_sector = 0;
+	struct bio *child = NULL;
+	struct bio_vec *bvec;
+	struct loop_dio *dio;
+	int i;
+
+	dio = mempool_alloc(lo->lo_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->pending, 1);
+
+	if (!bio->bi_size) {
+		/* An empty flush */
+		loop_dio_submit(dio, loop_dio_alloc(dio, bdev, 0, rw, 0));
+		goto out;
+	}
+
+	bio_for_each_segment(bvec, bio, i) {
+		struct page *page = bvec->bv_page;
+		unsigned int off = bvec->bv_offset, len = bvec->bv_len;
+
+		while (len) {
+			unsigned int chunk;
+			sector_t sector;
+			loff_t avail;
+
+			avail = loop_map_pos(lo, blkbits, pos, &sector);
+			if (!avail) {
+				dio->error = -EIO;
+				goto out;
+			}
+			chunk = min_t(loff_t, len, avail);
+
+			if (child && (sector != next_sector ||
+			    bio_add_page(child, page, chunk, off) < chunk)) {
+				loop_dio_submit(dio, child);
+				child = NULL;
+				rw &= ~REQ_FLUSH;
+			}
+			if (!child) {
+				child = loop_dio_alloc(dio, bdev, sector, rw,
+						       bio->bi_vcnt - i);
+				if (bio_add_page(child, page, chunk,
+						 off) < chunk) {
+					bio_put(child);
+					child = NULL;
+					dio->error = -EIO;
+					goto out;
+				}
+			}
+
+			next_sector = sector + (chunk >> 9);
+			pos += chunk;
+			off += chunk;
+			len -= chunk;
+		}
+	}
+
+out:
+	if (child)
+		loop_dio_submit(dio, child);
+	loop_dio_put(dio);
+}
+
 static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
@@ -534,6 +815,14 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_MAP) && old_bio->bi_bdev) {
+		atomic_inc(&lo->lo_dio_pending);
+		spin_unlock_irq(&lo->lo_lock);
+		if (loop_direct_one(lo, old_bio))
+			return 0;
+		loop_dio_done(lo);
+		spin_lock_irq(&lo->lo_lock);
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -553,7 +842,11 @@ static void loop_unplug(struct request_queue *q)
 	struct loop_device *lo = q->queuedata;
 
 	queue_flag_clear_unlocked(QUEUE_FLAG_PLUGGED, q);
-	blk_run_address_space(lo->lo_backing_file->f_mapping);
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP)
+		blk_unplug(bdev_get_queue(
+			lo->lo_backing_file->f_mapping->host->i_sb->s_bdev));
+	else
+		blk_run_address_space(lo->lo_backing_file->f_mapping);
 }
 
 struct switch_request {
@@ -563,12 +856,68 @@ struct switch_request {
 
 static void do_loop_switch(struct loop_device *, struct switch_request *);
 
+/*
+ * A directly mapped loop device went through the page cache of the backing
+ * file for a bio touching a hole. Write back and drop that range of the page
+ * cache, which may also cover mapped pages.
+ */
+static int loop_sync_range(struct loop_device *lo, struct bio *bio)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+	loff_t start = ((loff_t)bio->bi_sector << 9) + lo->lo_offset;
+	loff_t end = start + bio->bi_size - 1;
+	int ret = 0;
+
+	if (!bio->bi_size)
+		return 0;
+
+	if (bio_rw(bio) == WRITE)
+		ret = filemap_write_and_wait_range(mapping, start, end);
+	invalidate_inode_pages2_range(mapping, start >> PAGE_CACHE_SHIFT,
+				      end >> PAGE_CACHE_SHIFT);
+	return ret ? -EIO : 0;
+}
+
+/*
+ * A bio which loop_make_request() could not remap to a single bio. The
+ * directly submitted bios are counted in lo_dio_pending for this one too,
+ * so that the mapping stays while it is used.
+ */
+static void loop_handle_direct_bio(struct loop_device *lo, struct bio *bio)
+{
+	int ret;
+
+	if (loop_bio_mapped(lo, bio)) {
+		loop_direct_request(lo, bio);
+		return;
+	}
+
+	ret = do_bio_filebacked(lo, bio);
+	if (!ret)
+		ret = loop_sync_range(lo, bio);
+	bio_endio(bio, ret);
+	loop_dio_done(lo);
+}
+
 static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 {
+	int direct;
+
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
-	} else {
+		return;
+	}
+
+	spin_lock_irq(&lo->lo_lock);
+	direct = lo->lo_flags & LO_FLAGS_DIRECT_MAP;
+	if (direct)
+		atomic_inc(&lo->lo_dio_pending);
+	spin_unlock_irq(&lo->lo_lock);
+
+	if (direct)
+		loop_handle_direct_bio(lo, bio);
+	else {
 		int ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, ret);
 	}
@@ -693,6 +1042,11 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* and not mapped to the blocks of the old backing file */
+	error = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -726,6 +1080,309 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	return error;
 }
 
+/* The extents of a backing file while it is being mapped */
+struct loop_map {
+	struct loop_extent	*ext;
+	unsigned int		nr, max;
+	unsigned int		per_page;	/* blocks per page */
+	sector_t		next;		/* first block we may map */
+};
+
+/*
+ * Blocks start to end - 1 are not to be mapped. Unmap the whole pages they
+ * are in: the mapped blocks before them in the first page, and the ones
+ * after them in the last page are never mapped.
+ */
+static void loop_map_hole(struct loop_map *m, sector_t start, sector_t end)
+{
+	sector_t page_start = start & ~(sector_t)(m->per_page - 1);
+	sector_t page_end = (end + m->per_page - 1) &
+			    ~(sector_t)(m->per_page - 1);
+
+	while (m->nr && m->ext[m->nr - 1].start + m->ext[m->nr - 1].nr >
+			page_start) {
+		struct loop_extent *ext = &m->ext[m->nr - 1];
+
+		if (ext->start >= page_start)
+			m->nr--;
+		else
+			ext->nr = page_start - ext->start;
+	}
+	if (m->next < page_end)
+		m->next = page_end;
+}
+
+/* Map count blocks from block of the backing file to phys on the device */
+static int loop_map_add(struct loop_map *m, sector_t block, sector_t phys,
+			sector_t count)
+{
+	struct loop_extent *ext = m->nr ? &m->ext[m->nr - 1] : NULL;
+
+	if (block < m->next) {
+		sector_t skip = m->next - block;
+
+		if (skip >= count)
+			return 0;
+		block += skip;
+		phys += skip;
+		count -= skip;
+	}
+	m->next = block + count;
+
+	if (ext && ext->start + ext->nr == block &&
+	    ext->block + ext->nr == phys) {
+		ext->nr += count;
+		return 0;
+	}
+
+	if (m->nr == m->max) {
+		unsigned int max = m->max ? m->max * 2 : 64;
+
+		ext = vmalloc(max * sizeof(struct loop_extent));
+		if (!ext)
+			return -ENOMEM;
+		if (m->ext)
+			memcpy(ext, m->ext, m->nr * sizeof(*ext));
+		vfree(m->ext);
+		m->ext = ext;
+		m->max = max;
+	}
+	ext = &m->ext[m->nr++];
+	ext->start = block;
+	ext->nr = count;
+	ext->block = phys;
+	return 0;
+}
+
+/*
+ * Extents which do not simply hold the file data at fe_physical. Unwritten
+ * (preallocated) extents in particular read back as zeroes until the
+ * filesystem converts them, which it only does for writes it sees.
+ */
+#define LOOP_FIEMAP_UNMAPPABLE	(FIEMAP_EXTENT_UNKNOWN |		\
+				 FIEMAP_EXTENT_DELALLOC |		\
+				 FIEMAP_EXTENT_ENCODED |		\
+				 FIEMAP_EXTENT_DATA_ENCRYPTED |		\
+				 FIEMAP_EXTENT_NOT_ALIGNED |		\
+				 FIEMAP_EXTENT_DATA_INLINE |		\
+				 FIEMAP_EXTENT_DATA_TAIL |		\
+				 FIEMAP_EXTENT_UNWRITTEN)
+
+static int loop_map_fiemap(struct loop_map *m, struct inode *inode,
+			   sector_t last)
+{
+	unsigned int blkbits = inode->i_blkbits;
+	unsigned int max = PAGE_SIZE / sizeof(struct fiemap_extent);
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *fe;
+	loff_t pos = 0, prev, size = (loff_t)last << blkbits;
+	mm_segment_t old_fs;
+	unsigned int i;
+	int err = 0;
+
+	fe = kmalloc(max * sizeof(*fe), GFP_KERNEL);
+	if (!fe)
+		return -ENOMEM;
+
+	while (pos < size) {
+		memset(&fieinfo, 0, sizeof(fieinfo));
+		fieinfo.fi_extents_max = max;
+		fieinfo.fi_extents_start = (struct fiemap_extent __user *)fe;
+
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		err = inode->i_op->fiemap(inode, &fieinfo, pos, size - pos);
+		set_fs(old_fs);
+		if (err || !fieinfo.fi_extents_mapped)
+			break;
+
+		prev = pos;
+		for (i = 0; i < fieinfo.fi_extents_mapped; i++) {
+			loff_t start = max_t(loff_t, fe[i].fe_logical, pos);
+			loff_t end = min_t(loff_t, fe[i].fe_logical +
+					   fe[i].fe_length, size);
+			sector_t block = start >> blkbits;
+
+			if (end <= start)
+				continue;
+			if (start > pos)
+				loop_map_hole(m, pos >> blkbits, block);
+			if ((fe[i].fe_flags & LOOP_FIEMAP_UNMAPPABLE) ||
+			    ((fe[i].fe_logical | fe[i].fe_physical |
+			      fe[i].fe_length) & ((1 << blkbits) - 1)))
+				loop_map_hole(m, block, end >> blkbits);
+			else
+				err = loop_map_add(m, block,
+					(fe[i].fe_physical +
+					 (start - fe[i].fe_logical)) >> blkbits,
+					(end >> blkbits) - block);
+			if (err)
+				goto out;
+			pos = end;
+		}
+		if (pos == prev || (fe[i - 1].fe_flags & FIEMAP_EXTENT_LAST))
+			break;
+		cond_resched();
+	}
+	/* No extent beyond pos: the rest of the file is a hole */
+	if (!err && pos < size)
+		loop_map_hole(m, pos >> blkbits, last);
+out:
+	kfree(fe);
+	return err;
+}
+
+/*
+ * Map the backing file into an array of extents, a page at a time. Pages
+ * with a hole, or with blocks the filesystem does not report as plain
+ * data, are left out. The fiemap inode operation tells unwritten extents
+ * apart, so it is used where available; bmap() maps them like written
+ * ones.
+ */
+static int loop_map_extents(struct loop_device *lo, struct inode *inode)
+{
+	sector_t block, last = i_size_read(inode) >> inode->i_blkbits;
+	struct loop_map m = {
+		.per_page = PAGE_CACHE_SIZE >> inode->i_blkbits,
+	};
+	int err = 0;
+
+	if (inode->i_op->fiemap) {
+		err = loop_map_fiemap(&m, inode, last);
+	} else {
+		for (block = 0; block < last && !err; block++) {
+			sector_t phys = bmap(inode, block);
+
+			if (!phys) {
+				loop_map_hole(&m, block, block + 1);
+				block = m.next - 1;
+				continue;
+			}
+			err = loop_map_add(&m, block, phys, 1);
+			cond_resched();
+		}
+	}
+
+	if (err) {
+		vfree(m.ext);
+		return err;
+	}
+	lo->lo_extents = m.ext;
+	lo->lo_nr_extents = m.nr;
+	return 0;
+}
+
+/*
+ * Switch a loop device to direct mapping. As the page cache of the backing
+ * file is bypassed from now on, nobody else may have the loop device open,
+ * and all I/O which went through the loop thread has to be flushed out to
+ * the backing file first. The page cache of the backing file is written
+ * back and dropped; see the comment above struct loop_extent for how it is
+ * kept out of the way afterwards.
+ */
+static int loop_set_direct_map(struct loop_device *lo)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (lo->lo_refcnt > 1)	/* we needed one fd for the ioctl */
+		return -EBUSY;
+	if (lo->lo_encryption || (lo->lo_offset & 511))
+		return -EINVAL;
+	if (!S_ISREG(inode->i_mode) || !inode->i_sb->s_bdev ||
+	    inode->i_blkbits < 9 ||
+	    (!inode->i_op->fiemap && !file->f_mapping->a_ops->bmap))
+		return -EINVAL;
+
+	fsync_bdev(lo->lo_device);
+	err = loop_flush(lo);
+	if (err)
+		return err;
+	err = vfs_fsync(file, 0);
+	if (err)
+		return err;
+
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode)) {
+		err = -EBUSY;
+		goto out_unlock;
+	}
+	err = loop_map_extents(lo, inode);
+	if (err)
+		goto out_unlock;
+	inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	/*
+	 * Drop the page cache of the backing file, which was written back
+	 * above, so that nothing stale is read through it for the holes.
+	 * This fails if somebody has it mapped or dirtied it meanwhile.
+	 */
+	err = invalidate_inode_pages2(file->f_mapping);
+	if (err)
+		goto out_clear;
+
+	err = -ENOMEM;
+	lo->lo_bio_set = bioset_create(BIO_POOL_SIZE, 0);
+	if (!lo->lo_bio_set)
+		goto out_clear;
+	lo->lo_dio_pool = mempool_create_kmalloc_pool(LOOP_DIO_POOL_SIZE,
+						      sizeof(struct loop_dio));
+	if (!lo->lo_dio_pool)
+		goto out_bioset;
+
+	atomic_set(&lo->lo_dio_pending, 0);
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags |= LO_FLAGS_DIRECT_MAP;
+	spin_unlock_irq(&lo->lo_lock);
+	return 0;
+
+out_bioset:
+	bioset_free(lo->lo_bio_set);
+	lo->lo_bio_set = NULL;
+out_clear:
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+out_unlock:
+	mutex_unlock(&inode->i_mutex);
+	return err;
+}
+
+/*
+ * Go back to the loop thread. Waits for the directly mapped bios in flight.
+ */
+static void loop_clr_direct_map(struct loop_device *lo)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_MAP;
+	spin_unlock_irq(&lo->lo_lock);
+	wait_event(lo->lo_event, !atomic_read(&lo->lo_dio_pending));
+
+	mempool_destroy(lo->lo_dio_pool);
+	lo->lo_dio_pool = NULL;
+	bioset_free(lo->lo_bio_set);
+	lo->lo_bio_set = NULL;
+
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	mutex_unlock(&inode->i_mutex);
+
+	/* The page cache may have been read while we wrote around it */
+	invalidate_inode_pages2(file->f_mapping);
+}
+
 static inline int is_loop_device(struct file *file)
 {
 	struct inode *i = file->f_mapping->host;
@@ -800,16 +1457,25 @@ static ssize_t loop_attr_autoclear_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", autoclear ? "1" : "0");
 }
 
+static ssize_t loop_attr_direct_map_show(struct loop_device *lo, char *buf)
+{
+	int direct_map = (lo->lo_flags & LO_FLAGS_DIRECT_MAP);
+
+	return sprintf(buf, "%s\n", direct_map ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
+LOOP_ATTR_RO(direct_map);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
 	&loop_attr_offset.attr,
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
+	&loop_attr_direct_map.attr,
 	NULL,
 };
 
@@ -1022,6 +1688,8 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 	lo->lo_state = Lo_rundown;
 	spin_unlock_irq(&lo->lo_lock);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP)
+		loop_clr_direct_map(lo);
 	kthread_stop(lo->lo_thread);
 
 	lo->lo_queue->unplug_fn = NULL;
@@ -1081,6 +1749,9 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* direct mapping bypasses the transfer function */
+	if (info->lo_encrypt_type && (info->lo_flags & LO_FLAGS_DIRECT_MAP))
+		return -EINVAL;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1103,6 +1774,9 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 
 	if (lo->lo_offset != info->lo_offset ||
 	    lo->lo_sizelimit != info->lo_sizelimit) {
+		if ((lo->lo_flags & LO_FLAGS_DIRECT_MAP) &&
+		    (info->lo_offset & 511))
+			return -EINVAL;
 		lo->lo_offset = info->lo_offset;
 		lo->lo_sizelimit = info->lo_sizelimit;
 		if (figure_loop_size(lo))
@@ -1123,6 +1797,20 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	     (info->lo_flags & LO_FLAGS_AUTOCLEAR))
 		lo->lo_flags ^= LO_FLAGS_AUTOCLEAR;
 
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_MAP) !=
+	     (info->lo_flags & LO_FLAGS_DIRECT_MAP)) {
+		if (info->lo_flags & LO_FLAGS_DIRECT_MAP) {
+			err = loop_set_direct_map(lo);
+			if (err)
+				return err;
+		} else {
+			if (lo->lo_refcnt > 1)
+				return -EBUSY;
+			fsync_bdev(lo->lo_device);
+			loop_clr_direct_map(lo);
+		}
+	}
+
 	lo->lo_encrypt_key_size = info->lo_encrypt_key_size;
 	lo->lo_init[0] = info->lo_init[0];
 	lo->lo_init[1] = info->lo_init[1];
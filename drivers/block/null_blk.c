@@ -0,0 +1,653 @@
+/*
+ * Null block device driver.
+ *
+ * Completes every I/O without touching the data, so that the cost of the
+ * block layer itself can be measured: bio submission, the request_fn path
+ * with its elevator and queue_lock, or the multi-queue path, and the
+ * completion path in softirq, IPI or timer context.
+ *
+ * See Documentation/block/null_blk.txt for the parameters.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/bio.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+
+struct nullb_cmd {
+	struct list_head list;
+	struct call_single_data csd;
+	struct request *rq;
+	struct bio *bio;
+	unsigned int tag;
+	struct nullb_queue *nq;
+};
+
+struct nullb_queue {
+	unsigned long *tag_map;
+	wait_queue_head_t wait;
+	unsigned int queue_depth;
+
+	struct nullb_cmd *cmds;
+};
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+	spinlock_t lock;		/* queue_lock in NULL_Q_RQ mode */
+
+	struct nullb_queue *queues;
+	unsigned int nr_queues;
+};
+
+static LIST_HEAD(nullb_list);
+static int nullb_indexes;
+static int null_major;
+
+/* Commands waiting for the completion timer of a CPU */
+struct completion_queue {
+	struct list_head list;
+	struct hrtimer timer;
+};
+
+static DEFINE_PER_CPU(struct completion_queue, completion_queues);
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+	NULL_IRQ_TIMER		= 2,
+	NULL_IRQ_IPI		= 3,
+
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+};
+
+static int submit_queues = 1;
+module_param(submit_queues, int, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Number of submission queues");
+
+static int home_node = NUMA_NO_NODE;
+module_param(home_node, int, S_IRUGO);
+MODULE_PARM_DESC(home_node, "Home node for the device");
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "0: bio, 1: request_fn, 2: multi-queue");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Block size (in bytes)");
+
+static int nr_devices = 2;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "Completion: 0 inline, 1 softirq, 2 timer, 3 IPI");
+
+static int completion_nsec = 10000;
+module_param(completion_nsec, int, S_IRUGO);
+MODULE_PARM_DESC(completion_nsec, "Completion delay in ns (irqmode=2)");
+
+static int irq_cpu;
+module_param(irq_cpu, int, S_IRUGO);
+MODULE_PARM_DESC(irq_cpu, "CPU the completion IPIs are sent to (irqmode=3)");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Commands per submission queue");
+
+static void put_tag(struct nullb_queue *nq, unsigned int tag)
+{
+	clear_bit(tag, nq->tag_map);
+	smp_mb__after_clear_bit();
+
+	if (waitqueue_active(&nq->wait))
+		wake_up(&nq->wait);
+}
+
+static unsigned int get_tag(struct nullb_queue *nq)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(nq->tag_map, nq->queue_depth);
+		if (tag >= nq->queue_depth)
+			return -1U;
+	} while (test_and_set_bit(tag, nq->tag_map));
+
+	return tag;
+}
+
+static void free_cmd(struct nullb_cmd *cmd)
+{
+	put_tag(cmd->nq, cmd->tag);
+}
+
+static struct nullb_cmd *__alloc_cmd(struct nullb_queue *nq)
+{
+	struct nullb_cmd *cmd;
+	unsigned int tag;
+
+	tag = get_tag(nq);
+	if (tag == -1U)
+		return NULL;
+
+	cmd = &nq->cmds[tag];
+	cmd->tag = tag;
+	cmd->nq = nq;
+	return cmd;
+}
+
+static struct nullb_cmd *alloc_cmd(struct nullb_queue *nq, int can_wait)
+{
+	struct nullb_cmd *cmd;
+	DEFINE_WAIT(wait);
+
+	cmd = __alloc_cmd(nq);
+	if (cmd || !can_wait)
+		return cmd;
+
+	do {
+		prepare_to_wait(&nq->wait, &wait, TASK_UNINTERRUPTIBLE);
+		cmd = __alloc_cmd(nq);
+		if (cmd)
+			break;
+
+		io_schedule();
+	} while (1);
+
+	finish_wait(&nq->wait, &wait);
+	return cmd;
+}
+
+static void end_cmd(struct nullb_cmd *cmd)
+{
+	struct request_queue *q;
+	unsigned long flags;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		blk_mq_end_io(cmd->rq, 0);
+		return;
+	case NULL_Q_RQ:
+		q = cmd->rq->q;
+		blk_end_request_all(cmd->rq, 0);
+		free_cmd(cmd);
+
+		/* null_request_fn() may have run out of commands */
+		if (unlikely(blk_queue_stopped(q))) {
+			spin_lock_irqsave(q->queue_lock, flags);
+			blk_start_queue(q);
+			spin_unlock_irqrestore(q->queue_lock, flags);
+		}
+		return;
+	case NULL_Q_BIO:
+		bio_endio(cmd->bio, 0);
+		break;
+	}
+
+	free_cmd(cmd);
+}
+
+static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+{
+	struct completion_queue *cq;
+	struct nullb_cmd *cmd;
+	LIST_HEAD(list);
+
+	cq = container_of(timer, struct completion_queue, timer);
+	list_splice_init(&cq->list, &list);
+
+	while (!list_empty(&list)) {
+		cmd = list_first_entry(&list, struct nullb_cmd, list);
+		list_del(&cmd->list);
+		end_cmd(cmd);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * The timer of a CPU is armed by its first pending command, and completes
+ * everything queued on that CPU when it fires.
+ */
+static void null_cmd_end_timer(struct nullb_cmd *cmd)
+{
+	struct completion_queue *cq;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cq = &__get_cpu_var(completion_queues);
+	list_add_tail(&cmd->list, &cq->list);
+	if (list_is_singular(&cq->list))
+		hrtimer_start(&cq->timer, ktime_set(0, completion_nsec),
+			      HRTIMER_MODE_REL_PINNED);
+	local_irq_restore(flags);
+}
+
+#ifdef CONFIG_USE_GENERIC_SMP_HELPERS
+static void null_ipi_cmd_end_io(void *data)
+{
+	end_cmd(data);
+}
+
+/*
+ * Like a device with a single interrupt vector: complete from the IPI
+ * handler on irq_cpu, whichever CPU submitted.
+ */
+static void null_cmd_end_ipi(struct nullb_cmd *cmd)
+{
+	cmd->csd.func = null_ipi_cmd_end_io;
+	cmd->csd.info = cmd;
+	__smp_call_function_single(irq_cpu, &cmd->csd, 0);
+}
+#else
+static void null_cmd_end_ipi(struct nullb_cmd *cmd)
+{
+	end_cmd(cmd);
+}
+#endif
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	if (queue_mode == NULL_Q_MQ)
+		end_cmd(blk_mq_rq_to_pdu(rq));
+	else
+		end_cmd(rq->special);
+}
+
+static void null_handle_cmd(struct nullb_cmd *cmd)
+{
+	/* Complete IO by inline, softirq, timer or IPI */
+	switch (irqmode) {
+	case NULL_IRQ_SOFTIRQ:
+		if (queue_mode != NULL_Q_BIO) {
+			blk_complete_request(cmd->rq);
+			break;
+		}
+		/* bios don't carry the submitting CPU, complete inline */
+		end_cmd(cmd);
+		break;
+	case NULL_IRQ_NONE:
+		end_cmd(cmd);
+		break;
+	case NULL_IRQ_TIMER:
+		null_cmd_end_timer(cmd);
+		break;
+	case NULL_IRQ_IPI:
+		null_cmd_end_ipi(cmd);
+		break;
+	}
+}
+
+static struct nullb_queue *nullb_to_queue(struct nullb *nullb)
+{
+	int index = 0;
+
+	if (nullb->nr_queues != 1)
+		index = raw_smp_processor_id() /
+			((nr_cpu_ids + nullb->nr_queues - 1) / nullb->nr_queues);
+
+	return &nullb->queues[index];
+}
+
+static int null_queue_bio(struct request_queue *q, struct bio *bio)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_queue *nq = nullb_to_queue(nullb);
+	struct nullb_cmd *cmd;
+
+	cmd = alloc_cmd(nq, 1);
+	cmd->bio = bio;
+
+	null_handle_cmd(cmd);
+	return 0;
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_queue *nq = nullb_to_queue(nullb);
+	struct nullb_cmd *cmd;
+	struct request *rq;
+
+	while ((rq = blk_peek_request(q)) != NULL) {
+		cmd = alloc_cmd(nq, 0);
+		if (!cmd) {
+			/* restarted by end_cmd() */
+			blk_stop_queue(q);
+
+			/* unless a command was freed before it could see that */
+			smp_mb();
+			cmd = alloc_cmd(nq, 0);
+			if (!cmd)
+				break;
+			queue_flag_clear(QUEUE_FLAG_STOPPED, q);
+		}
+		blk_start_request(rq);
+
+		cmd->rq = rq;
+		rq->special = cmd;
+
+		spin_unlock_irq(q->queue_lock);
+		null_handle_cmd(cmd);
+		spin_lock_irq(q->queue_lock);
+	}
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct nullb_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	cmd->rq = rq;
+	cmd->nq = hctx->driver_data;
+
+	null_handle_cmd(cmd);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
+{
+	init_waitqueue_head(&nq->wait);
+	nq->queue_depth = hw_queue_depth;
+}
+
+static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			  unsigned int index)
+{
+	struct nullb *nullb = data;
+	struct nullb_queue *nq = &nullb->queues[index];
+
+	hctx->driver_data = nq;
+	null_init_queue(nullb, nq);
+	nullb->nr_queues++;
+
+	return 0;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+	.init_hctx	= null_init_hctx,
+};
+
+static struct blk_mq_reg null_mq_reg = {
+	.ops		= &null_mq_ops,
+	.cmd_size	= sizeof(struct nullb_cmd),
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
+static void cleanup_queue(struct nullb_queue *nq)
+{
+	kfree(nq->tag_map);
+	kfree(nq->cmds);
+}
+
+static void cleanup_queues(struct nullb *nullb)
+{
+	int i;
+
+	for (i = 0; i < nullb->nr_queues; i++)
+		cleanup_queue(&nullb->queues[i]);
+
+	kfree(nullb->queues);
+}
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	cleanup_queues(nullb);
+	kfree(nullb);
+}
+
+static void null_del_devs(void)
+{
+	struct nullb *nullb;
+
+	while (!list_empty(&nullb_list)) {
+		nullb = list_entry(nullb_list.next, struct nullb, list);
+		null_del_dev(nullb);
+	}
+}
+
+static int null_open(struct block_device *bdev, fmode_t mode)
+{
+	return 0;
+}
+
+static int null_release(struct gendisk *disk, fmode_t mode)
+{
+	return 0;
+}
+
+static const struct block_device_operations null_fops = {
+	.owner =	THIS_MODULE,
+	.open =		null_open,
+	.release =	null_release,
+};
+
+static int setup_commands(struct nullb_queue *nq)
+{
+	int tag_size;
+
+	nq->cmds = kcalloc(nq->queue_depth, sizeof(*nq->cmds), GFP_KERNEL);
+	if (!nq->cmds)
+		return -ENOMEM;
+
+	tag_size = ALIGN(nq->queue_depth, BITS_PER_LONG) / BITS_PER_LONG;
+	nq->tag_map = kcalloc(tag_size, sizeof(unsigned long), GFP_KERNEL);
+	if (!nq->tag_map) {
+		kfree(nq->cmds);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int setup_queues(struct nullb *nullb)
+{
+	nullb->queues = kzalloc_node(submit_queues * sizeof(struct nullb_queue),
+				     GFP_KERNEL, home_node);
+	if (!nullb->queues)
+		return -ENOMEM;
+
+	nullb->nr_queues = 0;
+	return 0;
+}
+
+static int init_driver_queues(struct nullb *nullb)
+{
+	struct nullb_queue *nq;
+	int i, ret = 0;
+
+	for (i = 0; i < submit_queues; i++) {
+		nq = &nullb->queues[i];
+
+		null_init_queue(nullb, nq);
+
+		ret = setup_commands(nq);
+		if (ret)
+			return ret;
+		nullb->nr_queues++;
+	}
+
+	return 0;
+}
+
+static int null_add_dev(void)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+
+	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, home_node);
+	if (!nullb)
+		return -ENOMEM;
+
+	spin_lock_init(&nullb->lock);
+
+	if (setup_queues(nullb))
+		goto err;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		null_mq_reg.numa_node = home_node;
+		null_mq_reg.queue_depth = hw_queue_depth;
+		null_mq_reg.nr_hw_queues = submit_queues;
+
+		nullb->q = blk_mq_init_queue(&null_mq_reg, nullb);
+		break;
+	case NULL_Q_BIO:
+		nullb->q = blk_alloc_queue_node(GFP_KERNEL, home_node);
+		if (nullb->q)
+			blk_queue_make_request(nullb->q, null_queue_bio);
+		break;
+	case NULL_Q_RQ:
+		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock,
+					       home_node);
+		if (nullb->q)
+			blk_queue_prep_rq(nullb->q, NULL);
+		break;
+	}
+
+	if (!nullb->q)
+		goto queue_fail;
+
+	if (queue_mode != NULL_Q_MQ && init_driver_queues(nullb)) {
+		blk_cleanup_queue(nullb->q);
+		goto queue_fail;
+	}
+
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+	/* the data never moves, no need for bounce buffers */
+	blk_queue_bounce_limit(nullb->q, BLK_BOUNCE_ANY);
+
+	disk = nullb->disk = alloc_disk_node(1, home_node);
+	if (!disk) {
+		blk_cleanup_queue(nullb->q);
+		goto queue_fail;
+	}
+
+	list_add_tail(&nullb->list, &nullb_list);
+	nullb->index = nullb_indexes++;
+
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	set_capacity(disk, (sector_t)gb << (30 - 9));
+
+	disk->flags |= GENHD_FL_EXT_DEVT;
+	disk->major		= null_major;
+	disk->first_minor	= nullb->index;
+	disk->fops		= &null_fops;
+	disk->private_data	= nullb;
+	disk->queue		= nullb->q;
+	sprintf(disk->disk_name, "nullb%d", nullb->index);
+	add_disk(disk);
+	return 0;
+
+queue_fail:
+	cleanup_queues(nullb);
+err:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+
+	if (bs != 512 && bs != 1024 && bs != 2048 && bs != 4096) {
+		printk(KERN_WARNING "null_blk: invalid block size\n");
+		printk(KERN_WARNING "null_blk: defaults block size to 512\n");
+		bs = 512;
+	}
+
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ) {
+		printk(KERN_ERR "null_blk: invalid queue_mode %d\n",
+		       queue_mode);
+		return -EINVAL;
+	}
+
+	if (irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_IPI) {
+		printk(KERN_ERR "null_blk: invalid irqmode %d\n", irqmode);
+		return -EINVAL;
+	}
+
+	if (irqmode == NULL_IRQ_IPI &&
+	    (irq_cpu < 0 || irq_cpu >= nr_cpu_ids || !cpu_online(irq_cpu))) {
+		printk(KERN_ERR "null_blk: irq_cpu %d is not online\n",
+		       irq_cpu);
+		return -EINVAL;
+	}
+
+	if (hw_queue_depth < 1 ||
+	    (queue_mode == NULL_Q_MQ && hw_queue_depth > BLK_MQ_MAX_DEPTH)) {
+		printk(KERN_ERR "null_blk: invalid hw_queue_depth %d\n",
+		       hw_queue_depth);
+		return -EINVAL;
+	}
+
+	if (submit_queues < 1)
+		submit_queues = 1;
+	else if (submit_queues > nr_cpu_ids)
+		submit_queues = nr_cpu_ids;
+
+	if (irqmode == NULL_IRQ_TIMER) {
+		for_each_possible_cpu(i) {
+			struct completion_queue *cq;
+
+			cq = &per_cpu(completion_queues, i);
+			INIT_LIST_HEAD(&cq->list);
+			hrtimer_init(&cq->timer, CLOCK_MONOTONIC,
+				     HRTIMER_MODE_REL);
+			cq->timer.function = null_cmd_timer_expired;
+		}
+	}
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		if (null_add_dev()) {
+			null_del_devs();
+			unregister_blkdev(null_major, "nullb");
+			return -ENOMEM;
+		}
+	}
+
+	printk(KERN_INFO "null_blk: module loaded\n");
+	return 0;
+}
+
+static void __exit null_exit(void)
+{
+	null_del_devs();
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
@@ -21,9 +21,12 @@
  */
 
 #include <linux/fs.h>
+#include <linux/genhd.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/list.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/types.h>
@@ -34,18 +37,33 @@
 #include <linux/mutex.h>
 
 
+struct mtdblk_cache {
+	struct list_head list;
+	unsigned char *data;
+	unsigned long offset;
+	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } state;
+};
+
 struct mtdblk_dev {
 	struct mtd_blktrans_dev mbd;
 	int count;
 	struct mutex cache_mutex;
-	unsigned char *cache_data;
-	unsigned long cache_offset;
+	struct mtdblk_cache *cache;
+	unsigned int cache_nr;
+	struct list_head cache_lru;
 	unsigned int cache_size;
-	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } cache_state;
+	unsigned long cache_hits;
+	unsigned long cache_misses;
+	unsigned long cache_writebacks;
 };
 
 static struct mutex mtdblks_lock;
 
+static unsigned int cache_blocks = 1;
+module_param(cache_blocks, uint, 0444);
+MODULE_PARM_DESC(cache_blocks, "Number of eraseblocks cached per device "
+			       "for read-modify-write (default 1)");
+
 /*
  * Cache stuff...
  *
@@ -54,6 +72,11 @@ static struct mutex mtdblks_lock;
  * sectors for each block write requests.  To avoid over-erasing flash sectors
  * and to speed things up, we locally cache a whole flash sector while it is
  * being written to until a different sector is required.
+ *
+ * Up to cache_blocks sectors are cached at a time.  Cache entries are kept
+ * on an LRU list with the most recently used one first and empty entries
+ * at the tail, so the tail is always the entry to (re)use: either an empty
+ * one or the least recently used dirty sector, which then gets written back.
  */
 
 static void erase_callback(struct erase_info *done)
@@ -111,22 +134,24 @@ static int erase_write (struct mtd_info *mtd, unsigned long pos,
 }
 
 
-static int write_cached_data (struct mtdblk_dev *mtdblk)
+static int write_cached_data (struct mtdblk_dev *mtdblk,
+			      struct mtdblk_cache *cache)
 {
 	struct mtd_info *mtd = mtdblk->mbd.mtd;
 	int ret;
 
-	if (mtdblk->cache_state != STATE_DIRTY)
+	if (cache->state != STATE_DIRTY)
 		return 0;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "mtdblock: writing cached data for \"%s\" "
 			"at 0x%lx, size 0x%x\n", mtd->name,
-			mtdblk->cache_offset, mtdblk->cache_size);
+			cache->offset, mtdblk->cache_size);
 
-	ret = erase_write (mtd, mtdblk->cache_offset,
-			   mtdblk->cache_size, mtdblk->cache_data);
+	ret = erase_write (mtd, cache->offset,
+			   mtdblk->cache_size, cache->data);
 	if (ret)
 		return ret;
+	mtdblk->cache_writebacks++;
 
 	/*
 	 * Here we could argubly set the cache state to STATE_CLEAN.
@@ -135,16 +160,89 @@ static int write_cached_data (struct mtdblk_dev *mtdblk)
 	 * means.  Let's declare it empty and leave buffering tasks to
 	 * the buffer cache instead.
 	 */
-	mtdblk->cache_state = STATE_EMPTY;
+	cache->state = STATE_EMPTY;
+	list_move_tail(&cache->list, &mtdblk->cache_lru);
 	return 0;
 }
 
+static int write_all_cached_data(struct mtdblk_dev *mtdblk)
+{
+	unsigned int i;
+	int ret, err = 0;
+
+	for (i = 0; i < mtdblk->cache_nr; i++) {
+		ret = write_cached_data(mtdblk, &mtdblk->cache[i]);
+		if (ret && !err)
+			err = ret;
+	}
+	return err;
+}
+
+static struct mtdblk_cache *find_cached_sect(struct mtdblk_dev *mtdblk,
+					     unsigned long sect_start)
+{
+	struct mtdblk_cache *cache;
+
+	list_for_each_entry(cache, &mtdblk->cache_lru, list) {
+		if (cache->state == STATE_EMPTY)
+			break;
+		if (cache->offset == sect_start) {
+			list_move(&cache->list, &mtdblk->cache_lru);
+			return cache;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Get a cache entry filled with the sector at sect_start, evicting the
+ * least recently used one if all of them are in use.
+ */
+static struct mtdblk_cache *fill_cached_sect(struct mtdblk_dev *mtdblk,
+					     unsigned long sect_start)
+{
+	struct mtd_info *mtd = mtdblk->mbd.mtd;
+	struct mtdblk_cache *cache;
+	size_t retlen;
+	int ret;
+
+	cache = list_entry(mtdblk->cache_lru.prev, struct mtdblk_cache, list);
+	ret = write_cached_data(mtdblk, cache);
+	if (ret)
+		return ERR_PTR(ret);
+
+	if (unlikely(!cache->data)) {
+		cache->data = vmalloc(mtdblk->cache_size);
+		if (!cache->data)
+			return ERR_PTR(-EINTR);
+		/* -EINTR is not really correct, but it is the best match
+		 * documented in man 2 write for all cases.  We could also
+		 * return -EAGAIN sometimes, but why bother?
+		 */
+	}
+
+	/* fill the cache with the current sector */
+	cache->state = STATE_EMPTY;
+	ret = mtd->read(mtd, sect_start, mtdblk->cache_size, &retlen,
+			cache->data);
+	if (ret)
+		return ERR_PTR(ret);
+	if (retlen != mtdblk->cache_size)
+		return ERR_PTR(-EIO);
+
+	cache->offset = sect_start;
+	cache->state = STATE_CLEAN;
+	list_move(&cache->list, &mtdblk->cache_lru);
+	return cache;
+}
+
 
 static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			    int len, const char *buf)
 {
 	struct mtd_info *mtd = mtdblk->mbd.mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *cache;
 	size_t retlen;
 	int ret;
 
@@ -161,44 +259,38 @@ static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 		if( size > len )
 			size = len;
 
+		cache = find_cached_sect(mtdblk, sect_start);
+
 		if (size == sect_size) {
 			/*
 			 * We are covering a whole sector.  Thus there is no
 			 * need to bother with the cache while it may still be
-			 * useful for other partial writes.
+			 * useful for other partial writes.  A cached copy of
+			 * this sector is stale from now on, so drop it.
 			 */
+			if (cache) {
+				cache->state = STATE_EMPTY;
+				list_move_tail(&cache->list,
+					       &mtdblk->cache_lru);
+			}
 			ret = erase_write (mtd, pos, size, buf);
 			if (ret)
 				return ret;
 		} else {
 			/* Partial sector: need to use the cache */
 
-			if (mtdblk->cache_state == STATE_DIRTY &&
-			    mtdblk->cache_offset != sect_start) {
-				ret = write_cached_data(mtdblk);
-				if (ret)
-					return ret;
-			}
-
-			if (mtdblk->cache_state == STATE_EMPTY ||
-			    mtdblk->cache_offset != sect_start) {
-				/* fill the cache with the current sector */
-				mtdblk->cache_state = STATE_EMPTY;
-				ret = mtd->read(mtd, sect_start, sect_size,
-						&retlen, mtdblk->cache_data);
-				if (ret)
-					return ret;
-				if (retlen != sect_size)
-					return -EIO;
-
-				mtdblk->cache_offset = sect_start;
-				mtdblk->cache_size = sect_size;
-				mtdblk->cache_state = STATE_CLEAN;
+			if (cache) {
+				mtdblk->cache_hits++;
+			} else {
+				mtdblk->cache_misses++;
+				cache = fill_cached_sect(mtdblk, sect_start);
+				if (IS_ERR(cache))
+					return PTR_ERR(cache);
 			}
 
 			/* write data to our local cache */
-			memcpy (mtdblk->cache_data + offset, buf, size);
-			mtdblk->cache_state = STATE_DIRTY;
+			memcpy (cache->data + offset, buf, size);
+			cache->state = STATE_DIRTY;
 		}
 
 		buf += size;
@@ -215,6 +307,7 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 {
 	struct mtd_info *mtd = mtdblk->mbd.mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *cache;
 	size_t retlen;
 	int ret;
 
@@ -237,10 +330,12 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 		 * contains what we want, otherwise we read the data directly
 		 * from flash.
 		 */
-		if (mtdblk->cache_state != STATE_EMPTY &&
-		    mtdblk->cache_offset == sect_start) {
-			memcpy (buf, mtdblk->cache_data + offset, size);
+		cache = find_cached_sect(mtdblk, sect_start);
+		if (cache) {
+			mtdblk->cache_hits++;
+			memcpy (buf, cache->data + offset, size);
 		} else {
+			mtdblk->cache_misses++;
 			ret = mtd->read(mtd, pos, size, &retlen, buf);
 			if (ret)
 				return ret;
@@ -267,21 +362,13 @@ static int mtdblock_writesect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct mtdblk_dev *mtdblk = container_of(dev, struct mtdblk_dev, mbd);
-	if (unlikely(!mtdblk->cache_data && mtdblk->cache_size)) {
-		mtdblk->cache_data = vmalloc(mtdblk->mbd.mtd->erasesize);
-		if (!mtdblk->cache_data)
-			return -EINTR;
-		/* -EINTR is not really correct, but it is the best match
-		 * documented in man 2 write for all cases.  We could also
-		 * return -EAGAIN sometimes, but why bother?
-		 */
-	}
 	return do_cached_write(mtdblk, block<<9, 512, buf);
 }
 
 static int mtdblock_open(struct mtd_blktrans_dev *mbd)
 {
 	struct mtdblk_dev *mtdblk = container_of(mbd, struct mtdblk_dev, mbd);
+	unsigned int i;
 
 	DEBUG(MTD_DEBUG_LEVEL1,"mtdblock_open\n");
 
@@ -295,10 +382,26 @@ static int mtdblock_open(struct mtd_blktrans_dev *mbd)
 	/* OK, it's not open. Create cache info for it */
 	mtdblk->count = 1;
 	mutex_init(&mtdblk->cache_mutex);
-	mtdblk->cache_state = STATE_EMPTY;
+	INIT_LIST_HEAD(&mtdblk->cache_lru);
+	mtdblk->cache_nr = 0;
+	mtdblk->cache_size = 0;
 	if (!(mbd->mtd->flags & MTD_NO_ERASE) && mbd->mtd->erasesize) {
+		mtdblk->cache_nr = max(cache_blocks, 1U);
+		mtdblk->cache = kcalloc(mtdblk->cache_nr,
+					sizeof(struct mtdblk_cache),
+					GFP_KERNEL);
+		if (!mtdblk->cache) {
+			mtdblk->count = 0;
+			mutex_unlock(&mtdblks_lock);
+			return -ENOMEM;
+		}
+		for (i = 0; i < mtdblk->cache_nr; i++) {
+			mtdblk->cache[i].state = STATE_EMPTY;
+			list_add_tail(&mtdblk->cache[i].list,
+				      &mtdblk->cache_lru);
+		}
+		/* The sector buffers are allocated on first use */
 		mtdblk->cache_size = mbd->mtd->erasesize;
-		mtdblk->cache_data = NULL;
 	}
 
 	mutex_unlock(&mtdblks_lock);
@@ -311,20 +414,25 @@ static int mtdblock_open(struct mtd_blktrans_dev *mbd)
 static int mtdblock_release(struct mtd_blktrans_dev *mbd)
 {
 	struct mtdblk_dev *mtdblk = container_of(mbd, struct mtdblk_dev, mbd);
+	unsigned int i;
 
    	DEBUG(MTD_DEBUG_LEVEL1, "mtdblock_release\n");
 
 	mutex_lock(&mtdblks_lock);
 
 	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
+	write_all_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
 	if (!--mtdblk->count) {
 		/* It was the last usage. Free the cache */
 		if (mbd->mtd->sync)
 			mbd->mtd->sync(mbd->mtd);
-		vfree(mtdblk->cache_data);
+		for (i = 0; i < mtdblk->cache_nr; i++)
+			vfree(mtdblk->cache[i].data);
+		kfree(mtdblk->cache);
+		mtdblk->cache = NULL;
+		mtdblk->cache_nr = 0;
 	}
 
 	mutex_unlock(&mtdblks_lock);
@@ -337,16 +445,49 @@ static int mtdblock_release(struct mtd_blktrans_dev *mbd)
 static int mtdblock_flush(struct mtd_blktrans_dev *dev)
 {
 	struct mtdblk_dev *mtdblk = container_of(dev, struct mtdblk_dev, mbd);
+	int ret;
 
 	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
+	ret = write_all_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
 	if (dev->mtd->sync)
 		dev->mtd->sync(dev->mtd);
-	return 0;
+	return ret;
 }
 
+/* Cache statistics, exported as attributes of the block device */
+#define MTDBLK_ATTR(_name)						\
+static ssize_t mtdblock_attr_##_name##_show(struct device *dev,		\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct mtd_blktrans_dev *mbd = dev_to_disk(dev)->private_data;	\
+	struct mtdblk_dev *mtdblk;					\
+									\
+	if (!mbd)							\
+		return -ENODEV;						\
+	mtdblk = container_of(mbd, struct mtdblk_dev, mbd);		\
+	return sprintf(buf, "%lu\n", (unsigned long)mtdblk->_name);	\
+}									\
+static DEVICE_ATTR(_name, S_IRUGO, mtdblock_attr_##_name##_show, NULL)
+
+MTDBLK_ATTR(cache_nr);
+MTDBLK_ATTR(cache_hits);
+MTDBLK_ATTR(cache_misses);
+MTDBLK_ATTR(cache_writebacks);
+
+static struct attribute *mtdblock_attrs[] = {
+	&dev_attr_cache_nr.attr,
+	&dev_attr_cache_hits.attr,
+	&dev_attr_cache_misses.attr,
+	&dev_attr_cache_writebacks.attr,
+	NULL,
+};
+
+static struct attribute_group mtdblock_attr_group = {
+	.attrs = mtdblock_attrs,
+};
+
 static void mtdblock_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
 {
 	struct mtdblk_dev *dev = kzalloc(sizeof(*dev), GFP_KERNEL);
@@ -363,6 +504,8 @@ static void mtdblock_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
 	if (!(mtd->flags & MTD_WRITEABLE))
 		dev->mbd.readonly = 1;
 
+	dev->mbd.disk_attributes = &mtdblock_attr_group;
+
 	if (add_mtd_blktrans_dev(&dev->mbd))
 		kfree(dev);
 }
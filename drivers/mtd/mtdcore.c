@@ -35,6 +35,7 @@
 #include <linux/idr.h>
 #include <linux/backing-dev.h>
 #include <linux/gfp.h>
+#include <linux/completion.h>
 
 #include <linux/mtd/mtd.h>
 
@@ -638,6 +639,113 @@ int default_mtd_writev(struct mtd_info *mtd, const struct kvec *vecs,
 	return ret;
 }
 
+/**
+ * mtd_io_req_done - finish an asynchronous MTD request
+ * @req: the request, with the results of all its segments filled in
+ *
+ * Sets @req->error from the per-segment results and calls the completion
+ * callback.  This is meant for MTD drivers implementing the ->submit method.
+ */
+void mtd_io_req_done(struct mtd_io_req *req)
+{
+	unsigned int i;
+
+	req->error = 0;
+	for (i = 0; i < req->nr_vec; i++) {
+		int ret = req->vec[i].ret;
+
+		if (!ret)
+			continue;
+		if (ret != -EUCLEAN) {
+			req->error = ret;
+			break;
+		}
+		req->error = -EUCLEAN;
+	}
+
+	req->complete(req);
+}
+
+/* Synchronous fallback for devices which do not implement ->submit */
+static void mtd_io_sync(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	unsigned int i;
+
+	for (i = 0; i < req->nr_vec; i++) {
+		struct mtd_io_vec *vec = &req->vec[i];
+
+		vec->retlen = 0;
+		if (req->dir == MTD_IO_READ)
+			vec->ret = mtd->read(mtd, req->base + vec->ofs, vec->len,
+					     &vec->retlen, vec->buf);
+		else if (mtd->write)
+			vec->ret = mtd->write(mtd, req->base + vec->ofs,
+					      vec->len, &vec->retlen, vec->buf);
+		else
+			vec->ret = -EROFS;
+	}
+
+	mtd_io_req_done(req);
+}
+
+/**
+ * mtd_submit - submit an asynchronous vectored MTD request
+ * @mtd: MTD device description object
+ * @req: the request
+ *
+ * Queues @req to @mtd.  If zero is returned, the @req->complete callback is
+ * called exactly once when the request has been served, possibly before this
+ * function returns; @req and the data buffers must stay around until then.
+ * If a negative error code is returned, the request was rejected and the
+ * callback is not called.
+ *
+ * Devices which do not implement asynchronous I/O serve the request
+ * synchronously using their ->read and ->write methods.
+ */
+int mtd_submit(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	if (req->dir != MTD_IO_READ && req->dir != MTD_IO_WRITE)
+		return -EINVAL;
+	if (req->dir == MTD_IO_WRITE && !(mtd->flags & MTD_WRITEABLE))
+		return -EROFS;
+
+	req->error = 0;
+	req->base = 0;
+	if (mtd->submit)
+		return mtd->submit(mtd, req);
+
+	req->mtd = mtd;
+	mtd_io_sync(mtd, req);
+	return 0;
+}
+
+static void mtd_submit_wait_done(struct mtd_io_req *req)
+{
+	complete(req->priv);
+}
+
+/**
+ * mtd_submit_wait - submit an MTD request and wait for it
+ * @mtd: MTD device description object
+ * @req: the request; @req->complete and @req->priv are overwritten
+ *
+ * Returns the overall result of the request, see &struct mtd_io_req.
+ */
+int mtd_submit_wait(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	int err;
+
+	req->complete = mtd_submit_wait_done;
+	req->priv = &done;
+	err = mtd_submit(mtd, req);
+	if (err)
+		return err;
+
+	wait_for_completion(&done);
+	return req->error;
+}
+
 EXPORT_SYMBOL_GPL(add_mtd_device);
 EXPORT_SYMBOL_GPL(del_mtd_device);
 EXPORT_SYMBOL_GPL(get_mtd_device);
@@ -648,6 +756,9 @@ EXPORT_SYMBOL_GPL(__put_mtd_device);
 EXPORT_SYMBOL_GPL(register_mtd_user);
 EXPORT_SYMBOL_GPL(unregister_mtd_user);
 EXPORT_SYMBOL_GPL(default_mtd_writev);
+EXPORT_SYMBOL_GPL(mtd_io_req_done);
+EXPORT_SYMBOL_GPL(mtd_submit);
+EXPORT_SYMBOL_GPL(mtd_submit_wait);
 
 #ifdef CONFIG_PROC_FS
 
@@ -229,6 +229,23 @@ static int part_writev(struct mtd_info *mtd, const struct kvec *vecs,
 					to + part->offset, retlen);
 }
 
+/*
+ * Note, ECC statistics of asynchronous reads are only accounted to the
+ * master device.
+ */
+static int part_submit(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	struct mtd_part *part = PART(mtd);
+	unsigned int i;
+
+	for (i = 0; i < req->nr_vec; i++)
+		if (req->vec[i].ofs < 0 ||
+		    req->vec[i].ofs + req->vec[i].len > mtd->size)
+			return -EINVAL;
+	req->base += part->offset;
+	return part->master->submit(part->master, req);
+}
+
 static int part_erase(struct mtd_info *mtd, struct erase_info *instr)
 {
 	struct mtd_part *part = PART(mtd);
@@ -434,6 +451,8 @@ static struct mtd_part *allocate_partition(struct mtd_info *master,
 	}
 	if (master->writev)
 		slave->mtd.writev = part_writev;
+	if (master->submit)
+		slave->mtd.submit = part_submit;
 	if (master->lock)
 		slave->mtd.lock = part_lock;
 	if (master->unlock)
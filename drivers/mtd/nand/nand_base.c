@@ -42,10 +42,14 @@
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/nand_ecc.h>
+#include <linux/mtd/nand_bch.h>
 #include <linux/interrupt.h>
 #include <linux/bitops.h>
 #include <linux/leds.h>
 #include <linux/io.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #ifdef CONFIG_MTD_PARTITIONS
 #include <linux/mtd/partitions.h>
@@ -107,6 +111,12 @@ static int nand_do_write_oob(struct mtd_info *mtd, loff_t to,
  */
 DEFINE_LED_TRIGGER(nand_led_trigger);
 
+/* Serves asynchronous requests, see nand_submit() */
+static struct workqueue_struct *nand_io_wq;
+
+/* Parent of the per-chip operation statistics in debugfs */
+static struct dentry *nand_debugfs_root;
+
 static int check_offs_len(struct mtd_info *mtd,
 					loff_t ofs, uint64_t len)
 {
@@ -1439,6 +1449,48 @@ static uint8_t *nand_transfer_oob(struct nand_chip *chip, uint8_t *oob,
 	return NULL;
 }
 
+/**
+ * nand_read_pages_cached - [Internal] Read pages in cache read mode
+ * @mtd:	MTD device structure
+ * @chip:	nand chip info structure
+ * @buf:	buffer to store the data, @n pages long
+ * @page:	first page to read
+ * @n:		number of pages to read, at least two
+ * @raw:	use _raw version of read_page
+ *
+ * Reads @n consecutive pages of one block using the cache read
+ * (sequential) command, so the chip loads the next page into its data
+ * register while the current one is transferred out of the cache register.
+ */
+static int nand_read_pages_cached(struct mtd_info *mtd, struct nand_chip *chip,
+				  uint8_t *buf, int page, int n, int raw)
+{
+	int i, ret;
+
+	chip->cmdfunc(mtd, NAND_CMD_READ0, 0x00, page);
+
+	for (i = 0; i < n; i++, page++) {
+		chip->cmdfunc(mtd, i == n - 1 ? NAND_CMD_READCACHEEND :
+			      NAND_CMD_READCACHESEQ, -1, -1);
+
+		if (unlikely(raw))
+			ret = chip->ecc.read_page_raw(mtd, chip, buf, page);
+		else
+			ret = chip->ecc.read_page(mtd, chip, buf, page);
+		if (ret < 0) {
+			/* Leave cache read mode before bailing out */
+			if (i != n - 1)
+				chip->cmdfunc(mtd, NAND_CMD_READCACHEEND,
+					      -1, -1);
+			return ret;
+		}
+
+		chip->stats.cache_reads++;
+		buf += mtd->writesize;
+	}
+	return 0;
+}
+
 /**
  * nand_do_read_ops - [Internal] Read data with ECC
  *
@@ -1451,7 +1503,7 @@ static uint8_t *nand_transfer_oob(struct nand_chip *chip, uint8_t *oob,
 static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			    struct mtd_oob_ops *ops)
 {
-	int chipnr, page, realpage, col, bytes, aligned;
+	int chipnr, page, realpage, col, bytes, aligned, npages;
 	struct nand_chip *chip = mtd->priv;
 	struct mtd_ecc_stats stats;
 	int blkcheck = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
@@ -1480,9 +1532,26 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 	while (1) {
 		bytes = min(mtd->writesize - col, readlen);
 		aligned = (bytes == mtd->writesize);
+		npages = min_t(int, readlen >> chip->page_shift,
+			       blkcheck + 1 - (page & blkcheck));
+
+		/*
+		 * Use cache read for runs of whole pages inside a block, the
+		 * chip fetches the next page while we transfer the current.
+		 */
+		if (NAND_HAS_CACHEREAD(chip) && !col && !oob && npages > 1) {
+			ret = nand_read_pages_cached(mtd, chip, buf, page,
+					npages, ops->mode == MTD_OOB_RAW);
+			if (ret < 0)
+				break;
 
-		/* Is the current page in the buffer ? */
-		if (realpage != chip->pagebuf || oob) {
+			bytes = npages << chip->page_shift;
+			buf += bytes;
+			/* The loop tail below steps to the page after the run */
+			realpage += npages - 1;
+			sndcmd = 1;
+		} else if (realpage != chip->pagebuf || oob) {
+			/* The current page is not in the buffer */
 			bufpoi = aligned ? buf : chip->buffers->databuf;
 
 			if (likely(sndcmd)) {
@@ -1502,6 +1571,7 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 							  page);
 			if (ret < 0)
 				break;
+			chip->stats.page_reads++;
 
 			/* Transfer not aligned data */
 			if (!aligned) {
@@ -2069,12 +2139,14 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 		chip->ecc.write_page(mtd, chip, buf);
 
 	/*
-	 * Cached progamming disabled for now, Not sure if its worth the
-	 * trouble. The speed gain is not very impressive. (2.3->2.6Mib/s)
+	 * Cached programming is disabled unless the board driver asks for it
+	 * with NAND_USE_CACHEPRG. Not sure if its worth the trouble in
+	 * general. The speed gain is not very impressive. (2.3->2.6Mib/s)
 	 */
-	cached = 0;
+	if (!(chip->options & NAND_USE_CACHEPRG))
+		cached = 0;
 
-	if (!cached || !(chip->options & NAND_CACHEPRG)) {
+	if (!cached || !NAND_HAS_CACHEPROG(chip)) {
 
 		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
 		status = chip->waitfunc(mtd, chip);
@@ -2086,11 +2158,28 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 			status = chip->errstat(mtd, chip, FL_WRITING, status,
 					       page);
 
+		/* Last page of a cache program sequence reports its parent */
+		if (chip->cacheprg_pending) {
+			chip->cacheprg_pending = 0;
+			if (status & NAND_STATUS_FAIL_N1)
+				return -EIO;
+		}
+
 		if (status & NAND_STATUS_FAIL)
 			return -EIO;
 	} else {
+		/*
+		 * The chip returns ready as soon as the cache register is
+		 * free again, the page is programmed in the background. The
+		 * status bits refer to the previous pages of the sequence.
+		 */
 		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
 		status = chip->waitfunc(mtd, chip);
+
+		if ((status & NAND_STATUS_FAIL) ||
+		    (chip->cacheprg_pending && (status & NAND_STATUS_FAIL_N1)))
+			return -EIO;
+		chip->cacheprg_pending = 1;
 	}
 
 #ifdef CONFIG_MTD_NAND_VERIFY_WRITE
@@ -2103,6 +2192,36 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 	return 0;
 }
 
+/**
+ * nand_wait_cacheprg - [Internal] Wait for a cache program sequence to end
+ * @mtd:	MTD device structure
+ * @chip:	NAND chip descriptor
+ *
+ * Used when a cache program sequence was aborted. Polls the true ready
+ * status bit until the page still programmed in the background is done.
+ */
+static void nand_wait_cacheprg(struct mtd_info *mtd, struct nand_chip *chip)
+{
+	unsigned long timeo = jiffies + msecs_to_jiffies(20);
+	int i;
+
+	chip->cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
+	if (in_interrupt() || oops_in_progress) {
+		for (i = 0; i < 20000; i++) {
+			if (chip->read_byte(mtd) & NAND_STATUS_TRUE_READY)
+				break;
+			udelay(1);
+		}
+	} else {
+		while (time_before(jiffies, timeo)) {
+			if (chip->read_byte(mtd) & NAND_STATUS_TRUE_READY)
+				break;
+			cond_resched();
+		}
+	}
+	chip->cacheprg_pending = 0;
+}
+
 /**
  * nand_fill_oob - [Internal] Transfer client buffer to oob
  * @chip:	nand chip structure
@@ -2243,6 +2362,12 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 		if (ret)
 			break;
 
+		if (cached && NAND_HAS_CACHEPROG(chip) &&
+		    (chip->options & NAND_USE_CACHEPRG))
+			chip->stats.cache_programs++;
+		else
+			chip->stats.page_programs++;
+
 		writelen -= bytes;
 		if (!writelen)
 			break;
@@ -2260,6 +2385,9 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 		}
 	}
 
+	if (unlikely(chip->cacheprg_pending))
+		nand_wait_cacheprg(mtd, chip);
+
 	ops->retlen = ops->len - writelen;
 	if (unlikely(oob))
 		ops->oobretlen = ops->ooblen;
@@ -2342,6 +2470,98 @@ static int nand_write(struct mtd_info *mtd, loff_t to, size_t len,
 	return ret;
 }
 
+/**
+ * nand_do_io_req - [Internal] serve one asynchronous request
+ * @mtd:	MTD device structure
+ * @req:	the request
+ *
+ * All segments of the request are served under one claim of the chip.
+ */
+static void nand_do_io_req(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	struct nand_chip *chip = mtd->priv;
+	unsigned int i;
+
+	nand_get_device(chip, mtd, req->dir == MTD_IO_READ ?
+			FL_READING : FL_WRITING);
+
+	for (i = 0; i < req->nr_vec; i++) {
+		struct mtd_io_vec *vec = &req->vec[i];
+		loff_t ofs = req->base + vec->ofs;
+
+		vec->retlen = 0;
+		if (ofs < 0 || ofs + vec->len > mtd->size) {
+			vec->ret = -EINVAL;
+			continue;
+		}
+		if (!vec->len) {
+			vec->ret = 0;
+			continue;
+		}
+
+		chip->ops.len = vec->len;
+		chip->ops.datbuf = vec->buf;
+		chip->ops.oobbuf = NULL;
+
+		if (req->dir == MTD_IO_READ)
+			vec->ret = nand_do_read_ops(mtd, ofs, &chip->ops);
+		else
+			vec->ret = nand_do_write_ops(mtd, ofs, &chip->ops);
+		vec->retlen = chip->ops.retlen;
+	}
+
+	nand_release_device(mtd);
+	mtd_io_req_done(req);
+}
+
+/**
+ * nand_io_work - [Internal] asynchronous request worker
+ * @work:	the chip's work item
+ *
+ * Serves the queued requests in submission order.  The workqueue is
+ * non-reentrant, so there is only one worker per chip at a time.
+ */
+static void nand_io_work(struct work_struct *work)
+{
+	struct nand_chip *chip = container_of(work, struct nand_chip, io_work);
+	struct mtd_io_req *req;
+
+	spin_lock(&chip->io_lock);
+	while (!list_empty(&chip->io_queue)) {
+		req = list_first_entry(&chip->io_queue, struct mtd_io_req,
+				       list);
+		list_del(&req->list);
+		spin_unlock(&chip->io_lock);
+
+		nand_do_io_req(req->mtd, req);
+
+		spin_lock(&chip->io_lock);
+	}
+	spin_unlock(&chip->io_lock);
+}
+
+/**
+ * nand_submit - [MTD Interface] queue an asynchronous request
+ * @mtd:	MTD device structure
+ * @req:	the request
+ *
+ * The request is served by a worker thread, which lets the submitter
+ * prepare the next request, or process the data of the previous one,
+ * while the chip is busy.
+ */
+static int nand_submit(struct mtd_info *mtd, struct mtd_io_req *req)
+{
+	struct nand_chip *chip = mtd->priv;
+
+	req->mtd = mtd;
+	spin_lock(&chip->io_lock);
+	list_add_tail(&req->list, &chip->io_queue);
+	spin_unlock(&chip->io_lock);
+
+	queue_work(nand_io_wq, &chip->io_work);
+	return 0;
+}
+
 /**
  * nand_do_write_oob - [MTD Interface] NAND write out-of-band
  * @mtd:	MTD device structure
@@ -2596,6 +2816,7 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 		chip->erase_cmd(mtd, page & chip->pagemask);
 
 		status = chip->waitfunc(mtd, chip);
+		chip->stats.erases++;
 
 		/*
 		 * See if operation failed and additional status checks are
@@ -2896,6 +3117,12 @@ static int nand_flash_detect_onfi(struct mtd_info *mtd, struct nand_chip *chip,
 	chip->options |= (NAND_NO_READRDY |
 			NAND_NO_AUTOINCR) & NAND_CHIPOPTIONS_MSK;
 
+	/* Optional commands: bit 0 page cache program, bit 1 read cache */
+	if (le16_to_cpu(p->opt_cmd) & (1 << 0))
+		chip->options |= NAND_CACHEPRG;
+	if (le16_to_cpu(p->opt_cmd) & (1 << 1))
+		chip->options |= NAND_CACHERD;
+
 	return 1;
 }
 
@@ -3220,6 +3447,61 @@ int nand_scan_ident(struct mtd_info *mtd, int maxchips,
 EXPORT_SYMBOL(nand_scan_ident);
 
 
+static int nand_stats_show(struct seq_file *m, void *v)
+{
+	struct mtd_info *mtd = m->private;
+	struct nand_chip *chip = mtd->priv;
+
+	seq_printf(m, "name:           %s\n", mtd->name);
+	seq_printf(m, "cache read:     %s\n",
+		   NAND_HAS_CACHEREAD(chip) ? "yes" : "no");
+	seq_printf(m, "cache program:  %s\n",
+		   NAND_HAS_CACHEPROG(chip) ? "yes" : "no");
+	seq_printf(m, "page_reads:     %lu\n", chip->stats.page_reads);
+	seq_printf(m, "cache_reads:    %lu\n", chip->stats.cache_reads);
+	seq_printf(m, "page_programs:  %lu\n", chip->stats.page_programs);
+	seq_printf(m, "cache_programs: %lu\n", chip->stats.cache_programs);
+	seq_printf(m, "erases:         %lu\n", chip->stats.erases);
+	return 0;
+}
+
+static int nand_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nand_stats_show, inode->i_private);
+}
+
+static const struct file_operations nand_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nand_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/**
+ * nand_stats_add - [Internal] Export the operation statistics of a chip
+ * @mtd:	MTD device structure
+ *
+ * Creates nand/nand<N> in debugfs. The MTD device number is not known
+ * before the driver registers it, so the chips are numbered in scan order.
+ */
+static void nand_stats_add(struct mtd_info *mtd)
+{
+	static atomic_t nand_stats_nr = ATOMIC_INIT(0);
+	struct nand_chip *chip = mtd->priv;
+	char name[16];
+
+	if (!nand_debugfs_root)
+		return;
+
+	sprintf(name, "nand%d", atomic_inc_return(&nand_stats_nr) - 1);
+	chip->stats_dentry = debugfs_create_file(name, S_IRUGO,
+						 nand_debugfs_root, mtd,
+						 &nand_stats_fops);
+	if (IS_ERR(chip->stats_dentry))
+		chip->stats_dentry = NULL;
+}
+
 /**
  * nand_scan_tail - [NAND Interface] Scan for the NAND device
  * @mtd:	    MTD device structure
@@ -3244,7 +3526,7 @@ int nand_scan_tail(struct mtd_info *mtd)
 	/*
 	 * If no default placement scheme is given, select an appropriate one
 	 */
-	if (!chip->ecc.layout) {
+	if (!chip->ecc.layout && (chip->ecc.mode != NAND_ECC_SOFT_BCH)) {
 		switch (mtd->oobsize) {
 		case 8:
 			chip->ecc.layout = &nand_oob_8;
@@ -3347,6 +3629,40 @@ int nand_scan_tail(struct mtd_info *mtd)
 		chip->ecc.bytes = 3;
 		break;
 
+	case NAND_ECC_SOFT_BCH:
+		if (!mtd_nand_has_bch()) {
+			printk(KERN_WARNING "CONFIG_MTD_NAND_ECC_BCH not enabled\n");
+			BUG();
+		}
+		chip->ecc.calculate = nand_bch_calculate_ecc;
+		chip->ecc.correct = nand_bch_correct_data;
+		chip->ecc.read_page = nand_read_page_swecc;
+		chip->ecc.read_subpage = nand_read_subpage;
+		chip->ecc.write_page = nand_write_page_swecc;
+		chip->ecc.read_page_raw = nand_read_page_raw;
+		chip->ecc.write_page_raw = nand_write_page_raw;
+		chip->ecc.read_oob = nand_read_oob_std;
+		chip->ecc.write_oob = nand_write_oob_std;
+		/*
+		 * Board driver should supply ecc.size and ecc.bytes values to
+		 * select how many bits are correctable; see nand_bch_init()
+		 * for details. Otherwise, default to 4 bits for large page
+		 * devices.
+		 */
+		if (!chip->ecc.size && (mtd->oobsize >= 64)) {
+			chip->ecc.size = 512;
+			chip->ecc.bytes = 7;
+		}
+		chip->ecc.priv = nand_bch_init(mtd,
+					       chip->ecc.size,
+					       chip->ecc.bytes,
+					       &chip->ecc.layout);
+		if (!chip->ecc.priv) {
+			printk(KERN_WARNING "BCH ECC initialization failed!\n");
+			BUG();
+		}
+		break;
+
 	case NAND_ECC_NONE:
 		printk(KERN_WARNING "NAND_ECC_NONE selected by board driver. "
 		       "This is not recommended !!\n");
@@ -3407,8 +3723,28 @@ int nand_scan_tail(struct mtd_info *mtd)
 	}
 	chip->subpagesize = mtd->writesize >> mtd->subpage_sft;
 
+	/*
+	 * The cache commands must reach the chip untouched and without an
+	 * address cycle, which only the generic large page command function
+	 * is known to do. The OOB first read path and read back verification
+	 * interleave other reads with the sequence, so disable it for them.
+	 */
+	if (chip->cmdfunc != nand_command_lp)
+		chip->options &= ~(NAND_CACHEPRG | NAND_CACHERD);
+	if (chip->ecc.mode == NAND_ECC_HW_OOB_FIRST)
+		chip->options &= ~NAND_CACHERD;
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+	chip->options &= ~NAND_CACHEPRG;
+#endif
+	chip->cacheprg_pending = 0;
+	memset(&chip->stats, 0, sizeof(chip->stats));
+	chip->stats_dentry = NULL;
+
 	/* Initialize state */
 	chip->state = FL_READY;
+	spin_lock_init(&chip->io_lock);
+	INIT_LIST_HEAD(&chip->io_queue);
+	INIT_WORK(&chip->io_work, nand_io_work);
 
 	/* De-select the device */
 	chip->select_chip(mtd, -1);
@@ -3425,6 +3761,7 @@ int nand_scan_tail(struct mtd_info *mtd)
 	mtd->unpoint = NULL;
 	mtd->read = nand_read;
 	mtd->write = nand_write;
+	mtd->submit = nand_submit;
 	mtd->panic_write = panic_nand_write;
 	mtd->read_oob = nand_read_oob;
 	mtd->write_oob = nand_write_oob;
@@ -3439,12 +3776,17 @@ int nand_scan_tail(struct mtd_info *mtd)
 	/* propagate ecc.layout to mtd_info */
 	mtd->ecclayout = chip->ecc.layout;
 
-	/* Check, if we should skip the bad block table scan */
-	if (chip->options & NAND_SKIP_BBTSCAN)
-		return 0;
+	/* Build bad block table, unless we should skip the scan */
+	if (!(chip->options & NAND_SKIP_BBTSCAN)) {
+		int ret = chip->scan_bbt(mtd);
+
+		if (ret)
+			return ret;
+	}
 
-	/* Build bad block table */
-	return chip->scan_bbt(mtd);
+	/* Only now the chip is there for good, and nand_release() needed */
+	nand_stats_add(mtd);
+	return 0;
 }
 EXPORT_SYMBOL(nand_scan_tail);
 
@@ -3503,6 +3845,14 @@ void nand_release(struct mtd_info *mtd)
 	/* Deregister the device */
 	del_mtd_device(mtd);
 
+	/* All users are gone, but the worker may still be finishing up */
+	flush_work(&chip->io_work);
+
+	debugfs_remove(chip->stats_dentry);
+
+	if (chip->ecc.mode == NAND_ECC_SOFT_BCH)
+		nand_bch_free((struct nand_bch_control *)chip->ecc.priv);
+
 	/* Free bad block table memory */
 	kfree(chip->bbt);
 	if (!(chip->options & NAND_OWN_BUFFERS))
@@ -3517,6 +3867,16 @@ EXPORT_SYMBOL_GPL(nand_release);
 
 static int __init nand_base_init(void)
 {
+	nand_io_wq = alloc_workqueue("nand_io", WQ_NON_REENTRANT |
+				     WQ_MEM_RECLAIM, 0);
+	if (!nand_io_wq)
+		return -ENOMEM;
+
+	/* Statistics are optional, carry on without them */
+	nand_debugfs_root = debugfs_create_dir("nand", NULL);
+	if (IS_ERR(nand_debugfs_root))
+		nand_debugfs_root = NULL;
+
 	led_trigger_register_simple("nand-disk", &nand_led_trigger);
 	return 0;
 }
@@ -3524,6 +3884,8 @@ static int __init nand_base_init(void)
 static void __exit nand_base_exit(void)
 {
 	led_trigger_unregister_simple(nand_led_trigger);
+	debugfs_remove(nand_debugfs_root);
+	destroy_workqueue(nand_io_wq);
 }
 
 module_init(nand_base_init);
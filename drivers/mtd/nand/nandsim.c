@@ -34,6 +34,7 @@
 #include <linux/string.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
+#include <linux/mtd/nand_bch.h>
 #include <linux/mtd/partitions.h>
 #include <linux/delay.h>
 #include <linux/list.h>
@@ -41,6 +42,7 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/pagemap.h>
+#include <linux/ktime.h>
 
 /* Default simulator parameters values */
 #if !defined(CONFIG_NANDSIM_FIRST_ID_BYTE)  || \
@@ -108,6 +110,8 @@ static unsigned int rptwear = 0;
 static unsigned int overridesize = 0;
 static char *cache_file = NULL;
 static unsigned int bbt;
+static unsigned int cache_ops;
+static unsigned int bch;
 
 module_param(first_id_byte,  uint, 0400);
 module_param(second_id_byte, uint, 0400);
@@ -132,6 +136,8 @@ module_param(rptwear,        uint, 0400);
 module_param(overridesize,   uint, 0400);
 module_param(cache_file,     charp, 0400);
 module_param(bbt,	     uint, 0400);
+module_param(cache_ops,      uint, 0400);
+module_param(bch,            uint, 0400);
 
 MODULE_PARM_DESC(first_id_byte,  "The first byte returned by NAND Flash 'read ID' command (manufacturer ID)");
 MODULE_PARM_DESC(second_id_byte, "The second byte returned by NAND Flash 'read ID' command (chip ID)");
@@ -165,6 +171,9 @@ MODULE_PARM_DESC(overridesize,   "Specifies the NAND Flash size overriding the I
 				 " e.g. 5 means a size of 32 erase blocks");
 MODULE_PARM_DESC(cache_file,     "File to use to cache nand pages instead of memory");
 MODULE_PARM_DESC(bbt,		 "0 OOB, 1 BBT with marker in OOB, 2 BBT with marker in data area");
+MODULE_PARM_DESC(bch,            "Enable BCH ecc and set how many bits should "
+				 "be correctable in 512-byte blocks");
+MODULE_PARM_DESC(cache_ops,      "Support cache read and cache program (large page chips only) if not zero");
 
 /* The largest possible page size */
 #define NS_LARGEST_PAGE_SIZE	4096
@@ -221,6 +230,7 @@ MODULE_PARM_DESC(bbt,		 "0 OOB, 1 BBT with marker in OOB, 2 BBT with marker in d
 #define STATE_CMD_RESET        0x0000000C /* reset */
 #define STATE_CMD_RNDOUT       0x0000000D /* random output command */
 #define STATE_CMD_RNDOUTSTART  0x0000000E /* random output start command */
+#define STATE_CMD_READCACHE    0x0000000F /* cache read (sequential or end) command */
 #define STATE_CMD_MASK         0x0000000F /* command states mask */
 
 /* After an address is input, the simulator goes to one of these states */
@@ -253,9 +263,10 @@ MODULE_PARM_DESC(bbt,		 "0 OOB, 1 BBT with marker in OOB, 2 BBT with marker in d
 #define ACTION_ZEROOFF   0x00400000 /* don't add any offset to address */
 #define ACTION_HALFOFF   0x00500000 /* add to address half of page */
 #define ACTION_OOBOFF    0x00600000 /* add to address OOB offset */
+#define ACTION_CACHECPY  0x00700000 /* copy the loaded page to the internal buffer */
 #define ACTION_MASK      0x00700000 /* action mask */
 
-#define NS_OPER_NUM      13 /* Number of operations supported by the simulator */
+#define NS_OPER_NUM      14 /* Number of operations supported by the simulator */
 #define NS_OPER_STATES   6  /* Maximum number of states in operation */
 
 #define OPT_ANY          0xFFFFFFFF /* any chip supports this operation */
@@ -361,6 +372,10 @@ struct nandsim {
 	void *file_buf;
 	struct page *held_pages[NS_MAX_HELD_PAGES];
 	int held_cnt;
+
+	/* Cache operations */
+	int cache_row;          /* page loaded to the data register, or -1 */
+	ktime_t busy_until;     /* the array is busy in the background till then */
 };
 
 /*
@@ -406,6 +421,8 @@ static struct nandsim_operations {
 	/* Large page devices random page read */
 	{OPT_LARGEPAGE, {STATE_CMD_RNDOUT, STATE_ADDR_COLUMN, STATE_CMD_RNDOUTSTART | ACTION_CPY,
 			       STATE_DATAOUT, STATE_READY}},
+	/* Large page devices cache read of the next page */
+	{OPT_LARGEPAGE, {STATE_CMD_READCACHE | ACTION_CACHECPY, STATE_DATAOUT, STATE_READY}},
 };
 
 struct weak_block {
@@ -1030,6 +1047,8 @@ static char *get_state_name(uint32_t state)
 			return "STATE_CMD_RNDOUT";
 		case STATE_CMD_RNDOUTSTART:
 			return "STATE_CMD_RNDOUTSTART";
+		case STATE_CMD_READCACHE:
+			return "STATE_CMD_READCACHE";
 		case STATE_ADDR_PAGE:
 			return "STATE_ADDR_PAGE";
 		case STATE_ADDR_SEC:
@@ -1080,6 +1099,9 @@ static int check_command(int cmd)
 	case NAND_CMD_RESET:
 	case NAND_CMD_RNDOUT:
 	case NAND_CMD_RNDOUTSTART:
+	case NAND_CMD_CACHEDPROG:
+	case NAND_CMD_READCACHESEQ:
+	case NAND_CMD_READCACHEEND:
 		return 0;
 
 	case NAND_CMD_STATUS_MULTI:
@@ -1099,6 +1121,7 @@ static uint32_t get_state_by_command(unsigned command)
 		case NAND_CMD_READ1:
 			return STATE_CMD_READ1;
 		case NAND_CMD_PAGEPROG:
+		case NAND_CMD_CACHEDPROG:
 			return STATE_CMD_PAGEPROG;
 		case NAND_CMD_READSTART:
 			return STATE_CMD_READSTART;
@@ -1122,6 +1145,9 @@ static uint32_t get_state_by_command(unsigned command)
 			return STATE_CMD_RNDOUT;
 		case NAND_CMD_RNDOUTSTART:
 			return STATE_CMD_RNDOUTSTART;
+		case NAND_CMD_READCACHESEQ:
+		case NAND_CMD_READCACHEEND:
+			return STATE_CMD_READCACHE;
 	}
 
 	NS_ERR("get_state_by_command: unknown command, BUG\n");
@@ -1577,6 +1603,27 @@ static int prog_page(struct nandsim *ns, int num)
 	return 0;
 }
 
+/*
+ * Wait for the page being loaded or programmed in the background by a cache
+ * operation.
+ */
+static void ns_wait_array(struct nandsim *ns)
+{
+	s64 left = ktime_us_delta(ns->busy_until, ktime_get());
+
+	if (left > 0)
+		NS_UDELAY(left);
+}
+
+/*
+ * Start a background array operation of the given duration (microseconds).
+ */
+static void ns_set_busy(struct nandsim *ns, uint us)
+{
+	if (do_delays)
+		ns->busy_until = ktime_add_us(ktime_get(), us);
+}
+
 /*
  * If state has any action bit, perform this action.
  *
@@ -1608,8 +1655,11 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 			NS_ERR("do_state_action: column number is too large\n");
 			break;
 		}
+		ns_wait_array(ns);
 		num = ns->geom.pgszoob - ns->regs.off - ns->regs.column;
 		read_page(ns, num);
+		if (ns->regs.command == NAND_CMD_READSTART)
+			ns->cache_row = ns->regs.row;
 
 		NS_DBG("do_state_action: (ACTION_CPY:) copy %d bytes to int buf, raw offset %d\n",
 			num, NS_RAW_OFFSET(ns) + ns->regs.off);
@@ -1626,6 +1676,39 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 
 		break;
 
+	case ACTION_CACHECPY:
+		/*
+		 * Move the page in the data register to the internal buffer
+		 * and, for the sequential command, start loading the next one.
+		 */
+
+		if (ns->cache_row < 0) {
+			NS_ERR("do_state_action: cache read, but no page was loaded\n");
+			return -1;
+		}
+
+		ns_wait_array(ns);
+		ns->regs.row = ns->cache_row;
+		ns->regs.column = 0;
+		ns->regs.off = 0;
+		num = ns->geom.pgszoob;
+		read_page(ns, num);
+
+		NS_DBG("do_state_action: (ACTION_CACHECPY:) copy %d bytes to int buf, raw offset %d\n",
+			num, NS_RAW_OFFSET(ns));
+		NS_LOG("cache read page %d\n", ns->regs.row);
+
+		if (ns->regs.command == NAND_CMD_READCACHESEQ &&
+		    ns->cache_row + 1 < ns->geom.pgnum) {
+			ns->cache_row += 1;
+			ns_set_busy(ns, access_delay);
+		} else
+			ns->cache_row = -1;
+
+		NS_UDELAY(input_cycle * ns->geom.pgsz / 1000 / busdiv);
+
+		break;
+
 	case ACTION_SECERASE:
 		/*
 		 * Erase sector.
@@ -1645,6 +1728,8 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 		ns->regs.row = (ns->regs.row <<
 				8 * (ns->geom.pgaddrbytes - ns->geom.secaddrbytes)) | ns->regs.column;
 		ns->regs.column = 0;
+		ns->cache_row = -1;
+		ns_wait_array(ns);
 
 		erase_block_no = ns->regs.row >> (ns->geom.secshift - ns->geom.pgshift);
 
@@ -1683,6 +1768,10 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 			return -1;
 		}
 
+		/* The previous page of a cache program must be done first */
+		ns_wait_array(ns);
+		ns->cache_row = -1;
+
 		if (prog_page(ns, num) == -1)
 			return -1;
 
@@ -1692,7 +1781,11 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 			num, ns->regs.row, ns->regs.column, NS_RAW_OFFSET(ns) + ns->regs.off);
 		NS_LOG("programm page %d\n", ns->regs.row);
 
-		NS_UDELAY(programm_delay);
+		/* Cache program returns as soon as the data register is free */
+		if (ns->regs.command == NAND_CMD_CACHEDPROG)
+			ns_set_busy(ns, programm_delay);
+		else
+			NS_UDELAY(programm_delay);
 		NS_UDELAY(output_cycle * ns->geom.pgsz / 1000 / busdiv);
 
 		if (write_error(page_no)) {
@@ -1900,8 +1993,12 @@ static u_char ns_nand_read_byte(struct mtd_info *mtd)
 
 	/* Status register may be read as many times as it is wanted */
 	if (NS_STATE(ns->state) == STATE_DATAOUT_STATUS) {
-		NS_DBG("read_byte: return %#x status\n", ns->regs.status);
-		return ns->regs.status;
+		outb = ns->regs.status;
+		/* True ready is clear while a cache operation is running */
+		if (ktime_us_delta(ns->busy_until, ktime_get()) <= 0)
+			outb |= NAND_STATUS_TRUE_READY;
+		NS_DBG("read_byte: return %#x status\n", (uint)outb);
+		return outb;
 	}
 
 	/* Check if there is any data in the internal buffer which may be read */
@@ -1972,6 +2069,7 @@ static void ns_nand_write_byte(struct mtd_info *mtd, u_char byte)
 
 		if (byte == NAND_CMD_RESET) {
 			NS_LOG("reset chip\n");
+			ns->cache_row = -1;
 			switch_to_ready_state(ns, NS_STATUS_OK(ns));
 			return;
 		}
@@ -1982,6 +2080,11 @@ static void ns_nand_write_byte(struct mtd_info *mtd, u_char byte)
 			return;
 		}
 
+		/* The page loaded by a read need not be output before a cache read */
+		if ((byte == NAND_CMD_READCACHESEQ || byte == NAND_CMD_READCACHEEND)
+			&& NS_STATE(ns->state) == STATE_DATAOUT)
+			switch_to_ready_state(ns, NS_STATUS_OK(ns));
+
 		if (NS_STATE(ns->state) == STATE_DATAOUT_STATUS
 			|| NS_STATE(ns->state) == STATE_DATAOUT_STATUS_M
 			|| NS_STATE(ns->state) == STATE_DATAOUT) {
@@ -2289,6 +2392,7 @@ static int __init ns_init_module(void)
 		nand->geom.idbytes = 2;
 	nand->regs.status = NS_STATUS_OK(nand);
 	nand->nxstate = STATE_UNKNOWN;
+	nand->cache_row = -1;
 	nand->options |= OPT_PAGE256; /* temporary value */
 	nand->ids[0] = first_id_byte;
 	nand->ids[1] = second_id_byte;
@@ -2310,7 +2414,52 @@ static int __init ns_init_module(void)
 	if ((retval = parse_gravepages()) != 0)
 		goto error;
 
-	if ((retval = nand_scan(nsmtd, 1)) != 0) {
+	/*
+	 * Cache operations and BCH ecc are set up between the two scan
+	 * phases: they depend on the geometry, and the identification resets
+	 * the chip options from the ID table.
+	 */
+	retval = nand_scan_ident(nsmtd, 1, NULL);
+	if (retval) {
+		NS_ERR("cannot scan NAND Simulator device\n");
+		if (retval > 0)
+			retval = -ENXIO;
+		goto error;
+	}
+
+	if (bch) {
+		unsigned int eccsteps, eccbytes;
+		if (!mtd_nand_has_bch()) {
+			NS_ERR("BCH ECC support is disabled\n");
+			retval = -EINVAL;
+			goto error;
+		}
+		/* use 512-byte ecc blocks */
+		eccsteps = nsmtd->writesize/512;
+		eccbytes = (bch*13+7)/8;
+		/* do not bother supporting small page devices */
+		if ((nsmtd->oobsize < 64) || !eccsteps) {
+			NS_ERR("bch not available on small page devices\n");
+			retval = -EINVAL;
+			goto error;
+		}
+		if ((eccbytes*eccsteps+2) > nsmtd->oobsize) {
+			NS_ERR("invalid bch value %u\n", bch);
+			retval = -EINVAL;
+			goto error;
+		}
+		chip->ecc.mode = NAND_ECC_SOFT_BCH;
+		chip->ecc.size = 512;
+		chip->ecc.bytes = eccbytes;
+		NS_INFO("using %u-bit/%u bytes BCH ECC\n", bch, chip->ecc.size);
+	}
+
+	if (cache_ops)
+		chip->options |= NAND_CACHEPRG | NAND_CACHERD |
+				 NAND_USE_CACHEPRG;
+
+	retval = nand_scan_tail(nsmtd);
+	if (retval) {
 		NS_ERR("can't register NAND Simulator\n");
 		if (retval > 0)
 			retval = -ENXIO;
@@ -0,0 +1,538 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; see the file COPYING. If not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Test the asynchronous MTD request interface and compare its throughput
+ * with the synchronous one.
+ *
+ * The interesting case is reading one page from every eraseblock, which is
+ * what UBI does when attaching.  With nandsim, use the access_delay,
+ * programm_delay and do_delays parameters to model the flash latencies.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/err.h>
+#include <linux/mtd/mtd.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/completion.h>
+
+#define PRINT_PREF KERN_INFO "mtd_asynctest: "
+
+static int dev;
+module_param(dev, int, S_IRUGO);
+MODULE_PARM_DESC(dev, "MTD device number to use");
+
+static int batch = 16;
+module_param(batch, int, S_IRUGO);
+MODULE_PARM_DESC(batch, "Number of segments per asynchronous request");
+
+static struct mtd_info *mtd;
+static unsigned char *iobuf;
+static unsigned char *bbt;
+
+static int pgsize;
+static int ebcnt;
+static int pgcnt;
+static int goodebcnt;
+static struct timeval start, finish;
+static unsigned long next = 1;
+
+/*
+ * Two requests are kept in flight: one is being served by the MTD device
+ * while the data of the other one are checked.
+ */
+struct async_slot {
+	struct mtd_io_req req;
+	struct mtd_io_vec *vec;
+	unsigned char *buf;
+	struct completion done;
+	int busy;
+};
+
+static struct async_slot slots[2];
+
+static inline unsigned int simple_rand(void)
+{
+	next = next * 1103515245 + 12345;
+	return (unsigned int)((next / 65536) % 32768);
+}
+
+static inline void simple_srand(unsigned long seed)
+{
+	next = seed;
+}
+
+static void set_random_data(unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = simple_rand();
+}
+
+static int erase_eraseblock(int ebnum)
+{
+	int err;
+	struct erase_info ei;
+	loff_t addr = ebnum * mtd->erasesize;
+
+	memset(&ei, 0, sizeof(struct erase_info));
+	ei.mtd  = mtd;
+	ei.addr = addr;
+	ei.len  = mtd->erasesize;
+
+	err = mtd->erase(mtd, &ei);
+	if (err) {
+		printk(PRINT_PREF "error %d while erasing EB %d\n", err, ebnum);
+		return err;
+	}
+
+	if (ei.state == MTD_ERASE_FAILED) {
+		printk(PRINT_PREF "some erase error occurred at EB %d\n",
+		       ebnum);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int erase_whole_device(void)
+{
+	int err;
+	unsigned int i;
+
+	for (i = 0; i < ebcnt; ++i) {
+		if (bbt[i])
+			continue;
+		err = erase_eraseblock(i);
+		if (err)
+			return err;
+		cond_resched();
+	}
+	return 0;
+}
+
+static int is_block_bad(int ebnum)
+{
+	loff_t addr = ebnum * mtd->erasesize;
+	int ret;
+
+	ret = mtd->block_isbad(mtd, addr);
+	if (ret)
+		printk(PRINT_PREF "block %d is bad\n", ebnum);
+	return ret;
+}
+
+static int scan_for_bad_eraseblocks(void)
+{
+	int i, bad = 0;
+
+	bbt = kzalloc(ebcnt, GFP_KERNEL);
+	if (!bbt) {
+		printk(PRINT_PREF "error: cannot allocate memory\n");
+		return -ENOMEM;
+	}
+
+	/* NOR flash does not implement block_isbad */
+	if (mtd->block_isbad == NULL)
+		goto out;
+
+	printk(PRINT_PREF "scanning for bad eraseblocks\n");
+	for (i = 0; i < ebcnt; ++i) {
+		bbt[i] = is_block_bad(i) ? 1 : 0;
+		if (bbt[i])
+			bad += 1;
+		cond_resched();
+	}
+	printk(PRINT_PREF "scanned %d eraseblocks, %d are bad\n", i, bad);
+out:
+	goodebcnt = ebcnt - bad;
+	return 0;
+}
+
+static inline void start_timing(void)
+{
+	do_gettimeofday(&start);
+}
+
+static inline void stop_timing(void)
+{
+	do_gettimeofday(&finish);
+}
+
+static long calc_speed(long k)
+{
+	long ms;
+
+	ms = (finish.tv_sec - start.tv_sec) * 1000 +
+	     (finish.tv_usec - start.tv_usec) / 1000;
+	if (!ms)
+		ms = 1;
+	return (k * 1000) / ms;
+}
+
+static int check_data(const unsigned char *buf, loff_t addr, size_t len)
+{
+	size_t ofs = mtd_mod_by_eb(addr, mtd);
+
+	if (memcmp(buf, iobuf + ofs, len)) {
+		printk(PRINT_PREF "error: verify failed at %#llx\n", addr);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int write_whole_device(void)
+{
+	size_t written;
+	int i, err;
+
+	for (i = 0; i < ebcnt; ++i) {
+		loff_t addr = (loff_t)i * mtd->erasesize;
+
+		if (bbt[i])
+			continue;
+		err = mtd->write(mtd, addr, mtd->erasesize, &written, iobuf);
+		if (err || written != mtd->erasesize) {
+			printk(PRINT_PREF "error: write failed at %#llx\n",
+			       addr);
+			return err ? err : -EINVAL;
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+/* Read the first page of every eraseblock, one page at a time */
+static int sync_read_first_pages(void)
+{
+	size_t read;
+	int i, err;
+
+	for (i = 0; i < ebcnt; ++i) {
+		loff_t addr = (loff_t)i * mtd->erasesize;
+
+		if (bbt[i])
+			continue;
+		err = mtd->read(mtd, addr, pgsize, &read, slots[0].buf);
+		if (err == -EUCLEAN)
+			err = 0;
+		if (err || read != pgsize) {
+			printk(PRINT_PREF "error: read failed at %#llx\n",
+			       addr);
+			return err ? err : -EINVAL;
+		}
+		err = check_data(slots[0].buf, addr, pgsize);
+		if (err)
+			return err;
+		cond_resched();
+	}
+	return 0;
+}
+
+static void async_done(struct mtd_io_req *req)
+{
+	struct async_slot *slot = req->priv;
+
+	complete(&slot->done);
+}
+
+/* Wait for the request in @slot and check what it read */
+static int async_finish(struct async_slot *slot)
+{
+	int i, err;
+
+	if (!slot->busy)
+		return 0;
+	wait_for_completion(&slot->done);
+	slot->busy = 0;
+
+	err = slot->req.error;
+	if (err == -EUCLEAN)
+		err = 0;
+	if (err) {
+		printk(PRINT_PREF "error %d: async request failed\n", err);
+		return err;
+	}
+
+	for (i = 0; i < slot->req.nr_vec; i++) {
+		struct mtd_io_vec *vec = &slot->vec[i];
+
+		if (vec->retlen != vec->len) {
+			printk(PRINT_PREF "error: short transfer at %#llx\n",
+			       vec->ofs);
+			return -EINVAL;
+		}
+		if (slot->req.dir != MTD_IO_READ)
+			continue;
+		err = check_data(vec->buf, vec->ofs, vec->len);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int async_submit(struct async_slot *slot, int dir, int nr_vec)
+{
+	int err;
+
+	slot->req.dir = dir;
+	slot->req.vec = slot->vec;
+	slot->req.nr_vec = nr_vec;
+	slot->req.complete = async_done;
+	slot->req.priv = slot;
+	init_completion(&slot->done);
+
+	err = mtd_submit(mtd, &slot->req);
+	if (err) {
+		printk(PRINT_PREF "error %d: cannot submit request\n", err);
+		return err;
+	}
+	slot->busy = 1;
+	return 0;
+}
+
+/* Read the first page of every eraseblock, @batch pages per request */
+static int async_read_first_pages(void)
+{
+	int i = 0, cur = 0, n, err = 0;
+
+	while (i < ebcnt) {
+		struct async_slot *slot = &slots[cur];
+
+		for (n = 0; n < batch && i < ebcnt; i++) {
+			if (bbt[i])
+				continue;
+			slot->vec[n].ofs = (loff_t)i * mtd->erasesize;
+			slot->vec[n].len = pgsize;
+			slot->vec[n].buf = slot->buf + n * pgsize;
+			n += 1;
+		}
+		if (!n)
+			break;
+
+		err = async_submit(slot, MTD_IO_READ, n);
+		if (err)
+			goto out;
+
+		/* Check the other request while this one is served */
+		cur = !cur;
+		err = async_finish(&slots[cur]);
+		if (err)
+			goto out;
+		cond_resched();
+	}
+
+out:
+	/* Never leave a request in flight */
+	if (async_finish(&slots[0]) && !err)
+		err = -EIO;
+	if (async_finish(&slots[1]) && !err)
+		err = -EIO;
+	return err;
+}
+
+/* Write or read the whole device, one page per segment */
+static int async_whole_device(int dir)
+{
+	int i, j, cur = 0, n, err = 0;
+
+	for (i = 0; i < ebcnt; ++i) {
+		loff_t addr = (loff_t)i * mtd->erasesize;
+
+		if (bbt[i])
+			continue;
+
+		for (j = 0; j < pgcnt; j += n) {
+			struct async_slot *slot = &slots[cur];
+			unsigned char *buf;
+
+			for (n = 0; n < batch && j + n < pgcnt; n++) {
+				buf = iobuf + (j + n) * pgsize;
+				if (dir == MTD_IO_READ)
+					buf = slot->buf + n * pgsize;
+				slot->vec[n].ofs = addr + (j + n) * pgsize;
+				slot->vec[n].len = pgsize;
+				slot->vec[n].buf = buf;
+			}
+
+			err = async_submit(slot, dir, n);
+			if (err)
+				goto out;
+			cur = !cur;
+			err = async_finish(&slots[cur]);
+			if (err)
+				goto out;
+		}
+		cond_resched();
+	}
+
+out:
+	if (async_finish(&slots[0]) && !err)
+		err = -EIO;
+	if (async_finish(&slots[1]) && !err)
+		err = -EIO;
+	return err;
+}
+
+static int __init mtd_asynctest_init(void)
+{
+	int err, i;
+	long speed;
+	uint64_t tmp;
+
+	printk(KERN_INFO "\n");
+	printk(KERN_INFO "=================================================\n");
+	printk(PRINT_PREF "MTD device: %d\n", dev);
+
+	if (batch < 1) {
+		printk(PRINT_PREF "error: batch must be positive\n");
+		return -EINVAL;
+	}
+
+	mtd = get_mtd_device(NULL, dev);
+	if (IS_ERR(mtd)) {
+		err = PTR_ERR(mtd);
+		printk(PRINT_PREF "error: cannot get MTD device\n");
+		return err;
+	}
+
+	if (mtd->writesize == 1) {
+		printk(PRINT_PREF "not NAND flash, assume page size is 512 "
+		       "bytes.\n");
+		pgsize = 512;
+	} else
+		pgsize = mtd->writesize;
+
+	tmp = mtd->size;
+	do_div(tmp, mtd->erasesize);
+	ebcnt = tmp;
+	pgcnt = mtd->erasesize / pgsize;
+
+	printk(PRINT_PREF "MTD device size %llu, eraseblock size %u, "
+	       "page size %u, count of eraseblocks %u, pages per "
+	       "eraseblock %u, %s, %d segments per request\n",
+	       (unsigned long long)mtd->size, mtd->erasesize,
+	       pgsize, ebcnt, pgcnt,
+	       mtd->submit ? "asynchronous" : "synchronous fallback", batch);
+
+	err = -ENOMEM;
+	iobuf = kmalloc(mtd->erasesize, GFP_KERNEL);
+	if (!iobuf)
+		goto out_nomem;
+	for (i = 0; i < 2; i++) {
+		slots[i].vec = kcalloc(batch, sizeof(struct mtd_io_vec),
+				       GFP_KERNEL);
+		slots[i].buf = vmalloc(batch * pgsize);
+		if (!slots[i].vec || !slots[i].buf)
+			goto out_nomem;
+	}
+
+	simple_srand(1);
+	set_random_data(iobuf, mtd->erasesize);
+
+	err = scan_for_bad_eraseblocks();
+	if (err)
+		goto out;
+
+	err = erase_whole_device();
+	if (err)
+		goto out;
+	err = write_whole_device();
+	if (err)
+		goto out;
+
+	/* Read the first page of each eraseblock, like UBI scanning does */
+	printk(PRINT_PREF "testing synchronous first page read speed\n");
+	start_timing();
+	err = sync_read_first_pages();
+	if (err)
+		goto out;
+	stop_timing();
+	speed = calc_speed(goodebcnt * (long)pgsize / 1024);
+	printk(PRINT_PREF "synchronous first page read speed is %ld KiB/s\n",
+	       speed);
+
+	printk(PRINT_PREF "testing asynchronous first page read speed\n");
+	start_timing();
+	err = async_read_first_pages();
+	if (err)
+		goto out;
+	stop_timing();
+	speed = calc_speed(goodebcnt * (long)pgsize / 1024);
+	printk(PRINT_PREF "asynchronous first page read speed is %ld KiB/s\n",
+	       speed);
+
+	/* Read the whole device */
+	printk(PRINT_PREF "testing asynchronous page read speed\n");
+	start_timing();
+	err = async_whole_device(MTD_IO_READ);
+	if (err)
+		goto out;
+	stop_timing();
+	speed = calc_speed(goodebcnt * (long)(mtd->erasesize / 1024));
+	printk(PRINT_PREF "asynchronous page read speed is %ld KiB/s\n",
+	       speed);
+
+	/* Write the whole device and verify it */
+	err = erase_whole_device();
+	if (err)
+		goto out;
+
+	printk(PRINT_PREF "testing asynchronous page write speed\n");
+	start_timing();
+	err = async_whole_device(MTD_IO_WRITE);
+	if (err)
+		goto out;
+	stop_timing();
+	speed = calc_speed(goodebcnt * (long)(mtd->erasesize / 1024));
+	printk(PRINT_PREF "asynchronous page write speed is %ld KiB/s\n",
+	       speed);
+
+	printk(PRINT_PREF "verifying asynchronously written data\n");
+	err = async_whole_device(MTD_IO_READ);
+	if (err)
+		goto out;
+
+	printk(PRINT_PREF "finished\n");
+	goto out;
+
+out_nomem:
+	printk(PRINT_PREF "error: cannot allocate memory\n");
+out:
+	for (i = 0; i < 2; i++) {
+		vfree(slots[i].buf);
+		kfree(slots[i].vec);
+	}
+	kfree(iobuf);
+	kfree(bbt);
+	put_mtd_device(mtd);
+	if (err)
+		printk(PRINT_PREF "error %d occurred\n", err);
+	printk(KERN_INFO "=================================================\n");
+	return err;
+}
+module_init(mtd_asynctest_init);
+
+static void __exit mtd_asynctest_exit(void)
+{
+	return;
+}
+module_exit(mtd_asynctest_exit);
+
+MODULE_DESCRIPTION("Asynchronous MTD request test module");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,271 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; see the file COPYING. If not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Test JFFS2 read and write speed as the number of concurrent threads grows.
+ *
+ * Each thread writes, syncs and reads back its own file in the given
+ * directory, which should be on a mounted JFFS2 file system. The page cache
+ * of the files is dropped before they are read, so that reading decompresses
+ * the data. Half of every 64 bytes written is random, so that the data
+ * compresses, but not too well. The files are truncated to zero at the end.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+#include <linux/uaccess.h>
+
+#define PRINT_PREF KERN_INFO "mtd_jffs2speedtest: "
+
+#define MAX_THREADS 32
+
+static char *dir;
+module_param(dir, charp, S_IRUGO);
+MODULE_PARM_DESC(dir, "directory on a mounted JFFS2 file system to use");
+
+static int threads = 4;
+module_param(threads, int, S_IRUGO);
+MODULE_PARM_DESC(threads, "maximum number of threads (default 4, max. 32)");
+
+static int size = 1024;
+module_param(size, int, S_IRUGO);
+MODULE_PARM_DESC(size, "KiB written and read by each thread (default 1024)");
+
+struct speed_thread {
+	int num;
+	int write;
+	int err;
+	struct completion done;
+};
+
+static struct speed_thread thr[MAX_THREADS];
+
+static struct file *open_file(int num, int flags)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/jffs2_speedtest.%d", dir, num);
+	return filp_open(path, flags, 0600);
+}
+
+static void set_test_data(unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += 4) {
+		if (i % 64 < 32)
+			*(u32 *)(buf + i) = random32();
+		else
+			*(u32 *)(buf + i) = 0x6a666673;
+	}
+}
+
+static int write_file(struct file *file, unsigned char *buf)
+{
+	loff_t pos = 0;
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < size * 1024 / PAGE_SIZE; i++) {
+		set_test_data(buf, PAGE_SIZE);
+		ret = vfs_write(file, (const char __user *)buf, PAGE_SIZE,
+				&pos);
+		if (ret != PAGE_SIZE)
+			return ret < 0 ? ret : -EIO;
+		cond_resched();
+	}
+
+	return vfs_fsync(file, 0);
+}
+
+static int read_file(struct file *file, unsigned char *buf)
+{
+	loff_t pos = 0;
+	ssize_t ret;
+
+	do {
+		ret = vfs_read(file, (char __user *)buf, PAGE_SIZE, &pos);
+		cond_resched();
+	} while (ret > 0);
+
+	if (ret < 0)
+		return ret;
+	if (pos != size * 1024)
+		return -EIO;
+	return 0;
+}
+
+static int speed_thread_fn(void *arg)
+{
+	struct speed_thread *t = arg;
+	struct file *file;
+	unsigned char *buf;
+	mm_segment_t old_fs;
+
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf) {
+		t->err = -ENOMEM;
+		goto out;
+	}
+
+	if (t->write)
+		file = open_file(t->num, O_WRONLY | O_CREAT | O_TRUNC);
+	else
+		file = open_file(t->num, O_RDONLY);
+	if (IS_ERR(file)) {
+		t->err = PTR_ERR(file);
+		goto out_free;
+	}
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	if (t->write)
+		t->err = write_file(file, buf);
+	else
+		t->err = read_file(file, buf);
+	set_fs(old_fs);
+
+	filp_close(file, NULL);
+out_free:
+	kfree(buf);
+out:
+	complete_and_exit(&t->done, 0);
+}
+
+static int drop_cache(int num)
+{
+	struct file *file;
+
+	file = open_file(num, O_RDONLY);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	invalidate_mapping_pages(file->f_mapping, 0, -1);
+	filp_close(file, NULL);
+	return 0;
+}
+
+static int run_threads(int n, int write, long *speed)
+{
+	struct task_struct *task;
+	ktime_t start;
+	s64 us;
+	int i, err = 0;
+
+	for (i = 0; i < n && !write; i++) {
+		err = drop_cache(i);
+		if (err)
+			return err;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		thr[i].num = i;
+		thr[i].write = write;
+		thr[i].err = 0;
+		init_completion(&thr[i].done);
+		task = kthread_run(speed_thread_fn, &thr[i], "jffs2speed%d", i);
+		if (IS_ERR(task)) {
+			printk(PRINT_PREF "error: cannot start thread %d\n", i);
+			thr[i].err = PTR_ERR(task);
+			complete(&thr[i].done);
+		}
+	}
+	for (i = 0; i < n; i++)
+		wait_for_completion(&thr[i].done);
+	us = ktime_us_delta(ktime_get(), start);
+
+	for (i = 0; i < n; i++)
+		if (thr[i].err) {
+			printk(PRINT_PREF "error %d in thread %d\n",
+			       thr[i].err, i);
+			err = thr[i].err;
+		}
+	if (err)
+		return err;
+
+	*speed = div64_s64((s64)n * size * 1000000, us ? us : 1);
+	return 0;
+}
+
+static void truncate_files(int n)
+{
+	struct file *file;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		file = open_file(i, O_WRONLY | O_TRUNC);
+		if (!IS_ERR(file))
+			filp_close(file, NULL);
+	}
+}
+
+static int __init mtd_jffs2speedtest_init(void)
+{
+	int n, err = 0;
+	long wspeed, rspeed;
+
+	printk(KERN_INFO "\n");
+	printk(KERN_INFO "=================================================\n");
+
+	if (!dir) {
+		printk(PRINT_PREF "error: use dir=<directory on JFFS2>\n");
+		return -EINVAL;
+	}
+	if (threads < 1 || threads > MAX_THREADS ||
+	    size < 1 || size % (PAGE_SIZE / 1024)) {
+		printk(PRINT_PREF "error: bad threads or size parameter\n");
+		return -EINVAL;
+	}
+
+	printk(PRINT_PREF "testing in %s, %d KiB per thread, up to %d "
+	       "threads\n", dir, size, threads);
+
+	for (n = 1; ; n = min(n * 2, threads)) {
+		err = run_threads(n, 1, &wspeed);
+		if (err)
+			break;
+		err = run_threads(n, 0, &rspeed);
+		if (err)
+			break;
+		printk(PRINT_PREF "%2d threads: write %ld KiB/s, read %ld "
+		       "KiB/s\n", n, wspeed, rspeed);
+		if (n == threads)
+			break;
+	}
+
+	truncate_files(threads);
+	if (err)
+		printk(PRINT_PREF "error %d occurred\n", err);
+	else
+		printk(PRINT_PREF "finished\n");
+	printk(KERN_INFO "=================================================\n");
+	return err;
+}
+module_init(mtd_jffs2speedtest_init);
+
+static void __exit mtd_jffs2speedtest_exit(void)
+{
+	return;
+}
+module_exit(mtd_jffs2speedtest_exit);
+
+MODULE_DESCRIPTION("JFFS2 concurrent read/write speed test module");
+MODULE_LICENSE("GPL");
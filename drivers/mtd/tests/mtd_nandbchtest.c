@@ -0,0 +1,244 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; see the file COPYING. If not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Test the BCH library used by the NAND_ECC_SOFT_BCH mode: check that random
+ * patterns of up to t bit errors are corrected, count how many patterns of
+ * t+1 errors are detected, and report encoding and decoding throughput.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/bch.h>
+
+#define PRINT_PREF KERN_INFO "mtd_nandbchtest: "
+
+/* Random error patterns tried for each number of errors */
+#define TRIALS		200
+/* Blocks processed for each throughput figure */
+#define BENCH_BLOCKS	4000
+/* Largest t in the table below, plus one */
+#define MAX_ERRORS	17
+
+#if defined(CONFIG_BCH) || defined(CONFIG_BCH_MODULE)
+
+static const struct bch_test {
+	int m;
+	int t;
+	unsigned int len;
+} tests[] = {
+	{ 13,  4,  512 },	/* default NAND_ECC_SOFT_BCH setup */
+	{ 13,  8,  512 },
+	{ 14,  8, 1024 },
+	{ 14, 16, 1024 },
+};
+
+static uint8_t *data, *error_data;
+static uint8_t ecc[64], error_ecc[64];
+static unsigned int errloc[MAX_ERRORS];
+
+/*
+ * Flip nerr distinct bits of the codeword formed by data and ecc. The bit
+ * numbering is the one of the error locations returned by decode_bch().
+ */
+static void inject_errors(struct bch_control *bch, unsigned int len, int nerr)
+{
+	unsigned int nbits = 8 * len + bch->ecc_bits;
+	unsigned int pos[MAX_ERRORS];
+	int i, j;
+
+	for (i = 0; i < nerr; i++) {
+		do {
+			/* Pick a codeword bit, MSB first, and renumber it */
+			pos[i] = random32() % nbits;
+			pos[i] = (pos[i] & ~7) | (7 - (pos[i] & 7));
+			for (j = 0; j < i; j++)
+				if (pos[j] == pos[i])
+					break;
+		} while (j < i);
+
+		if (pos[i] < 8 * len)
+			error_data[pos[i] / 8] ^= 1 << (pos[i] % 8);
+		else
+			error_ecc[(pos[i] - 8 * len) / 8] ^=
+				1 << ((pos[i] - 8 * len) % 8);
+	}
+}
+
+static int correct(struct bch_control *bch, unsigned int len)
+{
+	int i, count;
+
+	count = decode_bch(bch, error_data, len, error_ecc, NULL, NULL, errloc);
+	for (i = 0; i < count; i++)
+		if (errloc[i] < 8 * len)
+			error_data[errloc[i] / 8] ^= 1 << (errloc[i] % 8);
+	return count;
+}
+
+static int bch_correction_test(struct bch_control *bch, unsigned int len)
+{
+	int nerr, trial, count, detected = 0;
+
+	for (nerr = 0; nerr <= bch->t + 1; nerr++) {
+		for (trial = 0; trial < TRIALS; trial++) {
+			get_random_bytes(data, len);
+			memset(ecc, 0, sizeof(ecc));
+			encode_bch(bch, data, len, ecc);
+
+			memcpy(error_data, data, len);
+			memcpy(error_ecc, ecc, bch->ecc_bytes);
+			inject_errors(bch, len, nerr);
+
+			count = correct(bch, len);
+
+			/* Beyond t errors, failing to decode is all we hope */
+			if (nerr > bch->t) {
+				if (count < 0)
+					detected++;
+				continue;
+			}
+
+			if (count != nerr || memcmp(data, error_data, len)) {
+				printk(KERN_ERR "mtd_nandbchtest: not ok - "
+				       "%d errors, decode returned %d\n",
+				       nerr, count);
+				print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET,
+					       16, 4, error_data, len, false);
+				return -EINVAL;
+			}
+		}
+		cond_resched();
+	}
+
+	printk(PRINT_PREF "ok - corrected up to %d errors, %d/%d patterns "
+	       "of %d errors detected\n", bch->t, detected, TRIALS,
+	       bch->t + 1);
+	return 0;
+}
+
+/* Print throughput in KiB/s and time per KiB for blocks of len bytes */
+static void report(const char *what, unsigned int len, s64 ns)
+{
+	u64 kib = (u64)BENCH_BLOCKS * len / 1024;
+
+	if (ns <= 0)
+		ns = 1;
+	printk(PRINT_PREF "%-24s %8llu KiB/s, %6llu ns/KiB\n", what,
+	       div64_u64(kib * NSEC_PER_SEC, ns), div64_u64(ns, kib));
+}
+
+static void bch_speed_test(struct bch_control *bch, unsigned int len)
+{
+	char name[32];
+	ktime_t start;
+	int i;
+
+	get_random_bytes(data, len);
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_BLOCKS; i++) {
+		memset(ecc, 0, sizeof(ecc));
+		encode_bch(bch, data, len, ecc);
+	}
+	report("encode", len, ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_BLOCKS; i++)
+		decode_bch(bch, data, len, ecc, NULL, NULL, errloc);
+	report("decode, no error", len,
+	       ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	/* Same worst case pattern each time, set up outside the timing */
+	memcpy(error_data, data, len);
+	memcpy(error_ecc, ecc, bch->ecc_bytes);
+	inject_errors(bch, len, bch->t);
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_BLOCKS; i++)
+		decode_bch(bch, error_data, len, error_ecc, NULL, NULL, errloc);
+	sprintf(name, "decode, %d errors", bch->t);
+	report(name, len, ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+static int nand_bch_test(const struct bch_test *test)
+{
+	struct bch_control *bch;
+	int err;
+
+	bch = init_bch(test->m, test->t, 0);
+	if (!bch) {
+		printk(KERN_ERR "mtd_nandbchtest: init_bch(%d, %d) failed\n",
+		       test->m, test->t);
+		return -EINVAL;
+	}
+
+	printk(PRINT_PREF "m = %d, t = %d, %u data bytes, %u ecc bytes\n",
+	       test->m, test->t, test->len, bch->ecc_bytes);
+
+	err = bch_correction_test(bch, test->len);
+	if (!err)
+		bch_speed_test(bch, test->len);
+
+	free_bch(bch);
+	return err;
+}
+
+static int __init bch_test_init(void)
+{
+	int i, err = 0;
+
+	data = kmalloc(1024, GFP_KERNEL);
+	error_data = kmalloc(1024, GFP_KERNEL);
+	if (!data || !error_data) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		err = nand_bch_test(&tests[i]);
+		if (err)
+			break;
+	}
+
+out:
+	kfree(error_data);
+	kfree(data);
+	return err;
+}
+
+#else
+
+static int __init bch_test_init(void)
+{
+	printk(PRINT_PREF "CONFIG_BCH is not enabled, nothing to test\n");
+	return 0;
+}
+
+#endif
+
+static void __exit bch_test_exit(void)
+{
+}
+
+module_init(bch_test_init);
+module_exit(bch_test_exit);
+
+MODULE_DESCRIPTION("BCH ECC library test module");
+MODULE_LICENSE("GPL");
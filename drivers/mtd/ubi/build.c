@@ -42,6 +42,7 @@
 #include <linux/miscdevice.h>
 #include <linux/log2.h>
 #include <linux/kthread.h>
+#include <linux/math64.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include "ubi.h"
@@ -60,10 +61,14 @@
  * @name: MTD character device node path, MTD device name, or MTD device number
  *        string
  * @vid_hdr_offs: VID header offset
+ * @bgt_threads: number of background threads (%0 means the default)
+ * @erase_banks: number of erase banks (%0 means the default)
  */
 struct mtd_dev_param {
 	char name[MTD_PARAM_LEN_MAX];
 	int vid_hdr_offs;
+	int bgt_threads;
+	int erase_banks;
 };
 
 /* Numbers of elements set in the @mtd_dev_param array */
@@ -131,6 +136,18 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_works =
+	__ATTR(erase_works, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_latency_avg =
+	__ATTR(erase_latency_avg, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_latency_max =
+	__ATTR(erase_latency_max, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_works =
+	__ATTR(wl_works, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_latency_avg =
+	__ATTR(wl_latency_avg, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_latency_max =
+	__ATTR(wl_latency_max, S_IRUGO, dev_attribute_show, NULL);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -311,6 +328,26 @@ int ubi_major2num(int major)
 	return ubi_num;
 }
 
+/**
+ * work_latency_avg - get the average latency of UBI works.
+ * @ubi: UBI device description object
+ * @type: type of the works
+ *
+ * Returns the average latency in microseconds.
+ */
+static unsigned long long work_latency_avg(struct ubi_device *ubi, int type)
+{
+	unsigned long long total;
+	unsigned long count;
+
+	spin_lock(&ubi->wl_lock);
+	total = ubi->work_stats[type].total_us;
+	count = ubi->work_stats[type].count;
+	spin_unlock(&ubi->wl_lock);
+
+	return count ? div64_u64(total, count) : 0;
+}
+
 /* "Show" method for files in '/<sysfs>/class/ubi/ubiX/' */
 static ssize_t dev_attribute_show(struct device *dev,
 				  struct device_attribute *attr, char *buf)
@@ -355,6 +392,22 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_erase_works)
+		ret = sprintf(buf, "%lu\n",
+			      ubi->work_stats[UBI_WORK_ERASE].count);
+	else if (attr == &dev_erase_latency_avg)
+		ret = sprintf(buf, "%llu\n",
+			      work_latency_avg(ubi, UBI_WORK_ERASE));
+	else if (attr == &dev_erase_latency_max)
+		ret = sprintf(buf, "%u\n",
+			      ubi->work_stats[UBI_WORK_ERASE].max_us);
+	else if (attr == &dev_wl_works)
+		ret = sprintf(buf, "%lu\n", ubi->work_stats[UBI_WORK_WL].count);
+	else if (attr == &dev_wl_latency_avg)
+		ret = sprintf(buf, "%llu\n",
+			      work_latency_avg(ubi, UBI_WORK_WL));
+	else if (attr == &dev_wl_latency_max)
+		ret = sprintf(buf, "%u\n", ubi->work_stats[UBI_WORK_WL].max_us);
 	else
 		ret = -EINVAL;
 
@@ -422,6 +475,24 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_works);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_latency_avg);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_latency_max);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_works);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_latency_avg);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_latency_max);
 	return err;
 }
 
@@ -431,6 +502,12 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_wl_latency_max);
+	device_remove_file(&ubi->dev, &dev_wl_latency_avg);
+	device_remove_file(&ubi->dev, &dev_wl_works);
+	device_remove_file(&ubi->dev, &dev_erase_latency_max);
+	device_remove_file(&ubi->dev, &dev_erase_latency_avg);
+	device_remove_file(&ubi->dev, &dev_erase_works);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -575,19 +652,21 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * Note, if the checkpoint support is enabled, 'ubi_scan()' first tries to
+ * read the on-flash checkpoint and scans only the physical eraseblocks it
+ * does not describe. Full media scanning is the fall-back attaching method
+ * if there is no valid checkpoint.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
+	unsigned long start = jiffies;
 	struct ubi_scan_info *si;
 
 	si = ubi_scan(ubi);
 	if (IS_ERR(si))
 		return PTR_ERR(si);
+	ubi_msg("scanning took %u ms", jiffies_to_msecs(jiffies - start));
 
 	ubi->bad_peb_count = si->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
@@ -838,11 +917,58 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
 	return 0;
 }
 
+/**
+ * start_bgt - create the background threads of an UBI device.
+ * @ubi: UBI device description object
+ *
+ * The threads are created stopped. This function returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int start_bgt(struct ubi_device *ubi)
+{
+	int i;
+	struct task_struct *thread;
+
+	for (i = 0; i < ubi->bgt_count; i++) {
+		if (i == 0)
+			thread = kthread_create(ubi_thread, ubi, "%s",
+						ubi->bgt_name);
+		else
+			thread = kthread_create(ubi_thread, ubi, "%s/%d",
+						ubi->bgt_name, i);
+		if (IS_ERR(thread)) {
+			ubi_err("cannot spawn background thread %d of \"%s\", "
+				"error %ld", i, ubi->bgt_name, PTR_ERR(thread));
+			return PTR_ERR(thread);
+		}
+		ubi->bgt_threads[i] = thread;
+	}
+
+	return 0;
+}
+
+/**
+ * stop_bgt - stop the background threads of an UBI device.
+ * @ubi: UBI device description object
+ */
+static void stop_bgt(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->bgt_count; i++)
+		if (ubi->bgt_threads[i]) {
+			kthread_stop(ubi->bgt_threads[i]);
+			ubi->bgt_threads[i] = NULL;
+		}
+}
+
 /**
  * ubi_attach_mtd_dev - attach an MTD device.
  * @mtd: MTD device description object
  * @ubi_num: number to assign to the new UBI device
  * @vid_hdr_offset: VID header offset
+ * @bgt_threads: number of background threads, %0 means %UBI_BGT_THREADS
+ * @erase_banks: number of erase banks, %0 means %UBI_ERASE_BANKS
  *
  * This function attaches MTD device @mtd_dev to UBI and assign @ubi_num number
  * to the newly created UBI device, unless @ubi_num is %UBI_DEV_NUM_AUTO, in
@@ -853,7 +979,8 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
  * Note, the invocations of this function has to be serialized by the
  * @ubi_devices_mutex.
  */
-int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
+int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset,
+		       int bgt_threads, int erase_banks)
 {
 	struct ubi_device *ubi;
 	int i, err, ref = 0;
@@ -908,6 +1035,18 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		}
 	}
 
+	if (bgt_threads == 0)
+		bgt_threads = UBI_BGT_THREADS;
+	if (erase_banks == 0)
+		erase_banks = UBI_ERASE_BANKS;
+	if (bgt_threads < 1 || bgt_threads > UBI_MAX_BGT_THREADS ||
+	    erase_banks < 1 || erase_banks > UBI_MAX_ERASE_BANKS) {
+		ubi_err("bad number of background threads %d or erase banks "
+			"%d, max. is %d and %d", bgt_threads, erase_banks,
+			UBI_MAX_BGT_THREADS, UBI_MAX_ERASE_BANKS);
+		return -EINVAL;
+	}
+
 	ubi = kzalloc(sizeof(struct ubi_device), GFP_KERNEL);
 	if (!ubi)
 		return -ENOMEM;
@@ -915,6 +1054,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	ubi->mtd = mtd;
 	ubi->ubi_num = ubi_num;
 	ubi->vid_hdr_offset = vid_hdr_offset;
+	ubi->bgt_count = bgt_threads;
+	ubi->erase_banks = erase_banks;
 	ubi->autoresize_vol_id = -1;
 
 	mutex_init(&ubi->buf_mutex);
@@ -956,17 +1097,17 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 			goto out_detach;
 	}
 
+	err = ubi_ensure_checkpoint(ubi);
+	if (err)
+		goto out_detach;
+
 	err = uif_init(ubi, &ref);
 	if (err)
 		goto out_detach;
 
-	ubi->bgt_thread = kthread_create(ubi_thread, ubi, ubi->bgt_name);
-	if (IS_ERR(ubi->bgt_thread)) {
-		err = PTR_ERR(ubi->bgt_thread);
-		ubi_err("cannot spawn \"%s\", error %d", ubi->bgt_name,
-			err);
-		goto out_uif;
-	}
+	err = start_bgt(ubi);
+	if (err)
+		goto out_bgt;
 
 	ubi_msg("attached mtd%d to ubi%d", mtd->index, ubi_num);
 	ubi_msg("MTD device name:            \"%s\"", mtd->name);
@@ -985,6 +1126,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		ubi->beb_rsvd_pebs);
 	ubi_msg("max/mean erase counter: %d/%d", ubi->max_ec, ubi->mean_ec);
 	ubi_msg("image sequence number:  %d", ubi->image_seq);
+	ubi_msg("background threads:     %d", ubi->bgt_count);
+	ubi_msg("erase banks:            %d", ubi->erase_banks);
 
 	/*
 	 * The below lock makes sure we do not race with 'ubi_thread()' which
@@ -993,14 +1136,16 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	spin_lock(&ubi->wl_lock);
 	if (!DBG_DISABLE_BGT)
 		ubi->thread_enabled = 1;
-	wake_up_process(ubi->bgt_thread);
+	for (i = 0; i < ubi->bgt_count; i++)
+		wake_up_process(ubi->bgt_threads[i]);
 	spin_unlock(&ubi->wl_lock);
 
 	ubi_devices[ubi_num] = ubi;
 	ubi_notify_all(ubi, UBI_VOLUME_ADDED, NULL);
 	return ubi_num;
 
-out_uif:
+out_bgt:
+	stop_bgt(ubi);
 	uif_close(ubi);
 out_detach:
 	ubi_wl_close(ubi);
@@ -1063,11 +1208,17 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	dbg_msg("detaching mtd%d from ubi%d", ubi->mtd->index, ubi_num);
 
 	/*
-	 * Before freeing anything, we have to stop the background thread to
-	 * prevent it from doing anything on this device while we are freeing.
+	 * Before freeing anything, we have to stop the background threads to
+	 * prevent them from doing anything on this device while we are
+	 * freeing.
+	 */
+	stop_bgt(ubi);
+
+	/*
+	 * Write a fresh checkpoint, so that the next attach does not have to
+	 * scan the pool. Failure is not fatal - the device will be scanned.
 	 */
-	if (ubi->bgt_thread)
-		kthread_stop(ubi->bgt_thread);
+	ubi_update_checkpoint(ubi);
 
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
@@ -1212,7 +1363,8 @@ static int __init ubi_init(void)
 
 		mutex_lock(&ubi_devices_mutex);
 		err = ubi_attach_mtd_dev(mtd, UBI_DEV_NUM_AUTO,
-					 p->vid_hdr_offs);
+					 p->vid_hdr_offs, p->bgt_threads,
+					 p->erase_banks);
 		mutex_unlock(&ubi_devices_mutex);
 		if (err < 0) {
 			ubi_err("cannot attach mtd%d", mtd->index);
@@ -1328,7 +1480,7 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	struct mtd_dev_param *p;
 	char buf[MTD_PARAM_LEN_MAX];
 	char *pbuf = &buf[0];
-	char *tokens[2] = {NULL, NULL};
+	char *tokens[4] = {NULL, NULL, NULL, NULL};
 
 	if (!val)
 		return -EINVAL;
@@ -1358,7 +1510,7 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (buf[len - 1] == '\n')
 		buf[len - 1] = '\0';
 
-	for (i = 0; i < 2; i++)
+	for (i = 0; i < 4; i++)
 		tokens[i] = strsep(&pbuf, ",");
 
 	if (pbuf) {
@@ -1376,18 +1528,44 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (p->vid_hdr_offs < 0)
 		return p->vid_hdr_offs;
 
+	if (tokens[2] && *tokens[2]) {
+		p->bgt_threads = simple_strtoul(tokens[2], NULL, 0);
+		if (p->bgt_threads < 1 || p->bgt_threads > UBI_MAX_BGT_THREADS) {
+			printk(KERN_ERR "UBI error: bad number of background "
+			       "threads at \"%s\", max. is %d\n", val,
+			       UBI_MAX_BGT_THREADS);
+			return -EINVAL;
+		}
+	}
+
+	if (tokens[3] && *tokens[3]) {
+		p->erase_banks = simple_strtoul(tokens[3], NULL, 0);
+		if (p->erase_banks < 1 || p->erase_banks > UBI_MAX_ERASE_BANKS) {
+			printk(KERN_ERR "UBI error: bad number of erase banks "
+			       "at \"%s\", max. is %d\n", val,
+			       UBI_MAX_ERASE_BANKS);
+			return -EINVAL;
+		}
+	}
+
 	mtd_devs += 1;
 	return 0;
 }
 
 module_param_call(mtd, ubi_mtd_param_parse, NULL, NULL, 000);
 MODULE_PARM_DESC(mtd, "MTD devices to attach. Parameter format: "
-		      "mtd=<name|num|path>[,<vid_hdr_offs>].\n"
+		      "mtd=<name|num|path>[,<vid_hdr_offs>[,<bgt_threads>"
+		      "[,<erase_banks>]]].\n"
 		      "Multiple \"mtd\" parameters may be specified.\n"
 		      "MTD devices may be specified by their number, name, or "
 		      "path to the MTD character device node.\n"
 		      "Optional \"vid_hdr_offs\" parameter specifies UBI VID "
 		      "header position to be used by UBI.\n"
+		      "Optional \"bgt_threads\" and \"erase_banks\" "
+		      "parameters specify the number of background threads "
+		      "(max. " __stringify(UBI_MAX_BGT_THREADS) ") and of "
+		      "erase banks (max. " __stringify(UBI_MAX_ERASE_BANKS)
+		      "), the defaults are set in the kernel configuration.\n"
 		      "Example 1: mtd=/dev/mtd0 - attach MTD device "
 		      "/dev/mtd0.\n"
 		      "Example 2: mtd=content,1984 mtd=4 - attach MTD device "
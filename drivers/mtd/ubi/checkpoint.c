@@ -0,0 +1,1365 @@
+/*
+ * Copyright (c) International Business Machines Corp., 2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI attach checkpoint.
+ *
+ * Attaching an MTD device by scanning requires reading the EC and VID headers
+ * of every physical eraseblock, so the attach time grows linearly with the
+ * flash size. The checkpoint is a snapshot of the state of the WL and EBA
+ * sub-systems which is stored on the flash, so that only the physical
+ * eraseblocks which may have changed since the snapshot was taken have to be
+ * scanned.
+ *
+ * The checkpoint consists of the anchor, which is logical eraseblock 0 of the
+ * checkpoint super block volume, and possibly of several more logical
+ * eraseblocks of the checkpoint data volume (see &struct ubi_cp_sb). The anchor
+ * is always placed in one of the first %UBI_CP_MAX_START physical
+ * eraseblocks, so it is found by reading only a handful of VID headers.
+ *
+ * After a checkpoint has been written, new physical eraseblocks are handed
+ * out only from the checkpoint pool, a set of free physical eraseblocks
+ * recorded in the checkpoint. When attaching, the pool is scanned and the
+ * information found there overrides the checkpoint, because the sequence
+ * numbers of LEBs written after the checkpoint are higher than the checkpoint
+ * sequence number. When the pool is used up, a new checkpoint is written.
+ *
+ * Physical eraseblocks the checkpoint maps LEBs to must not be erased while
+ * the checkpoint is valid, otherwise an unclean reboot would resurrect stale
+ * mappings. The WL sub-system defers these erasures until the next checkpoint
+ * is written (see @ubi->cp_used_map).
+ *
+ * Each checkpoint reserves the physical eraseblocks the next checkpoint will
+ * be written to (see @ubi->cp_next) and lists them in its pool, so that they
+ * are scanned if the next checkpoint is only partially written. The
+ * checkpoint is updated in the following order:
+ *   1. the reserved blocks are taken, new blocks are reserved for the next
+ *      checkpoint and the pool is refilled;
+ *   2. the state is serialized with all mapping changes blocked;
+ *   3. the data blocks are written, and the anchor is written the last;
+ *   4. the old anchor is erased synchronously, and the rest of the old
+ *      checkpoint is scheduled for erasure.
+ *
+ * Until the new anchor is written, the old checkpoint stays valid. An unclean
+ * reboot between steps 3 and 4 leaves two anchors on the flash, and the newer
+ * one wins. The new checkpoint lists the blocks of the old one as to be
+ * erased.
+ *
+ * If there are no reserved blocks, which happens after attaching if the pool
+ * of the checkpoint had too few free physical eraseblocks left, any free
+ * physical eraseblock may be used for the new checkpoint. The old checkpoint
+ * describes those as free and does not scan them, so it is invalidated
+ * first by synchronously erasing its anchor, and an unclean reboot during
+ * the update results in scanning.
+ *
+ * If anything goes wrong, or if the checkpoint would not fit
+ * %UBI_CP_MAX_BLOCKS eraseblocks, checkpoints are disabled for the device and
+ * it will be attached by scanning next time.
+ */
+
+#include <linux/crc32.h>
+#include "ubi.h"
+
+/**
+ * cp_max_size - calculate the maximum size of the checkpoint.
+ * @ubi: UBI device description object
+ */
+static int cp_max_size(const struct ubi_device *ubi)
+{
+	int size;
+
+	size = sizeof(struct ubi_cp_sb) + sizeof(struct ubi_cp_hdr);
+	size += (ubi->cp_pool.max_size + UBI_CP_MAX_BLOCKS) * sizeof(__be32);
+	size += ubi->peb_count * sizeof(struct ubi_cp_ec);
+	size += (ubi->vtbl_slots + UBI_INT_VOL_COUNT) *
+		sizeof(struct ubi_cp_volume);
+	size += ubi->peb_count * sizeof(__be32);
+	return size;
+}
+
+/**
+ * cp_get - get the next object of the checkpoint buffer.
+ * @pos: current position in the buffer
+ * @end: end of the buffer
+ * @size: size of the object
+ *
+ * This function returns a pointer to the object at @pos and advances @pos by
+ * @size, or returns %NULL if the object does not fit the buffer.
+ */
+static void *cp_get(void **pos, const void *end, size_t size)
+{
+	void *p = *pos;
+
+	if (size > end - p)
+		return NULL;
+	*pos = p + size;
+	return p;
+}
+
+/**
+ * cp_put_ec - add a &struct ubi_cp_ec object to the checkpoint buffer.
+ * @pos: current position in the buffer
+ * @end: end of the buffer
+ * @e: the wear-leveling entry to add
+ *
+ * Returns zero in case of success and %-ENOSPC if the buffer is full.
+ */
+static int cp_put_ec(void **pos, const void *end, const struct ubi_wl_entry *e)
+{
+	struct ubi_cp_ec *cp_ec;
+
+	cp_ec = cp_get(pos, end, sizeof(struct ubi_cp_ec));
+	if (!cp_ec)
+		return -ENOSPC;
+	cp_ec->pnum = cpu_to_be32(e->pnum);
+	cp_ec->ec = cpu_to_be32(e->ec);
+	return 0;
+}
+
+/**
+ * cp_put_tree - add all entries of a WL RB-tree to the checkpoint buffer.
+ * @pos: current position in the buffer
+ * @end: end of the buffer
+ * @root: the RB-tree
+ *
+ * Returns the number of added entries in case of success and %-ENOSPC if the
+ * buffer is full.
+ */
+static int cp_put_tree(void **pos, const void *end, struct rb_root *root)
+{
+	int count = 0;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+	ubi_rb_for_each_entry(rb, e, root, u.rb) {
+		if (cp_put_ec(pos, end, e))
+			return -ENOSPC;
+		count += 1;
+	}
+	return count;
+}
+
+/**
+ * fill_checkpoint - serialize the WL and EBA state to the checkpoint buffer.
+ * @ubi: UBI device description object
+ * @map: bitmap to mark the physical eraseblocks mapped in the EBA tables
+ * @sqnum: the checkpoint sequence number is returned here
+ *
+ * The caller has to hold @ubi->cp_eba_sem in write mode and @ubi->move_mutex,
+ * so that neither the EBA sub-system nor the wear-leveling worker change the
+ * mappings. This function returns the size of the checkpoint in case of
+ * success and %-ENOSPC if the checkpoint does not fit the buffer.
+ */
+static int fill_checkpoint(struct ubi_device *ubi, unsigned long *map,
+			   unsigned long long *sqnum)
+{
+	int i, n, err = -ENOSPC, free_count, used_count = 0, erase_count = 0;
+	int scrub_count, vol_count = 0;
+	struct ubi_cp_pool *pool = &ubi->cp_pool;
+	struct ubi_cp_hdr *hdr;
+	struct ubi_wl_entry *e;
+	struct ubi_work *wrk;
+	void *pos, *end;
+
+	pos = ubi->cp_buf + sizeof(struct ubi_cp_sb);
+	end = ubi->cp_buf + ubi->cp_max_blocks * ubi->leb_size;
+
+	hdr = cp_get(&pos, end, sizeof(struct ubi_cp_hdr));
+	if (!hdr)
+		return -ENOSPC;
+	memset(hdr, 0, sizeof(struct ubi_cp_hdr));
+	hdr->magic = cpu_to_be32(UBI_CP_HDR_MAGIC);
+	hdr->peb_count = cpu_to_be32(ubi->peb_count);
+
+	spin_lock(&ubi->wl_lock);
+	for (i = pool->used; i < pool->size; i++) {
+		__be32 *pnum = cp_get(&pos, end, sizeof(__be32));
+
+		if (!pnum)
+			goto out_wl_unlock;
+		*pnum = cpu_to_be32(pool->pebs[i]);
+	}
+	for (i = 0; i < ubi->cp_next_count; i++) {
+		__be32 *pnum = cp_get(&pos, end, sizeof(__be32));
+
+		if (!pnum)
+			goto out_wl_unlock;
+		*pnum = cpu_to_be32(ubi->cp_next[i]->pnum);
+	}
+	hdr->pool_size = cpu_to_be32(pool->size - pool->used +
+				     ubi->cp_next_count);
+
+	free_count = cp_put_tree(&pos, end, &ubi->free);
+	if (free_count < 0)
+		goto out_wl_unlock;
+
+	n = cp_put_tree(&pos, end, &ubi->used);
+	if (n < 0)
+		goto out_wl_unlock;
+	used_count += n;
+	n = cp_put_tree(&pos, end, &ubi->erroneous);
+	if (n < 0)
+		goto out_wl_unlock;
+	used_count += n;
+	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
+		list_for_each_entry(e, &ubi->pq[i], u.list) {
+			if (cp_put_ec(&pos, end, e))
+				goto out_wl_unlock;
+			used_count += 1;
+		}
+
+	scrub_count = cp_put_tree(&pos, end, &ubi->scrub);
+	if (scrub_count < 0)
+		goto out_wl_unlock;
+
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (ubi_is_erase_work(wrk)) {
+			if (cp_put_ec(&pos, end, wrk->e))
+				goto out_wl_unlock;
+			erase_count += 1;
+		}
+	list_for_each_entry(wrk, &ubi->cp_deferred, list) {
+		if (cp_put_ec(&pos, end, wrk->e))
+			goto out_wl_unlock;
+		erase_count += 1;
+	}
+	/* The old checkpoint is erased once this one is written */
+	for (i = 0; i < ubi->cp_nblocks; i++) {
+		if (cp_put_ec(&pos, end, ubi->cp_e[i]))
+			goto out_wl_unlock;
+		erase_count += 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	hdr->free_count = cpu_to_be32(free_count);
+	hdr->used_count = cpu_to_be32(used_count);
+	hdr->scrub_count = cpu_to_be32(scrub_count);
+	hdr->erase_count = cpu_to_be32(erase_count);
+
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+		struct ubi_cp_volume *cp_vol;
+		__be32 *eba;
+		int lnum;
+
+		if (!vol)
+			continue;
+
+		cp_vol = cp_get(&pos, end, sizeof(struct ubi_cp_volume));
+		eba = cp_get(&pos, end, vol->reserved_pebs * sizeof(__be32));
+		if (!cp_vol || !eba)
+			goto out_vol_unlock;
+
+		memset(cp_vol, 0, sizeof(struct ubi_cp_volume));
+		cp_vol->magic = cpu_to_be32(UBI_CP_VOL_MAGIC);
+		cp_vol->vol_id = cpu_to_be32(vol->vol_id);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			cp_vol->vol_type = UBI_VID_DYNAMIC;
+		else
+			cp_vol->vol_type = UBI_VID_STATIC;
+		cp_vol->data_pad = cpu_to_be32(vol->data_pad);
+		cp_vol->used_ebs = cpu_to_be32(vol->used_ebs);
+		cp_vol->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		cp_vol->reserved_pebs = cpu_to_be32(vol->reserved_pebs);
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			int pnum = vol->eba_tbl[lnum];
+
+			eba[lnum] = cpu_to_be32(pnum);
+			if (pnum >= 0)
+				__set_bit(pnum, map);
+		}
+		vol_count += 1;
+	}
+	hdr->vol_count = cpu_to_be32(vol_count);
+
+	spin_lock(&ubi->ltree_lock);
+	*sqnum = ubi->global_sqnum++;
+	spin_unlock(&ubi->ltree_lock);
+	err = pos - ubi->cp_buf;
+
+out_vol_unlock:
+	spin_unlock(&ubi->volumes_lock);
+	return err;
+
+out_wl_unlock:
+	spin_unlock(&ubi->wl_lock);
+	return err;
+}
+
+/**
+ * write_checkpoint - write the checkpoint to the flash.
+ * @ubi: UBI device description object
+ * @blocks: wear-leveling entries of the physical eraseblocks to write to
+ * @nblocks: how many physical eraseblocks the checkpoint occupies
+ * @len: size of the checkpoint in @ubi->cp_buf
+ * @sqnum: the checkpoint sequence number
+ *
+ * The data blocks are written first and the anchor is written the last, so
+ * that the checkpoint becomes valid only once it is completely on the flash.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int write_checkpoint(struct ubi_device *ubi,
+			    struct ubi_wl_entry **blocks, int nblocks, int len,
+			    unsigned long long sqnum)
+{
+	int i, err;
+	struct ubi_cp_sb *sb = ubi->cp_buf;
+	struct ubi_vid_hdr *vid_hdr;
+	int data_size = len - sizeof(struct ubi_cp_sb);
+
+	memset(sb, 0, sizeof(struct ubi_cp_sb));
+	sb->magic = cpu_to_be32(UBI_CP_SB_MAGIC);
+	sb->version = UBI_CP_FMT_VERSION;
+	sb->data_size = cpu_to_be32(data_size);
+	sb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, sb + 1, data_size));
+	sb->nblocks = cpu_to_be32(nblocks);
+	for (i = 0; i < nblocks; i++)
+		sb->block_loc[i] = cpu_to_be32(blocks[i]->pnum);
+	sb->sqnum = cpu_to_be64(sqnum);
+	sb->sb_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, sb, UBI_CP_SB_SIZE_CRC));
+
+	/* Pad the last min. I/O unit with 0xFF bytes */
+	memset(ubi->cp_buf + len, 0xFF, ALIGN(len, ubi->min_io_size) - len);
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->compat = UBI_CP_VOLUME_COMPAT;
+	vid_hdr->sqnum = cpu_to_be64(sqnum);
+
+	for (i = nblocks - 1; i >= 0; i--) {
+		int pnum = blocks[i]->pnum, offs = i * ubi->leb_size;
+		int size = min_t(int, len - offs, ubi->leb_size);
+
+		vid_hdr->vol_id = cpu_to_be32(i == 0 ? UBI_CP_SB_VOLUME_ID :
+						       UBI_CP_DATA_VOLUME_ID);
+		vid_hdr->lnum = cpu_to_be32(i);
+
+		dbg_gen("write checkpoint block %d to PEB %d", i, pnum);
+		err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+		if (err)
+			break;
+
+		err = ubi_io_write_data(ubi, ubi->cp_buf + offs, pnum, 0,
+					ALIGN(size, ubi->min_io_size));
+		if (err)
+			break;
+	}
+
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+}
+
+/**
+ * invalidate_checkpoint - invalidate the on-flash checkpoint.
+ * @ubi: UBI device description object
+ *
+ * This function synchronously erases the anchor of the current checkpoint
+ * and schedules the rest of its physical eraseblocks for erasure. The caller
+ * decides which erasures stay deferred (see 'ubi_wl_set_cp_map()'). Returns
+ * zero in case of success and a negative error code in case of failure, in
+ * which case UBI is switched to R/O mode.
+ */
+static int invalidate_checkpoint(struct ubi_device *ubi)
+{
+	int i, err;
+
+	if (ubi->cp_nblocks) {
+		err = ubi_wl_erase_cp_peb(ubi, ubi->cp_e[0]);
+		if (err) {
+			ubi_err("cannot erase checkpoint anchor PEB %d, "
+				"error %d", ubi->cp_e[0]->pnum, err);
+			ubi_ro_mode(ubi);
+			return err;
+		}
+
+		for (i = 1; i < ubi->cp_nblocks; i++) {
+			err = ubi_wl_put_cp_peb(ubi, ubi->cp_e[i], 1);
+			if (err) {
+				while (i < ubi->cp_nblocks)
+					kmem_cache_free(ubi_wl_entry_slab,
+							ubi->cp_e[i++]);
+				ubi->cp_nblocks = 0;
+				ubi_ro_mode(ubi);
+				return err;
+			}
+		}
+		ubi->cp_nblocks = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * disable_checkpoint - stop writing checkpoints.
+ * @ubi: UBI device description object
+ *
+ * This function is called when a checkpoint cannot be written. There is no
+ * valid checkpoint on the flash at this point, so the device will be attached
+ * by scanning next time.
+ */
+static void disable_checkpoint(struct ubi_device *ubi)
+{
+	int i;
+
+	ubi_warn("checkpoints are disabled");
+	ubi_wl_set_cp_map(ubi, NULL);
+	ubi_wl_return_pool(ubi);
+	for (i = 0; i < ubi->cp_next_count; i++)
+		ubi_wl_put_cp_peb(ubi, ubi->cp_next[i], 0);
+	ubi->cp_next_count = 0;
+	ubi->cp_disabled = 1;
+}
+
+/**
+ * ubi_update_checkpoint - write a new checkpoint.
+ * @ubi: UBI device description object
+ *
+ * This function refills the checkpoint pool and writes a new checkpoint, and
+ * then releases the old one (see the comment at the top of this file for the
+ * order of things). If the new checkpoint cannot be written, checkpoints are
+ * disabled. Returns zero in case of success and a negative error code if the
+ * old checkpoint could not be invalidated or released.
+ */
+int ubi_update_checkpoint(struct ubi_device *ubi)
+{
+	int i, err, len, nblocks, map_size, taken = 0, written = 0;
+	unsigned long long sqnum;
+	unsigned long *map, *both;
+	struct ubi_wl_entry *e, *blocks[UBI_CP_MAX_BLOCKS];
+
+	if (ubi->cp_disabled)
+		return 0;
+	if (ubi->ro_mode)
+		return -EROFS;
+
+	map_size = BITS_TO_LONGS(ubi->peb_count) * sizeof(unsigned long);
+	map = kzalloc(map_size, GFP_NOFS);
+	both = kmalloc(map_size, GFP_NOFS);
+	if (!map || !both) {
+		kfree(map);
+		kfree(both);
+		return -ENOMEM;
+	}
+
+	down_write(&ubi->cp_eba_sem);
+	if (ubi->cp_disabled) {
+		/* Somebody has disabled checkpoints meanwhile */
+		err = 0;
+		goto out_unlock;
+	}
+
+	if (ubi->cp_next_count == ubi->cp_max_blocks) {
+		for (i = 0; i < ubi->cp_next_count; i++)
+			blocks[taken++] = ubi->cp_next[i];
+	} else {
+		/* Any free PEB will do, the old checkpoint must go first */
+		err = invalidate_checkpoint(ubi);
+		if (err)
+			goto out_unlock;
+		ubi_wl_set_cp_map(ubi, NULL);
+		for (i = 0; i < ubi->cp_next_count; i++)
+			ubi_wl_put_cp_peb(ubi, ubi->cp_next[i], 0);
+	}
+	ubi->cp_next_count = 0;
+
+	/*
+	 * Return the rest of the pool first, so that the physical eraseblocks
+	 * in there may be used for the checkpoint.
+	 */
+	ubi_wl_return_pool(ubi);
+
+	for (i = taken; i < ubi->cp_max_blocks; i++) {
+		e = ubi_wl_get_cp_peb(ubi, i == 0 ? UBI_CP_MAX_START : INT_MAX,
+				      NULL);
+		if (IS_ERR(e)) {
+			err = PTR_ERR(e);
+			ubi_err("cannot get PEB for checkpoint, error %d", err);
+			goto out_put;
+		}
+		blocks[taken++] = e;
+	}
+
+	for (i = 0; i < ubi->cp_max_blocks; i++) {
+		e = ubi_wl_get_cp_peb(ubi, i == 0 ? UBI_CP_MAX_START : INT_MAX,
+				      NULL);
+		if (IS_ERR(e)) {
+			err = PTR_ERR(e);
+			ubi_err("cannot reserve PEB for checkpoint, error %d",
+				err);
+			goto out_put;
+		}
+		ubi->cp_next[ubi->cp_next_count++] = e;
+	}
+
+	ubi_wl_refill_pool(ubi);
+
+	mutex_lock(&ubi->move_mutex);
+	len = fill_checkpoint(ubi, map, &sqnum);
+	if (len >= 0) {
+		/*
+		 * Until the new checkpoint is written, the old one is still
+		 * valid, so what either of them maps must not be erased.
+		 */
+		if (ubi->cp_used_map)
+			bitmap_or(both, map, ubi->cp_used_map, ubi->peb_count);
+		else
+			memcpy(both, map, map_size);
+		ubi_wl_set_cp_map(ubi, both);
+		both = NULL;
+	}
+	mutex_unlock(&ubi->move_mutex);
+	if (len < 0) {
+		err = len;
+		ubi_err("checkpoint does not fit %d PEBs", ubi->cp_max_blocks);
+		goto out_put;
+	}
+
+	nblocks = DIV_ROUND_UP(len, ubi->leb_size);
+	err = write_checkpoint(ubi, blocks, nblocks, len, sqnum);
+	if (err) {
+		ubi_err("cannot write checkpoint, error %d", err);
+		written = nblocks;
+		goto out_put;
+	}
+
+	/* The new checkpoint is valid, the old one may go */
+	err = invalidate_checkpoint(ubi);
+	ubi_wl_set_cp_map(ubi, map);
+	map = NULL;
+
+	for (i = 0; i < nblocks; i++)
+		ubi->cp_e[i] = blocks[i];
+	ubi->cp_nblocks = nblocks;
+
+	/* Return the physical eraseblocks the checkpoint did not need */
+	for (i = nblocks; i < ubi->cp_max_blocks; i++)
+		ubi_wl_put_cp_peb(ubi, blocks[i], 0);
+
+	dbg_gen("checkpoint written: %d bytes, %d PEBs, anchor PEB %d, "
+		"sqnum %llu", len, nblocks, blocks[0]->pnum, sqnum);
+	up_write(&ubi->cp_eba_sem);
+	return err;
+
+out_put:
+	/*
+	 * The first @written physical eraseblocks might have been written to,
+	 * so erase them, the rest are still clean. Then get rid of the old
+	 * checkpoint, which is not going to be maintained any more.
+	 */
+	for (i = 0; i < taken; i++)
+		if (ubi_wl_put_cp_peb(ubi, blocks[i], i < written))
+			kmem_cache_free(ubi_wl_entry_slab, blocks[i]);
+	err = invalidate_checkpoint(ubi);
+	disable_checkpoint(ubi);
+out_unlock:
+	up_write(&ubi->cp_eba_sem);
+	kfree(both);
+	kfree(map);
+	return err;
+}
+
+/**
+ * ubi_ensure_checkpoint - make sure there is a checkpoint on the flash.
+ * @ubi: UBI device description object
+ *
+ * This function is called at the end of attaching and writes a checkpoint if
+ * the device was attached by scanning. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_ensure_checkpoint(struct ubi_device *ubi)
+{
+	if (ubi->cp_disabled || ubi->cp_nblocks || ubi->ro_mode)
+		return 0;
+	return ubi_update_checkpoint(ubi);
+}
+
+/**
+ * ubi_cp_init - initialize the checkpoint sub-system.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function is called by the WL sub-system when it has built its data
+ * structures. It takes over the bitmap of physical eraseblocks the on-flash
+ * checkpoint maps LEBs to, sizes the checkpoint pool and reserves physical
+ * eraseblocks for the checkpoint. Returns zero in case of success and a
+ * negative error code in case of failure.
+ *
+ * The old, the new and the next checkpoint may all occupy physical
+ * eraseblocks while a checkpoint is being written, so three times the
+ * checkpoint size is reserved.
+ */
+int ubi_cp_init(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int i, err, reserve;
+	struct ubi_wl_entry *e;
+	struct ubi_cp_pool *pool = &ubi->cp_pool;
+
+	if (ubi->cp_nblocks) {
+		ubi->cp_used_map = si->cp_used_map;
+		si->cp_used_map = NULL;
+	}
+
+	pool->max_size = clamp_t(int, ubi->peb_count / 20,
+				 UBI_CP_MIN_POOL_SIZE, UBI_CP_MAX_POOL_SIZE);
+	ubi->cp_max_blocks = DIV_ROUND_UP(cp_max_size(ubi), ubi->leb_size);
+	reserve = 3 * ubi->cp_max_blocks;
+
+	if (ubi->ro_mode) {
+		ubi->cp_disabled = 1;
+		return 0;
+	}
+
+	if (ubi->cp_max_blocks > UBI_CP_MAX_BLOCKS ||
+	    ubi->avail_pebs < reserve) {
+		ubi_warn("no room for the checkpoint (%d PEBs needed)",
+			 reserve);
+		ubi->cp_disabled = 1;
+		err = invalidate_checkpoint(ubi);
+		ubi_wl_set_cp_map(ubi, NULL);
+		return err;
+	}
+
+	pool->pebs = kmalloc(pool->max_size * sizeof(int), GFP_KERNEL);
+	if (!pool->pebs)
+		return -ENOMEM;
+
+	ubi->cp_buf = vmalloc(ubi->cp_max_blocks * ubi->leb_size);
+	if (!ubi->cp_buf)
+		return -ENOMEM;
+
+	ubi->avail_pebs -= reserve;
+	ubi->rsvd_pebs += reserve;
+
+	if (!ubi->cp_nblocks || !si->cp_pool_map)
+		return 0;
+
+	/*
+	 * The on-flash checkpoint scans its pool, so the free physical
+	 * eraseblocks there may take the next checkpoint without invalidating
+	 * this one first.
+	 */
+	for (i = 0; i < ubi->cp_max_blocks; i++) {
+		e = ubi_wl_get_cp_peb(ubi, i == 0 ? UBI_CP_MAX_START : INT_MAX,
+				      si->cp_pool_map);
+		if (IS_ERR(e))
+			break;
+		ubi->cp_next[ubi->cp_next_count++] = e;
+	}
+	return 0;
+}
+
+/**
+ * ubi_cp_close - close the checkpoint sub-system.
+ * @ubi: UBI device description object
+ *
+ * This function frees the wear-leveling entries owned by the checkpoint code.
+ * It is called by the WL sub-system when it is closed.
+ */
+void ubi_cp_close(struct ubi_device *ubi)
+{
+	int i;
+	struct ubi_cp_pool *pool = &ubi->cp_pool;
+
+	for (i = pool->used; i < pool->size; i++)
+		kmem_cache_free(ubi_wl_entry_slab,
+				ubi->lookuptbl[pool->pebs[i]]);
+	for (i = 0; i < ubi->cp_nblocks; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->cp_e[i]);
+	for (i = 0; i < ubi->cp_next_count; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->cp_next[i]);
+	pool->used = pool->size = 0;
+	ubi->cp_nblocks = 0;
+	ubi->cp_next_count = 0;
+
+	kfree(pool->pebs);
+	vfree(ubi->cp_buf);
+	kfree(ubi->cp_used_map);
+}
+
+/**
+ * find_anchor - find the checkpoint anchors.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ * @sqnums: sequence numbers of the first @region physical eraseblocks are
+ *          returned here (%0 if there is no valid VID header)
+ * @region: how many physical eraseblocks to look at
+ * @anchors: the two newest anchors are returned here, the newest first
+ *
+ * The anchor of the old checkpoint stays on the flash until it is erased
+ * after the new checkpoint has been written, and the new checkpoint may
+ * have been written only partially. This function returns how many anchors
+ * were found (at most two are returned), and a negative error code in case of
+ * failure.
+ */
+static int find_anchor(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr,
+		       unsigned long long *sqnums, int region, int *anchors)
+{
+	int pnum, err, count = 0;
+
+	for (pnum = 0; pnum < region; pnum++) {
+		sqnums[pnum] = 0;
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		else if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			return err;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		sqnums[pnum] = be64_to_cpu(vid_hdr->sqnum);
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_CP_SB_VOLUME_ID)
+			continue;
+
+		if (count == 0 || sqnums[pnum] > sqnums[anchors[0]]) {
+			anchors[1] = anchors[0];
+			anchors[0] = pnum;
+		} else if (count == 1 || sqnums[pnum] > sqnums[anchors[1]])
+			anchors[1] = pnum;
+		count += 1;
+	}
+
+	return min(count, 2);
+}
+
+/**
+ * read_cp_data - read the checkpoint from the flash.
+ * @ubi: UBI device description object
+ * @anchor: the physical eraseblock which contains the anchor
+ * @sqnum: sequence number of the anchor
+ * @vid_hdr: VID header buffer to use
+ * @len: size of the checkpoint is returned here
+ *
+ * This function reads the checkpoint super block and data to a vmalloc'ed
+ * buffer and checks their CRCs. Returns the buffer in case of success and an
+ * error pointer in case of failure (%-EINVAL if the checkpoint is invalid).
+ */
+static void *read_cp_data(struct ubi_device *ubi, int anchor,
+			  unsigned long long sqnum, struct ubi_vid_hdr *vid_hdr,
+			  int *len)
+{
+	int i, err, nblocks, data_size;
+	struct ubi_cp_sb *sb;
+	uint32_t crc;
+	void *buf = NULL;
+
+	sb = kmalloc(sizeof(struct ubi_cp_sb), GFP_KERNEL);
+	if (!sb)
+		return ERR_PTR(-ENOMEM);
+
+	err = ubi_io_read_data(ubi, sb, anchor, 0, sizeof(struct ubi_cp_sb));
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_bad;
+
+	err = -EINVAL;
+	crc = crc32(UBI_CRC32_INIT, sb, UBI_CP_SB_SIZE_CRC);
+	if (be32_to_cpu(sb->magic) != UBI_CP_SB_MAGIC ||
+	    crc != be32_to_cpu(sb->sb_crc)) {
+		dbg_bld("bad checkpoint super block in PEB %d", anchor);
+		goto out_bad;
+	}
+
+	if (sb->version != UBI_CP_FMT_VERSION) {
+		ubi_warn("unsupported checkpoint format version %d",
+			 (int)sb->version);
+		goto out_bad;
+	}
+
+	nblocks = be32_to_cpu(sb->nblocks);
+	data_size = be32_to_cpu(sb->data_size);
+	if (nblocks < 1 || nblocks > UBI_CP_MAX_BLOCKS || data_size < 0 ||
+	    data_size > nblocks * ubi->leb_size - sizeof(struct ubi_cp_sb) ||
+	    be64_to_cpu(sb->sqnum) != sqnum ||
+	    be32_to_cpu(sb->block_loc[0]) != anchor) {
+		dbg_bld("inconsistent checkpoint super block in PEB %d",
+			anchor);
+		goto out_bad;
+	}
+
+	*len = sizeof(struct ubi_cp_sb) + data_size;
+	buf = vmalloc(*len);
+	if (!buf) {
+		err = -ENOMEM;
+		goto out_bad;
+	}
+
+	for (i = 0; i < nblocks; i++) {
+		int pnum = be32_to_cpu(sb->block_loc[i]);
+		int offs = i * ubi->leb_size;
+		int size = min_t(int, *len - offs, ubi->leb_size);
+
+		err = -EINVAL;
+		if (pnum < 0 || pnum >= ubi->peb_count || size <= 0)
+			goto out_bad;
+
+		if (i > 0) {
+			err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+			if (err && err != UBI_IO_BITFLIPS)
+				goto out_bad;
+
+			err = -EINVAL;
+			if (be32_to_cpu(vid_hdr->vol_id) !=
+						UBI_CP_DATA_VOLUME_ID ||
+			    be32_to_cpu(vid_hdr->lnum) != i ||
+			    be64_to_cpu(vid_hdr->sqnum) != sqnum) {
+				dbg_bld("PEB %d is not checkpoint block %d",
+					pnum, i);
+				goto out_bad;
+			}
+		}
+
+		err = ubi_io_read_data(ubi, buf + offs, pnum, 0, size);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_bad;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_cp_sb), data_size);
+	if (crc != be32_to_cpu(sb->data_crc)) {
+		dbg_bld("checkpoint data CRC error");
+		err = -EINVAL;
+		goto out_bad;
+	}
+
+	kfree(sb);
+	return buf;
+
+out_bad:
+	if (err > 0)
+		err = -EIO;
+	vfree(buf);
+	kfree(sb);
+	return ERR_PTR(err);
+}
+
+/**
+ * account_ec - account the erase counter of a physical eraseblock.
+ * @si: scanning information
+ * @ec: the erase counter
+ *
+ * This is what 'process_eb()' does for scanned physical eraseblocks.
+ */
+static void account_ec(struct ubi_scan_info *si, int ec)
+{
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+}
+
+/**
+ * mark_peb - mark a physical eraseblock as described by the checkpoint.
+ * @ubi: UBI device description object
+ * @seen: bitmap of described physical eraseblocks
+ * @pnum: the physical eraseblock number
+ *
+ * Returns zero in case of success and %-EINVAL if @pnum is invalid or was
+ * already described.
+ */
+static int mark_peb(const struct ubi_device *ubi, unsigned long *seen,
+		    int pnum)
+{
+	if (pnum < 0 || pnum >= ubi->peb_count ||
+	    test_and_set_bit(pnum, seen)) {
+		dbg_bld("bad PEB %d in the checkpoint", pnum);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * add_erase - add a physical eraseblock described by the checkpoint to the
+ *             erase list.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @seen: bitmap of described physical eraseblocks
+ * @pnum: the physical eraseblock number
+ * @ec: erase counter of the physical eraseblock
+ *
+ * The physical eraseblock may have gone bad after the checkpoint was written,
+ * in which case it is left for scanning. Returns zero in case of success and
+ * a negative error code in case of failure.
+ */
+static int add_erase(struct ubi_device *ubi, struct ubi_scan_info *si,
+		     unsigned long *seen, int pnum, int ec)
+{
+	int err;
+
+	err = ubi_io_is_bad(ubi, pnum);
+	if (err < 0)
+		return err;
+	if (err) {
+		clear_bit(pnum, seen);
+		return 0;
+	}
+
+	account_ec(si, ec);
+	return ubi_scan_add_to_list(si, pnum, ec, &si->erase);
+}
+
+/**
+ * add_volume - add a volume described by the checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @cp_vol: the checkpoint volume record
+ * @eba: the EBA table of the volume
+ * @used_ec: erase counters of the used physical eraseblocks
+ * @scrub: bitmap of physical eraseblocks which have to be scrubbed
+ * @map: bitmap of physical eraseblocks mapped by the EBA tables
+ * @sqnum: the checkpoint sequence number
+ *
+ * This function adds the mapped logical eraseblocks of the volume to the
+ * scanning information as if their VID headers were read, but using the
+ * checkpoint sequence number. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+static int add_volume(struct ubi_device *ubi, struct ubi_scan_info *si,
+		      const struct ubi_cp_volume *cp_vol, const __be32 *eba,
+		      const int *used_ec, const unsigned long *scrub,
+		      unsigned long *map, unsigned long long sqnum)
+{
+	int err, lnum, vol_id = be32_to_cpu(cp_vol->vol_id);
+	int used_ebs = be32_to_cpu(cp_vol->used_ebs);
+	int data_pad = be32_to_cpu(cp_vol->data_pad);
+	int reserved_pebs = be32_to_cpu(cp_vol->reserved_pebs);
+	struct ubi_vid_hdr vid_hdr;
+
+	if (be32_to_cpu(cp_vol->magic) != UBI_CP_VOL_MAGIC ||
+	    (vol_id >= UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) ||
+	    vol_id < 0 || data_pad < 0 || data_pad >= ubi->leb_size ||
+	    (cp_vol->vol_type != UBI_VID_DYNAMIC &&
+	     cp_vol->vol_type != UBI_VID_STATIC) ||
+	    used_ebs < 0 || used_ebs > reserved_pebs) {
+		dbg_bld("bad checkpoint record of volume %d", vol_id);
+		return -EINVAL;
+	}
+
+	memset(&vid_hdr, 0, sizeof(struct ubi_vid_hdr));
+	vid_hdr.vol_type = cp_vol->vol_type;
+	if (vol_id == UBI_LAYOUT_VOLUME_ID)
+		vid_hdr.compat = UBI_LAYOUT_VOLUME_COMPAT;
+	vid_hdr.vol_id = cp_vol->vol_id;
+	vid_hdr.sqnum = cpu_to_be64(sqnum);
+	vid_hdr.data_pad = cp_vol->data_pad;
+	if (cp_vol->vol_type == UBI_VID_STATIC)
+		vid_hdr.used_ebs = cp_vol->used_ebs;
+
+	for (lnum = 0; lnum < reserved_pebs; lnum++) {
+		int pnum = be32_to_cpu(eba[lnum]);
+
+		if (pnum == UBI_LEB_UNMAPPED)
+			continue;
+
+		if (pnum < 0 || pnum >= ubi->peb_count || used_ec[pnum] < 0 ||
+		    test_and_set_bit(pnum, map)) {
+			dbg_bld("bad PEB %d of LEB %d:%d in the checkpoint",
+				pnum, vol_id, lnum);
+			return -EINVAL;
+		}
+
+		vid_hdr.lnum = cpu_to_be32(lnum);
+		if (cp_vol->vol_type == UBI_VID_STATIC) {
+			if (lnum == used_ebs - 1)
+				vid_hdr.data_size = cp_vol->last_eb_bytes;
+			else
+				vid_hdr.data_size =
+					cpu_to_be32(ubi->leb_size - data_pad);
+		}
+
+		err = ubi_scan_add_used(ubi, si, pnum, used_ec[pnum], &vid_hdr,
+					test_bit(pnum, scrub));
+		if (err)
+			return err;
+		account_ec(si, used_ec[pnum]);
+	}
+
+	return 0;
+}
+
+/**
+ * add_cp_blocks - add the checkpoint physical eraseblocks.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @sb: the checkpoint super block
+ *
+ * This function reads the EC headers of the physical eraseblocks which
+ * contain the checkpoint and adds them to the @si->cp list. Returns zero in
+ * case of success and a negative error code in case of failure.
+ */
+static int add_cp_blocks(struct ubi_device *ubi, struct ubi_scan_info *si,
+			 const struct ubi_cp_sb *sb)
+{
+	int i, err = 0, image_seq;
+	long long ec;
+	struct ubi_ec_hdr *ec_hdr;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		return -ENOMEM;
+
+	for (i = 0; i < be32_to_cpu(sb->nblocks); i++) {
+		int pnum = be32_to_cpu(sb->block_loc[i]);
+
+		err = ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
+		if (err && err != UBI_IO_BITFLIPS) {
+			if (err > 0)
+				err = -EINVAL;
+			break;
+		}
+
+		err = -EINVAL;
+		ec = be64_to_cpu(ec_hdr->ec);
+		image_seq = be32_to_cpu(ec_hdr->image_seq);
+		if (ec_hdr->version != UBI_VERSION ||
+		    ec > UBI_MAX_ERASECOUNTER ||
+		    (ubi->image_seq && image_seq &&
+		     ubi->image_seq != image_seq))
+			break;
+		if (!ubi->image_seq)
+			ubi->image_seq = image_seq;
+
+		account_ec(si, ec);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->cp);
+		if (err)
+			break;
+	}
+
+	kfree(ec_hdr);
+	return err;
+}
+
+/**
+ * process_cp - build scanning information from the checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ * @seen: bitmap of physical eraseblocks described by the checkpoint
+ * @buf: the checkpoint
+ * @len: size of the checkpoint
+ * @sqnums: sequence numbers of the first @region physical eraseblocks
+ * @region: how many physical eraseblocks @sqnums describes
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure (%-EINVAL if the checkpoint is invalid or stale).
+ */
+static int process_cp(struct ubi_device *ubi, struct ubi_scan_info *si,
+		      unsigned long *seen, void *buf, int len,
+		      const unsigned long long *sqnums, int region)
+{
+	int i, err, pool_size, free_count, used_count, erase_count, vol_count;
+	int map_size = BITS_TO_LONGS(ubi->peb_count) * sizeof(unsigned long);
+	unsigned long long sqnum;
+	unsigned long *map = NULL, *scrub = NULL, *pool_map = NULL;
+	int *used_ec = NULL;
+	struct ubi_cp_sb *sb = buf;
+	struct ubi_cp_hdr *hdr;
+	struct ubi_cp_ec *cp_free, *cp_used, *cp_erase;
+	__be32 *pool;
+	void *pos = buf + sizeof(struct ubi_cp_sb), *end = buf + len;
+	u8 region_ok[UBI_CP_MAX_START];
+
+	sqnum = be64_to_cpu(sb->sqnum);
+	hdr = cp_get(&pos, end, sizeof(struct ubi_cp_hdr));
+	if (!hdr || be32_to_cpu(hdr->magic) != UBI_CP_HDR_MAGIC ||
+	    be32_to_cpu(hdr->peb_count) != ubi->peb_count) {
+		dbg_bld("bad checkpoint header");
+		return -EINVAL;
+	}
+
+	pool_size = be32_to_cpu(hdr->pool_size);
+	free_count = be32_to_cpu(hdr->free_count);
+	used_count = be32_to_cpu(hdr->used_count);
+	i = be32_to_cpu(hdr->scrub_count);
+	erase_count = be32_to_cpu(hdr->erase_count);
+	vol_count = be32_to_cpu(hdr->vol_count);
+	if (pool_size < 0 || pool_size > ubi->peb_count ||
+	    free_count < 0 || free_count > ubi->peb_count ||
+	    used_count < 0 || used_count > ubi->peb_count ||
+	    i < 0 || i > ubi->peb_count ||
+	    erase_count < 0 || erase_count > ubi->peb_count ||
+	    vol_count < 0 || vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) {
+		dbg_bld("bad checkpoint header counters");
+		return -EINVAL;
+	}
+
+	pool = cp_get(&pos, end, pool_size * sizeof(__be32));
+	cp_free = cp_get(&pos, end, free_count * sizeof(struct ubi_cp_ec));
+	cp_used = cp_get(&pos, end, (used_count + i) *
+			 sizeof(struct ubi_cp_ec));
+	cp_erase = cp_get(&pos, end, erase_count * sizeof(struct ubi_cp_ec));
+	if (!pool || !cp_free || !cp_used || !cp_erase) {
+		dbg_bld("truncated checkpoint");
+		return -EINVAL;
+	}
+	used_count += i;
+
+	err = -ENOMEM;
+	map = kzalloc(map_size, GFP_KERNEL);
+	scrub = kzalloc(map_size, GFP_KERNEL);
+	pool_map = kzalloc(map_size, GFP_KERNEL);
+	used_ec = vmalloc(ubi->peb_count * sizeof(int));
+	if (!map || !scrub || !pool_map || !used_ec)
+		goto out_free;
+
+	/* Mark everything the checkpoint describes, rejecting duplicates */
+	err = -EINVAL;
+	memset(region_ok, 0, sizeof(region_ok));
+	for (i = 0; i < be32_to_cpu(sb->nblocks); i++) {
+		int pnum = be32_to_cpu(sb->block_loc[i]);
+
+		if (mark_peb(ubi, seen, pnum))
+			goto out_free;
+		if (pnum < region)
+			region_ok[pnum] = 1;
+	}
+
+	for (i = 0; i < pool_size; i++) {
+		int pnum = be32_to_cpu(pool[i]);
+
+		if (mark_peb(ubi, seen, pnum))
+			goto out_free;
+		__set_bit(pnum, pool_map);
+		if (pnum < region)
+			region_ok[pnum] = 1;
+	}
+
+	for (i = 0; i < ubi->peb_count; i++)
+		used_ec[i] = -1;
+
+	for (i = 0; i < free_count + used_count + erase_count; i++) {
+		/* The free, used, and erase arrays are contiguous */
+		int pnum = be32_to_cpu(cp_free[i].pnum);
+		int ec = be32_to_cpu(cp_free[i].ec);
+
+		if (mark_peb(ubi, seen, pnum) || ec < 0 ||
+		    ec > UBI_MAX_ERASECOUNTER)
+			goto out_free;
+
+		if (i >= free_count && i < free_count + used_count) {
+			used_ec[pnum] = ec;
+			if (i >= free_count + be32_to_cpu(hdr->used_count))
+				__set_bit(pnum, scrub);
+		}
+	}
+
+	/*
+	 * All physical eraseblocks written after the checkpoint belong to the
+	 * pool, so if there is a newer one outside of the pool, the checkpoint
+	 * is stale. This may happen if the device was used by an UBI
+	 * implementation which does not know about checkpoints.
+	 */
+	for (i = 0; i < region; i++)
+		if (sqnums[i] && sqnums[i] >= sqnum && !region_ok[i]) {
+			ubi_warn("PEB %d is newer than the checkpoint", i);
+			goto out_free;
+		}
+
+	for (i = 0; i < vol_count; i++) {
+		struct ubi_cp_volume *cp_vol;
+		__be32 *eba;
+
+		cp_vol = cp_get(&pos, end, sizeof(struct ubi_cp_volume));
+		if (!cp_vol ||
+		    be32_to_cpu(cp_vol->reserved_pebs) > ubi->peb_count)
+			goto out_free;
+		eba = cp_get(&pos, end, be32_to_cpu(cp_vol->reserved_pebs) *
+			     sizeof(__be32));
+		if (!eba)
+			goto out_free;
+
+		err = add_volume(ubi, si, cp_vol, eba, used_ec, scrub, map,
+				 sqnum);
+		if (err)
+			goto out_free;
+	}
+
+	for (i = 0; i < free_count; i++) {
+		int ec = be32_to_cpu(cp_free[i].ec);
+
+		account_ec(si, ec);
+		err = ubi_scan_add_to_list(si, be32_to_cpu(cp_free[i].pnum),
+					   ec, &si->free);
+		if (err)
+			goto out_free;
+	}
+
+	/* Used physical eraseblocks which are not mapped have to be erased */
+	for (i = 0; i < used_count; i++) {
+		int pnum = be32_to_cpu(cp_used[i].pnum);
+
+		if (test_bit(pnum, map))
+			continue;
+		err = add_erase(ubi, si, seen, pnum,
+				be32_to_cpu(cp_used[i].ec));
+		if (err)
+			goto out_free;
+	}
+
+	for (i = 0; i < erase_count; i++) {
+		err = add_erase(ubi, si, seen, be32_to_cpu(cp_erase[i].pnum),
+				be32_to_cpu(cp_erase[i].ec));
+		if (err)
+			goto out_free;
+	}
+
+	err = add_cp_blocks(ubi, si, sb);
+	if (err)
+		goto out_free;
+
+	/* The pool has to be scanned */
+	for (i = 0; i < pool_size; i++)
+		clear_bit(be32_to_cpu(pool[i]), seen);
+
+	si->cp_sqnum = sqnum;
+	if (si->max_sqnum < sqnum)
+		si->max_sqnum = sqnum;
+	si->cp_used_map = map;
+	si->cp_pool_map = pool_map;
+	map = pool_map = NULL;
+
+	ubi_msg("attaching by checkpoint: sqnum %llu, %d PEBs in %d blocks, "
+		"%d PEBs in the pool", sqnum, free_count + used_count +
+		erase_count, be32_to_cpu(sb->nblocks), pool_size);
+	err = 0;
+
+out_free:
+	vfree(used_ec);
+	kfree(pool_map);
+	kfree(scrub);
+	kfree(map);
+	return err;
+}
+
+/**
+ * erase_old_anchor - erase the anchor of a superseded checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @pnum: the physical eraseblock which contains the old anchor
+ *
+ * The new checkpoint lists the old anchor as to be erased. It is erased right
+ * away, so that the old checkpoint cannot come back if the new one is
+ * invalidated before the WL sub-system gets to it. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int erase_old_anchor(struct ubi_device *ubi, struct ubi_scan_info *si,
+			    int pnum)
+{
+	int err;
+	struct ubi_scan_leb *seb;
+
+	if (ubi->ro_mode)
+		return 0;
+
+	list_for_each_entry(seb, &si->erase, u.list)
+		if (seb->pnum == pnum) {
+			err = ubi_scan_erase_peb(ubi, si, pnum, seb->ec + 1);
+			if (err)
+				return err;
+			seb->ec += 1;
+			list_move(&seb->u.list, &si->free);
+			return 0;
+		}
+
+	dbg_bld("old checkpoint anchor PEB %d is not to be erased", pnum);
+	return -EINVAL;
+}
+
+/**
+ * ubi_read_checkpoint - read the checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ * @seen: bitmap to mark the physical eraseblocks described by the checkpoint
+ *
+ * This function looks for the checkpoint and, if there is a valid one, fills
+ * @si with the information it contains and marks the described physical
+ * eraseblocks in @seen, so that only the rest has to be scanned. Returns zero
+ * in case of success, %UBI_NO_CHECKPOINT if there is no valid checkpoint, in
+ * which case @si and @seen may contain garbage and the whole device has to be
+ * scanned, and a negative error code in case of failure.
+ */
+int ubi_read_checkpoint(struct ubi_device *ubi, struct ubi_scan_info *si,
+			unsigned long *seen)
+{
+	int i, err, count, region, len = 0, anchors[2];
+	unsigned long long *sqnums;
+	struct ubi_vid_hdr *vid_hdr;
+	void *buf;
+
+	region = min_t(int, ubi->peb_count, UBI_CP_MAX_START);
+	sqnums = kmalloc(region * sizeof(unsigned long long), GFP_KERNEL);
+	if (!sqnums)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		goto out_free;
+
+	count = find_anchor(ubi, vid_hdr, sqnums, region, anchors);
+	if (count == 0) {
+		dbg_bld("no checkpoint found");
+		err = UBI_NO_CHECKPOINT;
+		goto out_vid_hdr;
+	} else if (count < 0) {
+		err = count;
+		goto out_vid_hdr;
+	}
+
+	for (i = 0; i < count; i++) {
+		buf = read_cp_data(ubi, anchors[i], sqnums[anchors[i]],
+				   vid_hdr, &len);
+		if (!IS_ERR(buf) || PTR_ERR(buf) != -EINVAL)
+			break;
+		/*
+		 * The newer checkpoint may have been written only partially,
+		 * in which case the older one is still valid and scans the
+		 * blocks of the newer one.
+		 */
+		dbg_bld("checkpoint in PEB %d is invalid", anchors[i]);
+	}
+	if (IS_ERR(buf)) {
+		err = PTR_ERR(buf);
+		goto out_vid_hdr;
+	}
+
+	err = process_cp(ubi, si, seen, buf, len, sqnums, region);
+	vfree(buf);
+	if (!err && i == 0 && count == 2)
+		err = erase_old_anchor(ubi, si, anchors[1]);
+
+out_vid_hdr:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_free:
+	kfree(sqnums);
+	if (err < 0 && err != -ENOMEM) {
+		ubi_warn("cannot use the checkpoint (error %d), scanning",
+			 err);
+		err = UBI_NO_CHECKPOINT;
+	}
+	return err;
+}
@@ -340,8 +340,10 @@ int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 
 	dbg_eba("erase LEB %d:%d, PEB %d", vol_id, lnum, pnum);
 
+	ubi_cp_eba_lock(ubi);
 	vol->eba_tbl[lnum] = UBI_LEB_UNMAPPED;
 	err = ubi_wl_put_peb(ubi, pnum, 0);
+	ubi_cp_eba_unlock(ubi);
 
 out_unlock:
 	leb_write_unlock(ubi, vol_id, lnum);
@@ -507,8 +509,10 @@ static int recover_peb(struct ubi_device *ubi, int pnum, int vol_id, int lnum,
 		return -ENOMEM;
 
 retry:
+	ubi_cp_eba_lock(ubi);
 	new_pnum = ubi_wl_get_peb(ubi, UBI_UNKNOWN);
 	if (new_pnum < 0) {
+		ubi_cp_eba_unlock(ubi);
 		ubi_free_vid_hdr(ubi, vid_hdr);
 		return new_pnum;
 	}
@@ -551,6 +555,7 @@ retry:
 
 	vol->eba_tbl[lnum] = new_pnum;
 	ubi_wl_put_peb(ubi, pnum, 1);
+	ubi_cp_eba_unlock(ubi);
 
 	ubi_msg("data was successfully recovered");
 	return 0;
@@ -559,6 +564,7 @@ out_unlock:
 	mutex_unlock(&ubi->buf_mutex);
 out_put:
 	ubi_wl_put_peb(ubi, new_pnum, 1);
+	ubi_cp_eba_unlock(ubi);
 	ubi_free_vid_hdr(ubi, vid_hdr);
 	return err;
 
@@ -569,6 +575,7 @@ write_error:
 	 */
 	ubi_warn("failed to write to PEB %d", new_pnum);
 	ubi_wl_put_peb(ubi, new_pnum, 1);
+	ubi_cp_eba_unlock(ubi);
 	if (++tries > UBI_IO_RETRIES) {
 		ubi_free_vid_hdr(ubi, vid_hdr);
 		return err;
@@ -634,19 +641,21 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	}
 
 	vid_hdr->vol_type = UBI_VID_DYNAMIC;
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
 	vid_hdr->data_pad = cpu_to_be32(vol->data_pad);
 
 retry:
+	ubi_cp_eba_lock(ubi);
 	pnum = ubi_wl_get_peb(ubi, dtype);
 	if (pnum < 0) {
+		ubi_cp_eba_unlock(ubi);
 		ubi_free_vid_hdr(ubi, vid_hdr);
 		leb_write_unlock(ubi, vol_id, lnum);
 		return pnum;
 	}
+	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 
 	dbg_eba("write VID hdr and %d bytes at offset %d of LEB %d:%d, PEB %d",
 		len, offset, vol_id, lnum, pnum);
@@ -669,6 +678,7 @@ retry:
 	}
 
 	vol->eba_tbl[lnum] = pnum;
+	ubi_cp_eba_unlock(ubi);
 
 	leb_write_unlock(ubi, vol_id, lnum);
 	ubi_free_vid_hdr(ubi, vid_hdr);
@@ -676,6 +686,7 @@ retry:
 
 write_error:
 	if (err != -EIO || !ubi->bad_allowed) {
+		ubi_cp_eba_unlock(ubi);
 		ubi_ro_mode(ubi);
 		leb_write_unlock(ubi, vol_id, lnum);
 		ubi_free_vid_hdr(ubi, vid_hdr);
@@ -688,6 +699,7 @@ write_error:
 	 * this physical eraseblock went bad, the erase code will handle that.
 	 */
 	err = ubi_wl_put_peb(ubi, pnum, 1);
+	ubi_cp_eba_unlock(ubi);
 	if (err || ++tries > UBI_IO_RETRIES) {
 		ubi_ro_mode(ubi);
 		leb_write_unlock(ubi, vol_id, lnum);
@@ -695,7 +707,6 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -750,7 +761,6 @@ int ubi_eba_write_leb_st(struct ubi_device *ubi, struct ubi_volume *vol,
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -763,12 +773,15 @@ int ubi_eba_write_leb_st(struct ubi_device *ubi, struct ubi_volume *vol,
 	vid_hdr->data_crc = cpu_to_be32(crc);
 
 retry:
+	ubi_cp_eba_lock(ubi);
 	pnum = ubi_wl_get_peb(ubi, dtype);
 	if (pnum < 0) {
+		ubi_cp_eba_unlock(ubi);
 		ubi_free_vid_hdr(ubi, vid_hdr);
 		leb_write_unlock(ubi, vol_id, lnum);
 		return pnum;
 	}
+	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 
 	dbg_eba("write VID hdr and %d bytes at LEB %d:%d, PEB %d, used_ebs %d",
 		len, vol_id, lnum, pnum, used_ebs);
@@ -789,6 +802,7 @@ retry:
 
 	ubi_assert(vol->eba_tbl[lnum] < 0);
 	vol->eba_tbl[lnum] = pnum;
+	ubi_cp_eba_unlock(ubi);
 
 	leb_write_unlock(ubi, vol_id, lnum);
 	ubi_free_vid_hdr(ubi, vid_hdr);
@@ -801,6 +815,7 @@ write_error:
 		 * something nasty and unexpected happened. Switch to read-only
 		 * mode just in case.
 		 */
+		ubi_cp_eba_unlock(ubi);
 		ubi_ro_mode(ubi);
 		leb_write_unlock(ubi, vol_id, lnum);
 		ubi_free_vid_hdr(ubi, vid_hdr);
@@ -808,6 +823,7 @@ write_error:
 	}
 
 	err = ubi_wl_put_peb(ubi, pnum, 1);
+	ubi_cp_eba_unlock(ubi);
 	if (err || ++tries > UBI_IO_RETRIES) {
 		ubi_ro_mode(ubi);
 		leb_write_unlock(ubi, vol_id, lnum);
@@ -815,7 +831,6 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -868,7 +883,6 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 	if (err)
 		goto out_mutex;
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -881,11 +895,14 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 	vid_hdr->data_crc = cpu_to_be32(crc);
 
 retry:
+	ubi_cp_eba_lock(ubi);
 	pnum = ubi_wl_get_peb(ubi, dtype);
 	if (pnum < 0) {
+		ubi_cp_eba_unlock(ubi);
 		err = pnum;
 		goto out_leb_unlock;
 	}
+	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 
 	dbg_eba("change LEB %d:%d, PEB %d, write VID hdr to PEB %d",
 		vol_id, lnum, vol->eba_tbl[lnum], pnum);
@@ -907,11 +924,13 @@ retry:
 	if (vol->eba_tbl[lnum] >= 0) {
 		err = ubi_wl_put_peb(ubi, vol->eba_tbl[lnum], 0);
 		if (err)
-			goto out_leb_unlock;
+			goto out_cp_unlock;
 	}
 
 	vol->eba_tbl[lnum] = pnum;
 
+out_cp_unlock:
+	ubi_cp_eba_unlock(ubi);
 out_leb_unlock:
 	leb_write_unlock(ubi, vol_id, lnum);
 out_mutex:
@@ -927,16 +946,16 @@ write_error:
 		 * mode just in case.
 		 */
 		ubi_ro_mode(ubi);
-		goto out_leb_unlock;
+		goto out_cp_unlock;
 	}
 
 	err = ubi_wl_put_peb(ubi, pnum, 1);
+	ubi_cp_eba_unlock(ubi);
 	if (err || ++tries > UBI_IO_RETRIES) {
 		ubi_ro_mode(ubi);
 		goto out_leb_unlock;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -89,6 +89,8 @@
 #include <linux/crc32.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/completion.h>
 #include "ubi.h"
 
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
@@ -107,6 +109,199 @@ static int paranoid_check_vid_hdr(const struct ubi_device *ubi, int pnum,
 #define paranoid_check_vid_hdr(ubi, pnum, vid_hdr) 0
 #endif
 
+/*
+ * Header read-ahead.
+ *
+ * When attaching by scanning, UBI reads the EC and VID headers of every
+ * physical eraseblock, one after the other, and checks them before moving
+ * on to the next eraseblock.  To keep the flash busy while the headers are
+ * checked, the header area of the following eraseblocks is read ahead using
+ * asynchronous MTD requests: there are two windows of %UBI_HDR_RA_PEBS
+ * eraseblocks each, and while the scanning consumes one window, the other one
+ * is being read.  A window is refilled as soon as the scanning has moved past
+ * it.
+ *
+ * Read-ahead is only active during scanning, which is single-threaded and
+ * does not write to the flash, so no locking or invalidation is needed. Only
+ * clean reads and reads with corrected bit-flips are served from the
+ * read-ahead buffers, everything else is re-read by 'ubi_io_read()' the usual
+ * way.
+ */
+#define UBI_HDR_RA_PEBS 16
+
+struct ubi_hdr_ra_win {
+	int count;
+	int pnum[UBI_HDR_RA_PEBS];
+	struct mtd_io_vec vec[UBI_HDR_RA_PEBS];
+	struct mtd_io_req req;
+	struct completion done;
+	void *buf;
+};
+
+struct ubi_hdr_ra {
+	int len;
+	int next;
+	const unsigned long *skip;
+	struct ubi_hdr_ra_win win[2];
+};
+
+static void hdr_ra_done(struct mtd_io_req *req)
+{
+	struct ubi_hdr_ra_win *win = req->priv;
+
+	complete_all(&win->done);
+}
+
+/* Refill @win with the next eraseblocks to be scanned */
+static void hdr_ra_fill(const struct ubi_device *ubi,
+			struct ubi_hdr_ra_win *win)
+{
+	struct ubi_hdr_ra *ra = ubi->hdr_ra;
+	int pnum, i = 0;
+
+	for (pnum = ra->next; pnum < ubi->peb_count; pnum++) {
+		if (i == UBI_HDR_RA_PEBS)
+			break;
+		if (ra->skip && test_bit(pnum, ra->skip))
+			continue;
+		if (ubi->bad_allowed && ubi_io_is_bad(ubi, pnum))
+			continue;
+
+		win->pnum[i] = pnum;
+		win->vec[i].ofs = (loff_t)pnum * ubi->peb_size;
+		win->vec[i].len = ra->len;
+		win->vec[i].buf = win->buf + i * ra->len;
+		i += 1;
+	}
+	ra->next = pnum;
+	win->count = i;
+	if (!i)
+		return;
+
+	INIT_COMPLETION(win->done);
+	win->req.dir = MTD_IO_READ;
+	win->req.vec = win->vec;
+	win->req.nr_vec = i;
+	win->req.complete = hdr_ra_done;
+	win->req.priv = win;
+	if (mtd_submit(ubi->mtd, &win->req))
+		win->count = 0;
+}
+
+static void hdr_ra_wait(struct ubi_hdr_ra_win *win)
+{
+	if (win->count)
+		wait_for_completion(&win->done);
+}
+
+/**
+ * hdr_ra_read - serve a read from the header read-ahead buffers.
+ * @ubi: UBI device description object
+ * @buf: buffer where to store the read data
+ * @pnum: physical eraseblock number to read from
+ * @offset: offset within the physical eraseblock from where to read
+ * @len: how many bytes to read
+ *
+ * Returns %0 or %-EUCLEAN if the data were read ahead, and %-ENOENT if they
+ * were not or if the read-ahead failed.
+ */
+static int hdr_ra_read(const struct ubi_device *ubi, void *buf, int pnum,
+		       int offset, int len)
+{
+	struct ubi_hdr_ra *ra = ubi->hdr_ra;
+	int i, j;
+
+	if (offset + len > ra->len)
+		return -ENOENT;
+
+	for (i = 0; i < 2; i++) {
+		struct ubi_hdr_ra_win *win = &ra->win[i];
+
+		/* The scanning has moved past this window, refill it */
+		if (win->count && pnum > win->pnum[win->count - 1]) {
+			hdr_ra_wait(win);
+			hdr_ra_fill(ubi, win);
+		}
+
+		for (j = 0; j < win->count; j++) {
+			struct mtd_io_vec *vec = &win->vec[j];
+
+			if (win->pnum[j] != pnum)
+				continue;
+
+			hdr_ra_wait(win);
+			if (vec->ret && vec->ret != -EUCLEAN)
+				return -ENOENT;
+			if (vec->retlen != vec->len)
+				return -ENOENT;
+			memcpy(buf, vec->buf + offset, len);
+			return vec->ret;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * ubi_io_hdr_ra_start - start reading headers ahead of scanning.
+ * @ubi: UBI device description object
+ * @skip: bitmap of physical eraseblocks which will not be scanned, may be
+ *        %NULL
+ *
+ * The scanning has to go through the physical eraseblocks in ascending order
+ * and call 'ubi_io_hdr_ra_stop()' when it is done. Read-ahead is only an
+ * optimization, so this function silently does nothing if it cannot allocate
+ * memory.
+ */
+void ubi_io_hdr_ra_start(struct ubi_device *ubi, const unsigned long *skip)
+{
+	struct ubi_hdr_ra *ra;
+	int i;
+
+	ra = kzalloc(sizeof(struct ubi_hdr_ra), GFP_KERNEL);
+	if (!ra)
+		return;
+
+	ra->len = max(ubi->ec_hdr_alsize,
+		      ubi->vid_hdr_aloffset + ubi->vid_hdr_alsize);
+	ra->skip = skip;
+	for (i = 0; i < 2; i++) {
+		ra->win[i].buf = vmalloc(UBI_HDR_RA_PEBS * ra->len);
+		if (!ra->win[i].buf)
+			goto out_free;
+		init_completion(&ra->win[i].done);
+	}
+
+	ubi->hdr_ra = ra;
+	for (i = 0; i < 2; i++)
+		hdr_ra_fill(ubi, &ra->win[i]);
+	return;
+
+out_free:
+	vfree(ra->win[0].buf);
+	kfree(ra);
+}
+
+/**
+ * ubi_io_hdr_ra_stop - stop reading headers ahead.
+ * @ubi: UBI device description object
+ */
+void ubi_io_hdr_ra_stop(struct ubi_device *ubi)
+{
+	struct ubi_hdr_ra *ra = ubi->hdr_ra;
+	int i;
+
+	if (!ra)
+		return;
+
+	ubi->hdr_ra = NULL;
+	for (i = 0; i < 2; i++) {
+		hdr_ra_wait(&ra->win[i]);
+		vfree(ra->win[i].buf);
+	}
+	kfree(ra);
+}
+
 /**
  * ubi_io_read - read data from a physical eraseblock.
  * @ubi: UBI device description object
@@ -147,8 +342,16 @@ int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
 		return err;
 
 	addr = (loff_t)pnum * ubi->peb_size + offset;
+	if (ubi->hdr_ra) {
+		err = hdr_ra_read(ubi, buf, pnum, offset, len);
+		if (err != -ENOENT) {
+			read = len;
+			goto check;
+		}
+	}
 retry:
 	err = ubi->mtd->read(ubi->mtd, addr, len, &read, buf);
+check:
 	if (err) {
 		const char *errstr = (err == -EBADMSG) ? " (ECC error)" : "";
 
@@ -92,7 +92,8 @@ static struct ubi_vid_hdr *vidh;
  * @to_head: if not zero, add to the head of the list
  * @list: the list to add to
  *
- * This function adds physical eraseblock @pnum to free, erase, or alien lists.
+ * This function adds physical eraseblock @pnum to free, erase, alien, or
+ * checkpoint lists.
  * If @to_head is not zero, PEB will be added to the head of the list, which
  * basically means it will be processed first later. E.g., we add corrupted
  * PEBs (corrupted due to power cuts) to the head of the erase list to make
@@ -112,6 +113,8 @@ static int add_to_list(struct ubi_scan_info *si, int pnum, int ec, int to_head,
 	} else if (list == &si->alien) {
 		dbg_bld("add to alien: PEB %d, EC %d", pnum, ec);
 		si->alien_peb_count += 1;
+	} else if (list == &si->cp) {
+		dbg_bld("add to checkpoint: PEB %d, EC %d", pnum, ec);
 	} else
 		BUG();
 
@@ -128,6 +131,23 @@ static int add_to_list(struct ubi_scan_info *si, int pnum, int ec, int to_head,
 	return 0;
 }
 
+/**
+ * ubi_scan_add_to_list - add physical eraseblock to a list.
+ * @si: scanning information
+ * @pnum: physical eraseblock number to add
+ * @ec: erase counter of the physical eraseblock
+ * @list: the list to add to
+ *
+ * This is the same as 'add_to_list()', but it is used when the scanning
+ * information is built from the checkpoint. Returns zero in case of success
+ * and a negative error code in case of failure.
+ */
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list)
+{
+	return add_to_list(si, pnum, ec, 0, list);
+}
+
 /**
  * add_corrupted - add a corrupted physical eraseblock.
  * @si: scanning information
@@ -721,6 +741,23 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 	int err = 0;
 	struct ubi_scan_leb *seb, *tmp_seb;
 
+	if (!list_empty(&si->cp)) {
+		/*
+		 * The device was attached using the checkpoint, which does not
+		 * know about the PEB we are going to write. Invalidate the
+		 * checkpoint by erasing its anchor, so that the next attach
+		 * falls back to scanning if we do not manage to write a new
+		 * checkpoint.
+		 */
+		seb = list_entry(si->cp.next, struct ubi_scan_leb, u.list);
+		err = ubi_scan_erase_peb(ubi, si, seb->pnum, seb->ec + 1);
+		if (err)
+			return ERR_PTR(err);
+		seb->ec += 1;
+		list_move(&seb->u.list, &si->free);
+		list_splice_tail_init(&si->cp, &si->erase);
+	}
+
 	if (!list_empty(&si->free)) {
 		seb = list_entry(si->free.next, struct ubi_scan_leb, u.list);
 		list_del(&seb->u.list);
@@ -1005,6 +1042,24 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, will remove it", vol_id, lnum);
+			if (vol_id == UBI_CP_SB_VOLUME_ID && !ec_err &&
+			    !ubi->ro_mode) {
+				/*
+				 * This is an anchor of a checkpoint we do not
+				 * trust. Erase it right now, so that it is
+				 * never used after anything is written to the
+				 * flash.
+				 */
+				err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+				if (!err) {
+					ec += 1;
+					err = add_to_list(si, pnum, ec, 0,
+							  &si->free);
+					if (err)
+						return err;
+					goto adjust_mean_ec;
+				}
+			}
 			err = add_to_list(si, pnum, ec, 1, &si->erase);
 			if (err)
 				return err;
@@ -1127,29 +1182,50 @@ static int check_what_we_have(struct ubi_device *ubi, struct ubi_scan_info *si)
 }
 
 /**
- * ubi_scan - scan an MTD device.
- * @ubi: UBI device description object
+ * alloc_si - allocate scanning information.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * This function returns a pointer to the newly allocated and initialized
+ * scanning information object or %NULL if there is no memory.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+static struct ubi_scan_info *alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
 	INIT_LIST_HEAD(&si->erase);
 	INIT_LIST_HEAD(&si->alien);
+	INIT_LIST_HEAD(&si->cp);
 	si->volumes = RB_ROOT;
+	return si;
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function scans an MTD device and returns complete information about
+ * it. If the device contains a valid checkpoint, only the physical
+ * eraseblocks which are not described by the checkpoint are scanned.
+ * Otherwise, all of them are scanned. In case of failure, an error code is
+ * returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err, pnum, scanned = 0;
+	unsigned long *seen;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+	struct ubi_scan_info *si;
+
+	si = alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
 
 	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
@@ -1160,16 +1236,52 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	if (!vidh)
 		goto out_ech;
 
+	seen = kzalloc(BITS_TO_LONGS(ubi->peb_count) * sizeof(unsigned long),
+		       GFP_KERNEL);
+	if (!seen)
+		goto out_vidh;
+
+	err = ubi_read_checkpoint(ubi, si, seen);
+	if (err < 0)
+		goto out_seen;
+	if (err == UBI_NO_CHECKPOINT) {
+		struct ubi_scan_info *new_si;
+
+		/* Start from scratch and scan everything */
+		new_si = alloc_si();
+		if (!new_si) {
+			err = -ENOMEM;
+			goto out_seen;
+		}
+		ubi_scan_destroy_si(si);
+		si = new_si;
+		memset(seen, 0, BITS_TO_LONGS(ubi->peb_count) *
+				sizeof(unsigned long));
+	}
+
+	ubi_io_hdr_ra_start(ubi, seen);
 	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
 		cond_resched();
 
+		if (test_bit(pnum, seen))
+			continue;
+
 		dbg_gen("process PEB %d", pnum);
 		err = process_eb(ubi, si, pnum);
-		if (err < 0)
-			goto out_vidh;
+		if (err < 0) {
+			ubi_io_hdr_ra_stop(ubi);
+			goto out_seen;
+		}
+		scanned += 1;
 	}
+	ubi_io_hdr_ra_stop(ubi);
 
+	kfree(seen);
+	seen = NULL;
 	dbg_msg("scanning is finished");
+	if (scanned != ubi->peb_count)
+		ubi_msg("scanned %d PEBs not described by the checkpoint",
+			scanned);
 
 	/* Calculate mean erase counter */
 	if (si->ec_count)
@@ -1177,7 +1289,7 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 
 	err = check_what_we_have(ubi, si);
 	if (err)
-		goto out_vidh;
+		goto out_seen;
 
 	/*
 	 * In case of unknown erase counter we use the mean erase counter
@@ -1204,13 +1316,15 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 
 	err = paranoid_check_si(ubi, si);
 	if (err)
-		goto out_vidh;
+		goto out_seen;
 
 	ubi_free_vid_hdr(ubi, vidh);
 	kfree(ech);
 
 	return si;
 
+out_seen:
+	kfree(seen);
 out_vidh:
 	ubi_free_vid_hdr(ubi, vidh);
 out_ech:
@@ -1279,6 +1393,12 @@ void ubi_scan_destroy_si(struct ubi_scan_info *si)
 		list_del(&seb->u.list);
 		kfree(seb);
 	}
+	list_for_each_entry_safe(seb, seb_tmp, &si->cp, u.list) {
+		list_del(&seb->u.list);
+		kfree(seb);
+	}
+	kfree(si->cp_used_map);
+	kfree(si->cp_pool_map);
 
 	/* Destroy the volume RB-tree */
 	rb = si->volumes.rb_node;
@@ -1464,7 +1584,12 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 				goto bad_vid_hdr;
 			}
 
-			if (seb->sqnum != be64_to_cpu(vidh->sqnum)) {
+			/*
+			 * LEBs described by the checkpoint carry the
+			 * checkpoint sequence number instead of their own.
+			 */
+			if (seb->sqnum != be64_to_cpu(vidh->sqnum) &&
+			    (!si->cp_sqnum || seb->sqnum != si->cp_sqnum)) {
 				ubi_err("bad sqnum %llu", seb->sqnum);
 				goto bad_vid_hdr;
 			}
@@ -1503,7 +1628,8 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 			goto bad_vid_hdr;
 		}
 
-		if (sv->last_data_size != be32_to_cpu(vidh->data_size)) {
+		if (sv->last_data_size != be32_to_cpu(vidh->data_size) &&
+		    (!si->cp_sqnum || last_seb->sqnum != si->cp_sqnum)) {
 			ubi_err("bad last_data_size %d", sv->last_data_size);
 			goto bad_vid_hdr;
 		}
@@ -1542,6 +1668,9 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 	list_for_each_entry(seb, &si->alien, u.list)
 		buf[seb->pnum] = 1;
 
+	list_for_each_entry(seb, &si->cp, u.list)
+		buf[seb->pnum] = 1;
+
 	err = 0;
 	for (pnum = 0; pnum < ubi->peb_count; pnum++)
 		if (!buf[pnum]) {
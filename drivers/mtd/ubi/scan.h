@@ -93,6 +93,8 @@ struct ubi_scan_volume {
  * @erase: list of physical eraseblocks which have to be erased
  * @alien: list of physical eraseblocks which should not be used by UBI (e.g.,
  *         those belonging to "preserve"-compatible internal volumes)
+ * @cp: list of physical eraseblocks which contain the checkpoint the scanning
+ *      information was built from (the anchor goes first)
  * @corr_peb_count: count of PEBs in the @corr list
  * @empty_peb_count: count of PEBs which are presumably empty (contain only
  *                   0xFF bytes)
@@ -106,6 +108,11 @@ struct ubi_scan_volume {
  * @min_ec: lowest erase counter value
  * @max_ec: highest erase counter value
  * @max_sqnum: highest sequence number value
+ * @cp_sqnum: sequence number of the checkpoint the scanning information was
+ *            built from (%0 if the device was fully scanned)
+ * @cp_used_map: bitmap of physical eraseblocks the EBA tables of the
+ *               checkpoint refer to
+ * @cp_pool_map: bitmap of physical eraseblocks in the pool of the checkpoint
  * @mean_ec: mean erase counter value
  * @ec_sum: a temporary variable used when calculating @mean_ec
  * @ec_count: a temporary variable used when calculating @mean_ec
@@ -120,6 +127,7 @@ struct ubi_scan_info {
 	struct list_head free;
 	struct list_head erase;
 	struct list_head alien;
+	struct list_head cp;
 	int corr_peb_count;
 	int empty_peb_count;
 	int alien_peb_count;
@@ -131,6 +139,9 @@ struct ubi_scan_info {
 	int min_ec;
 	int max_ec;
 	unsigned long long max_sqnum;
+	unsigned long long cp_sqnum;
+	unsigned long *cp_used_map;
+	unsigned long *cp_pool_map;
 	int mean_ec;
 	uint64_t ec_sum;
 	int ec_count;
@@ -161,6 +172,8 @@ struct ubi_scan_volume *ubi_scan_find_sv(const struct ubi_scan_info *si,
 					 int vol_id);
 struct ubi_scan_leb *ubi_scan_find_seb(const struct ubi_scan_volume *sv,
 				       int lnum);
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list);
 void ubi_scan_rm_volume(struct ubi_scan_info *si, struct ubi_scan_volume *sv);
 struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 					   struct ubi_scan_info *si);
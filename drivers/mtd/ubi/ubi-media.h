@@ -312,6 +312,31 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The attach checkpoint is stored in two internal volumes: the super block
+ * volume, which contains the checkpoint anchor, and the data volume, which
+ * contains the rest of the checkpoint if it does not fit one eraseblock. They
+ * are "delete" compatible, so UBI implementations which do not support
+ * checkpoints simply erase them and attach the device by scanning.
+ */
+#define UBI_CP_SB_VOLUME_ID      (UBI_INTERNAL_VOL_START + 1)
+#define UBI_CP_DATA_VOLUME_ID    (UBI_INTERNAL_VOL_START + 2)
+#define UBI_CP_VOLUME_COMPAT     UBI_COMPAT_DELETE
+
+/* The checkpoint anchor has to be in one of the first %UBI_CP_MAX_START PEBs */
+#define UBI_CP_MAX_START 64
+
+/* Maximum number of physical eraseblocks a checkpoint may occupy */
+#define UBI_CP_MAX_BLOCKS 32
+
+/* Checkpoint magic numbers (ASCII "UBCP", "UBCH" and "UBCV") */
+#define UBI_CP_SB_MAGIC  0x55424350
+#define UBI_CP_HDR_MAGIC 0x55424348
+#define UBI_CP_VOL_MAGIC 0x55424356
+
+/* The version of the checkpoint format */
+#define UBI_CP_FMT_VERSION 1
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +400,119 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/* Size of the checkpoint super block without the ending CRC */
+#define UBI_CP_SB_SIZE_CRC (sizeof(struct ubi_cp_sb) - sizeof(__be32))
+
+/**
+ * struct ubi_cp_sb - checkpoint super block.
+ * @magic: checkpoint super block magic number (%UBI_CP_SB_MAGIC)
+ * @version: format version of this checkpoint
+ * @padding1: reserved, zeroes
+ * @data_size: size of the checkpoint data following the super block
+ * @data_crc: CRC32 checksum of the checkpoint data
+ * @nblocks: number of physical eraseblocks the checkpoint occupies, including
+ *           the one which holds the super block
+ * @block_loc: physical eraseblocks the checkpoint occupies
+ * @sqnum: sequence number reserved for this checkpoint
+ * @padding2: reserved, zeroes
+ * @sb_crc: CRC32 checksum of the super block
+ *
+ * The super block is stored at the beginning of the logical eraseblock 0 of
+ * the checkpoint super block volume (%UBI_CP_SB_VOLUME_ID), which is called
+ * the checkpoint anchor. The checkpoint data directly follows the super block
+ * and continues in logical eraseblocks 1, 2, ... of the checkpoint data
+ * volume (%UBI_CP_DATA_VOLUME_ID), which are stored in @block_loc[1],
+ * @block_loc[2], and so on.
+ *
+ * All eraseblocks written before the checkpoint have sequence numbers lower
+ * than @sqnum, and all eraseblocks written after the checkpoint have sequence
+ * numbers higher than @sqnum.
+ *
+ * The checkpoint data consists of a &struct ubi_cp_hdr object followed by:
+ *   o @pool_size %__be32 physical eraseblock numbers of the pool - the free
+ *     PEBs which may be written after the checkpoint and which therefore have
+ *     to be scanned when attaching;
+ *   o @free_count &struct ubi_cp_ec objects describing free PEBs;
+ *   o @used_count &struct ubi_cp_ec objects describing used PEBs;
+ *   o @scrub_count &struct ubi_cp_ec objects describing used PEBs which have
+ *     to be scrubbed;
+ *   o @erase_count &struct ubi_cp_ec objects describing PEBs which have to be
+ *     erased;
+ *   o @vol_count &struct ubi_cp_volume objects, each followed by
+ *     @reserved_pebs %__be32 physical eraseblock numbers, one per logical
+ *     eraseblock of the volume (%-1 if the logical eraseblock is unmapped).
+ */
+struct ubi_cp_sb {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  data_size;
+	__be32  data_crc;
+	__be32  nblocks;
+	__be32  block_loc[UBI_CP_MAX_BLOCKS];
+	__be64  sqnum;
+	__u8    padding2[32];
+	__be32  sb_crc;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_cp_hdr - checkpoint data header.
+ * @magic: checkpoint data header magic number (%UBI_CP_HDR_MAGIC)
+ * @peb_count: count of physical eraseblocks on the MTD device
+ * @pool_size: count of physical eraseblocks in the pool
+ * @free_count: count of free physical eraseblocks
+ * @used_count: count of used physical eraseblocks
+ * @scrub_count: count of physical eraseblocks which have to be scrubbed
+ * @erase_count: count of physical eraseblocks which have to be erased
+ * @vol_count: count of volumes, including the layout volume
+ * @padding: reserved, zeroes
+ */
+struct ubi_cp_hdr {
+	__be32  magic;
+	__be32  peb_count;
+	__be32  pool_size;
+	__be32  free_count;
+	__be32  used_count;
+	__be32  scrub_count;
+	__be32  erase_count;
+	__be32  vol_count;
+	__u8    padding[32];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_cp_ec - a physical eraseblock and its erase counter.
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ */
+struct ubi_cp_ec {
+	__be32  pnum;
+	__be32  ec;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_cp_volume - checkpoint volume record.
+ * @magic: checkpoint volume record magic number (%UBI_CP_VOL_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @padding1: reserved, zeroes
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @used_ebs: number of used logical eraseblocks of a static volume
+ * @last_eb_bytes: how many bytes are stored in the last logical eraseblock of
+ *                 a static volume
+ * @reserved_pebs: count of the logical eraseblocks in the EBA table which
+ *                 follows this record
+ * @padding2: reserved, zeroes
+ */
+struct ubi_cp_volume {
+	__be32  magic;
+	__be32  vol_id;
+	__u8    vol_type;
+	__u8    padding1[3];
+	__be32  data_pad;
+	__be32  used_ebs;
+	__be32  last_eb_bytes;
+	__be32  reserved_pebs;
+	__u8    padding2[8];
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -38,6 +38,7 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/ubi.h>
 
@@ -66,6 +67,14 @@
 /* Background thread name pattern */
 #define UBI_BGT_NAME_PATTERN "ubi_bgt%dd"
 
+/* Default and maximum number of background threads per UBI device */
+#define UBI_BGT_THREADS CONFIG_MTD_UBI_BGT_THREADS
+#define UBI_MAX_BGT_THREADS 8
+
+/* Default and maximum number of flash banks erased in parallel */
+#define UBI_ERASE_BANKS CONFIG_MTD_UBI_ERASE_BANKS
+#define UBI_MAX_ERASE_BANKS 16
+
 /* This marker in the EBA table means that the LEB is um-mapped */
 #define UBI_LEB_UNMAPPED -1
 
@@ -107,6 +116,13 @@ enum {
 	UBI_IO_BITFLIPS,
 };
 
+/* Returned by 'ubi_read_checkpoint()' if there is no valid checkpoint */
+#define UBI_NO_CHECKPOINT 1
+
+/* Bounds of the number of PEBs in the checkpoint pool */
+#define UBI_CP_MIN_POOL_SIZE 8
+#define UBI_CP_MAX_POOL_SIZE 256
+
 /*
  * Return codes of the 'ubi_eba_copy_leb()' function.
  *
@@ -149,6 +165,69 @@ struct ubi_wl_entry {
 	int pnum;
 };
 
+/**
+ * struct ubi_work - UBI work description data structure.
+ * @list: a link in the list of pending works
+ * @func: worker function
+ * @queued: when the work was scheduled
+ * @e: physical eraseblock to erase
+ * @torture: if the physical eraseblock has to be tortured
+ *
+ * The @func pointer points to the worker function. If the @cancel argument is
+ * not zero, the worker has to free the resources and exit immediately. The
+ * worker has to return zero in case of success and a negative error code in
+ * case of failure.
+ */
+struct ubi_work {
+	struct list_head list;
+	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
+	ktime_t queued;
+	/* The below fields are only relevant to erasure works */
+	struct ubi_wl_entry *e;
+	int torture;
+};
+
+/* Types of UBI works for the latency statistics */
+enum {
+	UBI_WORK_ERASE,
+	UBI_WORK_WL,
+	UBI_WORK_TYPES
+};
+
+/**
+ * struct ubi_work_stats - UBI work latency statistics.
+ * @count: how many works of this type were done
+ * @total_us: sum of latencies of these works in microseconds
+ * @max_us: maximum latency in microseconds
+ *
+ * The latency of a work is the time from its scheduling to its completion,
+ * so it includes the time the work spent waiting in the queue.
+ */
+struct ubi_work_stats {
+	unsigned long count;
+	unsigned long long total_us;
+	unsigned int max_us;
+};
+
+/**
+ * struct ubi_cp_pool - the checkpoint pool.
+ * @pebs: physical eraseblocks in the pool
+ * @used: how many physical eraseblocks of the pool were already handed out
+ * @size: how many physical eraseblocks are in the pool
+ * @max_size: maximum number of physical eraseblocks in the pool
+ *
+ * When the checkpoint is enabled, new physical eraseblocks are handed out only
+ * from the pool. The pool is recorded in the checkpoint, so that only these
+ * physical eraseblocks have to be scanned when attaching. When the pool is
+ * used up, a new checkpoint is written and the pool is refilled.
+ */
+struct ubi_cp_pool {
+	int *pebs;
+	int used;
+	int size;
+	int max_size;
+};
+
 /**
  * struct ubi_ltree_entry - an entry in the lock tree.
  * @rb: links RB-tree nodes
@@ -341,7 +420,8 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  * 	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- * 	     @erroneous, and @erroneous_peb_count fields
+ * 	     @erroneous, @erroneous_peb_count, @erase_bank_busy, and
+ * 	     @work_stats fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -352,9 +432,35 @@ struct ubi_wl_entry;
  * @move_to_put: if the "to" PEB was put
  * @works: list of pending works
  * @works_count: count of pending works
- * @bgt_thread: background thread description object
- * @thread_enabled: if the background thread is enabled
- * @bgt_name: background thread name
+ * @bgt_threads: background threads description objects
+ * @bgt_count: how many background threads the device has
+ * @thread_enabled: if the background threads are enabled
+ * @bgt_name: name of the first background thread, the others are called
+ *            "<bgt_name>/<thread number>"
+ * @erase_banks: how many erase banks the flash is split into
+ * @erase_bank_pebs: how many physical eraseblocks an erase bank contains
+ * @erase_bank_busy: how many erasures are in progress in each erase bank
+ * @work_stats: latency statistics of each type of works
+ *
+ * @cp_pool: the pool of physical eraseblocks handed out between checkpoints
+ * @cp_e: wear-leveling entries of the physical eraseblocks holding the
+ *        current on-flash checkpoint (the anchor goes first)
+ * @cp_nblocks: how many physical eraseblocks the current on-flash checkpoint
+ *              occupies (%0 if there is no valid checkpoint on the flash)
+ * @cp_next: wear-leveling entries of free physical eraseblocks reserved for
+ *           the next checkpoint (the anchor goes first); the current on-flash
+ *           checkpoint lists them in its pool, so they are scanned if the
+ *           next checkpoint is only partially written
+ * @cp_next_count: how many physical eraseblocks are in @cp_next
+ * @cp_max_blocks: how many physical eraseblocks a checkpoint may need
+ * @cp_disabled: non-zero if checkpoints are not written for this device
+ * @cp_used_map: bitmap of physical eraseblocks referred to by the EBA tables
+ *               of the on-flash checkpoint; their erasure is deferred
+ * @cp_deferred: list of erasure works deferred until the next checkpoint
+ * @cp_eba_sem: taken in read mode while a new physical eraseblock is being
+ *              mapped or a mapped one is being unmapped, and in write mode
+ *              while a checkpoint is being written
+ * @cp_buf: buffer used to read and write the checkpoint
  *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
@@ -382,6 +488,7 @@ struct ubi_wl_entry;
  *               not
  * @nor_flash: non-zero if working on top of NOR flash
  * @mtd: MTD device descriptor
+ * @hdr_ra: header read-ahead state, only used while scanning
  *
  * @peb_buf1: a buffer of PEB size used for different purposes
  * @peb_buf2: another buffer of PEB size used for different purposes
@@ -439,9 +546,29 @@ struct ubi_device {
 	int move_to_put;
 	struct list_head works;
 	int works_count;
-	struct task_struct *bgt_thread;
+	struct task_struct *bgt_threads[UBI_MAX_BGT_THREADS];
+	int bgt_count;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
+	int erase_banks;
+	int erase_bank_pebs;
+	int erase_bank_busy[UBI_MAX_ERASE_BANKS];
+	struct ubi_work_stats work_stats[UBI_WORK_TYPES];
+
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	/* Attach checkpoint stuff */
+	struct ubi_cp_pool cp_pool;
+	struct ubi_wl_entry *cp_e[UBI_CP_MAX_BLOCKS];
+	int cp_nblocks;
+	struct ubi_wl_entry *cp_next[UBI_CP_MAX_BLOCKS];
+	int cp_next_count;
+	int cp_max_blocks;
+	int cp_disabled;
+	unsigned long *cp_used_map;
+	struct list_head cp_deferred;
+	struct rw_semaphore cp_eba_sem;
+	void *cp_buf;
+#endif
 
 	/* I/O sub-system's stuff */
 	long long flash_size;
@@ -465,6 +592,7 @@ struct ubi_device {
 	unsigned int bad_allowed:1;
 	unsigned int nor_flash:1;
 	struct mtd_info *mtd;
+	struct ubi_hdr_ra *hdr_ra;
 
 	void *peb_buf1;
 	void *peb_buf2;
@@ -541,6 +669,35 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+int ubi_is_erase_work(struct ubi_work *wrk);
+struct ubi_wl_entry *ubi_wl_get_cp_peb(struct ubi_device *ubi, int max_pnum,
+				       const unsigned long *only);
+int ubi_wl_put_cp_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int erase);
+int ubi_wl_erase_cp_peb(struct ubi_device *ubi, struct ubi_wl_entry *e);
+void ubi_wl_return_pool(struct ubi_device *ubi);
+void ubi_wl_refill_pool(struct ubi_device *ubi);
+void ubi_wl_set_cp_map(struct ubi_device *ubi, unsigned long *map);
+
+/* checkpoint.c */
+int ubi_read_checkpoint(struct ubi_device *ubi, struct ubi_scan_info *si,
+			unsigned long *seen);
+int ubi_cp_init(struct ubi_device *ubi, struct ubi_scan_info *si);
+void ubi_cp_close(struct ubi_device *ubi);
+int ubi_update_checkpoint(struct ubi_device *ubi);
+int ubi_ensure_checkpoint(struct ubi_device *ubi);
+#else
+static inline int ubi_read_checkpoint(struct ubi_device *ubi,
+				      struct ubi_scan_info *si,
+				      unsigned long *seen)
+{
+	return UBI_NO_CHECKPOINT;
+}
+static inline int ubi_update_checkpoint(struct ubi_device *ubi) { return 0; }
+static inline int ubi_ensure_checkpoint(struct ubi_device *ubi) { return 0; }
+#endif
+
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
 		int len);
@@ -557,9 +714,12 @@ int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 			struct ubi_vid_hdr *vid_hdr, int verbose);
 int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 			 struct ubi_vid_hdr *vid_hdr);
+void ubi_io_hdr_ra_start(struct ubi_device *ubi, const unsigned long *skip);
+void ubi_io_hdr_ra_stop(struct ubi_device *ubi);
 
 /* build.c */
-int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset);
+int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset,
+		       int bgt_threads, int erase_banks);
 int ubi_detach_mtd_dev(int ubi_num, int anyway);
 struct ubi_device *ubi_get_device(int ubi_num);
 void ubi_put_device(struct ubi_device *ubi);
@@ -667,6 +827,32 @@ static inline void ubi_ro_mode(struct ubi_device *ubi)
 	}
 }
 
+/**
+ * ubi_cp_eba_lock - prevent the checkpoint from being written.
+ * @ubi: UBI device description object
+ *
+ * The EBA sub-system takes this lock before 'ubi_wl_get_peb()' and releases
+ * it with 'ubi_cp_eba_unlock()' once the new physical eraseblock is in the
+ * EBA table, so that a checkpoint never records a half-done mapping.
+ */
+static inline void ubi_cp_eba_lock(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	down_read(&ubi->cp_eba_sem);
+#endif
+}
+
+/**
+ * ubi_cp_eba_unlock - allow the checkpoint to be written.
+ * @ubi: UBI device description object
+ */
+static inline void ubi_cp_eba_unlock(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	up_read(&ubi->cp_eba_sem);
+#endif
+}
+
 /**
  * vol_id2idx - get table index by volume ID.
  * @ubi: UBI device description object
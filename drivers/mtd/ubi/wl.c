@@ -141,26 +141,6 @@
  */
 #define WL_MAX_FAILURES 32
 
-/**
- * struct ubi_work - UBI work description data structure.
- * @list: a link in the list of pending works
- * @func: worker function
- * @e: physical eraseblock to erase
- * @torture: if the physical eraseblock has to be tortured
- *
- * The @func pointer points to the worker function. If the @cancel argument is
- * not zero, the worker has to free the resources and exit immediately. The
- * worker has to return zero in case of success and a negative error code in
- * case of failure.
- */
-struct ubi_work {
-	struct list_head list;
-	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
-	/* The below fields are only relevant to erasure works */
-	struct ubi_wl_entry *e;
-	int torture;
-};
-
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
 static int paranoid_check_ec(struct ubi_device *ubi, int pnum, int ec);
 static int paranoid_check_in_wl_tree(struct ubi_wl_entry *e,
@@ -208,6 +188,82 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
+
+/**
+ * wake_up_bgt - wake up background threads.
+ * @ubi: UBI device description object
+ *
+ * This function wakes up as many background threads as there are pending
+ * works, but not more than there are threads. Has to be called with
+ * @ubi->wl_lock locked.
+ */
+static void wake_up_bgt(struct ubi_device *ubi)
+{
+	int i;
+
+	if (!ubi->thread_enabled)
+		return;
+
+	for (i = 0; i < ubi->bgt_count && i < ubi->works_count; i++)
+		wake_up_process(ubi->bgt_threads[i]);
+}
+
+/**
+ * erase_bank - get the erase bank of a physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock number
+ */
+static inline int erase_bank(const struct ubi_device *ubi, int pnum)
+{
+	return pnum / ubi->erase_bank_pebs;
+}
+
+/**
+ * pick_work - pick the next pending work.
+ * @ubi: UBI device description object
+ *
+ * Normally this is the oldest pending work. But if it is an erasure and
+ * another erasure is already in progress in the same erase bank, the oldest
+ * work which does not have to wait for an erase bank is picked instead, so
+ * that several threads keep different banks busy at the same time. If all
+ * pending works are erasures in busy banks, the oldest one is picked anyway.
+ * Has to be called with @ubi->wl_lock locked and @ubi->works not empty.
+ */
+static struct ubi_work *pick_work(struct ubi_device *ubi)
+{
+	struct ubi_work *wrk;
+
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (wrk->func != erase_worker ||
+		    !ubi->erase_bank_busy[erase_bank(ubi, wrk->e->pnum)])
+			return wrk;
+
+	return list_entry(ubi->works.next, struct ubi_work, list);
+}
+
+/**
+ * account_work - account the latency of a finished work.
+ * @ubi: UBI device description object
+ * @type: type of the work (%UBI_WORK_ERASE or %UBI_WORK_WL)
+ * @queued: when the work was scheduled
+ *
+ * Has to be called with @ubi->wl_lock locked.
+ */
+static void account_work(struct ubi_device *ubi, int type, ktime_t queued)
+{
+	struct ubi_work_stats *stats = &ubi->work_stats[type];
+	s64 us = ktime_us_delta(ktime_get(), queued);
+
+	if (us < 0)
+		us = 0;
+	stats->count += 1;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = min_t(s64, us, UINT_MAX);
+}
+
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
@@ -217,7 +273,8 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
  */
 static int do_work(struct ubi_device *ubi)
 {
-	int err;
+	int err, type, bank = -1;
+	ktime_t queued;
 	struct ubi_work *wrk;
 
 	cond_resched();
@@ -236,10 +293,33 @@ static int do_work(struct ubi_device *ubi)
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
+	wrk = pick_work(ubi);
 	list_del(&wrk->list);
 	ubi->works_count -= 1;
 	ubi_assert(ubi->works_count >= 0);
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	if (wrk->func == erase_worker && ubi->cp_used_map &&
+	    test_bit(wrk->e->pnum, ubi->cp_used_map)) {
+		/*
+		 * The on-flash checkpoint still maps a LEB to this PEB, so it
+		 * must stay intact until the next checkpoint is written. The
+		 * work is not done, so it is not accounted either: it is
+		 * re-queued, with a new time stamp, by 'ubi_wl_set_cp_map()'.
+		 */
+		dbg_wl("defer erasure of PEB %d", wrk->e->pnum);
+		list_add_tail(&wrk->list, &ubi->cp_deferred);
+		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->work_sem);
+		return 0;
+	}
+#endif
+	if (wrk->func == erase_worker) {
+		type = UBI_WORK_ERASE;
+		bank = erase_bank(ubi, wrk->e->pnum);
+		ubi->erase_bank_busy[bank] += 1;
+	} else
+		type = UBI_WORK_WL;
+	queued = wrk->queued;
 	spin_unlock(&ubi->wl_lock);
 
 	/*
@@ -250,6 +330,12 @@ static int do_work(struct ubi_device *ubi)
 	err = wrk->func(ubi, wrk, 0);
 	if (err)
 		ubi_err("work failed with error code %d", err);
+
+	spin_lock(&ubi->wl_lock);
+	if (bank >= 0)
+		ubi->erase_bank_busy[bank] -= 1;
+	account_work(ubi, type, queued);
+	spin_unlock(&ubi->wl_lock);
 	up_read(&ubi->work_sem);
 
 	return err;
@@ -377,38 +463,19 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
 }
 
 /**
- * ubi_wl_get_peb - get a physical eraseblock.
+ * pick_free_peb - pick a free physical eraseblock.
  * @ubi: UBI device description object
  * @dtype: type of data which will be stored in this physical eraseblock
  *
- * This function returns a physical eraseblock in case of success and a
- * negative error code in case of failure. Might sleep.
+ * This function picks a physical eraseblock from the @ubi->free tree which
+ * suits best for data of type @dtype and removes it from the tree. The
+ * @ubi->free tree must not be empty and @ubi->wl_lock has to be locked.
  */
-int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
+static struct ubi_wl_entry *pick_free_peb(struct ubi_device *ubi, int dtype)
 {
-	int err, medium_ec;
+	int medium_ec;
 	struct ubi_wl_entry *e, *first, *last;
 
-	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
-		   dtype == UBI_UNKNOWN);
-
-retry:
-	spin_lock(&ubi->wl_lock);
-	if (!ubi->free.rb_node) {
-		if (ubi->works_count == 0) {
-			ubi_assert(list_empty(&ubi->works));
-			ubi_err("no free eraseblocks");
-			spin_unlock(&ubi->wl_lock);
-			return -ENOSPC;
-		}
-		spin_unlock(&ubi->wl_lock);
-
-		err = produce_free_peb(ubi);
-		if (err < 0)
-			return err;
-		goto retry;
-	}
-
 	switch (dtype) {
 	case UBI_LONGTERM:
 		/*
@@ -450,12 +517,120 @@ retry:
 	}
 
 	paranoid_check_in_wl_tree(e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	return e;
+}
+
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+/**
+ * pool_unused - get the number of not yet used checkpoint pool entries.
+ * @ubi: UBI device description object
+ *
+ * Returns %0 if checkpoints are disabled, in which case the @ubi->free tree is
+ * used directly.
+ */
+static int pool_unused(struct ubi_device *ubi)
+{
+	if (ubi->cp_disabled)
+		return 0;
+	return ubi->cp_pool.size - ubi->cp_pool.used;
+}
+
+/**
+ * get_pool_peb - get a physical eraseblock from the checkpoint pool.
+ * @ubi: UBI device description object
+ *
+ * This function returns the wear-leveling entry of the next physical
+ * eraseblock of the checkpoint pool, or %NULL if the pool is used up. The
+ * returned entry is in no tree. Note, @ubi->wl_lock has to be locked.
+ */
+static struct ubi_wl_entry *get_pool_peb(struct ubi_device *ubi)
+{
+	struct ubi_cp_pool *pool = &ubi->cp_pool;
+
+	if (pool->used == pool->size)
+		return NULL;
+	return ubi->lookuptbl[pool->pebs[pool->used++]];
+}
+#endif
+
+/**
+ * ubi_wl_get_peb - get a physical eraseblock.
+ * @ubi: UBI device description object
+ * @dtype: type of data which will be stored in this physical eraseblock
+ *
+ * This function returns a physical eraseblock in case of success and a
+ * negative error code in case of failure. Might sleep.
+ *
+ * The caller has to hold @ubi->cp_eba_sem in read mode (see
+ * 'ubi_cp_eba_lock()'), and keep it until the physical eraseblock is put to
+ * the EBA table or returned back, so that a checkpoint never records a
+ * half-done mapping. If the attach checkpoint is enabled, the physical
+ * eraseblocks are taken from the checkpoint pool. When the pool is used up,
+ * this function drops @ubi->cp_eba_sem, writes a new checkpoint, which
+ * refills the pool, and takes @ubi->cp_eba_sem again before returning.
+ */
+int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
+{
+	int err;
+	struct ubi_wl_entry *e;
 
+	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
+		   dtype == UBI_UNKNOWN);
+
+retry:
+	spin_lock(&ubi->wl_lock);
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	if (!ubi->cp_disabled) {
+		e = get_pool_peb(ubi);
+		if (!e) {
+			/*
+			 * The pool is used up. Write a new checkpoint, which
+			 * refills it.
+			 */
+			spin_unlock(&ubi->wl_lock);
+			ubi_cp_eba_unlock(ubi);
+			err = ubi_update_checkpoint(ubi);
+			ubi_cp_eba_lock(ubi);
+			if (err)
+				return err;
+
+			spin_lock(&ubi->wl_lock);
+			err = !ubi->cp_disabled && !pool_unused(ubi);
+			spin_unlock(&ubi->wl_lock);
+			if (err) {
+				ubi_err("no free eraseblocks");
+				return -ENOSPC;
+			}
+			goto retry;
+		}
+		goto out_protect;
+	}
+#endif
+	if (!ubi->free.rb_node) {
+		if (ubi->works_count == 0) {
+			ubi_assert(list_empty(&ubi->works));
+			ubi_err("no free eraseblocks");
+			spin_unlock(&ubi->wl_lock);
+			return -ENOSPC;
+		}
+		spin_unlock(&ubi->wl_lock);
+
+		err = produce_free_peb(ubi);
+		if (err < 0)
+			return err;
+		goto retry;
+	}
+
+	e = pick_free_peb(ubi, dtype);
+
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+out_protect:
+#endif
 	/*
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
@@ -470,6 +645,65 @@ retry:
 	return e->pnum;
 }
 
+/**
+ * wl_target - find the target physical eraseblock for moving data to.
+ * @ubi: UBI device description object
+ *
+ * This function returns the wear-leveling entry of a highly worn-out free
+ * physical eraseblock, or %NULL if there are no free physical eraseblocks.
+ * When the attach checkpoint is used, the target is picked from the
+ * checkpoint pool, because only the pool is scanned when attaching. Note,
+ * @ubi->wl_lock has to be locked.
+ */
+static struct ubi_wl_entry *wl_target(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	if (!ubi->cp_disabled) {
+		struct ubi_cp_pool *pool = &ubi->cp_pool;
+		struct ubi_wl_entry *e, *max = NULL;
+		int i;
+
+		for (i = pool->used; i < pool->size; i++) {
+			e = ubi->lookuptbl[pool->pebs[i]];
+			if (!max || e->ec > max->ec)
+				max = e;
+		}
+		return max;
+	}
+#endif
+	if (!ubi->free.rb_node)
+		return NULL;
+	return find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+}
+
+/**
+ * wl_take_target - take the target physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the wear-leveling entry returned by 'wl_target()'
+ *
+ * This function removes @e from the @ubi->free tree or from the checkpoint
+ * pool. Note, @ubi->wl_lock has to be locked.
+ */
+static void wl_take_target(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	if (!ubi->cp_disabled) {
+		struct ubi_cp_pool *pool = &ubi->cp_pool;
+		int i;
+
+		for (i = pool->used; i < pool->size; i++)
+			if (pool->pebs[i] == e->pnum)
+				break;
+		ubi_assert(i < pool->size);
+		pool->pebs[i] = pool->pebs[pool->used];
+		pool->pebs[pool->used++] = e->pnum;
+		return;
+	}
+#endif
+	paranoid_check_in_wl_tree(e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+}
+
 /**
  * prot_queue_del - remove a physical eraseblock from the protection queue.
  * @ubi: UBI device description object
@@ -610,17 +844,14 @@ repeat:
 static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
 	spin_lock(&ubi->wl_lock);
+	wrk->queued = ktime_get();
 	list_add_tail(&wrk->list, &ubi->works);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
-	if (ubi->thread_enabled)
-		wake_up_process(ubi->bgt_thread);
+	wake_up_bgt(ubi);
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
-
 /**
  * schedule_erase - schedule an erase work.
  * @ubi: UBI device description object
@@ -681,8 +912,8 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
-	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
+	e2 = wl_target(ubi);
+	if (!e2 || (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
 		 * the queue to be erased. Cancel movement - it will be
@@ -694,7 +925,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !e2, !ubi->used.rb_node);
 		goto out_cancel;
 	}
 
@@ -705,7 +936,6 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -720,14 +950,12 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	wl_take_target(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -958,7 +1186,8 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		e2 = wl_target(ubi);
+		if (!ubi->used.rb_node || !e2)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
@@ -969,7 +1198,6 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -1046,7 +1274,6 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 
 	ubi_err("failed to erase PEB %d, error %d", pnum, err);
 	kfree(wl_wrk);
-	kmem_cache_free(ubi_wl_entry_slab, e);
 
 	if (err == -EINTR || err == -ENOMEM || err == -EAGAIN ||
 	    err == -EBUSY) {
@@ -1059,7 +1286,10 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 			goto out_ro;
 		}
 		return err;
-	} else if (err != -EIO) {
+	}
+
+	kmem_cache_free(ubi_wl_entry_slab, e);
+	if (err != -EIO) {
 		/*
 		 * If this is not %-EIO, we have no idea what to do. Scheduling
 		 * this physical eraseblock for erasure again would cause
@@ -1277,6 +1507,18 @@ int ubi_wl_flush(struct ubi_device *ubi)
 {
 	int err;
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	/*
+	 * Some erasures may be deferred because the on-flash checkpoint refers
+	 * to the PEBs. Write a new checkpoint to release them.
+	 */
+	if (!list_empty(&ubi->cp_deferred)) {
+		err = ubi_update_checkpoint(ubi);
+		if (err)
+			return err;
+	}
+#endif
+
 	/*
 	 * Erase while the pending works queue is not empty, but not more than
 	 * the number of currently pending works.
@@ -1350,7 +1592,7 @@ int ubi_thread(void *u)
 	struct ubi_device *ubi = u;
 
 	ubi_msg("background thread \"%s\" started, PID %d",
-		ubi->bgt_name, task_pid_nr(current));
+		current->comm, task_pid_nr(current));
 
 	set_freezable();
 	for (;;) {
@@ -1375,16 +1617,18 @@ int ubi_thread(void *u)
 		err = do_work(ubi);
 		if (err) {
 			ubi_err("%s: work failed with error code %d",
-				ubi->bgt_name, err);
+				current->comm, err);
 			if (failures++ > WL_MAX_FAILURES) {
 				/*
-				 * Too many failures, disable the thread and
-				 * switch to read-only mode.
+				 * Too many failures, switch to read-only
+				 * mode, which puts all the threads to sleep.
+				 * @failures is per-thread, and
+				 * @ubi->thread_enabled is left alone: it
+				 * belongs to all the threads of the device.
 				 */
 				ubi_msg("%s: %d consecutive failures",
-					ubi->bgt_name, WL_MAX_FAILURES);
+					current->comm, WL_MAX_FAILURES);
 				ubi_ro_mode(ubi);
-				ubi->thread_enabled = 0;
 				continue;
 			}
 		} else
@@ -1393,7 +1637,7 @@ int ubi_thread(void *u)
 		cond_resched();
 	}
 
-	dbg_wl("background thread \"%s\" is killed", ubi->bgt_name);
+	dbg_wl("background thread \"%s\" is killed", current->comm);
 	return 0;
 }
 
@@ -1436,8 +1680,13 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	INIT_LIST_HEAD(&ubi->cp_deferred);
+	init_rwsem(&ubi->cp_eba_sem);
+#endif
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
+	ubi->erase_bank_pebs = DIV_ROUND_UP(ubi->peb_count, ubi->erase_banks);
 
 	err = -ENOMEM;
 	ubi->lookuptbl = kzalloc(ubi->peb_count * sizeof(void *), GFP_KERNEL);
@@ -1501,6 +1750,23 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		}
 	}
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	/*
+	 * The physical eraseblocks of the checkpoint are not in any tree, they
+	 * are owned by the checkpoint code.
+	 */
+	list_for_each_entry(seb, &si->cp, u.list) {
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e)
+			goto out_free;
+
+		e->pnum = seb->pnum;
+		e->ec = seb->ec;
+		ubi->lookuptbl[e->pnum] = e;
+		ubi->cp_e[ubi->cp_nblocks++] = e;
+	}
+#endif
+
 	if (ubi->avail_pebs < WL_RESERVED_PEBS) {
 		ubi_err("no enough physical eraseblocks (%d, need %d)",
 			ubi->avail_pebs, WL_RESERVED_PEBS);
@@ -1512,6 +1778,12 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	ubi->avail_pebs -= WL_RESERVED_PEBS;
 	ubi->rsvd_pebs += WL_RESERVED_PEBS;
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	err = ubi_cp_init(ubi, si);
+	if (err)
+		goto out_free;
+#endif
+
 	/* Schedule wear-leveling if needed */
 	err = ensure_wear_leveling(ubi);
 	if (err)
@@ -1520,7 +1792,13 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	return 0;
 
 out_free:
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	list_splice_tail_init(&ubi->cp_deferred, &ubi->works);
+#endif
 	cancel_pending(ubi);
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	ubi_cp_close(ubi);
+#endif
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
@@ -1552,7 +1830,13 @@ static void protection_queue_destroy(struct ubi_device *ubi)
 void ubi_wl_close(struct ubi_device *ubi)
 {
 	dbg_wl("close the WL sub-system");
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	list_splice_tail_init(&ubi->cp_deferred, &ubi->works);
+#endif
 	cancel_pending(ubi);
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+	ubi_cp_close(ubi);
+#endif
 	protection_queue_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->erroneous);
@@ -1561,6 +1845,179 @@ void ubi_wl_close(struct ubi_device *ubi)
 	kfree(ubi->lookuptbl);
 }
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+
+/**
+ * ubi_is_erase_work - check if a work is an erasure work.
+ * @wrk: the work object
+ */
+int ubi_is_erase_work(struct ubi_work *wrk)
+{
+	return wrk->func == erase_worker;
+}
+
+/**
+ * ubi_wl_get_cp_peb - get a physical eraseblock for the checkpoint.
+ * @ubi: UBI device description object
+ * @max_pnum: the physical eraseblock number has to be less than this
+ * @only: if not %NULL, only the physical eraseblocks marked in this bitmap
+ *        are considered
+ *
+ * This function takes the least worn-out free physical eraseblock with number
+ * less than @max_pnum, and does pending works synchronously if there is no
+ * such physical eraseblock and @only is %NULL. Returns the wear-leveling
+ * entry of the physical eraseblock, which is not in any tree, in case of
+ * success and an error pointer in case of failure.
+ */
+struct ubi_wl_entry *ubi_wl_get_cp_peb(struct ubi_device *ubi, int max_pnum,
+				       const unsigned long *only)
+{
+	int err;
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	for (;;) {
+		spin_lock(&ubi->wl_lock);
+		for (p = rb_first(&ubi->free); p; p = rb_next(p)) {
+			e = rb_entry(p, struct ubi_wl_entry, u.rb);
+			if (e->pnum < max_pnum &&
+			    (!only || test_bit(e->pnum, only))) {
+				rb_erase(&e->u.rb, &ubi->free);
+				spin_unlock(&ubi->wl_lock);
+				return e;
+			}
+		}
+
+		if (ubi->works_count == 0 || only) {
+			spin_unlock(&ubi->wl_lock);
+			return ERR_PTR(-ENOSPC);
+		}
+		spin_unlock(&ubi->wl_lock);
+
+		err = do_work(ubi);
+		if (err)
+			return ERR_PTR(err);
+	}
+}
+
+/**
+ * ubi_wl_put_cp_peb - return a physical eraseblock of the checkpoint.
+ * @ubi: UBI device description object
+ * @e: the wear-leveling entry of the physical eraseblock
+ * @erase: if the physical eraseblock has to be erased
+ *
+ * If @erase is zero, the physical eraseblock has not been written to and is
+ * put back to the @ubi->free tree. Otherwise it is scheduled for erasure.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+int ubi_wl_put_cp_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int erase)
+{
+	if (erase)
+		return schedule_erase(ubi, e, 0);
+
+	spin_lock(&ubi->wl_lock);
+	wl_tree_add(e, &ubi->free);
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * ubi_wl_erase_cp_peb - synchronously erase a physical eraseblock of the
+ *                       checkpoint.
+ * @ubi: UBI device description object
+ * @e: the wear-leveling entry of the physical eraseblock
+ *
+ * This function erases the physical eraseblock and puts it to the @ubi->free
+ * tree. Returns zero in case of success and a negative error code in case of
+ * failure, in which case @e is left untouched.
+ */
+int ubi_wl_erase_cp_peb(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	int err;
+
+	err = sync_erase(ubi, e, 0);
+	if (err)
+		return err;
+
+	spin_lock(&ubi->wl_lock);
+	wl_tree_add(e, &ubi->free);
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * ubi_wl_return_pool - return the unused checkpoint pool entries.
+ * @ubi: UBI device description object
+ *
+ * This function puts the not yet used physical eraseblocks of the checkpoint
+ * pool back to the @ubi->free tree and empties the pool.
+ */
+void ubi_wl_return_pool(struct ubi_device *ubi)
+{
+	struct ubi_cp_pool *pool = &ubi->cp_pool;
+
+	spin_lock(&ubi->wl_lock);
+	while (pool->used < pool->size)
+		wl_tree_add(ubi->lookuptbl[pool->pebs[pool->used++]],
+			    &ubi->free);
+	pool->used = pool->size = 0;
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_refill_pool - refill the checkpoint pool.
+ * @ubi: UBI device description object
+ *
+ * This function empties the checkpoint pool and fills it up again with free
+ * physical eraseblocks of medium erase counter.
+ */
+void ubi_wl_refill_pool(struct ubi_device *ubi)
+{
+	struct ubi_cp_pool *pool = &ubi->cp_pool;
+
+	ubi_wl_return_pool(ubi);
+
+	spin_lock(&ubi->wl_lock);
+	while (pool->size < pool->max_size && ubi->free.rb_node) {
+		struct ubi_wl_entry *e = pick_free_peb(ubi, UBI_UNKNOWN);
+
+		pool->pebs[pool->size++] = e->pnum;
+	}
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_set_cp_map - set the bitmap of PEBs used by the on-flash checkpoint.
+ * @ubi: UBI device description object
+ * @map: the new bitmap (may be %NULL)
+ *
+ * This function replaces @ubi->cp_used_map by @map and frees the old one.
+ * Erasures deferred because of the old bitmap are put back to the queue of
+ * pending works.
+ */
+void ubi_wl_set_cp_map(struct ubi_device *ubi, unsigned long *map)
+{
+	unsigned long *old;
+	struct ubi_work *wrk, *tmp;
+
+	spin_lock(&ubi->wl_lock);
+	old = ubi->cp_used_map;
+	ubi->cp_used_map = map;
+	list_for_each_entry_safe(wrk, tmp, &ubi->cp_deferred, list) {
+		wrk->queued = ktime_get();
+		list_move_tail(&wrk->list, &ubi->works);
+		ubi->works_count += 1;
+	}
+	wake_up_bgt(ubi);
+	spin_unlock(&ubi->wl_lock);
+
+	kfree(old);
+}
+
+#endif /* CONFIG_MTD_UBI_CHECKPOINT */
+
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
 
 /**
@@ -21,11 +21,12 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/crypto.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -38,14 +39,24 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+/*
+ * Compression backends, by crypto API name. The first one is used
+ * unless another is selected through sysfs before initialization.
+ */
+static const char * const backends[] = {
+	"lzo",
+	"deflate",
+	NULL
+};
+
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -73,30 +84,138 @@ static int zram_test_flag(struct zram *zram, u32 index,
 	return zram->table[index].flags & BIT(flag);
 }
 
-static void zram_set_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static spinlock_t *zram_table_lock(struct zram *zram, u32 index)
 {
-	zram->table[index].flags |= BIT(flag);
+	return &zram->table_lock[index & (ZRAM_TABLE_LOCKS - 1)];
 }
 
-static void zram_clear_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+/*
+ * Grab the compression stream of the current CPU. We may sleep and
+ * migrate while holding it, so it is protected by its own mutex rather
+ * than by disabling preemption; contention only happens when that
+ * occurs.
+ */
+static struct zram_comp_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_comp_stream *zstrm;
+
+	zstrm = per_cpu_ptr(zram->streams, raw_smp_processor_id());
+	mutex_lock(&zstrm->lock);
+
+	return zstrm;
+}
+
+static void zram_stream_put(struct zram_comp_stream *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
+
+static void zram_free_streams(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_stream *zstrm;
+
+		zstrm = per_cpu_ptr(zram->streams, cpu);
+		if (zstrm->tfm)
+			crypto_free_comp(zstrm->tfm);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+
+	free_percpu(zram->streams);
+	zram->streams = NULL;
+}
+
+static int zram_alloc_streams(struct zram *zram)
+{
+	int cpu;
+
+	zram->streams = alloc_percpu(struct zram_comp_stream);
+	if (!zram->streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_stream *zstrm;
+
+		zstrm = per_cpu_ptr(zram->streams, cpu);
+		mutex_init(&zstrm->lock);
+
+		zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(zstrm->tfm)) {
+			int ret = PTR_ERR(zstrm->tfm);
+
+			zstrm->tfm = NULL;
+			zram_free_streams(zram);
+			return ret;
+		}
+
+		/* Compressed output may exceed PAGE_SIZE, so use 2 pages */
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->buffer) {
+			zram_free_streams(zram);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+int zram_set_compressor(struct zram *zram, const char *name)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (sysfs_streq(name, backends[i]))
+			break;
+	}
+
+	if (!backends[i] || !crypto_has_comp(backends[i], 0, 0))
+		return -EINVAL;
+
+	zram->compressor = backends[i];
+	return 0;
+}
+
+ssize_t zram_show_compressors(struct zram *zram, char *buf)
 {
-	zram->table[index].flags &= ~BIT(flag);
+	int i;
+	ssize_t sz = 0;
+
+	for (i = 0; backends[i]; i++) {
+		if (!crypto_has_comp(backends[i], 0, 0))
+			continue;
+
+		if (zram->compressor == backends[i])
+			sz += sprintf(buf + sz, "[%s] ", backends[i]);
+		else
+			sz += sprintf(buf + sz, "%s ", backends[i]);
+	}
+
+	sz += sprintf(buf + sz, "\n");
+	return sz;
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Returns 1 and sets *element if the page consists of a single
+ * repeated word.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
@@ -129,56 +248,83 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+/*
+ * Release the memory backing a table entry which has already been
+ * unlinked from the table, and account for it.
+ */
+static void zram_free_obj(struct zram *zram, struct table *entry)
 {
 	u32 clen;
 	void *obj;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
-
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+	/* No memory is allocated for same element filled pages. */
+	if (entry->flags & BIT(ZRAM_SAME)) {
+		zram_stat_dec(&zram->stats.pages_same);
+		if (!entry->element)
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+	if (unlikely(!entry->page))
+		return;
+
+	if (unlikely(entry->flags & BIT(ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+		__free_page(entry->page);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
+	obj = kmap_atomic(entry->page, KM_USER0) + entry->offset;
 	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
 	kunmap_atomic(obj, KM_USER0);
 
-	xv_free(zram->mem_pool, page, offset);
+	xv_free(zram->mem_pool, entry->page, entry->offset);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
+}
+
+/*
+ * Replace table entry @index with @entry and free whatever was stored
+ * there before.
+ */
+static void zram_replace_page(struct zram *zram, u32 index,
+			struct table *entry)
+{
+	struct table old;
+	spinlock_t *lock = zram_table_lock(zram, index);
+
+	spin_lock(lock);
+	old = zram->table[index];
+	zram->table[index] = *entry;
+	spin_unlock(lock);
+
+	zram_free_obj(zram, &old);
+}
+
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct table empty = { };
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram_replace_page(zram, index, &empty);
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
-	void *user_mem;
+	unsigned int pos;
+	unsigned long *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -206,6 +352,7 @@ static int zram_read(struct zram *zram, struct bio *bio)
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zram_comp_stream *zstrm;
 
 	if (unlikely(!zram->init_done)) {
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -216,23 +363,32 @@ static int zram_read(struct zram *zram, struct bio *bio)
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
+	/* Some compressors keep decompression state, so use a stream */
+	zstrm = zram_stream_get(zram);
+
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
+		unsigned int clen, dlen;
+		unsigned long element;
 		struct page *page;
 		struct zobj_header *zheader;
 		unsigned char *user_mem, *cmem;
+		spinlock_t *lock = zram_table_lock(zram, index);
 
 		page = bvec->bv_page;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
+		spin_lock(lock);
+		if (zram_test_flag(zram, index, ZRAM_SAME)) {
+			element = zram->table[index].element;
+			spin_unlock(lock);
+			handle_same_page(page, element);
 			index++;
 			continue;
 		}
 
 		/* Requested page is not present in compressed area */
 		if (unlikely(!zram->table[index].page)) {
+			spin_unlock(lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			/* Do nothing */
@@ -243,26 +399,31 @@ static int zram_read(struct zram *zram, struct bio *bio)
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			spin_unlock(lock);
 			index++;
 			continue;
 		}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
-
+		/*
+		 * Copy the object out to the stream buffer and decompress
+		 * it without the table lock: a racing write frees the old
+		 * object only after replacing it under that lock.
+		 */
 		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
 				zram->table[index].offset;
+		clen = xv_get_object_size(cmem) - sizeof(*zheader);
+		memcpy(zstrm->buffer, cmem + sizeof(*zheader), clen);
+		kunmap_atomic(cmem, KM_USER1);
+		spin_unlock(lock);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
-
+		user_mem = kmap_atomic(page, KM_USER0);
+		dlen = PAGE_SIZE;
+		ret = crypto_comp_decompress(zstrm->tfm, zstrm->buffer, clen,
+					user_mem, &dlen);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret || dlen != PAGE_SIZE)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -273,11 +434,13 @@ static int zram_read(struct zram *zram, struct bio *bio)
 		index++;
 	}
 
+	zram_stream_put(zstrm);
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
 
 out:
+	zram_stream_put(zstrm);
 	bio_io_error(bio);
 	return 0;
 }
@@ -299,41 +462,47 @@ static int zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		u32 offset;
-		size_t clen;
+		unsigned int clen;
+		struct table entry = { };
 		struct zobj_header *zheader;
+		struct zram_comp_stream *zstrm;
 		struct page *page, *page_store;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
 
 		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
+		 * Pages filled with a single repeated word need neither
+		 * compression nor allocation.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
-
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
+		if (page_same_filled(user_mem, &entry.element)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
+			entry.flags = BIT(ZRAM_SAME);
+			zram_replace_page(zram, index, &entry);
+			zram_stat_inc(&zram->stats.pages_same);
+			if (!entry.element)
+				zram_stat_inc(&zram->stats.pages_zero);
 			index++;
 			continue;
 		}
+		kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		/*
+		 * The stream mutex may sleep, so the page has to be mapped
+		 * again once we own the stream.
+		 */
+		zstrm = zram_stream_get(zram);
+		src = zstrm->buffer;
 
+		clen = 2 * PAGE_SIZE;
+		user_mem = kmap_atomic(page, KM_USER0);
+		ret = crypto_comp_compress(zstrm->tfm, user_mem, PAGE_SIZE,
+					src, &clen);
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_stream_put(zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -345,10 +514,12 @@ static int zram_write(struct zram *zram, struct bio *bio)
 		 * errors which has side effect of hanging the system.
 		 */
 		if (unlikely(clen > max_zpage_size)) {
+			zram_stream_put(zstrm);
+			zstrm = NULL;
+
 			clen = PAGE_SIZE;
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -357,32 +528,28 @@ static int zram_write(struct zram *zram, struct bio *bio)
 			}
 
 			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+			entry.flags = BIT(ZRAM_UNCOMPRESSED);
 			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
 			src = kmap_atomic(page, KM_USER0);
 			goto memstore;
 		}
 
 		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
+				&page_store, &offset,
 				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+			zram_stream_put(zstrm);
 			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
+				"page: %u, size=%u\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
 memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = kmap_atomic(page_store, KM_USER1) + offset;
 
 #if 0
 		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		if (!(entry.flags & BIT(ZRAM_UNCOMPRESSED))) {
 			zheader = (struct zobj_header *)cmem;
 			zheader->table_idx = index;
 			cmem += sizeof(*zheader);
@@ -392,8 +559,18 @@ memstore:
 		memcpy(cmem, src, clen);
 
 		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
+		if (unlikely(entry.flags & BIT(ZRAM_UNCOMPRESSED)))
 			kunmap_atomic(src, KM_USER0);
+		if (zstrm)
+			zram_stream_put(zstrm);
+
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with the old contents of this sector now.
+		 */
+		entry.page = page_store;
+		entry.offset = offset;
+		zram_replace_page(zram, index, &entry);
 
 		/* Update stats */
 		zram_stat64_add(zram, &zram->stats.compr_size, clen);
@@ -401,7 +578,6 @@ memstore:
 		if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -466,11 +642,7 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_free_streams(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
@@ -480,7 +652,7 @@ void zram_reset_device(struct zram *zram)
 		page = zram->table[index].page;
 		offset = zram->table[index].offset;
 
-		if (!page)
+		if (zram_test_flag(zram, index, ZRAM_SAME) || !page)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
@@ -516,17 +688,10 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_streams(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression streams!\n",
+			zram->compressor);
 		goto fail;
 	}
 
@@ -583,9 +748,11 @@ static const struct block_device_operations zram_devops = {
 
 static int create_device(struct zram *zram, int device_id)
 {
-	int ret = 0;
+	int i, ret = 0;
 
-	mutex_init(&zram->lock);
+	for (i = 0; i < ZRAM_TABLE_LOCKS; i++)
+		spin_lock_init(&zram->table_lock[i]);
+	zram->compressor = backends[0];
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
 
@@ -62,13 +62,23 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 
+/*
+ * Table entries are protected by a small array of spinlocks hashed
+ * on the page index, so that I/O to different pages does not contend.
+ */
+#define ZRAM_TABLE_LOCK_SHIFT	6
+#define ZRAM_TABLE_LOCKS	(1 << ZRAM_TABLE_LOCK_SHIFT)
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/*
+	 * Page consists of a single repeated word (e.g. zeros). No memory
+	 * is allocated for it; the word is kept in table[page_no].element.
+	 */
+	ZRAM_SAME,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -77,7 +87,10 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
+	union {
+		struct page *page;
+		unsigned long element;	/* ZRAM_SAME pages */
+	};
 	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
@@ -91,20 +104,32 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of same element filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+};
+
+/*
+ * Compression stream: a crypto API transform for the device's
+ * compressor plus a buffer for compressed data, going out on writes and
+ * coming in on reads. One is allocated for each possible CPU so that
+ * I/O running on different CPUs (de)compresses in parallel.
+ */
+struct zram_comp_stream {
+	struct mutex lock;	/* serialize users of this stream */
+	struct crypto_comp *tfm;
+	void *buffer;
 };
 
 struct zram {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zram_comp_stream __percpu *streams;
+	const char *compressor;	/* crypto API name, e.g. "lzo" */
 	struct table *table;
+	spinlock_t table_lock[ZRAM_TABLE_LOCKS];
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -127,5 +152,7 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_compressor(struct zram *zram, const char *name);
+extern ssize_t zram_show_compressors(struct zram *zram, char *buf);
 
 #endif
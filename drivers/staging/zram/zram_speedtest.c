@@ -0,0 +1,288 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * Test zram swap-out and swap-in speed as the number of concurrent threads
+ * grows.
+ *
+ * Each thread writes its own range of the given zram device one page per
+ * bio, as swap_writepage() does, then reads it back one page per bio and
+ * frees each slot through ->swap_slot_free_notify(), as a swap-in does.
+ * Half of every 64 bytes written is random, so that the data compresses,
+ * but not too well. The data read back is checked.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+
+#define PRINT_PREF KERN_INFO "zram_speedtest: "
+
+#define MAX_THREADS 32
+
+static char *dev;
+module_param(dev, charp, S_IRUGO);
+MODULE_PARM_DESC(dev, "zram device to use, with its disksize set");
+
+static int threads = 4;
+module_param(threads, int, S_IRUGO);
+MODULE_PARM_DESC(threads, "maximum number of threads (default 4, max. 32)");
+
+static int size = 16384;
+module_param(size, int, S_IRUGO);
+MODULE_PARM_DESC(size, "KiB swapped by each thread (default 16384)");
+
+struct speed_thread {
+	int num;
+	int write;
+	int err;
+	struct completion done;
+};
+
+static struct block_device *bdev;
+static struct speed_thread thr[MAX_THREADS];
+
+static void set_test_data(unsigned char *buf, int num, pgoff_t index)
+{
+	size_t i;
+
+	for (i = 0; i < PAGE_SIZE; i += 4) {
+		if (i % 64 < 32)
+			*(u32 *)(buf + i) = random32();
+		else
+			*(u32 *)(buf + i) = (u32)(num << 24 | index);
+	}
+}
+
+static int check_test_data(unsigned char *buf, int num, pgoff_t index)
+{
+	size_t i;
+
+	for (i = 32; i < PAGE_SIZE; i += 64)
+		if (*(u32 *)(buf + i) != (u32)(num << 24 | index))
+			return -EIO;
+	return 0;
+}
+
+static void speed_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int rw_page(int rw, struct page *page, pgoff_t index)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int err;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+	bio->bi_bdev = bdev;
+	bio->bi_sector = index << (PAGE_SHIFT - 9);
+	bio->bi_end_io = speed_end_io;
+	bio->bi_private = &done;
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+	err = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+	return err;
+}
+
+static int swap_out(int num, struct page *page)
+{
+	pgoff_t first = (pgoff_t)num * size / (PAGE_SIZE / 1024);
+	pgoff_t index;
+	void *buf;
+	int err;
+
+	for (index = first; index < first + size / (PAGE_SIZE / 1024);
+	     index++) {
+		buf = kmap(page);
+		set_test_data(buf, num, index);
+		kunmap(page);
+		err = rw_page(WRITE, page, index);
+		if (err)
+			return err;
+		cond_resched();
+	}
+	return 0;
+}
+
+static int swap_in(int num, struct page *page)
+{
+	const struct block_device_operations *ops = bdev->bd_disk->fops;
+	pgoff_t first = (pgoff_t)num * size / (PAGE_SIZE / 1024);
+	pgoff_t index;
+	void *buf;
+	int err;
+
+	for (index = first; index < first + size / (PAGE_SIZE / 1024);
+	     index++) {
+		err = rw_page(READ, page, index);
+		if (err)
+			return err;
+		buf = kmap(page);
+		err = check_test_data(buf, num, index);
+		kunmap(page);
+		if (err)
+			return err;
+		/* the page is in memory again: its swap slot is freed */
+		if (ops->swap_slot_free_notify)
+			ops->swap_slot_free_notify(bdev, index);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int speed_thread_fn(void *arg)
+{
+	struct speed_thread *t = arg;
+	struct page *page;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		t->err = -ENOMEM;
+		goto out;
+	}
+
+	if (t->write)
+		t->err = swap_out(t->num, page);
+	else
+		t->err = swap_in(t->num, page);
+
+	__free_page(page);
+out:
+	complete_and_exit(&t->done, 0);
+}
+
+static int run_threads(int n, int write, long *speed)
+{
+	struct task_struct *task;
+	ktime_t start;
+	s64 us;
+	int i, err = 0;
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		thr[i].num = i;
+		thr[i].write = write;
+		thr[i].err = 0;
+		init_completion(&thr[i].done);
+		task = kthread_run(speed_thread_fn, &thr[i], "zramspeed%d", i);
+		if (IS_ERR(task)) {
+			printk(PRINT_PREF "error: cannot start thread %d\n", i);
+			thr[i].err = PTR_ERR(task);
+			complete(&thr[i].done);
+		}
+	}
+	for (i = 0; i < n; i++)
+		wait_for_completion(&thr[i].done);
+	us = ktime_us_delta(ktime_get(), start);
+
+	for (i = 0; i < n; i++)
+		if (thr[i].err) {
+			printk(PRINT_PREF "error %d in thread %d\n",
+			       thr[i].err, i);
+			err = thr[i].err;
+		}
+	if (err)
+		return err;
+
+	*speed = div64_s64((s64)n * size * 1000000, us ? us : 1);
+	return 0;
+}
+
+static int __init zram_speedtest_init(void)
+{
+	int n, err = 0;
+	long wspeed, rspeed;
+
+	printk(KERN_INFO "\n");
+	printk(KERN_INFO "=================================================\n");
+
+	if (!dev) {
+		printk(PRINT_PREF "error: use dev=<zram device>\n");
+		return -EINVAL;
+	}
+	if (threads < 1 || threads > MAX_THREADS ||
+	    size < 1 || size % (PAGE_SIZE / 1024)) {
+		printk(PRINT_PREF "error: bad threads or size parameter\n");
+		return -EINVAL;
+	}
+
+	bdev = open_bdev_exclusive(dev, FMODE_READ | FMODE_WRITE, &bdev);
+	if (IS_ERR(bdev)) {
+		err = PTR_ERR(bdev);
+		printk(PRINT_PREF "error %d: cannot open %s\n", err, dev);
+		return err;
+	}
+	if (strncmp(bdev->bd_disk->disk_name, "zram", 4)) {
+		printk(PRINT_PREF "error: %s is no zram device\n", dev);
+		err = -EINVAL;
+		goto out;
+	}
+	if ((u64)get_capacity(bdev->bd_disk) << 9 <
+	    (u64)threads * size * 1024) {
+		printk(PRINT_PREF "error: disksize of %s is below %d KiB\n",
+		       dev, threads * size);
+		err = -ENOSPC;
+		goto out;
+	}
+
+	printk(PRINT_PREF "testing %s, %d KiB per thread, up to %d threads\n",
+	       dev, size, threads);
+
+	for (n = 1; ; n = min(n * 2, threads)) {
+		err = run_threads(n, 1, &wspeed);
+		if (err)
+			break;
+		err = run_threads(n, 0, &rspeed);
+		if (err)
+			break;
+		printk(PRINT_PREF "%2d threads: swap-out %ld KiB/s, swap-in "
+		       "%ld KiB/s\n", n, wspeed, rspeed);
+		if (n == threads)
+			break;
+	}
+
+out:
+	close_bdev_exclusive(bdev, FMODE_READ | FMODE_WRITE);
+	if (err)
+		printk(PRINT_PREF "error %d occurred\n", err);
+	else
+		printk(PRINT_PREF "finished\n");
+	printk(KERN_INFO "=================================================\n");
+	return err;
+}
+module_init(zram_speedtest_init);
+
+static void __exit zram_speedtest_exit(void)
+{
+	return;
+}
+module_exit(zram_speedtest_exit);
+
+MODULE_DESCRIPTION("zram concurrent swap-out/swap-in speed test module");
+MODULE_LICENSE("GPL");
@@ -18,7 +18,7 @@
 #include "nodelist.h"
 
 static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *,
-		struct jffs2_inode_cache *, struct jffs2_full_dirent **);
+		struct jffs2_inode_cache *);
 
 static inline struct jffs2_inode_cache *
 first_inode_chain(int *i, struct jffs2_sb_info *c)
@@ -49,30 +49,34 @@ next_inode(int *i, struct jffs2_inode_cache *ic, struct jffs2_sb_info *c)
 static void jffs2_build_inode_pass1(struct jffs2_sb_info *c,
 				    struct jffs2_inode_cache *ic)
 {
-	struct jffs2_full_dirent *fd;
+	struct jffs2_scan_dirent *sd;
+	uint32_t i;
 
 	dbg_fsbuild("building directory inode #%u\n", ic->ino);
 
 	/* For each child, increase nlink */
-	for(fd = ic->scan_dents; fd; fd = fd->next) {
+	for (i = 0; i < ic->scan_dents->nr; i++) {
 		struct jffs2_inode_cache *child_ic;
-		if (!fd->ino)
+
+		sd = &ic->scan_dents->d[i];
+		if (!sd->ino)
 			continue;
 
 		/* we can get high latency here with huge directories */
 
-		child_ic = jffs2_get_ino_cache(c, fd->ino);
+		child_ic = jffs2_get_ino_cache(c, sd->ino);
 		if (!child_ic) {
-			dbg_fsbuild("child \"%s\" (ino #%u) of dir ino #%u doesn't exist!\n",
-				  fd->name, fd->ino, ic->ino);
-			jffs2_mark_node_obsolete(c, fd->raw);
+			dbg_fsbuild("child ino #%u of dir ino #%u doesn't exist!\n",
+				  sd->ino, ic->ino);
+			jffs2_mark_node_obsolete(c, sd->raw);
+			sd->ino = 0;
 			continue;
 		}
 
-		if (fd->type == DT_DIR) {
+		if (sd->type == DT_DIR) {
 			if (child_ic->pino_nlink) {
-				JFFS2_ERROR("child dir \"%s\" (ino #%u) of dir ino #%u appears to be a hard link\n",
-					    fd->name, fd->ino, ic->ino);
+				JFFS2_ERROR("child dir ino #%u of dir ino #%u appears to be a hard link\n",
+					    sd->ino, ic->ino);
 				/* TODO: What do we do about it? */
 			} else {
 				child_ic->pino_nlink = ic->ino;
@@ -80,7 +84,7 @@ static void jffs2_build_inode_pass1(struct jffs2_sb_info *c,
 		} else
 			child_ic->pino_nlink++;
 
-		dbg_fsbuild("increased nlink for child \"%s\" (ino #%u)\n", fd->name, fd->ino);
+		dbg_fsbuild("increased nlink for child ino #%u\n", sd->ino);
 		/* Can't free scan_dents so far. We might need them in pass 2 */
 	}
 }
@@ -95,8 +99,6 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	int ret;
 	int i;
 	struct jffs2_inode_cache *ic;
-	struct jffs2_full_dirent *fd;
-	struct jffs2_full_dirent *dead_fds = NULL;
 
 	dbg_fsbuild("build FS data structures\n");
 
@@ -126,42 +128,25 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 
 	/* Next, scan for inodes with nlink == 0 and remove them. If
 	   they were directories, then decrement the nlink of their
-	   children too, and repeat the scan. As that's going to be
-	   a fairly uncommon occurrence, it's not so evil to do it this
-	   way. Recursion bad. */
+	   children too, and remove those which are left with no links
+	   straight away, so that a single scan is enough. */
 	dbg_fsbuild("pass 2 starting\n");
 
 	for_each_inode(i, c, ic) {
-		if (ic->pino_nlink)
+		if (ic->pino_nlink || (ic->flags & INO_FLAGS_UNLINKED))
 			continue;
 
-		jffs2_build_remove_unlinked_inode(c, ic, &dead_fds);
+		jffs2_build_remove_unlinked_inode(c, ic);
 		cond_resched();
 	}
 
-	dbg_fsbuild("pass 2a starting\n");
-
-	while (dead_fds) {
-		fd = dead_fds;
-		dead_fds = fd->next;
-
-		ic = jffs2_get_ino_cache(c, fd->ino);
-
-		if (ic)
-			jffs2_build_remove_unlinked_inode(c, ic, &dead_fds);
-		jffs2_free_full_dirent(fd);
-	}
-
-	dbg_fsbuild("pass 2a complete\n");
+	dbg_fsbuild("pass 2 complete\n");
 	dbg_fsbuild("freeing temporary data structures\n");
 
-	/* Finally, we can scan again and free the dirent structs */
+	/* Finally, we can scan again and free the dirent arrays */
 	for_each_inode(i, c, ic) {
-		while(ic->scan_dents) {
-			fd = ic->scan_dents;
-			ic->scan_dents = fd->next;
-			jffs2_free_full_dirent(fd);
-		}
+		if (ic->scan_dents)
+			jffs2_free_scan_dirents(ic->scan_dents);
 		ic->scan_dents = NULL;
 		cond_resched();
 	}
@@ -178,11 +163,9 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 exit:
 	if (ret) {
 		for_each_inode(i, c, ic) {
-			while(ic->scan_dents) {
-				fd = ic->scan_dents;
-				ic->scan_dents = fd->next;
-				jffs2_free_full_dirent(fd);
-			}
+			if (ic->scan_dents)
+				jffs2_free_scan_dirents(ic->scan_dents);
+			ic->scan_dents = NULL;
 		}
 		jffs2_clear_xattr_subsystem(c);
 	}
@@ -190,15 +173,21 @@ exit:
 	return ret;
 }
 
-static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
-					struct jffs2_inode_cache *ic,
-					struct jffs2_full_dirent **dead_fds)
+/* Remove one inode with no links left. Children of it which are left
+   with no links are marked INO_FLAGS_UNLINKED and pushed onto the
+   *dead stack, to be removed by the caller. */
+static void jffs2_build_remove_one_inode(struct jffs2_sb_info *c,
+					 struct jffs2_inode_cache *ic,
+					 uint32_t *dead)
 {
 	struct jffs2_raw_node_ref *raw;
-	struct jffs2_full_dirent *fd;
+	struct jffs2_scan_dirent *sd;
+	uint32_t i;
 
 	dbg_fsbuild("removing ino #%u with nlink == zero.\n", ic->ino);
 
+	ic->flags |= INO_FLAGS_UNLINKED;
+
 	raw = ic->nodes;
 	while (raw != (void *)ic) {
 		struct jffs2_raw_node_ref *next = raw->next_in_ino;
@@ -208,53 +197,53 @@ static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
 	}
 
 	if (ic->scan_dents) {
-		int whinged = 0;
 		dbg_fsbuild("inode #%u was a directory which may have children...\n", ic->ino);
 
-		while(ic->scan_dents) {
+		for (i = 0; i < ic->scan_dents->nr; i++) {
 			struct jffs2_inode_cache *child_ic;
 
-			fd = ic->scan_dents;
-			ic->scan_dents = fd->next;
-
-			if (!fd->ino) {
+			sd = &ic->scan_dents->d[i];
+			if (!sd->ino) {
 				/* It's a deletion dirent. Ignore it */
-				dbg_fsbuild("child \"%s\" is a deletion dirent, skipping...\n", fd->name);
-				jffs2_free_full_dirent(fd);
+				dbg_fsbuild("child is a deletion dirent, skipping...\n");
 				continue;
 			}
-			if (!whinged)
-				whinged = 1;
 
-			dbg_fsbuild("removing child \"%s\", ino #%u\n", fd->name, fd->ino);
+			dbg_fsbuild("removing child ino #%u\n", sd->ino);
 
-			child_ic = jffs2_get_ino_cache(c, fd->ino);
+			child_ic = jffs2_get_ino_cache(c, sd->ino);
 			if (!child_ic) {
-				dbg_fsbuild("cannot remove child \"%s\", ino #%u, because it doesn't exist\n",
-						fd->name, fd->ino);
-				jffs2_free_full_dirent(fd);
+				dbg_fsbuild("cannot remove child ino #%u, because it doesn't exist\n",
+					    sd->ino);
 				continue;
 			}
 
-			/* Reduce nlink of the child. If it's now zero, stick it on the
-			   dead_fds list to be cleaned up later. Else just free the fd */
+			if (child_ic->flags & INO_FLAGS_UNLINKED) {
+				dbg_fsbuild("child ino #%u is already being removed\n",
+					    sd->ino);
+				continue;
+			}
+
+			/* Reduce nlink of the child. If it's now zero, push
+			   it to be removed as well */
 
-			if (fd->type == DT_DIR)
+			if (sd->type == DT_DIR)
 				child_ic->pino_nlink = 0;
 			else
 				child_ic->pino_nlink--;
 
 			if (!child_ic->pino_nlink) {
-				dbg_fsbuild("inode #%u (\"%s\") now has no links; adding to dead_fds list.\n",
-					  fd->ino, fd->name);
-				fd->next = *dead_fds;
-				*dead_fds = fd;
+				dbg_fsbuild("inode #%u now has no links.\n", sd->ino);
+				child_ic->flags |= INO_FLAGS_UNLINKED;
+				child_ic->pino_nlink = *dead;
+				*dead = child_ic->ino;
 			} else {
-				dbg_fsbuild("inode #%u (\"%s\") has now got nlink %d. Ignoring.\n",
-					  fd->ino, fd->name, child_ic->pino_nlink);
-				jffs2_free_full_dirent(fd);
+				dbg_fsbuild("inode #%u has now got nlink %d. Ignoring.\n",
+					  sd->ino, child_ic->pino_nlink);
 			}
 		}
+		jffs2_free_scan_dirents(ic->scan_dents);
+		ic->scan_dents = NULL;
 	}
 
 	/*
@@ -263,6 +252,30 @@ static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
 	*/
 }
 
+/* Remove an inode with nlink == zero, and everything which was only
+   reachable through it. Recursion bad, so orphaned children go on a
+   stack threaded through their pino_nlink, which holds the inode number
+   of the next one down. It is free while they have no links, and goes
+   back to zero when they are popped. Inode #0 never is a child, so it
+   ends the stack. Every inode is removed once, and every dirent array
+   walked once. */
+static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
+					      struct jffs2_inode_cache *ic)
+{
+	uint32_t dead = 0;
+
+	for (;;) {
+		jffs2_build_remove_one_inode(c, ic, &dead);
+		if (!dead)
+			break;
+
+		ic = jffs2_get_ino_cache(c, dead);
+		dead = ic->pino_nlink;
+		ic->pino_nlink = 0;
+		cond_resched();
+	}
+}
+
 static void jffs2_calc_trigger_levels(struct jffs2_sb_info *c)
 {
 	uint32_t size;
@@ -26,6 +26,105 @@ static int jffs2_compression_mode = JFFS2_COMPR_MODE_PRIORITY;
 static uint32_t none_stat_compr_blocks=0,none_stat_decompr_blocks=0,none_stat_compr_size=0;
 
 
+/*
+ * Set up a workspace pool whose alloc and free methods are filled in.
+ * Only the first workspace is allocated here, so that there always is one.
+ */
+int jffs2_compr_ws_pool_init(struct jffs2_compr_ws_pool *pool)
+{
+	mutex_init(&pool->grow_lock);
+	pool->max = min_t(int, num_possible_cpus(), JFFS2_COMPR_MAX_WS);
+	pool->ws[0] = pool->alloc();
+	if (!pool->ws[0])
+		return -ENOMEM;
+	pool->nr = 1;
+	return 0;
+}
+
+void jffs2_compr_ws_pool_destroy(struct jffs2_compr_ws_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nr; i++)
+		pool->free(pool->ws[i]);
+	pool->nr = 0;
+}
+
+/*
+ * Allocate one more workspace for a pool and return it locked, or return
+ * NULL. The allocation may enter reclaim and write back JFFS2 pages, which
+ * compresses data again, so the grow_lock is only tried: if it is taken,
+ * the caller waits for an existing workspace instead.
+ */
+static struct jffs2_compr_ws *jffs2_compr_ws_grow(struct jffs2_compr_ws_pool *pool)
+{
+	struct jffs2_compr_ws *ws = NULL;
+
+	if (!mutex_trylock(&pool->grow_lock))
+		return NULL;
+
+	if (pool->nr < pool->max) {
+		ws = pool->alloc();
+		if (ws) {
+			mutex_lock(&ws->lock);
+			pool->ws[pool->nr] = ws;
+			/* Publish the workspace before the new count */
+			smp_wmb();
+			pool->nr++;
+			D1(printk(KERN_DEBUG "jffs2: %d compressor workspaces\n", pool->nr));
+		} else {
+			/* Make do with what we have from now on */
+			pool->max = pool->nr;
+		}
+	}
+
+	mutex_unlock(&pool->grow_lock);
+	return ws;
+}
+
+/*
+ * Get a workspace from a pool. The one of the current CPU is tried first,
+ * then any other free one. If all of them are busy, a new one is added,
+ * and only if that is not possible do we sleep.
+ */
+struct jffs2_compr_ws *jffs2_compr_ws_get(struct jffs2_compr_ws_pool *pool)
+{
+	int i, first, nr = ACCESS_ONCE(pool->nr);
+	struct jffs2_compr_ws *ws;
+
+	/* Pairs with the barrier in jffs2_compr_ws_grow() */
+	smp_rmb();
+	first = raw_smp_processor_id() % nr;
+	for (i = 0; i < nr; i++) {
+		ws = pool->ws[(first + i) % nr];
+		if (mutex_trylock(&ws->lock))
+			return ws;
+	}
+
+	if (nr < pool->max) {
+		ws = jffs2_compr_ws_grow(pool);
+		if (ws)
+			return ws;
+	}
+
+	mutex_lock(&pool->ws[first]->lock);
+	return pool->ws[first];
+}
+
+/*
+ * Give the output buffer of a compressor back after use. Called with
+ * jffs2_compressor_list_lock held.
+ */
+static void jffs2_put_compr_buf(struct jffs2_compressor *this,
+				unsigned char *buf, uint32_t size)
+{
+	if (!this->compr_buf) {
+		this->compr_buf = buf;
+		this->compr_buf_size = size;
+	} else
+		kfree(buf);
+}
+
 /*
  * Return 1 to use this compression
  */
@@ -78,8 +177,8 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 	int ret = JFFS2_COMPR_NONE;
 	int compr_ret;
 	struct jffs2_compressor *this, *best=NULL;
-	unsigned char *output_buf = NULL, *tmp_buf;
-	uint32_t orig_slen, orig_dlen;
+	unsigned char *output_buf = NULL, *tmp_buf, *best_buf = NULL;
+	uint32_t orig_slen, orig_dlen, tmp_size, best_size = 0;
 	uint32_t best_slen=0, best_dlen=0;
 
 	switch (jffs2_compression_mode) {
@@ -127,49 +226,50 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			/* Skip decompress-only backwards-compatibility and disabled modules */
 			if ((!this->compress)||(this->disabled))
 				continue;
+			/* Take the output buffer of the compressor while
+			   we use it, as other CPUs may be compressing too */
+			tmp_buf = this->compr_buf;
+			tmp_size = this->compr_buf_size;
+			this->compr_buf = NULL;
+			this->compr_buf_size = 0;
+			this->usecount++;
+			spin_unlock(&jffs2_compressor_list_lock);
 			/* Allocating memory for output buffer if necessary */
-			if ((this->compr_buf_size < orig_slen) && (this->compr_buf)) {
-				spin_unlock(&jffs2_compressor_list_lock);
-				kfree(this->compr_buf);
-				spin_lock(&jffs2_compressor_list_lock);
-				this->compr_buf_size=0;
-				this->compr_buf=NULL;
+			if (tmp_buf && tmp_size < orig_slen) {
+				kfree(tmp_buf);
+				tmp_buf = NULL;
 			}
-			if (!this->compr_buf) {
-				spin_unlock(&jffs2_compressor_list_lock);
+			if (!tmp_buf) {
 				tmp_buf = kmalloc(orig_slen, GFP_KERNEL);
-				spin_lock(&jffs2_compressor_list_lock);
 				if (!tmp_buf) {
 					printk(KERN_WARNING "JFFS2: No memory for compressor allocation. (%d bytes)\n", orig_slen);
+					spin_lock(&jffs2_compressor_list_lock);
+					this->usecount--;
 					continue;
 				}
-				else {
-					this->compr_buf = tmp_buf;
-					this->compr_buf_size = orig_slen;
-				}
+				tmp_size = orig_slen;
 			}
-			this->usecount++;
-			spin_unlock(&jffs2_compressor_list_lock);
 			*datalen  = orig_slen;
 			*cdatalen = orig_dlen;
-			compr_ret = this->compress(data_in, this->compr_buf, datalen, cdatalen);
+			compr_ret = this->compress(data_in, tmp_buf, datalen, cdatalen);
 			spin_lock(&jffs2_compressor_list_lock);
 			this->usecount--;
-			if (!compr_ret) {
-				if (((!best_dlen) || jffs2_is_best_compression(this, best, *cdatalen, best_dlen))
-						&& (*cdatalen < *datalen)) {
-					best_dlen = *cdatalen;
-					best_slen = *datalen;
-					best = this;
-				}
-			}
+			if (!compr_ret && ((!best_dlen) || jffs2_is_best_compression(this, best, *cdatalen, best_dlen))
+					&& (*cdatalen < *datalen)) {
+				if (best_buf)
+					jffs2_put_compr_buf(best, best_buf, best_size);
+				best_dlen = *cdatalen;
+				best_slen = *datalen;
+				best = this;
+				best_buf = tmp_buf;
+				best_size = tmp_size;
+			} else
+				jffs2_put_compr_buf(this, tmp_buf, tmp_size);
 		}
 		if (best_dlen) {
 			*cdatalen = best_dlen;
 			*datalen  = best_slen;
-			output_buf = best->compr_buf;
-			best->compr_buf = NULL;
-			best->compr_buf_size = 0;
+			output_buf = best_buf;
 			best->stat_compr_blocks++;
 			best->stat_compr_orig_size += best_slen;
 			best->stat_compr_new_size  += best_dlen;
@@ -15,6 +15,7 @@
 #include <linux/kernel.h>
 #include <linux/vmalloc.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/types.h>
 #include <linux/string.h>
 #include <linux/slab.h>
@@ -62,6 +63,37 @@ struct jffs2_compressor {
 	uint32_t stat_decompr_blocks;
 };
 
+/*
+ * Compressors which need a workspace keep a pool of them, so that
+ * (de)compression on different CPUs does not serialise on a single mutex.
+ * The pool starts with one workspace, and another one is only allocated
+ * when all the existing ones are busy, up to one per CPU but not more
+ * than JFFS2_COMPR_MAX_WS. Each workspace starts with this.
+ */
+#define JFFS2_COMPR_MAX_WS 8
+
+struct jffs2_compr_ws {
+	struct mutex lock;
+};
+
+struct jffs2_compr_ws_pool {
+	struct jffs2_compr_ws *ws[JFFS2_COMPR_MAX_WS];
+	int nr;				/* allocated workspaces */
+	int max;			/* how many there may be */
+	struct mutex grow_lock;
+	struct jffs2_compr_ws *(*alloc)(void);
+	void (*free)(struct jffs2_compr_ws *ws);
+};
+
+int jffs2_compr_ws_pool_init(struct jffs2_compr_ws_pool *pool);
+void jffs2_compr_ws_pool_destroy(struct jffs2_compr_ws_pool *pool);
+struct jffs2_compr_ws *jffs2_compr_ws_get(struct jffs2_compr_ws_pool *pool);
+
+static inline void jffs2_compr_ws_put(struct jffs2_compr_ws *ws)
+{
+	mutex_unlock(&ws->lock);
+}
+
 int jffs2_register_compressor(struct jffs2_compressor *comp);
 int jffs2_unregister_compressor(struct jffs2_compressor *comp);
 
@@ -15,26 +15,56 @@
 #include <linux/vmalloc.h>
 #include <linux/init.h>
 #include <linux/lzo.h>
+#include <linux/slab.h>
 #include "compr.h"
 
-static void *lzo_mem;
-static void *lzo_compress_buf;
-static DEFINE_MUTEX(deflate_mutex);	/* for lzo_mem and lzo_compress_buf */
+struct lzo_ws {
+	struct jffs2_compr_ws ws;
+	void *mem;
+	void *compress_buf;
+};
+
+static void free_ws(struct jffs2_compr_ws *ws)
+{
+	struct lzo_ws *lws;
+
+	lws = container_of(ws, struct lzo_ws, ws);
+	vfree(lws->mem);
+	vfree(lws->compress_buf);
+	kfree(lws);
+}
+
+static struct jffs2_compr_ws *alloc_ws(void)
+{
+	struct lzo_ws *lws;
+
+	lws = kzalloc(sizeof(*lws), GFP_KERNEL);
+	if (!lws)
+		return NULL;
+	mutex_init(&lws->ws.lock);
+	lws->mem = vmalloc(LZO1X_MEM_COMPRESS);
+	lws->compress_buf = vmalloc(lzo1x_worst_compress(PAGE_SIZE));
+	if (!lws->mem || !lws->compress_buf) {
+		free_ws(&lws->ws);
+		return NULL;
+	}
+	return &lws->ws;
+}
+
+static struct jffs2_compr_ws_pool lzo_pool = {
+	.alloc = alloc_ws,
+	.free = free_ws,
+};
 
 static void free_workspace(void)
 {
-	vfree(lzo_mem);
-	vfree(lzo_compress_buf);
+	jffs2_compr_ws_pool_destroy(&lzo_pool);
 }
 
 static int __init alloc_workspace(void)
 {
-	lzo_mem = vmalloc(LZO1X_MEM_COMPRESS);
-	lzo_compress_buf = vmalloc(lzo1x_worst_compress(PAGE_SIZE));
-
-	if (!lzo_mem || !lzo_compress_buf) {
+	if (jffs2_compr_ws_pool_init(&lzo_pool)) {
 		printk(KERN_WARNING "Failed to allocate lzo deflate workspace\n");
-		free_workspace();
 		return -ENOMEM;
 	}
 
@@ -44,25 +74,28 @@ static int __init alloc_workspace(void)
 static int jffs2_lzo_compress(unsigned char *data_in, unsigned char *cpage_out,
 			      uint32_t *sourcelen, uint32_t *dstlen)
 {
+	struct jffs2_compr_ws *ws;
+	struct lzo_ws *lws;
 	size_t compress_size;
 	int ret;
 
-	mutex_lock(&deflate_mutex);
-	ret = lzo1x_1_compress(data_in, *sourcelen, lzo_compress_buf, &compress_size, lzo_mem);
+	ws = jffs2_compr_ws_get(&lzo_pool);
+	lws = container_of(ws, struct lzo_ws, ws);
+	ret = lzo1x_1_compress(data_in, *sourcelen, lws->compress_buf, &compress_size, lws->mem);
 	if (ret != LZO_E_OK)
 		goto fail;
 
 	if (compress_size > *dstlen)
 		goto fail;
 
-	memcpy(cpage_out, lzo_compress_buf, compress_size);
-	mutex_unlock(&deflate_mutex);
+	memcpy(cpage_out, lws->compress_buf, compress_size);
+	jffs2_compr_ws_put(ws);
 
 	*dstlen = compress_size;
 	return 0;
 
  fail:
-	mutex_unlock(&deflate_mutex);
+	jffs2_compr_ws_put(ws);
 	return -1;
 }
 
@@ -29,37 +29,78 @@
 	*/
 #define STREAM_END_SPACE 12
 
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
-static z_stream inf_strm, def_strm;
+struct zlib_ws {
+	struct jffs2_compr_ws ws;
+	z_stream strm;
+};
 
 #ifdef __KERNEL__ /* Linux-only */
 #include <linux/vmalloc.h>
 #include <linux/init.h>
 #include <linux/mutex.h>
 
-static int __init alloc_workspaces(void)
+static struct jffs2_compr_ws *alloc_ws(int size)
 {
-	def_strm.workspace = vmalloc(zlib_deflate_workspacesize());
-	if (!def_strm.workspace) {
-		printk(KERN_WARNING "Failed to allocate %d bytes for deflate workspace\n", zlib_deflate_workspacesize());
-		return -ENOMEM;
+	struct zlib_ws *zws;
+
+	zws = kzalloc(sizeof(*zws), GFP_KERNEL);
+	if (!zws)
+		return NULL;
+	zws->strm.workspace = vmalloc(size);
+	if (!zws->strm.workspace) {
+		printk(KERN_WARNING "Failed to allocate %d bytes for zlib workspace\n", size);
+		kfree(zws);
+		return NULL;
 	}
-	D1(printk(KERN_DEBUG "Allocated %d bytes for deflate workspace\n", zlib_deflate_workspacesize()));
-	inf_strm.workspace = vmalloc(zlib_inflate_workspacesize());
-	if (!inf_strm.workspace) {
-		printk(KERN_WARNING "Failed to allocate %d bytes for inflate workspace\n", zlib_inflate_workspacesize());
-		vfree(def_strm.workspace);
-		return -ENOMEM;
-	}
-	D1(printk(KERN_DEBUG "Allocated %d bytes for inflate workspace\n", zlib_inflate_workspacesize()));
-	return 0;
+	D1(printk(KERN_DEBUG "Allocated %d bytes for zlib workspace\n", size));
+	mutex_init(&zws->ws.lock);
+	return &zws->ws;
+}
+
+static void free_ws(struct jffs2_compr_ws *ws)
+{
+	struct zlib_ws *zws;
+
+	zws = container_of(ws, struct zlib_ws, ws);
+	vfree(zws->strm.workspace);
+	kfree(zws);
+}
+
+static struct jffs2_compr_ws *alloc_def_ws(void)
+{
+	return alloc_ws(zlib_deflate_workspacesize());
+}
+
+static struct jffs2_compr_ws *alloc_inf_ws(void)
+{
+	return alloc_ws(zlib_inflate_workspacesize());
 }
 
+static struct jffs2_compr_ws_pool def_pool = {
+	.alloc = alloc_def_ws,
+	.free = free_ws,
+};
+
+static struct jffs2_compr_ws_pool inf_pool = {
+	.alloc = alloc_inf_ws,
+	.free = free_ws,
+};
+
 static void free_workspaces(void)
 {
-	vfree(def_strm.workspace);
-	vfree(inf_strm.workspace);
+	jffs2_compr_ws_pool_destroy(&def_pool);
+	jffs2_compr_ws_pool_destroy(&inf_pool);
+}
+
+static int __init alloc_workspaces(void)
+{
+	if (jffs2_compr_ws_pool_init(&def_pool))
+		return -ENOMEM;
+	if (jffs2_compr_ws_pool_init(&inf_pool)) {
+		jffs2_compr_ws_pool_destroy(&def_pool);
+		return -ENOMEM;
+	}
+	return 0;
 }
 #else
 #define alloc_workspaces() (0)
@@ -70,44 +111,47 @@ static int jffs2_zlib_compress(unsigned char *data_in,
 			       unsigned char *cpage_out,
 			       uint32_t *sourcelen, uint32_t *dstlen)
 {
+	struct jffs2_compr_ws *ws;
+	z_stream *def_strm;
 	int ret;
 
 	if (*dstlen <= STREAM_END_SPACE)
 		return -1;
 
-	mutex_lock(&deflate_mutex);
+	ws = jffs2_compr_ws_get(&def_pool);
+	def_strm = &container_of(ws, struct zlib_ws, ws)->strm;
 
-	if (Z_OK != zlib_deflateInit(&def_strm, 3)) {
+	if (Z_OK != zlib_deflateInit(def_strm, 3)) {
 		printk(KERN_WARNING "deflateInit failed\n");
-		mutex_unlock(&deflate_mutex);
+		jffs2_compr_ws_put(ws);
 		return -1;
 	}
 
-	def_strm.next_in = data_in;
-	def_strm.total_in = 0;
+	def_strm->next_in = data_in;
+	def_strm->total_in = 0;
 
-	def_strm.next_out = cpage_out;
-	def_strm.total_out = 0;
+	def_strm->next_out = cpage_out;
+	def_strm->total_out = 0;
 
-	while (def_strm.total_out < *dstlen - STREAM_END_SPACE && def_strm.total_in < *sourcelen) {
-		def_strm.avail_out = *dstlen - (def_strm.total_out + STREAM_END_SPACE);
-		def_strm.avail_in = min((unsigned)(*sourcelen-def_strm.total_in), def_strm.avail_out);
+	while (def_strm->total_out < *dstlen - STREAM_END_SPACE && def_strm->total_in < *sourcelen) {
+		def_strm->avail_out = *dstlen - (def_strm->total_out + STREAM_END_SPACE);
+		def_strm->avail_in = min((unsigned)(*sourcelen-def_strm->total_in), def_strm->avail_out);
 		D1(printk(KERN_DEBUG "calling deflate with avail_in %d, avail_out %d\n",
-			  def_strm.avail_in, def_strm.avail_out));
-		ret = zlib_deflate(&def_strm, Z_PARTIAL_FLUSH);
+			  def_strm->avail_in, def_strm->avail_out));
+		ret = zlib_deflate(def_strm, Z_PARTIAL_FLUSH);
 		D1(printk(KERN_DEBUG "deflate returned with avail_in %d, avail_out %d, total_in %ld, total_out %ld\n",
-			  def_strm.avail_in, def_strm.avail_out, def_strm.total_in, def_strm.total_out));
+			  def_strm->avail_in, def_strm->avail_out, def_strm->total_in, def_strm->total_out));
 		if (ret != Z_OK) {
 			D1(printk(KERN_DEBUG "deflate in loop returned %d\n", ret));
-			zlib_deflateEnd(&def_strm);
-			mutex_unlock(&deflate_mutex);
+			zlib_deflateEnd(def_strm);
+			jffs2_compr_ws_put(ws);
 			return -1;
 		}
 	}
-	def_strm.avail_out += STREAM_END_SPACE;
-	def_strm.avail_in = 0;
-	ret = zlib_deflate(&def_strm, Z_FINISH);
-	zlib_deflateEnd(&def_strm);
+	def_strm->avail_out += STREAM_END_SPACE;
+	def_strm->avail_in = 0;
+	ret = zlib_deflate(def_strm, Z_FINISH);
+	zlib_deflateEnd(def_strm);
 
 	if (ret != Z_STREAM_END) {
 		D1(printk(KERN_DEBUG "final deflate returned %d\n", ret));
@@ -115,21 +159,21 @@ static int jffs2_zlib_compress(unsigned char *data_in,
 		goto out;
 	}
 
-	if (def_strm.total_out >= def_strm.total_in) {
+	if (def_strm->total_out >= def_strm->total_in) {
 		D1(printk(KERN_DEBUG "zlib compressed %ld bytes into %ld; failing\n",
-			  def_strm.total_in, def_strm.total_out));
+			  def_strm->total_in, def_strm->total_out));
 		ret = -1;
 		goto out;
 	}
 
 	D1(printk(KERN_DEBUG "zlib compressed %ld bytes into %ld\n",
-		  def_strm.total_in, def_strm.total_out));
+		  def_strm->total_in, def_strm->total_out));
 
-	*dstlen = def_strm.total_out;
-	*sourcelen = def_strm.total_in;
+	*dstlen = def_strm->total_out;
+	*sourcelen = def_strm->total_in;
 	ret = 0;
  out:
-	mutex_unlock(&deflate_mutex);
+	jffs2_compr_ws_put(ws);
 	return ret;
 }
 
@@ -137,18 +181,21 @@ static int jffs2_zlib_decompress(unsigned char *data_in,
 				 unsigned char *cpage_out,
 				 uint32_t srclen, uint32_t destlen)
 {
+	struct jffs2_compr_ws *ws;
+	z_stream *inf_strm;
 	int ret;
 	int wbits = MAX_WBITS;
 
-	mutex_lock(&inflate_mutex);
+	ws = jffs2_compr_ws_get(&inf_pool);
+	inf_strm = &container_of(ws, struct zlib_ws, ws)->strm;
 
-	inf_strm.next_in = data_in;
-	inf_strm.avail_in = srclen;
-	inf_strm.total_in = 0;
+	inf_strm->next_in = data_in;
+	inf_strm->avail_in = srclen;
+	inf_strm->total_in = 0;
 
-	inf_strm.next_out = cpage_out;
-	inf_strm.avail_out = destlen;
-	inf_strm.total_out = 0;
+	inf_strm->next_out = cpage_out;
+	inf_strm->avail_out = destlen;
+	inf_strm->total_out = 0;
 
 	/* If it's deflate, and it's got no preset dictionary, then
 	   we can tell zlib to skip the adler32 check. */
@@ -158,27 +205,27 @@ static int jffs2_zlib_decompress(unsigned char *data_in,
 
 		D2(printk(KERN_DEBUG "inflate skipping adler32\n"));
 		wbits = -((data_in[0] >> 4) + 8);
-		inf_strm.next_in += 2;
-		inf_strm.avail_in -= 2;
+		inf_strm->next_in += 2;
+		inf_strm->avail_in -= 2;
 	} else {
 		/* Let this remain D1 for now -- it should never happen */
 		D1(printk(KERN_DEBUG "inflate not skipping adler32\n"));
 	}
 
 
-	if (Z_OK != zlib_inflateInit2(&inf_strm, wbits)) {
+	if (Z_OK != zlib_inflateInit2(inf_strm, wbits)) {
 		printk(KERN_WARNING "inflateInit failed\n");
-		mutex_unlock(&inflate_mutex);
+		jffs2_compr_ws_put(ws);
 		return 1;
 	}
 
-	while((ret = zlib_inflate(&inf_strm, Z_FINISH)) == Z_OK)
+	while((ret = zlib_inflate(inf_strm, Z_FINISH)) == Z_OK)
 		;
 	if (ret != Z_STREAM_END) {
 		printk(KERN_NOTICE "inflate returned %d\n", ret);
 	}
-	zlib_inflateEnd(&inf_strm);
-	mutex_unlock(&inflate_mutex);
+	zlib_inflateEnd(inf_strm);
+	jffs2_compr_ws_put(ws);
 	return 0;
 }
 
@@ -16,6 +16,8 @@
 #include <linux/rbtree.h>
 #include <linux/crc32.h>
 #include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include "nodelist.h"
 
 static void jffs2_obsolete_node_frag(struct jffs2_sb_info *c,
@@ -403,6 +405,126 @@ int jffs2_add_full_dnode_to_inode(struct jffs2_sb_info *c, struct jffs2_inode_in
 	return 0;
 }
 
+static struct jffs2_scan_dirents *jffs2_alloc_scan_dirents(uint32_t max)
+{
+	struct jffs2_scan_dirents *list;
+	size_t size = sizeof(*list) + max * sizeof(struct jffs2_scan_dirent);
+
+	if (size <= PAGE_SIZE)
+		list = kmalloc(size, GFP_KERNEL);
+	else
+		list = vmalloc(size);
+	if (list) {
+		list->nr = 0;
+		list->max = max;
+	}
+	return list;
+}
+
+void jffs2_free_scan_dirents(struct jffs2_scan_dirents *list)
+{
+	if (is_vmalloc_addr(list))
+		vfree(list);
+	else
+		kfree(list);
+}
+
+/* The names of scan dirents are not kept in memory. When the length, hash
+   and CRC of two names match, read both names back from the medium to be
+   sure they really are the same, rather than lose a dirent whose name
+   merely collides. If they cannot be read, take them to be different:
+   then both are kept, which is what happens to any other pair of names. */
+static int jffs2_scan_dirent_names_match(struct jffs2_sb_info *c,
+					 const struct jffs2_scan_dirent *a,
+					 const struct jffs2_scan_dirent *b)
+{
+	size_t retlen;
+	uint8_t *buf;
+	int ret = 0;
+
+	buf = kmalloc(2 * a->nsize, GFP_KERNEL);
+	if (!buf)
+		return 0;
+
+	if (jffs2_flash_read(c, ref_offset(a->raw) + sizeof(struct jffs2_raw_dirent),
+			     a->nsize, &retlen, buf) || retlen != a->nsize)
+		goto out;
+	if (jffs2_flash_read(c, ref_offset(b->raw) + sizeof(struct jffs2_raw_dirent),
+			     b->nsize, &retlen, buf + a->nsize) || retlen != b->nsize)
+		goto out;
+
+	ret = !memcmp(buf, buf + a->nsize, a->nsize);
+	if (!ret)
+		dbg_dentlist("dirents at 0x%08x and 0x%08x have colliding names\n",
+			     ref_offset(a->raw), ref_offset(b->raw));
+out:
+	kfree(buf);
+	return ret;
+}
+
+/* Add a dirent found during scan to the array of its directory. If there
+   is already one with the same name, only the newer version is kept and
+   the other one is marked obsolete. Returns -ENOMEM if the array could
+   not be grown, in which case the new dirent has not been added. */
+int jffs2_add_scan_dirent(struct jffs2_sb_info *c, const struct jffs2_scan_dirent *new,
+			  struct jffs2_scan_dirents **list)
+{
+	struct jffs2_scan_dirents *l = *list;
+	struct jffs2_scan_dirent *d;
+	uint32_t lo = 0, hi, i;
+
+	dbg_dentlist("add dirent ino #%u, hash %#08x\n", new->ino, new->nhash);
+
+	if (l) {
+		/* Find the first entry with a hash not below the new one */
+		hi = l->nr;
+		while (lo < hi) {
+			i = (lo + hi) / 2;
+			if (l->d[i].nhash < new->nhash)
+				lo = i + 1;
+			else
+				hi = i;
+		}
+
+		for (d = &l->d[lo]; d < &l->d[l->nr] && d->nhash == new->nhash; d++) {
+			if (d->nsize != new->nsize || d->name_crc != new->name_crc ||
+			    !jffs2_scan_dirent_names_match(c, d, new))
+				continue;
+
+			/* Duplicate. Keep the newer one */
+			if (new->version < d->version) {
+				dbg_dentlist("Eep! Marking new dirent node obsolete, old is ino #%u\n",
+					d->ino);
+				jffs2_mark_node_obsolete(c, new->raw);
+			} else {
+				dbg_dentlist("marking old dirent ino #%u obsolete\n", d->ino);
+				jffs2_mark_node_obsolete(c, d->raw);
+				*d = *new;
+			}
+			return 0;
+		}
+	}
+
+	if (!l || l->nr == l->max) {
+		struct jffs2_scan_dirents *n;
+
+		n = jffs2_alloc_scan_dirents(l ? l->max * 2 : 8);
+		if (!n)
+			return -ENOMEM;
+		if (l) {
+			n->nr = l->nr;
+			memcpy(n->d, l->d, l->nr * sizeof(struct jffs2_scan_dirent));
+			jffs2_free_scan_dirents(l);
+		}
+		*list = l = n;
+	}
+
+	memmove(&l->d[lo + 1], &l->d[lo], (l->nr - lo) * sizeof(struct jffs2_scan_dirent));
+	l->d[lo] = *new;
+	l->nr++;
+	return 0;
+}
+
 void jffs2_set_inocache_state(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic, int state)
 {
 	spin_lock(&c->inocache_lock);
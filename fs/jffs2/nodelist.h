@@ -160,8 +160,8 @@ struct jffs2_inode_cache {
 	   can terminate the raw node refs' next_in_ino list -- which
 	   currently struct jffs2_xattr_datum and struct jffs2_xattr_ref. */
 
-	struct jffs2_full_dirent *scan_dents; /* Used during scan to hold
-		temporary lists of dirents, and later must be set to
+	struct jffs2_scan_dirents *scan_dents; /* Used during scan to hold
+		temporary arrays of dirents, and later must be set to
 		NULL to mark the end of the raw_node_ref->next_in_ino
 		chain. */
 	struct jffs2_raw_node_ref *nodes;
@@ -194,6 +194,7 @@ struct jffs2_inode_cache {
 #define INO_STATE_CLEARING	6	/* In clear_inode() */
 
 #define INO_FLAGS_XATTR_CHECKED	0x01	/* has no duplicate xattr_ref */
+#define INO_FLAGS_UNLINKED	0x02	/* removed by jffs2_build_filesystem() */
 
 #define RAWNODE_CLASS_INODE_CACHE	0
 #define RAWNODE_CLASS_XATTR_DATUM	1
@@ -258,6 +259,32 @@ struct jffs2_full_dirent
 	unsigned char name[0];
 };
 
+/*
+  During scan, dirents are only needed to work out the link counts and
+  to find the dirents which have been superseded by newer versions. So
+  rather than a jffs2_full_dirent with a copy of the name, each one is
+  kept as a compact record in a per-directory array sorted by name hash.
+  Two dirents have the same name if the name length, the name hash and
+  the name CRC all match, and the names read back from the medium do.
+*/
+struct jffs2_scan_dirent
+{
+	struct jffs2_raw_node_ref *raw;
+	uint32_t version;
+	uint32_t ino; /* == zero for unlink */
+	uint32_t nhash;
+	uint32_t name_crc;
+	uint8_t nsize;
+	uint8_t type;
+};
+
+struct jffs2_scan_dirents
+{
+	uint32_t nr;
+	uint32_t max;
+	struct jffs2_scan_dirent d[0];
+};
+
 /*
   Fragments - used to build a map of which raw node to obtain
   data from for each part of the ino
@@ -358,6 +385,8 @@ static inline struct jffs2_node_frag *frag_last(struct rb_root *root)
 
 /* nodelist.c */
 void jffs2_add_fd_to_list(struct jffs2_sb_info *c, struct jffs2_full_dirent *new, struct jffs2_full_dirent **list);
+int jffs2_add_scan_dirent(struct jffs2_sb_info *c, const struct jffs2_scan_dirent *new, struct jffs2_scan_dirents **list);
+void jffs2_free_scan_dirents(struct jffs2_scan_dirents *list);
 void jffs2_set_inocache_state(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic, int state);
 struct jffs2_inode_cache *jffs2_get_ino_cache(struct jffs2_sb_info *c, uint32_t ino);
 void jffs2_add_ino_cache (struct jffs2_sb_info *c, struct jffs2_inode_cache *new);
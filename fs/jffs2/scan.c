@@ -1005,7 +1005,7 @@ static int jffs2_scan_inode_node(struct jffs2_sb_info *c, struct jffs2_erasebloc
 static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				  struct jffs2_raw_dirent *rd, uint32_t ofs, struct jffs2_summary *s)
 {
-	struct jffs2_full_dirent *fd;
+	struct jffs2_scan_dirent sd;
 	struct jffs2_inode_cache *ic;
 	uint32_t checkedlen;
 	uint32_t crc;
@@ -1034,19 +1034,11 @@ static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblo
 		printk(KERN_ERR "Dirent at %08x has zeroes in name. Truncating to %d chars\n",
 		       ofs, checkedlen);
 	}
-	fd = jffs2_alloc_full_dirent(checkedlen+1);
-	if (!fd) {
-		return -ENOMEM;
-	}
-	memcpy(&fd->name, rd->name, checkedlen);
-	fd->name[checkedlen] = 0;
-
-	crc = crc32(0, fd->name, rd->nsize);
+	crc = crc32(0, rd->name, rd->nsize);
 	if (crc != je32_to_cpu(rd->name_crc)) {
 		printk(KERN_NOTICE "jffs2_scan_dirent_node(): Name CRC failed on node at 0x%08x: Read 0x%08x, calculated 0x%08x\n",
 		       ofs, je32_to_cpu(rd->name_crc), crc);
-		D1(printk(KERN_NOTICE "Name for which CRC failed is (now) '%s', ino #%d\n", fd->name, je32_to_cpu(rd->ino)));
-		jffs2_free_full_dirent(fd);
+		D1(printk(KERN_NOTICE "Name for which CRC failed is (now) '%.*s', ino #%d\n", checkedlen, rd->name, je32_to_cpu(rd->ino)));
 		/* FIXME: Why do we believe totlen? */
 		/* We believe totlen because the CRC on the node _header_ was OK, just the name failed. */
 		if ((err = jffs2_scan_dirty_space(c, jeb, PAD(je32_to_cpu(rd->totlen)))))
@@ -1054,20 +1046,20 @@ static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblo
 		return 0;
 	}
 	ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(rd->pino));
-	if (!ic) {
-		jffs2_free_full_dirent(fd);
+	if (!ic)
 		return -ENOMEM;
-	}
-
-	fd->raw = jffs2_link_node_ref(c, jeb, ofs | dirent_node_state(rd),
-				      PAD(je32_to_cpu(rd->totlen)), ic);
 
-	fd->next = NULL;
-	fd->version = je32_to_cpu(rd->version);
-	fd->ino = je32_to_cpu(rd->ino);
-	fd->nhash = full_name_hash(fd->name, checkedlen);
-	fd->type = rd->type;
-	jffs2_add_fd_to_list(c, fd, &ic->scan_dents);
+	sd.raw = jffs2_link_node_ref(c, jeb, ofs | dirent_node_state(rd),
+				     PAD(je32_to_cpu(rd->totlen)), ic);
+
+	sd.version = je32_to_cpu(rd->version);
+	sd.ino = je32_to_cpu(rd->ino);
+	sd.nhash = full_name_hash(rd->name, checkedlen);
+	sd.name_crc = crc;
+	sd.nsize = rd->nsize;
+	sd.type = rd->type;
+	if ((err = jffs2_add_scan_dirent(c, &sd, &ic->scan_dents)))
+		return err;
 
 	if (jffs2_sum_active()) {
 		jffs2_sum_add_dirent_mem(s, rd, ofs - jeb->offset);
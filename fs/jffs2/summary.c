@@ -385,7 +385,7 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 				struct jffs2_raw_summary *summary, uint32_t *pseudo_random)
 {
 	struct jffs2_inode_cache *ic;
-	struct jffs2_full_dirent *fd;
+	struct jffs2_scan_dirent sd;
 	void *sp;
 	int i, ino;
 	int err;
@@ -452,29 +452,25 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 				}
 
 
-				fd = jffs2_alloc_full_dirent(checkedlen+1);
-				if (!fd)
-					return -ENOMEM;
-
-				memcpy(&fd->name, spd->name, checkedlen);
-				fd->name[checkedlen] = 0;
-
 				ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(spd->pino));
-				if (!ic) {
-					jffs2_free_full_dirent(fd);
+				if (!ic)
 					return -ENOMEM;
-				}
-
-				fd->raw = sum_link_node_ref(c, jeb,  je32_to_cpu(spd->offset) | REF_UNCHECKED,
-							    PAD(je32_to_cpu(spd->totlen)), ic);
-
-				fd->next = NULL;
-				fd->version = je32_to_cpu(spd->version);
-				fd->ino = je32_to_cpu(spd->ino);
-				fd->nhash = full_name_hash(fd->name, checkedlen);
-				fd->type = spd->type;
 
-				jffs2_add_fd_to_list(c, fd, &ic->scan_dents);
+				sd.raw = sum_link_node_ref(c, jeb,  je32_to_cpu(spd->offset) | REF_UNCHECKED,
+							   PAD(je32_to_cpu(spd->totlen)), ic);
+
+				sd.version = je32_to_cpu(spd->version);
+				sd.ino = je32_to_cpu(spd->ino);
+				sd.nhash = full_name_hash(spd->name, checkedlen);
+				/* The summary does not carry the name CRC, but
+				   it is the CRC of the same name as in the node */
+				sd.name_crc = crc32(0, spd->name, spd->nsize);
+				sd.nsize = spd->nsize;
+				sd.type = spd->type;
+
+				err = jffs2_add_scan_dirent(c, &sd, &ic->scan_dents);
+				if (err)
+					return err;
 
 				*pseudo_random += je32_to_cpu(spd->version);
 
@@ -37,6 +37,7 @@
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
 #include "decompressor.h"
+#include "page_actor.h"
 
 /*
  * Read the metadata block length, this is stored in the first two
@@ -71,113 +72,49 @@ static struct buffer_head *get_block_length(struct super_block *sb,
 
 
 /*
- * Read and decompress a metadata block or datablock.  Length is non-zero
- * if a datablock is being read (the size is stored elsewhere in the
- * filesystem), otherwise the length is obtained from the first two bytes of
- * the metadata block.  A bit in the length field indicates if the block
- * is stored uncompressed in the filesystem (usually because compression
- * generated a larger block - this does occasionally happen with zlib).
+ * Wait for the buffer heads of a block, then decompress (or copy, if the
+ * block is stored uncompressed) its contents into output.  The buffer
+ * heads are released and the bh array freed.
  */
-int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
-			int length, u64 *next_index, int srclength, int pages)
+static int squashfs_read_bh(struct super_block *sb, struct buffer_head **bh,
+	int b, int offset, int length, int compressed, u64 index,
+	struct squashfs_page_actor *output, int srclength)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	struct buffer_head **bh;
-	int offset = index & ((1 << msblk->devblksize_log2) - 1);
-	u64 cur_index = index >> msblk->devblksize_log2;
-	int bytes, compressed, b = 0, k = 0, page = 0, avail;
-
-	bh = kcalloc(((srclength + msblk->devblksize - 1)
-		>> msblk->devblksize_log2) + 1, sizeof(*bh), GFP_KERNEL);
-	if (bh == NULL)
-		return -ENOMEM;
-
-	if (length) {
-		/*
-		 * Datablock.
-		 */
-		bytes = -offset;
-		compressed = SQUASHFS_COMPRESSED_BLOCK(length);
-		length = SQUASHFS_COMPRESSED_SIZE_BLOCK(length);
-		if (next_index)
-			*next_index = index + length;
-
-		TRACE("Block @ 0x%llx, %scompressed size %d, src size %d\n",
-			index, compressed ? "" : "un", length, srclength);
-
-		if (length < 0 || length > srclength ||
-				(index + length) > msblk->bytes_used)
-			goto read_failure;
-
-		for (b = 0; bytes < length; b++, cur_index++) {
-			bh[b] = sb_getblk(sb, cur_index);
-			if (bh[b] == NULL)
-				goto block_release;
-			bytes += msblk->devblksize;
-		}
-		ll_rw_block(READ, b, bh);
-	} else {
-		/*
-		 * Metadata block.
-		 */
-		if ((index + 2) > msblk->bytes_used)
-			goto read_failure;
-
-		bh[0] = get_block_length(sb, &cur_index, &offset, &length);
-		if (bh[0] == NULL)
-			goto read_failure;
-		b = 1;
-
-		bytes = msblk->devblksize - offset;
-		compressed = SQUASHFS_COMPRESSED(length);
-		length = SQUASHFS_COMPRESSED_SIZE(length);
-		if (next_index)
-			*next_index = index + length + 2;
+	int bytes, k = 0, avail, i;
 
-		TRACE("Block @ 0x%llx, %scompressed size %d\n", index,
-				compressed ? "" : "un", length);
-
-		if (length < 0 || length > srclength ||
-					(index + length) > msblk->bytes_used)
+	for (i = 0; i < b; i++) {
+		wait_on_buffer(bh[i]);
+		if (!buffer_uptodate(bh[i]))
 			goto block_release;
-
-		for (; bytes < length; b++) {
-			bh[b] = sb_getblk(sb, ++cur_index);
-			if (bh[b] == NULL)
-				goto block_release;
-			bytes += msblk->devblksize;
-		}
-		ll_rw_block(READ, b - 1, bh + 1);
 	}
 
 	if (compressed) {
-		length = squashfs_decompress(msblk, buffer, bh, b, offset,
-			 length, srclength, pages);
+		length = squashfs_decompress(msblk, output, bh, b, offset,
+			 length, srclength);
 		if (length < 0)
-			goto read_failure;
+			goto block_release;
+
+		for (; k < b; k++)
+			put_bh(bh[k]);
 	} else {
 		/*
 		 * Block is uncompressed.
 		 */
-		int i, in, pg_offset = 0;
-
-		for (i = 0; i < b; i++) {
-			wait_on_buffer(bh[i]);
-			if (!buffer_uptodate(bh[i]))
-				goto block_release;
-		}
+		int in, pg_offset = 0;
+		void *data = squashfs_first_page(output);
 
 		for (bytes = length; k < b; k++) {
 			in = min(bytes, msblk->devblksize - offset);
 			bytes -= in;
 			while (in) {
 				if (pg_offset == PAGE_CACHE_SIZE) {
-					page++;
+					data = squashfs_next_page(output);
 					pg_offset = 0;
 				}
 				avail = min_t(int, in, PAGE_CACHE_SIZE -
 						pg_offset);
-				memcpy(buffer[page] + pg_offset,
+				memcpy(data + pg_offset,
 						bh[k]->b_data + offset, avail);
 				in -= avail;
 				pg_offset += avail;
@@ -186,11 +123,186 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 			offset = 0;
 			put_bh(bh[k]);
 		}
+		squashfs_finish_page(output);
 	}
 
 	kfree(bh);
 	return length;
 
+block_release:
+	for (; k < b; k++)
+		put_bh(bh[k]);
+
+	ERROR("squashfs_read_data failed to read block 0x%llx\n",
+					(unsigned long long) index);
+	kfree(bh);
+	return -EIO;
+}
+
+
+/*
+ * Start reading a datablock without waiting for the I/O to complete, so
+ * that several datablocks can be in flight while earlier ones are being
+ * decompressed.  Length is the datablock length as stored in the block
+ * list.  The read is finished by squashfs_read_datablock_complete() or
+ * abandoned with squashfs_read_datablock_release().
+ */
+int squashfs_read_datablock_submit(struct super_block *sb,
+	struct squashfs_data_req *req, u64 index, int length, int srclength)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	u64 cur_index = index >> msblk->devblksize_log2;
+	int bytes;
+
+	req->index = index;
+	req->offset = index & ((1 << msblk->devblksize_log2) - 1);
+	req->compressed = SQUASHFS_COMPRESSED_BLOCK(length);
+	req->length = SQUASHFS_COMPRESSED_SIZE_BLOCK(length);
+	req->b = 0;
+
+	TRACE("Block @ 0x%llx, %scompressed size %d, src size %d\n",
+		index, req->compressed ? "" : "un", req->length, srclength);
+
+	if (req->length < 0 || req->length > srclength ||
+			(index + req->length) > msblk->bytes_used)
+		goto read_failure;
+
+	req->bh = kcalloc(((srclength + msblk->devblksize - 1)
+		>> msblk->devblksize_log2) + 1, sizeof(*req->bh), GFP_KERNEL);
+	if (req->bh == NULL)
+		return -ENOMEM;
+
+	for (bytes = -req->offset; bytes < req->length; req->b++,
+			cur_index++) {
+		req->bh[req->b] = sb_getblk(sb, cur_index);
+		if (req->bh[req->b] == NULL)
+			goto block_release;
+		bytes += msblk->devblksize;
+	}
+	ll_rw_block(READ, req->b, req->bh);
+
+	return 0;
+
+block_release:
+	squashfs_read_datablock_release(req);
+
+read_failure:
+	ERROR("squashfs_read_data failed to read block 0x%llx\n",
+					(unsigned long long) index);
+	return -EIO;
+}
+
+
+/*
+ * Wait for and decompress a datablock started with
+ * squashfs_read_datablock_submit().
+ */
+int squashfs_read_datablock_complete(struct super_block *sb,
+	struct squashfs_data_req *req, struct squashfs_page_actor *output,
+	int srclength)
+{
+	int res = squashfs_read_bh(sb, req->bh, req->b, req->offset,
+		req->length, req->compressed, req->index, output, srclength);
+
+	req->bh = NULL;
+	req->b = 0;
+	return res;
+}
+
+
+void squashfs_read_datablock_release(struct squashfs_data_req *req)
+{
+	int i;
+
+	for (i = 0; i < req->b; i++)
+		put_bh(req->bh[i]);
+
+	kfree(req->bh);
+	req->bh = NULL;
+	req->b = 0;
+}
+
+
+/*
+ * Read and decompress a metadata block or datablock.  Length is non-zero
+ * if a datablock is being read (the size is stored elsewhere in the
+ * filesystem), otherwise the length is obtained from the first two bytes of
+ * the metadata block.  A bit in the length field indicates if the block
+ * is stored uncompressed in the filesystem (usually because compression
+ * generated a larger block - this does occasionally happen with zlib).
+ */
+int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
+			int length, u64 *next_index, int srclength, int pages)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct squashfs_page_actor actor;
+	struct buffer_head **bh;
+	int offset = index & ((1 << msblk->devblksize_log2) - 1);
+	u64 cur_index = index >> msblk->devblksize_log2;
+	int bytes, compressed, b = 0, k = 0;
+
+	squashfs_actor_init(&actor, buffer, pages);
+
+	if (length) {
+		/*
+		 * Datablock.
+		 */
+		struct squashfs_data_req req;
+		int res;
+
+		if (next_index)
+			*next_index = index +
+				SQUASHFS_COMPRESSED_SIZE_BLOCK(length);
+
+		res = squashfs_read_datablock_submit(sb, &req, index, length,
+			srclength);
+		if (res)
+			return res;
+
+		return squashfs_read_datablock_complete(sb, &req, &actor,
+			srclength);
+	}
+
+	/*
+	 * Metadata block.
+	 */
+	bh = kcalloc(((srclength + msblk->devblksize - 1)
+		>> msblk->devblksize_log2) + 1, sizeof(*bh), GFP_KERNEL);
+	if (bh == NULL)
+		return -ENOMEM;
+
+	if ((index + 2) > msblk->bytes_used)
+		goto read_failure;
+
+	bh[0] = get_block_length(sb, &cur_index, &offset, &length);
+	if (bh[0] == NULL)
+		goto read_failure;
+	b = 1;
+
+	bytes = msblk->devblksize - offset;
+	compressed = SQUASHFS_COMPRESSED(length);
+	length = SQUASHFS_COMPRESSED_SIZE(length);
+	if (next_index)
+		*next_index = index + length + 2;
+
+	TRACE("Block @ 0x%llx, %scompressed size %d\n", index,
+			compressed ? "" : "un", length);
+
+	if (length < 0 || length > srclength ||
+				(index + length) > msblk->bytes_used)
+		goto block_release;
+
+	for (; bytes < length; b++) {
+		bh[b] = sb_getblk(sb, ++cur_index);
+		if (bh[b] == NULL)
+			goto block_release;
+		bytes += msblk->devblksize;
+	}
+	ll_rw_block(READ, b - 1, bh + 1);
+
+	return squashfs_read_bh(sb, bh, b, offset, length, compressed, index,
+		&actor, srclength);
+
 block_release:
 	for (; k < b; k++)
 		put_bh(bh[k]);
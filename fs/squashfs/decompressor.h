@@ -23,11 +23,21 @@
  * decompressor.h
  */
 
+struct squashfs_page_actor;
+
+/*
+ * A decompressor allocates independent streams with init(); decompress()
+ * is handed one of them and never called concurrently on the same stream.
+ * How streams are shared between readers is decided by the
+ * decompressor_{single,multi,multi_percpu}.c implementation selected at
+ * build time.
+ */
 struct squashfs_decompressor {
 	void	*(*init)(struct squashfs_sb_info *);
 	void	(*free)(void *);
-	int	(*decompress)(struct squashfs_sb_info *, void **,
-		struct buffer_head **, int, int, int, int, int);
+	int	(*decompress)(struct squashfs_sb_info *, void *,
+		struct squashfs_page_actor *, struct buffer_head **, int, int,
+		int, int);
 	int	id;
 	char	*name;
 	int	supported;
@@ -44,12 +54,4 @@ static inline void squashfs_decompressor_free(struct squashfs_sb_info *msblk,
 	if (msblk->decompressor)
 		msblk->decompressor->free(s);
 }
-
-static inline int squashfs_decompress(struct squashfs_sb_info *msblk,
-	void **buffer, struct buffer_head **bh, int b, int offset, int length,
-	int srclength, int pages)
-{
-	return msblk->decompressor->decompress(msblk, buffer, bh, b, offset,
-		length, srclength, pages);
-}
 #endif
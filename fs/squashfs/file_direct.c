@@ -0,0 +1,385 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * file_direct.c
+ */
+
+/*
+ * This file decompresses datablocks straight into the page cache pages
+ * they cover, avoiding the copy through the read_page cache.  The
+ * cache is only used when some of the pages cannot be grabbed (they are
+ * locked by another reader, or already uptodate).
+ *
+ * It also implements readpages, so that readahead submits the I/O for
+ * all the datablocks in the readahead window at once, and decompresses
+ * each block while the reads of the following ones are still in flight.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+#include "page_actor.h"
+
+/*
+ * Maximum number of datablocks readpages keeps in flight before it
+ * waits for them.
+ */
+#define SQUASHFS_READAHEAD_BLOCKS	8
+
+/* Pages of one datablock collected by squashfs_readpages() */
+struct squashfs_ra_block {
+	struct squashfs_data_req	req;
+	struct page			**page;
+	int				start_index;
+	int				pages;
+	u64				block;
+	int				bsize;
+	int				done;
+};
+
+/* Number of page cache pages covered by the datablock at start_index */
+static int squashfs_block_pages(struct inode *inode, int start_index)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int end_index = start_index | mask;
+
+	if (end_index > file_end)
+		end_index = file_end;
+
+	return end_index - start_index + 1;
+}
+
+/*
+ * Grab the pages of a block not already held by the caller.  Returns the
+ * number of pages which could not be grabbed, either because someone else
+ * holds them locked or because they are already uptodate.
+ */
+static int squashfs_grab_pages(struct address_space *mapping,
+	int start_index, int pages, struct page **page)
+{
+	int i, missing_pages = 0;
+
+	for (i = 0; i < pages; i++) {
+		if (page[i])
+			continue;
+
+		page[i] = grab_cache_page_nowait(mapping, start_index + i);
+		if (page[i] == NULL) {
+			missing_pages++;
+			continue;
+		}
+
+		if (PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			page[i] = NULL;
+			missing_pages++;
+		}
+	}
+
+	return missing_pages;
+}
+
+/*
+ * Mark the pages of a block uptodate (or errored), unlock them and drop
+ * the reference held on them.  Target_page is not released, and on error
+ * is left locked to be dealt with by the caller.
+ */
+static void squashfs_finish_pages(struct page **page, int pages,
+	struct page *target_page, int error)
+{
+	int i;
+
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL)
+			continue;
+
+		if (error) {
+			if (page[i] == target_page)
+				continue;
+			SetPageError(page[i]);
+		} else {
+			flush_dcache_page(page[i]);
+			SetPageUptodate(page[i]);
+		}
+
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+}
+
+/*
+ * Decompress a submitted datablock directly into its page cache pages.
+ * The decompressor maps them one at a time through the page actor.
+ */
+static int squashfs_read_direct(struct super_block *sb,
+	struct squashfs_data_req *req, struct page **page, int pages)
+{
+	struct squashfs_page_actor actor;
+	void *pageaddr;
+	int i, bytes, res;
+
+	squashfs_actor_init_page(&actor, page, pages);
+
+	/*
+	 * Bounding the source length by the pages grabbed stops a
+	 * corrupted block from overrunning them.
+	 */
+	res = squashfs_read_datablock_complete(sb, req, &actor,
+		pages << PAGE_CACHE_SHIFT);
+	if (res < 0)
+		return res;
+
+	/* Zero the tail of the last page, and any pages not filled */
+	bytes = res & (PAGE_CACHE_SIZE - 1);
+	for (i = res >> PAGE_CACHE_SHIFT; i < pages; i++, bytes = 0) {
+		pageaddr = kmap_atomic(page[i], KM_USER0);
+		memset(pageaddr + bytes, 0, PAGE_CACHE_SIZE - bytes);
+		kunmap_atomic(pageaddr, KM_USER0);
+	}
+
+	return 0;
+}
+
+/*
+ * Read the datablock through the read_page cache and copy it into those
+ * of its pages we hold.
+ */
+static int squashfs_read_cache(struct super_block *sb, u64 block, int bsize,
+	int pages, struct page **page)
+{
+	struct squashfs_cache_entry *buffer = squashfs_get_datablock(sb,
+						 block, bsize);
+	int bytes = buffer->length, res = buffer->error, n, offset = 0;
+	void *pageaddr;
+
+	if (res) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		goto out;
+	}
+
+	for (n = 0; n < pages; n++, bytes -= PAGE_CACHE_SIZE,
+			offset += PAGE_CACHE_SIZE) {
+		int avail = bytes > 0 ? min_t(int, bytes, PAGE_CACHE_SIZE) : 0;
+
+		if (page[n] == NULL)
+			continue;
+
+		pageaddr = kmap_atomic(page[n], KM_USER0);
+		squashfs_copy_data(pageaddr, buffer, offset, avail);
+		memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
+		kunmap_atomic(pageaddr, KM_USER0);
+	}
+
+out:
+	squashfs_cache_put(buffer);
+	return res;
+}
+
+/* Read separately compressed datablock directly into page cache */
+int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+{
+	struct address_space *mapping = target_page->mapping;
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int pages = squashfs_block_pages(inode, start_index);
+	struct squashfs_data_req req;
+	struct page **page;
+	int res;
+
+	page = kcalloc(pages, sizeof(*page), GFP_KERNEL);
+	if (page == NULL)
+		return -ENOMEM;
+
+	/* Try to grab all the pages covered by the Squashfs block */
+	page[target_page->index - start_index] = target_page;
+	if (squashfs_grab_pages(mapping, start_index, pages, page)) {
+		/*
+		 * Couldn't get one or more pages, they have either been
+		 * read by someone else, or we're racing with another
+		 * reader of the same block.  Fall back to decompressing
+		 * into the read_page cache and copying.
+		 */
+		res = squashfs_read_cache(inode->i_sb, block, bsize, pages,
+			page);
+	} else {
+		res = squashfs_read_datablock_submit(inode->i_sb, &req, block,
+			bsize, pages << PAGE_CACHE_SHIFT);
+		if (res == 0)
+			res = squashfs_read_direct(inode->i_sb, &req, page,
+				pages);
+	}
+
+	squashfs_finish_pages(page, pages, target_page, res);
+	kfree(page);
+
+	return res;
+}
+
+
+/*
+ * All readahead pages of the block have been collected.  Grab its other
+ * pages and start the read, or if that is not possible read it through
+ * the read_page cache now.
+ */
+static void squashfs_ra_submit(struct inode *inode,
+	struct squashfs_ra_block *rb)
+{
+	struct super_block *sb = inode->i_sb;
+	int res;
+
+	if (squashfs_grab_pages(inode->i_mapping, rb->start_index, rb->pages,
+			rb->page)) {
+		res = squashfs_read_cache(sb, rb->block, rb->bsize, rb->pages,
+			rb->page);
+		goto done;
+	}
+
+	res = squashfs_read_datablock_submit(sb, &rb->req, rb->block,
+		rb->bsize, rb->pages << PAGE_CACHE_SHIFT);
+	if (res == 0)
+		return;
+
+done:
+	squashfs_finish_pages(rb->page, rb->pages, NULL, res);
+	rb->done = 1;
+}
+
+/*
+ * Decompress the submitted blocks in file order.  The I/O of the later
+ * blocks continues while the earlier ones are being decompressed.  Only
+ * one page of one block is mapped at any time, however many pages the
+ * readahead window holds.
+ */
+static void squashfs_ra_complete(struct inode *inode,
+	struct squashfs_ra_block *ra, int nr_blocks)
+{
+	int i, res;
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct squashfs_ra_block *rb = &ra[i];
+
+		if (!rb->done) {
+			res = squashfs_read_direct(inode->i_sb, &rb->req,
+				rb->page, rb->pages);
+			squashfs_finish_pages(rb->page, rb->pages, NULL, res);
+		}
+
+		kfree(rb->page);
+		memset(rb, 0, sizeof(*rb));
+	}
+}
+
+int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	struct squashfs_ra_block *ra, *rb = NULL;
+	int nr_blocks = 0;
+
+	ra = kcalloc(SQUASHFS_READAHEAD_BLOCKS, sizeof(*ra), GFP_KERNEL);
+	if (ra == NULL)
+		return -ENOMEM;
+
+	/* Pages are on the list in reverse order of index */
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+		int index = page->index >> shift;
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+				GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+
+		if (rb && rb->start_index == index << shift) {
+			/* Another page of the block being collected */
+			rb->page[page->index - rb->start_index] = page;
+			continue;
+		}
+
+		if (rb)
+			squashfs_ra_submit(inode, rb);
+		rb = NULL;
+
+		if (nr_blocks == SQUASHFS_READAHEAD_BLOCKS) {
+			squashfs_ra_complete(inode, ra, nr_blocks);
+			nr_blocks = 0;
+		}
+
+		if (index < file_end || squashfs_i(inode)->fragment_block ==
+				SQUASHFS_INVALID_BLK) {
+			rb = &ra[nr_blocks];
+			rb->bsize = squashfs_read_blocklist(inode, index,
+				&rb->block);
+		}
+
+		if (rb && rb->bsize > 0) {
+			rb->start_index = index << shift;
+			rb->pages = squashfs_block_pages(inode,
+				rb->start_index);
+			rb->page = kcalloc(rb->pages, sizeof(*rb->page),
+				GFP_KERNEL);
+		}
+
+		if (rb == NULL || rb->bsize <= 0 || rb->page == NULL) {
+			/*
+			 * Fragments, holes and errors are left to readpage,
+			 * which also reports the error.
+			 */
+			if (rb)
+				memset(rb, 0, sizeof(*rb));
+			rb = NULL;
+			mapping->a_ops->readpage(file, page);
+			page_cache_release(page);
+			continue;
+		}
+
+		rb->page[page->index - rb->start_index] = page;
+		nr_blocks++;
+	}
+
+	if (rb)
+		squashfs_ra_submit(inode, rb);
+	squashfs_ra_complete(inode, ra, nr_blocks);
+
+	kfree(ra);
+	return 0;
+}
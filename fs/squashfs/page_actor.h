@@ -0,0 +1,64 @@
+#ifndef PAGE_ACTOR_H
+#define PAGE_ACTOR_H
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * page_actor.h
+ */
+
+/*
+ * The destination of a decompression, handed out one page at a time.
+ * Either the buffers of a cache entry, which are always mapped, or page
+ * cache pages, which are kmap_atomic()ed one at a time, so that the
+ * number of pages in a datablock is not bounded by the kmap pool.
+ *
+ * No caller may sleep between squashfs_first_page() and
+ * squashfs_finish_page().
+ */
+struct squashfs_page_actor {
+	void	**buffer;
+	struct page **page;
+	void	*pageaddr;
+	void	*(*first)(struct squashfs_page_actor *);
+	void	*(*next)(struct squashfs_page_actor *);
+	void	(*finish)(struct squashfs_page_actor *);
+	int	pages;
+	int	next_page;
+};
+
+extern void squashfs_actor_init(struct squashfs_page_actor *, void **, int);
+extern void squashfs_actor_init_page(struct squashfs_page_actor *,
+				struct page **, int);
+
+/* Map and return the first page */
+static inline void *squashfs_first_page(struct squashfs_page_actor *actor)
+{
+	return actor->first(actor);
+}
+
+/* Unmap the current page, and map the next one, or return NULL at the end */
+static inline void *squashfs_next_page(struct squashfs_page_actor *actor)
+{
+	return actor->next(actor);
+}
+
+/* Unmap the current page */
+static inline void squashfs_finish_page(struct squashfs_page_actor *actor)
+{
+	actor->finish(actor);
+}
+#endif
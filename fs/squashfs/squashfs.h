@@ -32,9 +32,17 @@ static inline struct squashfs_inode_info *squashfs_i(struct inode *inode)
 	return list_entry(inode, struct squashfs_inode_info, vfs_inode);
 }
 
+struct squashfs_page_actor;
+
 /* block.c */
 extern int squashfs_read_data(struct super_block *, void **, u64, int, u64 *,
 				int, int);
+extern int squashfs_read_datablock_submit(struct super_block *,
+				struct squashfs_data_req *, u64, int, int);
+extern int squashfs_read_datablock_complete(struct super_block *,
+				struct squashfs_data_req *,
+				struct squashfs_page_actor *, int);
+extern void squashfs_read_datablock_release(struct squashfs_data_req *);
 
 /* cache.c */
 extern struct squashfs_cache *squashfs_cache_init(char *, int, int);
@@ -54,10 +62,30 @@ extern int squashfs_read_table(struct super_block *, void *, u64, int);
 /* decompressor.c */
 extern const struct squashfs_decompressor *squashfs_lookup_decompressor(int);
 
+/* decompressor_xxx.c */
+extern void *squashfs_decompressor_create(struct squashfs_sb_info *);
+extern void squashfs_decompressor_destroy(struct squashfs_sb_info *);
+extern int squashfs_decompress(struct squashfs_sb_info *,
+				struct squashfs_page_actor *,
+				struct buffer_head **, int, int, int, int);
+extern int squashfs_max_decompressors(void);
+
 /* export.c */
 extern __le64 *squashfs_read_inode_lookup_table(struct super_block *, u64,
 				unsigned int);
 
+/* file.c */
+extern int squashfs_read_blocklist(struct inode *, int, u64 *);
+extern void squashfs_copy_cache(struct page *, struct squashfs_cache_entry *,
+				int, int);
+
+/* file_xxx.c */
+extern int squashfs_readpage_block(struct page *, u64, int);
+
+/* file_direct.c */
+extern int squashfs_readpages(struct file *, struct address_space *,
+				struct list_head *, unsigned);
+
 /* fragment.c */
 extern int squashfs_frag_lookup(struct super_block *, unsigned int, u64 *);
 extern __le64 *squashfs_read_fragment_index_table(struct super_block *,
@@ -107,3 +135,6 @@ extern const struct squashfs_decompressor squashfs_zlib_comp_ops;
 
 /* lzo_wrapper.c */
 extern const struct squashfs_decompressor squashfs_lzo_comp_ops;
+
+/* xz_wrapper.c */
+extern const struct squashfs_decompressor squashfs_xz_comp_ops;
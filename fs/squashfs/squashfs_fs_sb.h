@@ -51,6 +51,16 @@ struct squashfs_cache_entry {
 	void			**data;
 };
 
+/* A datablock read which has been submitted but not yet decompressed */
+struct squashfs_data_req {
+	struct buffer_head	**bh;
+	int			b;
+	int			offset;
+	int			length;
+	int			compressed;
+	u64			index;
+};
+
 struct squashfs_sb_info {
 	const struct squashfs_decompressor	*decompressor;
 	int					devblksize;
@@ -62,7 +72,6 @@ struct squashfs_sb_info {
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
 	void					*stream;
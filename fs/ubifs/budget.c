@@ -65,6 +65,8 @@ static void shrink_liability(struct ubifs_info *c, int nr_to_write)
 	down_read(&c->vfs_sb->s_umount);
 	writeback_inodes_sb(c->vfs_sb);
 	up_read(&c->vfs_sb->s_umount);
+	/* Pipelined write-back releases the budget asynchronously */
+	ubifs_wb_flush(c);
 }
 
 /**
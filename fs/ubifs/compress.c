@@ -28,6 +28,7 @@
  */
 
 #include <linux/crypto.h>
+#include <linux/cpumask.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -37,12 +38,12 @@ static struct ubifs_compressor none_compr = {
 	.capi_name = "",
 };
 
-#ifdef CONFIG_UBIFS_FS_LZO
-static DEFINE_MUTEX(lzo_mutex);
+/* Maximum number of contexts per compressor */
+#define UBIFS_COMPR_MAX_CTX 32
 
+#ifdef CONFIG_UBIFS_FS_LZO
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
-	.comp_mutex = &lzo_mutex,
 	.name = "lzo",
 	.capi_name = "lzo",
 };
@@ -54,13 +55,9 @@ static struct ubifs_compressor lzo_compr = {
 #endif
 
 #ifdef CONFIG_UBIFS_FS_ZLIB
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
-
 static struct ubifs_compressor zlib_compr = {
 	.compr_type = UBIFS_COMPR_ZLIB,
-	.comp_mutex = &deflate_mutex,
-	.decomp_mutex = &inflate_mutex,
+	.decomp_lock = 1,
 	.name = "zlib",
 	.capi_name = "deflate",
 };
@@ -74,6 +71,82 @@ static struct ubifs_compressor zlib_compr = {
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/**
+ * grow_ctx - set up one more compressor context.
+ * @compr: compressor description object
+ *
+ * This function returns the new context, or %NULL if there is no room for
+ * one, if another task is adding one, or if the cryptoapi handle cannot be
+ * allocated. The allocation may enter reclaim and write back UBIFS pages,
+ * which compresses data, so @compr->grow_mutex is only tried: a nested call
+ * then just waits for an existing context.
+ */
+static struct ubifs_compr_ctx *grow_ctx(struct ubifs_compressor *compr)
+{
+	struct ubifs_compr_ctx *ctx = NULL;
+	struct crypto_comp *cc;
+
+	if (!mutex_trylock(&compr->grow_mutex))
+		return NULL;
+
+	if (compr->ctx_cnt < compr->ctx_max) {
+		cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(cc)) {
+			ubifs_warn("cannot allocate compressor %s context, "
+				   "error %ld", compr->name, PTR_ERR(cc));
+			/* Do not try again, make do with what there is */
+			compr->ctx_max = compr->ctx_cnt;
+		} else {
+			ctx = &compr->ctx[compr->ctx_cnt];
+			ctx->cc = cc;
+			/* Publish @ctx->cc before the new @compr->ctx_cnt */
+			smp_wmb();
+			compr->ctx_cnt += 1;
+			dbg_gen("compressor %s: %d contexts", compr->name,
+				compr->ctx_cnt);
+		}
+	}
+
+	mutex_unlock(&compr->grow_mutex);
+	return ctx;
+}
+
+/**
+ * lock_ctx - find and lock a compressor context.
+ * @compr: compressor description object
+ * @decomp: non-zero to lock the context for decompression
+ *
+ * This function returns a locked context, preferring the context of the
+ * current CPU. If it is busy (e.g., the task which uses it was preempted or
+ * migrated), a free context is looked for. If there is none, a new context is
+ * set up, and if that is not possible, the function waits for the context of
+ * the current CPU.
+ */
+static struct ubifs_compr_ctx *lock_ctx(struct ubifs_compressor *compr,
+					int decomp)
+{
+	int i, n, cnt = ACCESS_ONCE(compr->ctx_cnt);
+	struct ubifs_compr_ctx *ctx;
+
+	/* Pairs with the barrier in 'grow_ctx()' */
+	smp_rmb();
+	n = raw_smp_processor_id() % cnt;
+	for (i = 0; i < cnt; i++) {
+		ctx = &compr->ctx[(n + i) % cnt];
+		if (mutex_trylock(decomp ? &ctx->decomp_mutex :
+					   &ctx->comp_mutex))
+			return ctx;
+	}
+
+	ctx = NULL;
+	if (cnt < compr->ctx_max)
+		ctx = grow_ctx(compr);
+	if (!ctx)
+		ctx = &compr->ctx[n];
+	mutex_lock(decomp ? &ctx->decomp_mutex : &ctx->comp_mutex);
+	return ctx;
+}
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -97,6 +170,7 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 {
 	int err;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	struct ubifs_compr_ctx *ctx;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -105,12 +179,10 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+	ctx = lock_ctx(compr, 0);
+	err = crypto_comp_compress(ctx->cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	mutex_unlock(&ctx->comp_mutex);
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -150,6 +222,7 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 {
 	int err;
 	struct ubifs_compressor *compr;
+	struct ubifs_compr_ctx *ctx;
 
 	if (unlikely(compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)) {
 		ubifs_err("invalid compression type %d", compr_type);
@@ -169,12 +242,15 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		return 0;
 	}
 
-	if (compr->decomp_mutex)
-		mutex_lock(compr->decomp_mutex);
-	err = crypto_comp_decompress(compr->cc, in_buf, in_len, out_buf,
-				     (unsigned int *)out_len);
-	if (compr->decomp_mutex)
-		mutex_unlock(compr->decomp_mutex);
+	if (compr->decomp_lock) {
+		ctx = lock_ctx(compr, 1);
+		err = crypto_comp_decompress(ctx->cc, in_buf, in_len, out_buf,
+					     (unsigned int *)out_len);
+		mutex_unlock(&ctx->decomp_mutex);
+	} else
+		/* Decompression does not use the context state */
+		err = crypto_comp_decompress(compr->ctx[0].cc, in_buf, in_len,
+					     out_buf, (unsigned int *)out_len);
 	if (err)
 		ubifs_err("cannot decompress %d bytes, compressor %s, "
 			  "error %d", in_len, compr->name, err);
@@ -187,17 +263,40 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
  * @compr: compressor description object
  *
  * This function initializes the requested compressor and returns zero in case
- * of success or a negative error code in case of failure.
+ * of success or a negative error code in case of failure. Room is made for a
+ * context per possible CPU (but not more than %UBIFS_COMPR_MAX_CTX), but only
+ * the first one gets a cryptoapi handle here; the others get it when they are
+ * first needed, see 'lock_ctx()'.
  */
 static int __init compr_init(struct ubifs_compressor *compr)
 {
+	int i;
+	struct crypto_comp *cc;
+
 	if (compr->capi_name) {
-		compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
-		if (IS_ERR(compr->cc)) {
+		compr->ctx_max = min_t(int, num_possible_cpus(),
+				       UBIFS_COMPR_MAX_CTX);
+		compr->ctx = kcalloc(compr->ctx_max,
+				     sizeof(struct ubifs_compr_ctx),
+				     GFP_KERNEL);
+		if (!compr->ctx)
+			return -ENOMEM;
+
+		cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(cc)) {
 			ubifs_err("cannot initialize compressor %s, error %ld",
-				  compr->name, PTR_ERR(compr->cc));
-			return PTR_ERR(compr->cc);
+				  compr->name, PTR_ERR(cc));
+			kfree(compr->ctx);
+			return PTR_ERR(cc);
+		}
+
+		for (i = 0; i < compr->ctx_max; i++) {
+			mutex_init(&compr->ctx[i].comp_mutex);
+			mutex_init(&compr->ctx[i].decomp_mutex);
 		}
+		mutex_init(&compr->grow_mutex);
+		compr->ctx[0].cc = cc;
+		compr->ctx_cnt = 1;
 	}
 
 	ubifs_compressors[compr->compr_type] = compr;
@@ -210,9 +309,14 @@ static int __init compr_init(struct ubifs_compressor *compr)
  */
 static void compr_exit(struct ubifs_compressor *compr)
 {
-	if (compr->capi_name)
-		crypto_free_comp(compr->cc);
-	return;
+	int i;
+
+	if (!compr->capi_name)
+		return;
+
+	for (i = 0; i < compr->ctx_cnt; i++)
+		crypto_free_comp(compr->ctx[i].cc);
+	kfree(compr->ctx);
 }
 
 /**
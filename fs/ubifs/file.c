@@ -945,6 +945,144 @@ static int do_writepage(struct page *page, int len)
 	return err;
 }
 
+/**
+ * take_wb_batch - take a free write-back batch.
+ * @c: UBIFS file-system description object
+ *
+ * Returns the batch or %NULL if all of them are in use.
+ */
+static struct ubifs_wb_batch *take_wb_batch(struct ubifs_info *c)
+{
+	struct ubifs_wb_batch *batch = NULL;
+
+	spin_lock(&c->wb_lock);
+	if (!list_empty(&c->wb_free)) {
+		batch = list_first_entry(&c->wb_free, struct ubifs_wb_batch,
+					 list);
+		list_del(&batch->list);
+	}
+	spin_unlock(&c->wb_lock);
+	return batch;
+}
+
+/**
+ * wb_batch_worker - write a write-back batch to the journal.
+ * @work: the work of the batch
+ *
+ * This function writes the data nodes of a write-back batch to the journal,
+ * releases the budget of its pages, ends their write-back and puts the batch
+ * back to the list of free batches.
+ */
+static void wb_batch_worker(struct work_struct *work)
+{
+	int i, err;
+	struct ubifs_wb_batch *batch;
+	struct ubifs_info *c;
+
+	batch = container_of(work, struct ubifs_wb_batch, work);
+	c = batch->c;
+
+	err = ubifs_jnl_write_data_nodes(c, batch->buf, batch->lens,
+					 batch->cnt);
+	if (err) {
+		ubifs_err("cannot write %d pages of inode %lu, error %d",
+			  batch->page_cnt,
+			  batch->pages[0]->mapping->host->i_ino, err);
+		ubifs_ro_mode(c, err);
+	}
+
+	for (i = 0; i < batch->page_cnt; i++) {
+		struct page *page = batch->pages[i];
+
+		if (err) {
+			SetPageError(page);
+			mapping_set_error(page->mapping, err);
+		}
+		if (batch->new_page[i])
+			release_new_page_budget(c);
+		else
+			release_existing_page_budget(c);
+		end_page_writeback(page);
+	}
+
+	spin_lock(&c->wb_lock);
+	list_add(&batch->list, &c->wb_free);
+	spin_unlock(&c->wb_lock);
+	wake_up(&c->wb_wait);
+}
+
+/**
+ * queue_writepage - add a page to a write-back batch.
+ * @page: page to write
+ * @len: how many bytes of the page to write
+ * @batchp: the current batch of the write-back context
+ *
+ * This function is the pipelined counterpart of 'do_writepage()'. It
+ * compresses the page data nodes into the current batch of the write-back
+ * context, taking a free batch if there is none, and unlocks the page. The page
+ * stays under write-back until the batch has been written by the worker. Full
+ * batches are handed over to the worker straight away, and the caller has to
+ * submit the last one, see 'ubifs_writepages()'.
+ */
+static int queue_writepage(struct page *page, int len,
+			   struct ubifs_wb_batch **batchp)
+{
+	int i, blen, dlen;
+	unsigned int block;
+	void *addr;
+	union ubifs_key key;
+	struct inode *inode = page->mapping->host;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct ubifs_wb_batch *batch = *batchp;
+
+	if (!batch) {
+		wait_event(c->wb_wait, (batch = take_wb_batch(c)));
+		batch->page_cnt = batch->cnt = batch->len = 0;
+		*batchp = batch;
+	}
+
+	/* Update radix tree tags */
+	set_page_writeback(page);
+
+	addr = kmap(page);
+	block = page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+	i = 0;
+	while (len) {
+		struct ubifs_data_node *data = batch->buf + batch->len;
+
+		blen = min_t(int, len, UBIFS_BLOCK_SIZE);
+		data_key_init(c, &key, inode->i_ino, block);
+		dlen = ubifs_jnl_prep_data(c, inode, &key, addr, blen, data);
+		memset((void *)data + dlen, 0, ALIGN(dlen, 8) - dlen);
+		batch->lens[batch->cnt++] = dlen;
+		batch->len += ALIGN(dlen, 8);
+		if (++i >= UBIFS_BLOCKS_PER_PAGE)
+			break;
+		block += 1;
+		addr += blen;
+		len -= blen;
+	}
+	kunmap(page);
+
+	/*
+	 * The data are in the batch now, so the page may be unlocked and
+	 * re-dirtied. The budget is released when the batch has been written.
+	 */
+	ubifs_assert(PagePrivate(page));
+	batch->new_page[batch->page_cnt] = !!PageChecked(page);
+	batch->pages[batch->page_cnt++] = page;
+	atomic_long_dec(&c->dirty_pg_cnt);
+	ClearPagePrivate(page);
+	ClearPageChecked(page);
+	unlock_page(page);
+
+	if (batch->page_cnt == UBIFS_WB_BATCH_PAGES) {
+		queue_work(c->wb_wq, &batch->work);
+		*batchp = NULL;
+	}
+	return 0;
+}
+
 /*
  * When writing-back dirty inodes, VFS first writes-back pages belonging to the
  * inode, then the inode itself. For UBIFS this may cause a problem. Consider a
@@ -989,9 +1127,12 @@ static int do_writepage(struct page *page, int len)
  * 'do_writepage()', so we do write beyond inode size?
  * A: If we are in the middle of 'do_writepage()', truncation would be locked
  * on the page lock and it would not write the truncated inode node to the
- * journal before we have finished.
+ * journal before we have finished. With pipelined write-back the page is
+ * unlocked before its data are written, but it stays under write-back, and
+ * truncation waits for the write-back of the pages it drops and of the last
+ * page it keeps.
  */
-static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
+static int write_page(struct page *page, struct ubifs_wb_batch **batchp)
 {
 	struct inode *inode = page->mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
@@ -1029,6 +1170,8 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			 * with this.
 			 */
 		}
+		if (batchp)
+			return queue_writepage(page, PAGE_CACHE_SIZE, batchp);
 		return do_writepage(page, PAGE_CACHE_SIZE);
 	}
 
@@ -1050,6 +1193,8 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			goto out_unlock;
 	}
 
+	if (batchp)
+		return queue_writepage(page, len, batchp);
 	return do_writepage(page, len);
 
 out_unlock:
@@ -1057,6 +1202,35 @@ out_unlock:
 	return err;
 }
 
+static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
+{
+	return write_page(page, NULL);
+}
+
+static int pipelined_writepage(struct page *page,
+			       struct writeback_control *wbc, void *data)
+{
+	return write_page(page, data);
+}
+
+static int ubifs_writepages(struct address_space *mapping,
+			    struct writeback_control *wbc)
+{
+	int err;
+	struct ubifs_info *c = mapping->host->i_sb->s_fs_info;
+	struct ubifs_wb_batch *batch = NULL;
+
+	if (!c->wb_pipeline || !c->wb_wq)
+		return generic_writepages(mapping, wbc);
+
+	/* Pairs with the barrier in 'ubifs_wb_init()' */
+	smp_rmb();
+	err = write_cache_pages(mapping, wbc, pipelined_writepage, &batch);
+	if (batch)
+		queue_work(c->wb_wq, &batch->work);
+	return err;
+}
+
 /**
  * do_attr_changes - change inode attributes.
  * @inode: inode to change attributes for
@@ -1138,6 +1312,11 @@ static int do_truncation(struct ubifs_info *c, struct inode *inode,
 
 		page = find_lock_page(inode->i_mapping, index);
 		if (page) {
+			/*
+			 * Pipelined write-back may still be writing the old
+			 * contents of the page.
+			 */
+			wait_on_page_writeback(page);
 			if (PageDirty(page)) {
 				/*
 				 * 'ubifs_jnl_truncate()' will try to truncate
@@ -1538,9 +1717,103 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 	return 0;
 }
 
+/**
+ * ubifs_wb_init - initialize pipelined write-back.
+ * @c: UBIFS file-system description object
+ *
+ * This function allocates the write-back batches and starts the worker which
+ * writes them. If this fails, pipelined write-back is just disabled.
+ */
+void ubifs_wb_init(struct ubifs_info *c)
+{
+	int i;
+	struct workqueue_struct *wq;
+
+	ubifs_assert(c->wb_pipeline == 1);
+	ubifs_assert(!c->ro_mount);
+
+	if (c->wb_wq)
+		return; /* Already initialized */
+
+	c->wb_batches = kcalloc(UBIFS_WB_BATCHES,
+				sizeof(struct ubifs_wb_batch), GFP_KERNEL);
+	if (!c->wb_batches)
+		goto out_disable;
+
+	INIT_LIST_HEAD(&c->wb_free);
+	for (i = 0; i < UBIFS_WB_BATCHES; i++) {
+		struct ubifs_wb_batch *batch = &c->wb_batches[i];
+
+		batch->buf = vmalloc(UBIFS_WB_BATCH_BUF_SZ);
+		if (!batch->buf)
+			goto out_free;
+		INIT_WORK(&batch->work, wb_batch_worker);
+		batch->c = c;
+		list_add_tail(&batch->list, &c->wb_free);
+	}
+
+	wq = create_singlethread_workqueue(c->bgt_name);
+	if (!wq)
+		goto out_free;
+
+	/* Pairs with the barrier in 'ubifs_writepages()' */
+	smp_wmb();
+	c->wb_wq = wq;
+	return;
+
+out_free:
+	for (i = 0; i < UBIFS_WB_BATCHES; i++)
+		vfree(c->wb_batches[i].buf);
+	kfree(c->wb_batches);
+	c->wb_batches = NULL;
+out_disable:
+	ubifs_warn("cannot initialize pipelined write-back, disabling it");
+	c->mount_opts.wb_pipeline = 1;
+	c->wb_pipeline = 0;
+}
+
+/**
+ * ubifs_wb_flush - wait for pipelined write-back.
+ * @c: UBIFS file-system description object
+ *
+ * This function waits until all the write-back batches which have been handed
+ * over to the worker are written to the journal and the budget of their pages
+ * is released.
+ */
+void ubifs_wb_flush(struct ubifs_info *c)
+{
+	if (c->wb_wq)
+		flush_workqueue(c->wb_wq);
+}
+
+/**
+ * ubifs_wb_close - stop pipelined write-back.
+ * @c: UBIFS file-system description object
+ *
+ * This function is called when VFS has stopped writing to the file-system, i.e.
+ * on re-mounting R/O and on un-mounting. Note, pipelined write-back is not
+ * stopped on a R/W re-mount which disables it, because there may be
+ * write-back in progress; the worker just becomes idle.
+ */
+void ubifs_wb_close(struct ubifs_info *c)
+{
+	int i;
+
+	if (!c->wb_wq)
+		return;
+
+	destroy_workqueue(c->wb_wq);
+	c->wb_wq = NULL;
+	for (i = 0; i < UBIFS_WB_BATCHES; i++)
+		vfree(c->wb_batches[i].buf);
+	kfree(c->wb_batches);
+	c->wb_batches = NULL;
+}
+
 const struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
 	.writepage      = ubifs_writepage,
+	.writepages     = ubifs_writepages,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
 	.invalidatepage = ubifs_invalidatepage,
@@ -675,33 +675,30 @@ out_ro:
 }
 
 /**
- * ubifs_jnl_write_data - write a data node to the journal.
+ * ubifs_jnl_prep_data - prepare a data node.
  * @c: UBIFS file-system description object
  * @inode: inode the data node belongs to
  * @key: node key
- * @buf: buffer to write
+ * @buf: data to put to the node
  * @len: data length (must not exceed %UBIFS_BLOCK_SIZE)
+ * @data: the data node is prepared here
  *
- * This function writes a data node to the journal. Returns %0 if the data node
- * was successfully written, and a negative error code in case of failure.
+ * This function initializes data node @data and compresses @buf into it. The
+ * common header is not initialized, this is done when the node is written.
+ * Note, @data has to have room for %UBIFS_DATA_NODE_SZ +
+ * %UBIFS_BLOCK_SIZE * %WORST_COMPR_FACTOR bytes, even though the resulting
+ * node is never longer than %UBIFS_MAX_DATA_NODE_SZ. Returns the length of the
+ * data node.
  */
-int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
-			 const union ubifs_key *key, const void *buf, int len)
+int ubifs_jnl_prep_data(struct ubifs_info *c, const struct inode *inode,
+			const union ubifs_key *key, const void *buf, int len,
+			struct ubifs_data_node *data)
 {
-	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
-	int dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+	int compr_type, out_len;
 	struct ubifs_inode *ui = ubifs_inode(inode);
 
-	dbg_jnl("ino %lu, blk %u, len %d, key %s",
-		(unsigned long)key_inum(c, key), key_block(c, key), len,
-		DBGKEY(key));
 	ubifs_assert(len <= UBIFS_BLOCK_SIZE);
 
-	data = kmalloc(dlen, GFP_NOFS);
-	if (!data)
-		return -ENOMEM;
-
 	data->ch.node_type = UBIFS_DATA_NODE;
 	key_write(c, key, &data->key);
 	data->size = cpu_to_le32(len);
@@ -713,12 +710,41 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	else
 		compr_type = ui->compr_type;
 
-	out_len = dlen - UBIFS_DATA_NODE_SZ;
+	out_len = UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
 	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
 	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
 
-	dlen = UBIFS_DATA_NODE_SZ + out_len;
 	data->compr_type = cpu_to_le16(compr_type);
+	return UBIFS_DATA_NODE_SZ + out_len;
+}
+
+/**
+ * ubifs_jnl_write_data - write a data node to the journal.
+ * @c: UBIFS file-system description object
+ * @inode: inode the data node belongs to
+ * @key: node key
+ * @buf: buffer to write
+ * @len: data length (must not exceed %UBIFS_BLOCK_SIZE)
+ *
+ * This function writes a data node to the journal. Returns %0 if the data node
+ * was successfully written, and a negative error code in case of failure.
+ */
+int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
+			 const union ubifs_key *key, const void *buf, int len)
+{
+	struct ubifs_data_node *data;
+	int err, lnum, offs;
+	int dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+
+	dbg_jnl("ino %lu, blk %u, len %d, key %s",
+		(unsigned long)key_inum(c, key), key_block(c, key), len,
+		DBGKEY(key));
+
+	data = kmalloc(dlen, GFP_NOFS);
+	if (!data)
+		return -ENOMEM;
+
+	dlen = ubifs_jnl_prep_data(c, inode, key, buf, len, data);
 
 	/* Make reservation before allocating sequence numbers */
 	err = make_reservation(c, DATAHD, dlen);
@@ -749,6 +775,90 @@ out_free:
 	return err;
 }
 
+/**
+ * ubifs_jnl_write_data_nodes - write prepared data nodes to the journal.
+ * @c: UBIFS file-system description object
+ * @buf: the data nodes
+ * @lens: lengths of the data nodes
+ * @cnt: count of data nodes
+ *
+ * This function writes @cnt data nodes prepared by 'ubifs_jnl_prep_data()' to
+ * the journal. The nodes are stored in @buf one after another, each starting
+ * at an 8-byte aligned offset, and the gaps between them are zeroed. As many
+ * nodes as fit the current journal head eraseblock are written at once, so
+ * the whole batch usually takes one or two reservations instead of one per
+ * node. Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+int ubifs_jnl_write_data_nodes(struct ubifs_info *c, void *buf,
+			       const int *lens, int cnt)
+{
+	int err, i = 0, n, len, avail, lnum, offs, node_offs;
+	struct ubifs_wbuf *wbuf = &c->jheads[DATAHD].wbuf;
+	union ubifs_key key;
+
+	while (i < cnt) {
+		/* Make reservation for at least one node */
+		err = make_reservation(c, DATAHD, lens[i]);
+		if (err)
+			return err;
+
+		avail = c->leb_size - wbuf->offs - wbuf->used;
+		len = lens[i];
+		for (n = i + 1; n < cnt; n++) {
+			if (ALIGN(len, 8) + lens[n] > avail)
+				break;
+			len = ALIGN(len, 8) + lens[n];
+		}
+
+		node_offs = 0;
+		for (n = i; node_offs < len; n++) {
+			ubifs_prepare_node(c, buf + node_offs, lens[n], 0);
+			node_offs += ALIGN(lens[n], 8);
+		}
+
+		dbg_jnl("%d data nodes, %d bytes", n - i, len);
+		err = write_head(c, DATAHD, buf, len, &lnum, &offs, 0);
+		if (err)
+			goto out_release;
+
+		node_offs = 0;
+		for (n = i; node_offs < len; n++) {
+			struct ubifs_data_node *data = buf + node_offs;
+
+			key_read(c, &data->key, &key);
+			ubifs_wbuf_add_ino_nolock(wbuf, key_inum(c, &key));
+			node_offs += ALIGN(lens[n], 8);
+		}
+		release_head(c, DATAHD);
+
+		node_offs = 0;
+		for (n = i; node_offs < len; n++) {
+			struct ubifs_data_node *data = buf + node_offs;
+
+			key_read(c, &data->key, &key);
+			err = ubifs_tnc_add(c, &key, lnum, offs + node_offs,
+					    lens[n]);
+			if (err)
+				goto out_ro;
+			node_offs += ALIGN(lens[n], 8);
+		}
+
+		finish_reservation(c);
+		buf += node_offs;
+		i = n;
+	}
+
+	return 0;
+
+out_release:
+	release_head(c, DATAHD);
+out_ro:
+	ubifs_ro_mode(c, err);
+	finish_reservation(c);
+	return err;
+}
+
 /**
  * ubifs_jnl_write_inode - flush inode to the journal.
  * @c: UBIFS file-system description object
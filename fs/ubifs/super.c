@@ -431,6 +431,11 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 	else if (c->mount_opts.chk_data_crc == 1)
 		seq_printf(s, ",no_chk_data_crc");
 
+	if (c->mount_opts.wb_pipeline == 2)
+		seq_printf(s, ",wb_pipeline");
+	else if (c->mount_opts.wb_pipeline == 1)
+		seq_printf(s, ",no_wb_pipeline");
+
 	if (c->mount_opts.override_compr) {
 		seq_printf(s, ",compr=%s",
 			   ubifs_compr_name(c->mount_opts.compr_type));
@@ -452,6 +457,9 @@ static int ubifs_sync_fs(struct super_block *sb, int wait)
 	if (!wait)
 		return 0;
 
+	/* Make sure pipelined write-back has reached the write-buffers */
+	ubifs_wb_flush(c);
+
 	/*
 	 * Synchronize write buffers, because 'ubifs_run_commit()' does not
 	 * do this if it waits for an already running commit.
@@ -908,6 +916,8 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
  * Opt_override_compr: override default compressor
+ * Opt_wb_pipeline: enable pipelined write-back
+ * Opt_no_wb_pipeline: disable pipelined write-back
  * Opt_err: just end of array marker
  */
 enum {
@@ -918,6 +928,8 @@ enum {
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
 	Opt_override_compr,
+	Opt_wb_pipeline,
+	Opt_no_wb_pipeline,
 	Opt_err,
 };
 
@@ -929,6 +941,8 @@ static const match_table_t tokens = {
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
 	{Opt_override_compr, "compr=%s"},
+	{Opt_wb_pipeline, "wb_pipeline"},
+	{Opt_no_wb_pipeline, "no_wb_pipeline"},
 	{Opt_err, NULL},
 };
 
@@ -1028,6 +1042,14 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->default_compr = c->mount_opts.compr_type;
 			break;
 		}
+		case Opt_wb_pipeline:
+			c->mount_opts.wb_pipeline = 2;
+			c->wb_pipeline = 1;
+			break;
+		case Opt_no_wb_pipeline:
+			c->mount_opts.wb_pipeline = 1;
+			c->wb_pipeline = 0;
+			break;
 		default:
 		{
 			unsigned long flag;
@@ -1444,6 +1466,9 @@ static int mount_ubifs(struct ubifs_info *c)
 	dbg_msg("max. seq. number:    %llu", c->max_sqnum);
 	dbg_msg("commit number:       %llu", c->cmt_no);
 
+	if (c->wb_pipeline == 1 && !c->ro_mount)
+		ubifs_wb_init(c);
+
 	return 0;
 
 out_infos:
@@ -1679,6 +1704,7 @@ static void ubifs_remount_ro(struct ubifs_info *c)
 	ubifs_assert(!c->ro_mount);
 
 	mutex_lock(&c->umount_mutex);
+	ubifs_wb_close(c);
 	if (c->bgt) {
 		kthread_stop(c->bgt);
 		c->bgt = NULL;
@@ -1736,9 +1762,11 @@ static void ubifs_put_super(struct super_block *sb)
 	mutex_lock(&c->umount_mutex);
 	if (!c->ro_mount) {
 		/*
-		 * First of all kill the background thread to make sure it does
-		 * not interfere with un-mounting and freeing resources.
+		 * First of all kill the background thread and the write-back
+		 * worker to make sure they do not interfere with un-mounting
+		 * and freeing resources.
 		 */
+		ubifs_wb_close(c);
 		if (c->bgt) {
 			kthread_stop(c->bgt);
 			c->bgt = NULL;
@@ -1827,6 +1855,13 @@ static int ubifs_remount_fs(struct super_block *sb, int *flags, char *data)
 		c->bu.buf = NULL;
 	}
 
+	/*
+	 * Note, if pipelined write-back is disabled on a R/W re-mount, the
+	 * worker is left in place until the next R/O re-mount or un-mount.
+	 */
+	if (c->wb_pipeline == 1 && !c->ro_mount)
+		ubifs_wb_init(c);
+
 	ubifs_assert(c->lst.taken_empty_lebs > 0);
 	return 0;
 }
@@ -1929,6 +1964,8 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	mutex_init(&c->mst_mutex);
 	mutex_init(&c->umount_mutex);
 	mutex_init(&c->bu_mutex);
+	spin_lock_init(&c->wb_lock);
+	init_waitqueue_head(&c->wb_wait);
 	init_waitqueue_head(&c->cmt_wq);
 	c->buds = RB_ROOT;
 	c->old_idx = RB_ROOT;
@@ -36,6 +36,7 @@
 #include <linux/mtd/ubi.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
+#include <linux/workqueue.h>
 #include "ubifs-media.h"
 
 /* Version of this UBIFS implementation */
@@ -157,6 +158,22 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/* How many pages and data nodes a pipelined write-back batch may contain */
+#define UBIFS_WB_BATCH_PAGES DIV_ROUND_UP(8, UBIFS_BLOCKS_PER_PAGE)
+#define UBIFS_WB_BATCH_NODES (UBIFS_WB_BATCH_PAGES * UBIFS_BLOCKS_PER_PAGE)
+
+/*
+ * Size of the write-back batch buffer. The last data node needs extra room
+ * for worst case compression.
+ */
+#define UBIFS_WB_BATCH_BUF_SZ ((UBIFS_WB_BATCH_NODES - 1) *                \
+			       ALIGN(UBIFS_MAX_DATA_NODE_SZ, 8) +          \
+			       UBIFS_DATA_NODE_SZ +                        \
+			       UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR)
+
+/* Number of write-back batches per file-system */
+#define UBIFS_WB_BATCHES 3
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -810,19 +827,41 @@ struct ubifs_node_range {
 };
 
 /**
- * struct ubifs_compressor - UBIFS compressor description structure.
- * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
+ * struct ubifs_compr_ctx - UBIFS compressor context.
  * @cc: cryptoapi compressor handle
  * @comp_mutex: mutex used during compression
  * @decomp_mutex: mutex used during decompression
+ */
+struct ubifs_compr_ctx {
+	struct crypto_comp *cc;
+	struct mutex comp_mutex;
+	struct mutex decomp_mutex;
+};
+
+/**
+ * struct ubifs_compressor - UBIFS compressor description structure.
+ * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
+ * @ctx: compressor contexts
+ * @ctx_cnt: number of contexts which have a cryptoapi handle
+ * @ctx_max: number of elements in @ctx
+ * @grow_mutex: serializes adding contexts
+ * @decomp_lock: non-zero if decompression has to be serialized
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
+ *
+ * Each context has its own cryptoapi handle, so users of different contexts
+ * compress and decompress in parallel. Users prefer the context of the CPU
+ * they run on, so they rarely contend for a context. Only the first context
+ * is set up at init; the others are set up when all the existing ones are
+ * busy, so there are no more of them than concurrent users.
  */
 struct ubifs_compressor {
 	int compr_type;
-	struct crypto_comp *cc;
-	struct mutex *comp_mutex;
-	struct mutex *decomp_mutex;
+	struct ubifs_compr_ctx *ctx;
+	int ctx_cnt;
+	int ctx_max;
+	struct mutex grow_mutex;
+	int decomp_lock;
 	const char *name;
 	const char *capi_name;
 };
@@ -909,6 +948,37 @@ struct ubifs_orphan {
 	int new;
 };
 
+/**
+ * struct ubifs_wb_batch - a batch of pages being written back.
+ * @work: the work which writes the batch
+ * @list: link in the list of free batches
+ * @c: UBIFS file-system description object
+ * @pages: the pages
+ * @new_page: whether the corresponding page was budgeted as a new page
+ * @page_cnt: count of pages
+ * @lens: lengths of the data nodes
+ * @cnt: count of data nodes
+ * @len: used length of @buf
+ * @buf: the data nodes, prepared by 'ubifs_jnl_prep_data()'
+ *
+ * When write-back is pipelined, pages are compressed into a batch in the
+ * write-back context, and the batch is written to the journal by a worker,
+ * while the write-back context compresses the next batch. The pages stay
+ * under write-back until the batch is written.
+ */
+struct ubifs_wb_batch {
+	struct work_struct work;
+	struct list_head list;
+	struct ubifs_info *c;
+	struct page *pages[UBIFS_WB_BATCH_PAGES];
+	unsigned char new_page[UBIFS_WB_BATCH_PAGES];
+	int page_cnt;
+	int lens[UBIFS_WB_BATCH_NODES];
+	int cnt;
+	int len;
+	void *buf;
+};
+
 /**
  * struct ubifs_mount_opts - UBIFS-specific mount options information.
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
@@ -920,6 +990,8 @@ struct ubifs_orphan {
  *                  specified in @compr_type)
  * @compr_type: compressor type to override the superblock compressor with
  *              (%UBIFS_COMPR_NONE, etc)
+ * @wb_pipeline: enable/disable pipelined write-back (%0 default, %1 disable,
+ *               %2 enable)
  */
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
@@ -927,6 +999,7 @@ struct ubifs_mount_opts {
 	unsigned int chk_data_crc:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
+	unsigned int wb_pipeline:2;
 };
 
 struct ubifs_debug_info;
@@ -977,6 +1050,7 @@ struct ubifs_debug_info;
  * @bulk_read: enable bulk-reads
  * @default_compr: default compression algorithm (%UBIFS_COMPR_LZO, etc)
  * @rw_incompat: the media is not R/W compatible
+ * @wb_pipeline: enable pipelined write-back
  *
  * @tnc_mutex: protects the Tree Node Cache (TNC), @zroot, @cnext, @enext, and
  *             @calc_idx_sz
@@ -1003,6 +1077,13 @@ struct ubifs_debug_info;
  * @bu_mutex: protects the pre-allocated bulk-read buffer and @c->bu
  * @bu: pre-allocated bulk-read information
  *
+ * @wb_wq: workqueue writing pipelined write-back batches (%NULL if write-back
+ *         is not pipelined)
+ * @wb_batches: the write-back batches
+ * @wb_free: list of free write-back batches
+ * @wb_lock: protects @wb_free
+ * @wb_wait: wait queue to sleep on if there are no free write-back batches
+ *
  * @log_lebs: number of logical eraseblocks in the log
  * @log_bytes: log size in bytes
  * @log_last: last LEB of the log
@@ -1225,6 +1306,7 @@ struct ubifs_info {
 	unsigned int bulk_read:1;
 	unsigned int default_compr:2;
 	unsigned int rw_incompat:1;
+	unsigned int wb_pipeline:1;
 
 	struct mutex tnc_mutex;
 	struct ubifs_zbranch zroot;
@@ -1250,6 +1332,12 @@ struct ubifs_info {
 	struct mutex bu_mutex;
 	struct bu_info bu;
 
+	struct workqueue_struct *wb_wq;
+	struct ubifs_wb_batch *wb_batches;
+	struct list_head wb_free;
+	spinlock_t wb_lock;
+	wait_queue_head_t wb_wait;
+
 	int log_lebs;
 	long long log_bytes;
 	int log_last;
@@ -1489,8 +1577,13 @@ int ubifs_consolidate_log(struct ubifs_info *c);
 int ubifs_jnl_update(struct ubifs_info *c, const struct inode *dir,
 		     const struct qstr *nm, const struct inode *inode,
 		     int deletion, int xent);
+int ubifs_jnl_prep_data(struct ubifs_info *c, const struct inode *inode,
+			const union ubifs_key *key, const void *buf, int len,
+			struct ubifs_data_node *data);
 int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len);
+int ubifs_jnl_write_data_nodes(struct ubifs_info *c, void *buf,
+			       const int *lens, int cnt);
 int ubifs_jnl_write_inode(struct ubifs_info *c, const struct inode *inode);
 int ubifs_jnl_delete_inode(struct ubifs_info *c, const struct inode *inode);
 int ubifs_jnl_rename(struct ubifs_info *c, const struct inode *old_dir,
@@ -1691,6 +1784,9 @@ int ubifs_calc_dark(const struct ubifs_info *c, int spc);
 /* file.c */
 int ubifs_fsync(struct file *file, int datasync);
 int ubifs_setattr(struct dentry *dentry, struct iattr *attr);
+void ubifs_wb_init(struct ubifs_info *c);
+void ubifs_wb_flush(struct ubifs_info *c);
+void ubifs_wb_close(struct ubifs_info *c);
 
 /* dir.c */
 struct inode *ubifs_new_inode(struct ubifs_info *c, const struct inode *dir,
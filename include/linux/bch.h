@@ -0,0 +1,71 @@
+/*
+ * Generic binary BCH encoding/decoding library
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * See lib/bch.c for a description of the code and of the bit ordering.
+ */
+#ifndef _BCH_H
+#define _BCH_H
+
+#ifndef STANDALONE
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+/**
+ * struct bch_control - BCH control structure
+ * @m:		Galois field order
+ * @n:		maximum codeword size in bits (= 2^m-1)
+ * @t:		guaranteed number of correctable errors per codeword
+ * @ecc_bits:	ecc exact size in bits, i.e. generator polynomial degree
+ * @ecc_bytes:	ecc size in bytes
+ * @ecc_words:	ecc size in 32-bit words, used by the internal remainders
+ * @a_pow_tab:	Galois field GF(2^m) exponentiation lookup table
+ * @a_log_tab:	Galois field GF(2^m) log lookup table
+ * @mod_tab:	remainder tables for encoding 32 message bits at a time
+ * @ecc_buf:	ecc scratch buffer
+ * @ecc_buf2:	second ecc scratch buffer
+ * @syn:	syndrome buffer, 2t entries
+ * @elp:	error locator polynomial, 2t+1 coefficients
+ * @elp_b:	Berlekamp-Massey correction polynomial
+ * @elp_t:	Berlekamp-Massey scratch polynomial
+ * @chien:	Chien search term logs, t+1 entries
+ *
+ * The scratch buffers make a control structure usable by one caller at a
+ * time; users serialize access or allocate one structure per context.
+ */
+struct bch_control {
+	unsigned int	m;
+	unsigned int	n;
+	unsigned int	t;
+	unsigned int	ecc_bits;
+	unsigned int	ecc_bytes;
+	unsigned int	ecc_words;
+	uint16_t	*a_pow_tab;
+	uint16_t	*a_log_tab;
+	uint32_t	*mod_tab;
+	uint32_t	*ecc_buf;
+	uint32_t	*ecc_buf2;
+	unsigned int	*syn;
+	unsigned int	*elp;
+	unsigned int	*elp_b;
+	unsigned int	*elp_t;
+	int		*chien;
+};
+
+struct bch_control *init_bch(int m, int t, unsigned int prim_poly);
+
+void free_bch(struct bch_control *bch);
+
+void encode_bch(struct bch_control *bch, const uint8_t *data,
+		unsigned int len, uint8_t *ecc);
+
+int decode_bch(struct bch_control *bch, const uint8_t *data, unsigned int len,
+	       const uint8_t *recv_ecc, const uint8_t *calc_ecc,
+	       const unsigned int *syn, unsigned int *errloc);
+
+#endif /* _BCH_H */
@@ -26,6 +26,9 @@ struct scsi_ioctl_command;
 
 struct request_queue;
 struct elevator_queue;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 struct request_pm_state;
 struct blk_trace;
 struct request;
@@ -81,6 +84,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -280,6 +284,17 @@ struct request_queue
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	/*
+	 * Multi-queue state, see block/blk-mq.c.  queue_ctx holds the
+	 * per-cpu software queues, queue_hw_ctx the hardware queues they
+	 * are mapped onto.  Unused (mq_ops == NULL) for request_fn and
+	 * make_request_fn queues.
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx __percpu *queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
 	/*
 	 * Dispatch queue sorting
 	 */
@@ -0,0 +1,107 @@
+#ifndef _LINUX_CLEANCACHE_H
+#define _LINUX_CLEANCACHE_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+
+/*
+ * Cleancache: a second chance for clean page cache pages.  When a clean
+ * page of a filesystem which called cleancache_init_fs() at mount leaves
+ * the page cache, it is offered to a backend; readpage asks the backend
+ * before going to disk.  The backend may refuse a page, or drop it at any
+ * time later, so a get can always miss.  Pages are named by pool (one per
+ * filesystem), inode number and page index.
+ * See Documentation/vm/zcache.txt.
+ */
+struct cleancache_ops {
+	int (*init_fs)(size_t pagesize);
+	int (*get_page)(int pool_id, ino_t ino, pgoff_t index,
+			struct page *page);
+	void (*put_page)(int pool_id, ino_t ino, pgoff_t index,
+			 struct page *page);
+	void (*flush_page)(int pool_id, ino_t ino, pgoff_t index);
+	void (*flush_inode)(int pool_id, ino_t ino);
+	void (*flush_fs)(int pool_id);
+};
+
+#ifdef CONFIG_CLEANCACHE
+extern int cleancache_enabled;
+
+extern struct cleancache_ops
+	cleancache_register_ops(struct cleancache_ops *ops);
+extern void __cleancache_init_fs(struct super_block *sb);
+extern int __cleancache_get_page(struct page *page);
+extern void __cleancache_put_page(struct page *page);
+extern void __cleancache_flush_page(struct address_space *mapping,
+				    struct page *page);
+extern void __cleancache_flush_inode(struct address_space *mapping);
+extern void __cleancache_flush_fs(struct super_block *sb);
+
+static inline int cleancache_mapping_enabled(struct address_space *mapping)
+{
+	return cleancache_enabled &&
+		mapping->host->i_sb->cleancache_poolid >= 0;
+}
+
+static inline void cleancache_init_fs(struct super_block *sb)
+{
+	if (cleancache_enabled)
+		__cleancache_init_fs(sb);
+}
+
+/* Returns 0 if @page was filled from cleancache */
+static inline int cleancache_get_page(struct page *page)
+{
+	if (cleancache_mapping_enabled(page->mapping))
+		return __cleancache_get_page(page);
+	return -1;
+}
+
+static inline void cleancache_put_page(struct page *page)
+{
+	if (cleancache_mapping_enabled(page->mapping))
+		__cleancache_put_page(page);
+}
+
+static inline void cleancache_flush_page(struct address_space *mapping,
+					 struct page *page)
+{
+	if (cleancache_mapping_enabled(mapping))
+		__cleancache_flush_page(mapping, page);
+}
+
+static inline void cleancache_flush_inode(struct address_space *mapping)
+{
+	if (cleancache_mapping_enabled(mapping))
+		__cleancache_flush_inode(mapping);
+}
+
+static inline void cleancache_flush_fs(struct super_block *sb)
+{
+	if (cleancache_enabled)
+		__cleancache_flush_fs(sb);
+}
+#else /* CONFIG_CLEANCACHE */
+static inline void cleancache_init_fs(struct super_block *sb)
+{
+}
+static inline int cleancache_get_page(struct page *page)
+{
+	return -1;
+}
+static inline void cleancache_put_page(struct page *page)
+{
+}
+static inline void cleancache_flush_page(struct address_space *mapping,
+					 struct page *page)
+{
+}
+static inline void cleancache_flush_inode(struct address_space *mapping)
+{
+}
+static inline void cleancache_flush_fs(struct super_block *sb)
+{
+}
+#endif /* CONFIG_CLEANCACHE */
+
+#endif /* _LINUX_CLEANCACHE_H */
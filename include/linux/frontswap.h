@@ -0,0 +1,114 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+
+/*
+ * Frontswap: swap_writepage() first offers the page to a backend, and
+ * only writes it to the swap device if the backend refuses it.  What the
+ * backend accepts is the only copy of the data: it must keep it until the
+ * swap slot is flushed.  Pages are named by swap type and offset.
+ * See Documentation/vm/zcache.txt.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*put_page)(unsigned type, pgoff_t offset, struct page *page);
+	int (*get_page)(unsigned type, pgoff_t offset, struct page *page);
+	void (*flush_page)(unsigned type, pgoff_t offset);
+	void (*flush_area)(unsigned type);
+};
+
+#ifdef CONFIG_FRONTSWAP
+extern int frontswap_enabled;
+
+extern struct frontswap_ops
+	frontswap_register_ops(struct frontswap_ops *ops);
+extern void __frontswap_init(struct swap_info_struct *sis);
+extern int __frontswap_put_page(struct page *page);
+extern int __frontswap_get_page(struct page *page);
+extern void __frontswap_flush_page(struct swap_info_struct *sis,
+				   pgoff_t offset);
+extern void __frontswap_flush_area(struct swap_info_struct *sis);
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return sis->frontswap_map;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+	sis->frontswap_map = map;
+}
+
+/* Called at swapon, once the area has its frontswap_map */
+static inline void frontswap_init(struct swap_info_struct *sis)
+{
+	if (frontswap_enabled && sis->frontswap_map)
+		__frontswap_init(sis);
+}
+
+/* Returns 0 if the backend took @page, which then needs no write */
+static inline int frontswap_put_page(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_put_page(page);
+	return -1;
+}
+
+/* Returns 0 if @page was filled from frontswap */
+static inline int frontswap_get_page(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_get_page(page);
+	return -1;
+}
+
+/* The swap slot is free: drop any copy of it in the backend */
+static inline void frontswap_flush_page(struct swap_info_struct *sis,
+					pgoff_t offset)
+{
+	if (sis->frontswap_map && test_bit(offset, sis->frontswap_map))
+		__frontswap_flush_page(sis, offset);
+}
+
+/* Called at swapoff, when no slot of the area is in use any more */
+static inline void frontswap_flush_area(struct swap_info_struct *sis)
+{
+	if (sis->frontswap_map)
+		__frontswap_flush_area(sis);
+}
+#else /* CONFIG_FRONTSWAP */
+#define frontswap_enabled 0
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return NULL;
+}
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+}
+static inline void frontswap_init(struct swap_info_struct *sis)
+{
+}
+static inline int frontswap_put_page(struct page *page)
+{
+	return -1;
+}
+static inline int frontswap_get_page(struct page *page)
+{
+	return -1;
+}
+static inline void frontswap_flush_page(struct swap_info_struct *sis,
+					pgoff_t offset)
+{
+}
+static inline void frontswap_flush_area(struct swap_info_struct *sis)
+{
+}
+#endif /* CONFIG_FRONTSWAP */
+
+#endif /* _LINUX_FRONTSWAP_H */
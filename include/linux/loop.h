@@ -18,6 +18,7 @@
 #include <linux/blkdev.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/mempool.h>
 
 /* Possible states of device */
 enum {
@@ -27,6 +28,7 @@ enum {
 };
 
 struct loop_func_table;
+struct loop_extent;
 
 struct loop_device {
 	int		lo_number;
@@ -65,6 +67,13 @@ struct loop_device {
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
 	struct list_head	lo_list;
+
+	/* LO_FLAGS_DIRECT_MAP: backing file blocks on the underlying device */
+	struct loop_extent	*lo_extents;
+	unsigned int		lo_nr_extents;
+	struct bio_set		*lo_bio_set;
+	mempool_t		*lo_dio_pool;
+	atomic_t		lo_dio_pending;
 };
 
 #endif /* __KERNEL__ */
@@ -76,6 +85,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
 	LO_FLAGS_AUTOCLEAR	= 4,
+	LO_FLAGS_DIRECT_MAP	= 8,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
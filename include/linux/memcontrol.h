@@ -68,6 +68,8 @@ extern void mem_cgroup_uncharge_end(void);
 
 extern void mem_cgroup_uncharge_page(struct page *page);
 extern void mem_cgroup_uncharge_cache_page(struct page *page);
+extern bool mem_cgroup_huge_page_charged(struct page *page,
+					 struct mem_cgroup *mem);
 extern int mem_cgroup_shmem_charge_fallback(struct page *page,
 			struct mm_struct *mm, gfp_t gfp_mask);
 
@@ -172,6 +174,12 @@ static inline void mem_cgroup_uncharge_cache_page(struct page *page)
 {
 }
 
+static inline bool mem_cgroup_huge_page_charged(struct page *page,
+						struct mem_cgroup *mem)
+{
+	return false;
+}
+
 static inline int mem_cgroup_shmem_charge_fallback(struct page *page,
 			struct mm_struct *mm, gfp_t gfp_mask)
 {
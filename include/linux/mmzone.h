@@ -106,6 +106,7 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	NR_ANON_TRANSPARENT_HUGEPAGES,
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -168,6 +169,20 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * Free blocks of orders 1 to PCP_MAX_ORDER are cached per cpu too, so that
+ * small high-order allocations need not take zone->lock every time.
+ * vm_event_item has a PCP_ORDER*_HIT and PCP_ORDER*_REFILL for each order.
+ */
+#define PCP_MAX_ORDER	3
+
+struct per_cpu_order_pages {
+	int count;		/* number of blocks in the lists */
+
+	/* Lists of blocks, one per migrate type, as for order-0 pages */
+	struct list_head lists[MIGRATE_PCPTYPES];
+};
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
@@ -175,8 +190,21 @@ struct per_cpu_pages {
 
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
+
+	/* orders[n - 1] caches blocks of order n */
+	struct per_cpu_order_pages orders[PCP_MAX_ORDER];
 };
 
+/* Number of pages on the pcp lists, of all orders */
+static inline int pcp_pages(struct per_cpu_pages *pcp)
+{
+	int order, pages = pcp->count;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++)
+		pages += pcp->orders[order - 1].count << order;
+	return pages;
+}
+
 struct per_cpu_pageset {
 	struct per_cpu_pages pcp;
 #ifdef CONFIG_NUMA
@@ -607,6 +635,16 @@ extern struct page *mem_map;
  * Memory statistics and page replacement data structures are maintained on a
  * per-zone basis.
  */
+/* Up to vm.kswapd_threads of these reclaim each node's memory */
+#define MAX_KSWAPD_THREADS	16
+
+struct kswapd_thread {
+	struct task_struct *task;
+	struct pglist_data *pgdat;
+	int id;			/* index in pgdat->kswapd[] */
+	int max_order;		/* largest order it was woken for */
+};
+
 struct bootmem_data;
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
@@ -637,8 +675,8 @@ typedef struct pglist_data {
 					     range, including holes */
 	int node_id;
 	wait_queue_head_t kswapd_wait;
-	struct task_struct *kswapd;
-	int kswapd_max_order;
+	struct kswapd_thread kswapd[MAX_KSWAPD_THREADS];
+	int nr_kswapd;		/* kswapd[0] to kswapd[nr_kswapd - 1] run */
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -769,6 +807,8 @@ int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
 int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
+int percpu_order_pages_sysctl_handler(struct ctl_table *, int,
+					void __user *, size_t *, loff_t *);
 int sysctl_min_unmapped_ratio_sysctl_handler(struct ctl_table *, int,
 			void __user *, size_t *, loff_t *);
 int sysctl_min_slab_ratio_sysctl_handler(struct ctl_table *, int,
@@ -110,6 +110,60 @@ struct mtd_oob_ops {
 	uint8_t		*oobbuf;
 };
 
+/*
+ * Asynchronous request directions
+ */
+#define MTD_IO_READ	0
+#define MTD_IO_WRITE	1
+
+/**
+ * struct mtd_io_vec - one segment of an asynchronous MTD request
+ * @ofs:	offset to read from / write to
+ * @len:	number of bytes to read/write
+ * @buf:	data buffer
+ * @retlen:	number of bytes actually read/written
+ * @ret:	result of this segment, as the synchronous method would have
+ *		returned it (e.g. %-EUCLEAN for corrected bit-flips)
+ */
+struct mtd_io_vec {
+	loff_t		ofs;
+	size_t		len;
+	u_char		*buf;
+	size_t		retlen;
+	int		ret;
+};
+
+/**
+ * struct mtd_io_req - asynchronous, vectored MTD request
+ * @dir:	%MTD_IO_READ or %MTD_IO_WRITE
+ * @vec:	array of segments
+ * @nr_vec:	number of segments in @vec
+ * @error:	overall result: %0, %-EUCLEAN if some segments had corrected
+ *		bit-flips and none failed, or the error of the first segment
+ *		which failed
+ * @complete:	called once all segments are done; may be called from the
+ *		submitter's context or from a worker thread, but never from
+ *		atomic context
+ * @priv:	private data for @complete
+ *
+ * The remaining fields are private to the MTD layer.  Segments are processed
+ * in order, and requests submitted to the same device complete in submission
+ * order.
+ */
+struct mtd_io_req {
+	int			dir;
+	struct mtd_io_vec	*vec;
+	unsigned int		nr_vec;
+	int			error;
+	void			(*complete)(struct mtd_io_req *req);
+	void			*priv;
+
+	/* private */
+	struct mtd_info		*mtd;
+	loff_t			base;
+	struct list_head	list;
+};
+
 #define MTD_MAX_OOBFREE_ENTRIES_LARGE	32
 #define MTD_MAX_ECCPOS_ENTRIES_LARGE	448
 /*
@@ -237,6 +291,10 @@ struct mtd_info {
 	*/
 	int (*writev) (struct mtd_info *mtd, const struct kvec *vecs, unsigned long count, loff_t to, size_t *retlen);
 
+	/* Asynchronous vectored I/O, see mtd_submit(). Optional: devices
+	   without it are served synchronously by the MTD core. */
+	int (*submit) (struct mtd_info *mtd, struct mtd_io_req *req);
+
 	/* Sync */
 	void (*sync) (struct mtd_info *mtd);
 
@@ -337,6 +395,10 @@ int default_mtd_writev(struct mtd_info *mtd, const struct kvec *vecs,
 int default_mtd_readv(struct mtd_info *mtd, struct kvec *vecs,
 		      unsigned long count, loff_t from, size_t *retlen);
 
+int mtd_submit(struct mtd_info *mtd, struct mtd_io_req *req);
+int mtd_submit_wait(struct mtd_info *mtd, struct mtd_io_req *req);
+void mtd_io_req_done(struct mtd_io_req *req);
+
 #ifdef CONFIG_MTD_PARTITIONS
 void mtd_erase_callback(struct erase_info *instr);
 #else
@@ -20,6 +20,7 @@
 
 #include <linux/wait.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/flashchip.h>
 #include <linux/mtd/bbm.h>
@@ -102,6 +103,8 @@ extern int nand_unlock(struct mtd_info *mtd, loff_t ofs, uint64_t len);
 #define NAND_CMD_READSTART	0x30
 #define NAND_CMD_RNDOUTSTART	0xE0
 #define NAND_CMD_CACHEDPROG	0x15
+#define NAND_CMD_READCACHESEQ	0x31
+#define NAND_CMD_READCACHEEND	0x3f
 
 /* Extended commands for AG-AND device */
 /*
@@ -140,6 +143,7 @@ typedef enum {
 	NAND_ECC_HW,
 	NAND_ECC_HW_SYNDROME,
 	NAND_ECC_HW_OOB_FIRST,
+	NAND_ECC_SOFT_BCH,
 } nand_ecc_modes_t;
 
 /*
@@ -201,6 +205,9 @@ typedef enum {
 /* Device behaves just like nand, but is readonly */
 #define NAND_ROM		0x00000800
 
+/* Chip has cache read (sequential) function */
+#define NAND_CACHERD		0x00001000
+
 /* Options valid for Samsung large page devices */
 #define NAND_SAMSUNG_LP_OPTIONS \
 	(NAND_NO_PADDING | NAND_CACHEPRG | NAND_COPYBACK)
@@ -209,9 +216,11 @@ typedef enum {
 #define NAND_CANAUTOINCR(chip) (!(chip->options & NAND_NO_AUTOINCR))
 #define NAND_MUST_PAD(chip) (!(chip->options & NAND_NO_PADDING))
 #define NAND_HAS_CACHEPROG(chip) ((chip->options & NAND_CACHEPRG))
+#define NAND_HAS_CACHEREAD(chip) ((chip->options & NAND_CACHERD))
 #define NAND_HAS_COPYBACK(chip) ((chip->options & NAND_COPYBACK))
-/* Large page NAND with SOFT_ECC should support subpage reads */
-#define NAND_SUBPAGE_READ(chip) ((chip->ecc.mode == NAND_ECC_SOFT) \
+/* Large page NAND with SOFT_ECC or SOFT_BCH should support subpage reads */
+#define NAND_SUBPAGE_READ(chip) ((chip->ecc.mode == NAND_ECC_SOFT || \
+				  chip->ecc.mode == NAND_ECC_SOFT_BCH) \
 					&& (chip->page_shift > 9))
 
 /* Mask to zero out the chip options, which come from the id table */
@@ -239,6 +248,11 @@ typedef enum {
 #define NAND_USE_FLASH_BBT_NO_OOB	0x00100000
 /* Create an empty BBT with no vendor information if the BBT is available */
 #define NAND_CREATE_EMPTY_BBT		0x00200000
+/*
+ * Use cache program for multi-page writes if the chip has it. Only set this
+ * if the controller is known to pass the sequence through correctly.
+ */
+#define NAND_USE_CACHEPRG		0x00400000
 
 /* Options set by nand scan */
 /* Nand scan has allocated controller struct */
@@ -339,6 +353,7 @@ struct nand_hw_control {
  * @prepad:	padding information for syndrome based ecc generators
  * @postpad:	padding information for syndrome based ecc generators
  * @layout:	ECC layout control struct pointer
+ * @priv:	pointer to private ecc control data
  * @hwctl:	function to control hardware ecc generator. Must only
  *		be provided if an hardware ECC is available
  * @calculate:	function for ecc calculation or readback from ecc hardware
@@ -362,6 +377,7 @@ struct nand_ecc_ctrl {
 	int prepad;
 	int postpad;
 	struct nand_ecclayout	*layout;
+	void *priv;
 	void (*hwctl)(struct mtd_info *mtd, int mode);
 	int (*calculate)(struct mtd_info *mtd, const uint8_t *dat,
 			uint8_t *ecc_code);
@@ -398,6 +414,22 @@ struct nand_buffers {
 	uint8_t databuf[NAND_MAX_PAGESIZE + NAND_MAX_OOBSIZE];
 };
 
+/**
+ * struct nand_op_stats - NAND operation statistics
+ * @page_reads:		pages read one at a time
+ * @cache_reads:	pages read in cache read mode
+ * @page_programs:	pages programmed one at a time
+ * @cache_programs:	pages programmed in cache program mode
+ * @erases:		blocks erased
+ */
+struct nand_op_stats {
+	unsigned long page_reads;
+	unsigned long cache_reads;
+	unsigned long page_programs;
+	unsigned long cache_programs;
+	unsigned long erases;
+};
+
 /**
  * struct nand_chip - NAND Private Flash Chip Data
  * @IO_ADDR_R:		[BOARDSPECIFIC] address to read the 8 I/O lines of the
@@ -474,6 +506,13 @@ struct nand_buffers {
  *			additional error status checks (determine if errors are
  *			correctable).
  * @write_page:		[REPLACEABLE] High-level page write function
+ * @stats:		[INTERN] operation statistics, protected by the chip
+ *			lock
+ * @stats_dentry:	[INTERN] debugfs file exporting @stats
+ * @cacheprg_pending:	[INTERN] a cache program sequence is in progress
+ * @io_queue:		[INTERN] queue of asynchronous requests
+ * @io_lock:		[INTERN] protects @io_queue
+ * @io_work:		[INTERN] asynchronous request worker
  */
 
 struct nand_chip {
@@ -539,6 +578,14 @@ struct nand_chip {
 
 	struct nand_bbt_descr *badblock_pattern;
 
+	struct nand_op_stats stats;
+	struct dentry *stats_dentry;
+	int cacheprg_pending;
+
+	struct list_head io_queue;
+	spinlock_t io_lock;
+	struct work_struct io_work;
+
 	void *priv;
 };
 
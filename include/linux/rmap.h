@@ -202,6 +202,11 @@ int try_to_unmap(struct page *, enum ttu_flags flags);
 int try_to_unmap_one(struct page *, struct vm_area_struct *,
 			unsigned long address, enum ttu_flags flags);
 
+/*
+ * Called from mm/huge_memory.c to find each mapping of a hugepage
+ */
+unsigned long vma_address(struct page *page, struct vm_area_struct *vma);
+
 /*
  * Called from mm/filemap_xip.c to unmap empty zero page
  */
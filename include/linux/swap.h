@@ -162,6 +162,26 @@ enum {
 #define COUNT_CONTINUED	0x80	/* See swap_map continuation for full count */
 #define SWAP_MAP_SHMEM	0xbf	/* Owned by shmem/tmpfs, in first swap_map */
 
+/*
+ * Swap slots are grouped in clusters of SWAPFILE_CLUSTER.  The cluster lock
+ * serializes changes to the swap_map counts of its slots, so that taking
+ * and dropping references does not need swap_lock; count is the number of
+ * slots of the cluster in use, and only changes under swap_lock.
+ */
+struct swap_cluster_info {
+	spinlock_t lock;
+	unsigned int count;
+};
+
+/*
+ * The cluster a cpu allocates from on a solid state device, so that each
+ * cpu fills its own run of slots.
+ */
+struct percpu_cluster {
+	unsigned int next;	/* next slot to try */
+	unsigned int end;	/* end of the cluster */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -180,11 +200,17 @@ struct swap_info_struct {
 	unsigned int cluster_nr;	/* countdown to next cluster search */
 	unsigned int lowest_alloc;	/* while preparing discard cluster */
 	unsigned int highest_alloc;	/* while preparing discard cluster */
+	struct swap_cluster_info *cluster_info;	/* vmalloc'ed, per cluster */
+	struct percpu_cluster __percpu *percpu_cluster;	/* solid state only */
+	spinlock_t cont_lock;		/* protects count continuation lists */
 	struct swap_extent *curr_swap_extent;
 	struct swap_extent first_swap_extent;
 	struct block_device *bdev;	/* swap device or bdev of swap file */
 	struct file *swap_file;		/* seldom referenced */
 	unsigned int old_block_size;	/* seldom referenced */
+#ifdef CONFIG_FRONTSWAP
+	unsigned long *frontswap_map;	/* vmalloc'ed, slots in frontswap */
+#endif
 };
 
 struct swap_list_t {
@@ -284,6 +310,9 @@ static inline void scan_unevictable_unregister_node(struct node *node)
 }
 #endif
 
+extern int kswapd_threads;
+extern int kswapd_threads_sysctl_handler(struct ctl_table *, int,
+					 void __user *, size_t *, loff_t *);
 extern int kswapd_run(int nid);
 extern void kswapd_stop(int nid);
 
@@ -325,8 +354,10 @@ extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 extern long nr_swap_pages;
 extern long total_swap_pages;
 extern void si_swapinfo(struct sysinfo *);
-extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int, swp_entry_t []);
 extern swp_entry_t get_swap_page_of_type(int);
+extern void swapcache_free_entries(swp_entry_t *, int);
+extern int __swap_count(swp_entry_t);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
 extern int add_swap_count_continuation(swp_entry_t, gfp_t);
 extern void swap_shmem_alloc(swp_entry_t);
@@ -341,8 +372,17 @@ extern sector_t map_swap_page(struct page *, struct block_device **);
 extern sector_t swapdev_block(int, pgoff_t);
 extern int reuse_swap_page(struct page *);
 extern int try_to_free_swap(struct page *);
+extern struct swap_info_struct *page_swap_info(struct page *);
 struct backing_dev_info;
 
+/* linux/mm/swap_slots.c */
+#define SWAP_SLOTS_CACHE_SIZE	64
+extern bool swap_slot_cache_enabled;
+extern swp_entry_t get_swap_page(void);
+extern void free_swap_slot(swp_entry_t);
+extern void disable_swap_slots_cache_lock(void);
+extern void reenable_swap_slots_cache_unlock(void);
+
 /* linux/mm/thrash.c */
 extern struct mm_struct *swap_token_mm;
 extern void grab_swap_token(struct mm_struct *);
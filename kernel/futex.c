@@ -219,7 +219,7 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key)
 {
 	unsigned long address = (unsigned long)uaddr;
 	struct mm_struct *mm = current->mm;
-	struct page *page;
+	struct page *page, *page_head;
 	int err;
 
 	/*
@@ -251,7 +251,34 @@ again:
 	if (err < 0)
 		return err;
 
-	page = compound_head(page);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/*
+	 * The reference is on the tail page of a transparent hugepage, which
+	 * can be split as soon as interrupts are enabled: take it again with
+	 * them disabled, and move it to the head, which might be freed once
+	 * split otherwise.
+	 */
+	page_head = page;
+	if (unlikely(PageTail(page))) {
+		put_page(page);
+		local_irq_disable();
+		if (likely(__get_user_pages_fast(address, 1, 1, &page) == 1)) {
+			page_head = compound_head(page);
+			if (page != page_head) {
+				get_page(page_head);
+				put_page(page);
+			}
+			local_irq_enable();
+		} else {
+			local_irq_enable();
+			goto again;
+		}
+	}
+#else
+	page_head = compound_head(page);
+#endif
+	page = page_head;
+
 	lock_page(page);
 	if (!page->mapping) {
 		unlock_page(page);
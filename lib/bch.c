@@ -0,0 +1,587 @@
+/*
+ * Generic binary BCH encoding/decoding library
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This library provides runtime configurable encoding and decoding of binary
+ * Bose-Chaudhuri-Hocquenghem (BCH) codes over GF(2^m), 5 <= m <= 15, able to
+ * correct up to t bit errors per codeword. Codes are shortened: a message of
+ * len bytes is protected as long as 8*len + ecc_bits <= 2^m-1.
+ *
+ * Bit ordering: the codeword is the message, most significant bit of the
+ * first byte first, followed by the ecc_bits parity bits stored the same way
+ * in ecc_bytes bytes (the unused low bits of the last ecc byte are zero).
+ * Bit i of that stream is the coefficient of x^(N-1-i) of the codeword
+ * polynomial, N being the codeword length in bits.
+ *
+ * Encoding computes the remainder of the message times x^ecc_bits divided by
+ * the generator polynomial. The remainder is kept left aligned in 32-bit
+ * words, which makes one step per 32 message bits possible with four
+ * 256-entry tables, whatever the degree of the generator.
+ *
+ * Decoding starts from the remainder of the received codeword, i.e. the xor
+ * of the received and recomputed ecc, so an error free codeword costs one
+ * encoding. Otherwise the 2t syndromes are evaluated from that remainder, the
+ * error locator polynomial is found with Berlekamp-Massey, and its roots with
+ * a Chien search restricted to the N positions of the shortened codeword.
+ */
+
+/*
+ * The STANDALONE macro builds the library outside the kernel, e.g. into a
+ * testbed or a benchmark program, in the same way as nand_ecc.c.
+ */
+#ifndef STANDALONE
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/bch.h>
+#include <asm/unaligned.h>
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bch.h"
+
+#define EXPORT_SYMBOL_GPL(x)	/* x */
+#define MODULE_LICENSE(x)	/* x */
+#define MODULE_DESCRIPTION(x)	/* x */
+
+#define GFP_KERNEL		0
+#define kcalloc(n, size, flags)	calloc(n, size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define __fls(word)		(31 - __builtin_clz(word))
+#define __ffs(word)		__builtin_ctz(word)
+
+static inline uint32_t get_unaligned_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+#endif
+
+#define BCH_M_MIN	5
+#define BCH_M_MAX	15
+
+/* Default primitive polynomials, for m = 5..15 */
+static const unsigned int prim_poly_tab[] = {
+	0x25, 0x43, 0x83, 0x11d, 0x211, 0x409, 0x805, 0x1053, 0x201b,
+	0x402b, 0x8003,
+};
+
+/* Reduce v < 2n modulo n */
+static inline unsigned int mod_n(struct bch_control *bch, unsigned int v)
+{
+	return v < bch->n ? v : v - bch->n;
+}
+
+static inline unsigned int gf_mul(struct bch_control *bch, unsigned int a,
+				  unsigned int b)
+{
+	return (a && b) ? bch->a_pow_tab[mod_n(bch, bch->a_log_tab[a] +
+					       bch->a_log_tab[b])] : 0;
+}
+
+/* b must not be zero */
+static inline unsigned int gf_div(struct bch_control *bch, unsigned int a,
+				  unsigned int b)
+{
+	return a ? bch->a_pow_tab[mod_n(bch, bch->a_log_tab[a] + bch->n -
+					bch->a_log_tab[b])] : 0;
+}
+
+/* Remainder table k, entry i: i(x).x^(ecc_bits+8k) mod g(x) */
+static inline const uint32_t *mod_tab(struct bch_control *bch,
+				      unsigned int k, unsigned int i)
+{
+	return bch->mod_tab + (k * 256 + i) * bch->ecc_words;
+}
+
+/* Load ecc bytes as a left aligned remainder, dropping the padding bits */
+static void load_ecc(struct bch_control *bch, uint32_t *dst,
+		     const uint8_t *src)
+{
+	unsigned int i, pad = bch->ecc_bits % 32;
+
+	memset(dst, 0, bch->ecc_words * sizeof(*dst));
+	for (i = 0; i < bch->ecc_bytes; i++)
+		dst[i / 4] |= (uint32_t)src[i] << (24 - 8 * (i % 4));
+	if (pad)
+		dst[bch->ecc_words - 1] &= ~(0xffffffffu >> pad);
+}
+
+static void store_ecc(struct bch_control *bch, uint8_t *dst,
+		      const uint32_t *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < bch->ecc_bytes; i++)
+		dst[i] = src[i / 4] >> (24 - 8 * (i % 4));
+}
+
+/* Divide the message into remainder r, see the description at the top */
+static void encode_words(struct bch_control *bch, const uint8_t *data,
+			 unsigned int len, uint32_t *r)
+{
+	const unsigned int l = bch->ecc_words;
+	const uint32_t *t0, *t1, *t2, *t3;
+	unsigned int i;
+	uint32_t w;
+
+	for (; len >= 4; len -= 4, data += 4) {
+		w = r[0] ^ get_unaligned_be32(data);
+		t0 = mod_tab(bch, 0, w & 0xff);
+		t1 = mod_tab(bch, 1, (w >> 8) & 0xff);
+		t2 = mod_tab(bch, 2, (w >> 16) & 0xff);
+		t3 = mod_tab(bch, 3, w >> 24);
+
+		for (i = 0; i < l - 1; i++)
+			r[i] = r[i + 1] ^ t0[i] ^ t1[i] ^ t2[i] ^ t3[i];
+		r[l - 1] = t0[l - 1] ^ t1[l - 1] ^ t2[l - 1] ^ t3[l - 1];
+	}
+
+	/* Remaining bytes */
+	for (; len; len--, data++) {
+		t0 = mod_tab(bch, 0, (r[0] >> 24) ^ *data);
+
+		for (i = 0; i < l - 1; i++)
+			r[i] = ((r[i] << 8) | (r[i + 1] >> 24)) ^ t0[i];
+		r[l - 1] = (r[l - 1] << 8) ^ t0[l - 1];
+	}
+}
+
+/**
+ * encode_bch - calculate BCH ecc parity of data
+ * @bch:	BCH control structure
+ * @data:	data to encode
+ * @len:	data length in bytes
+ * @ecc:	ecc parity data, bch->ecc_bytes long
+ *
+ * The ecc buffer is used as the initial remainder and must be zeroed by the
+ * caller before a new message; this allows a message to be encoded in
+ * several chunks by calling encode_bch() once per chunk.
+ */
+void encode_bch(struct bch_control *bch, const uint8_t *data,
+		unsigned int len, uint8_t *ecc)
+{
+	load_ecc(bch, bch->ecc_buf, ecc);
+	encode_words(bch, data, len, bch->ecc_buf);
+	store_ecc(bch, ecc, bch->ecc_buf);
+}
+EXPORT_SYMBOL_GPL(encode_bch);
+
+/*
+ * Evaluate the syndromes S(j) = r(a^j), j = 1..2t, of the remainder r. Even
+ * syndromes follow from S(2j) = S(j)^2 for binary codes.
+ */
+static void compute_syndromes(struct bch_control *bch, const uint32_t *r,
+			      unsigned int *syn)
+{
+	const unsigned int t = bch->t;
+	unsigned int i, j, b, d, d2, e;
+	uint32_t w;
+
+	memset(syn, 0, 2 * t * sizeof(*syn));
+
+	for (i = 0; i < bch->ecc_words; i++) {
+		for (w = r[i]; w; w &= ~(1u << b)) {
+			b = __fls(w);
+			/* Degree of the term for bit b of word i */
+			d = bch->ecc_bits - 1 - (32 * i + 31 - b);
+			d2 = mod_n(bch, 2 * d);
+			for (j = 0, e = d; j < t; j++) {
+				syn[2 * j] ^= bch->a_pow_tab[e];
+				e = mod_n(bch, e + d2);
+			}
+		}
+	}
+
+	for (j = 1; j <= t; j++)
+		syn[2 * j - 1] = gf_mul(bch, syn[j - 1], syn[j - 1]);
+}
+
+/*
+ * Berlekamp-Massey: find the error locator polynomial of the syndromes.
+ * Returns its degree, or -1 if more than t errors are detected.
+ */
+static int compute_error_locator(struct bch_control *bch,
+				 const unsigned int *syn)
+{
+	const unsigned int t2 = 2 * bch->t;
+	const size_t size = (t2 + 1) * sizeof(*bch->elp);
+	unsigned int *elp = bch->elp, *b = bch->elp_b, *tmp = bch->elp_t;
+	unsigned int k, i, d, coef, bd = 1, shift = 1, l = 0;
+
+	memset(elp, 0, size);
+	memset(b, 0, size);
+	elp[0] = 1;
+	b[0] = 1;
+
+	for (k = 0; k < t2; k++) {
+		/* Discrepancy */
+		d = syn[k];
+		for (i = 1; i <= l; i++)
+			d ^= gf_mul(bch, elp[i], syn[k - i]);
+
+		if (!d) {
+			shift++;
+			continue;
+		}
+
+		coef = gf_div(bch, d, bd);
+		if (2 * l <= k) {
+			memcpy(tmp, elp, size);
+			for (i = 0; i + shift <= t2; i++)
+				elp[i + shift] ^= gf_mul(bch, coef, b[i]);
+			l = k + 1 - l;
+			memcpy(b, tmp, size);
+			bd = d;
+			shift = 1;
+		} else {
+			for (i = 0; i + shift <= t2; i++)
+				elp[i + shift] ^= gf_mul(bch, coef, b[i]);
+			shift++;
+		}
+	}
+
+	if (l > bch->t || !elp[l])
+		return -1;
+	for (i = l + 1; i <= t2; i++)
+		if (elp[i])
+			return -1;
+	return l;
+}
+
+/*
+ * Chien search: an error at degree d makes a^-d a root of the error locator.
+ * Only the nbits positions of the shortened codeword are searched. Returns
+ * the number of roots found, their codeword bit positions are stored in
+ * errloc in the format documented in decode_bch().
+ */
+static int chien_search(struct bch_control *bch, unsigned int nbits,
+			unsigned int deg, unsigned int *errloc)
+{
+	int *lg = bch->chien;
+	unsigned int d, i, v, j, nroots = 0;
+
+	/* Logs of the terms elp[i].a^(-i.d), -1 for zero coefficients */
+	for (i = 1; i <= deg; i++)
+		lg[i] = bch->elp[i] ? bch->a_log_tab[bch->elp[i]] : -1;
+
+	for (d = 0; d < nbits; d++) {
+		v = bch->elp[0];
+		for (i = 1; i <= deg; i++) {
+			if (lg[i] < 0)
+				continue;
+			v ^= bch->a_pow_tab[lg[i]];
+			lg[i] = mod_n(bch, lg[i] + bch->n - i);
+		}
+		if (v)
+			continue;
+
+		j = nbits - 1 - d;
+		errloc[nroots++] = (j & ~7) | (7 - (j & 7));
+		if (nroots == deg)
+			break;
+	}
+	return nroots;
+}
+
+/**
+ * decode_bch - decode received codeword and find bit error locations
+ * @bch:	BCH control structure
+ * @data:	received data, ignored if @calc_ecc or @syn is provided
+ * @len:	data length in bytes, always needed
+ * @recv_ecc:	received ecc, if NULL then assume it was xored in @calc_ecc
+ * @calc_ecc:	calculated ecc, if NULL then calc_ecc is computed from @data
+ * @syn:	hw computed syndrome data (if NULL, syndrome is calculated)
+ * @errloc:	output array of error locations, bch->t entries
+ *
+ * Returns the number of bit errors found, or a negative error code:
+ * -EBADMSG if the codeword cannot be corrected, -EINVAL if @len is too large
+ * for the code or the arguments are inconsistent.
+ *
+ * An error location errloc[n] below 8*@len is corrected with
+ *	data[errloc[n] / 8] ^= 1 << (errloc[n] % 8);
+ * a larger one points at bit errloc[n] - 8*@len of the ecc, using the same
+ * byte and bit numbering; nothing needs to be done for those.
+ *
+ * The accepted argument combinations are:
+ *	@data and @recv_ecc:		ecc is recomputed from the data
+ *	@recv_ecc and @calc_ecc:	e.g. ecc computed by hardware
+ *	@calc_ecc alone:		already xored with the received ecc
+ *	@syn:				syndromes computed by hardware
+ */
+int decode_bch(struct bch_control *bch, const uint8_t *data, unsigned int len,
+	       const uint8_t *recv_ecc, const uint8_t *calc_ecc,
+	       const unsigned int *syn, unsigned int *errloc)
+{
+	uint32_t *r = bch->ecc_buf, sum;
+	unsigned int i;
+	int err, nroots;
+
+	if (8 * len > bch->n - bch->ecc_bits)
+		return -EINVAL;
+
+	if (!syn) {
+		if (calc_ecc) {
+			load_ecc(bch, r, calc_ecc);
+		} else if (data && recv_ecc) {
+			memset(r, 0, bch->ecc_words * sizeof(*r));
+			encode_words(bch, data, len, r);
+		} else {
+			return -EINVAL;
+		}
+
+		sum = 0;
+		if (recv_ecc) {
+			load_ecc(bch, bch->ecc_buf2, recv_ecc);
+			for (i = 0; i < bch->ecc_words; i++) {
+				r[i] ^= bch->ecc_buf2[i];
+				sum |= r[i];
+			}
+		} else {
+			for (i = 0; i < bch->ecc_words; i++)
+				sum |= r[i];
+		}
+		/* No error */
+		if (!sum)
+			return 0;
+
+		compute_syndromes(bch, r, bch->syn);
+		syn = bch->syn;
+	}
+
+	err = compute_error_locator(bch, syn);
+	if (err > 0) {
+		nroots = chien_search(bch, 8 * len + bch->ecc_bits, err,
+				      errloc);
+		if (nroots != err)
+			err = -1;
+	}
+	return err >= 0 ? err : -EBADMSG;
+}
+EXPORT_SYMBOL_GPL(decode_bch);
+
+/* Fill the GF(2^m) power and log tables, fails if prim_poly isn't primitive */
+static int build_gf_tables(struct bch_control *bch, unsigned int prim_poly)
+{
+	unsigned int i, x = 1;
+	const unsigned int k = 1 << bch->m;
+
+	/* The polynomial must be of degree m */
+	if (!(prim_poly & k) || (prim_poly >> (bch->m + 1)))
+		return -EINVAL;
+
+	for (i = 0; i < bch->n; i++) {
+		bch->a_pow_tab[i] = x;
+		bch->a_log_tab[x] = i;
+		if (i && x == 1)
+			/* Polynomial is not primitive */
+			return -EINVAL;
+		x <<= 1;
+		if (x & k)
+			x ^= prim_poly;
+	}
+	bch->a_pow_tab[bch->n] = 1;
+	bch->a_log_tab[0] = 0;
+
+	return 0;
+}
+
+/*
+ * Compute the generator polynomial g(x), the product of the (x + a^i) over
+ * the cyclotomic cosets of a^1, a^3, ... a^(2t-1). Its coefficients, lowest
+ * degree first, go to g and its degree is returned.
+ */
+static int build_generator(struct bch_control *bch, unsigned int *g)
+{
+	uint8_t *roots;
+	unsigned int i, j, r, root, deg = 0;
+
+	roots = kcalloc(bch->n, sizeof(*roots), GFP_KERNEL);
+	if (!roots)
+		return -ENOMEM;
+
+	for (i = 0; i < bch->t; i++)
+		for (j = 0, r = 2 * i + 1; j < bch->m; j++) {
+			roots[r] = 1;
+			r = mod_n(bch, 2 * r);
+		}
+
+	g[0] = 1;
+	for (r = 1; r < bch->n; r++) {
+		if (!roots[r])
+			continue;
+		root = bch->a_pow_tab[r];
+		g[deg + 1] = 1;
+		for (j = deg; j > 0; j--)
+			g[j] = g[j - 1] ^ gf_mul(bch, g[j], root);
+		g[0] = gf_mul(bch, g[0], root);
+		deg++;
+	}
+	kfree(roots);
+
+	/* A product of minimal polynomials has binary coefficients */
+	for (i = 0; i <= deg; i++)
+		if (g[i] > 1)
+			return -EINVAL;
+	return deg;
+}
+
+/*
+ * Build the four remainder tables from b(j) = x^(ecc_bits+j) mod g(x),
+ * j = 0..31, all left aligned in ecc_words words.
+ */
+static int build_mod_tables(struct bch_control *bch, const unsigned int *g)
+{
+	const unsigned int l = bch->ecc_words, e = bch->ecc_bits;
+	const uint32_t *bj;
+	uint32_t *b, *p;
+	unsigned int i, j, k, w;
+
+	b = kcalloc(32 * l, sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	/* b(0) = g(x) - x^e */
+	for (i = 0; i < e; i++)
+		if (g[e - 1 - i])
+			b[i / 32] |= 1u << (31 - i % 32);
+
+	/* b(j) = b(j-1).x mod g(x) */
+	for (j = 1; j < 32; j++) {
+		uint32_t *prev = b + (j - 1) * l, *cur = b + j * l;
+
+		for (i = 0; i < l - 1; i++)
+			cur[i] = (prev[i] << 1) | (prev[i + 1] >> 31);
+		cur[l - 1] = prev[l - 1] << 1;
+		if (prev[0] & 0x80000000u)
+			for (i = 0; i < l; i++)
+				cur[i] ^= b[i];
+	}
+
+	/* Entry i of table k is the sum of b(8k+j) over the bits j of i */
+	for (k = 0; k < 4; k++)
+		for (i = 0; i < 256; i++) {
+			p = bch->mod_tab + (k * 256 + i) * l;
+			memset(p, 0, l * sizeof(*p));
+			for (j = i; j; j &= j - 1) {
+				bj = b + (8 * k + __ffs(j)) * l;
+				for (w = 0; w < l; w++)
+					p[w] ^= bj[w];
+			}
+		}
+
+	kfree(b);
+	return 0;
+}
+
+/**
+ * init_bch - initialize a BCH encoder/decoder
+ * @m:		Galois field order, between 5 and 15
+ * @t:		maximum error correction capability, in bits
+ * @prim_poly:	user-provided primitive polynomial, or 0 for the default one
+ *
+ * Returns a new BCH control structure, or NULL if the parameters are not
+ * supported or memory could not be allocated. The ecc size is
+ * bch->ecc_bytes bytes; a codeword protects at most (2^m-1-ecc_bits)/8
+ * data bytes.
+ */
+struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
+{
+	struct bch_control *bch;
+	unsigned int *g = NULL;
+	unsigned int words;
+	int deg;
+
+	if (m < BCH_M_MIN || m > BCH_M_MAX)
+		return NULL;
+	/* Leave room for at least one data byte */
+	if (t < 1 || m * t + 8 > (1 << m) - 1)
+		return NULL;
+
+	if (!prim_poly)
+		prim_poly = prim_poly_tab[m - BCH_M_MIN];
+
+	bch = kzalloc(sizeof(*bch), GFP_KERNEL);
+	if (!bch)
+		return NULL;
+
+	bch->m = m;
+	bch->t = t;
+	bch->n = (1 << m) - 1;
+	words = DIV_ROUND_UP(m * t, 32);
+	bch->ecc_words = words;
+
+	bch->a_pow_tab = kcalloc(bch->n + 1, sizeof(uint16_t), GFP_KERNEL);
+	bch->a_log_tab = kcalloc(bch->n + 1, sizeof(uint16_t), GFP_KERNEL);
+	bch->mod_tab = kcalloc(4 * 256 * words, sizeof(uint32_t), GFP_KERNEL);
+	bch->ecc_buf = kcalloc(words, sizeof(uint32_t), GFP_KERNEL);
+	bch->ecc_buf2 = kcalloc(words, sizeof(uint32_t), GFP_KERNEL);
+	bch->syn = kcalloc(2 * t, sizeof(unsigned int), GFP_KERNEL);
+	bch->elp = kcalloc(2 * t + 1, sizeof(unsigned int), GFP_KERNEL);
+	bch->elp_b = kcalloc(2 * t + 1, sizeof(unsigned int), GFP_KERNEL);
+	bch->elp_t = kcalloc(2 * t + 1, sizeof(unsigned int), GFP_KERNEL);
+	bch->chien = kcalloc(t + 1, sizeof(int), GFP_KERNEL);
+	g = kcalloc(m * t + 1, sizeof(*g), GFP_KERNEL);
+	if (!bch->a_pow_tab || !bch->a_log_tab || !bch->mod_tab ||
+	    !bch->ecc_buf || !bch->ecc_buf2 || !bch->syn || !bch->elp ||
+	    !bch->elp_b || !bch->elp_t || !bch->chien || !g)
+		goto fail;
+
+	if (build_gf_tables(bch, prim_poly))
+		goto fail;
+
+	deg = build_generator(bch, g);
+	if (deg <= 0)
+		goto fail;
+	bch->ecc_bits = deg;
+	bch->ecc_bytes = DIV_ROUND_UP(deg, 8);
+	/* The tables are indexed with the exact number of words */
+	bch->ecc_words = DIV_ROUND_UP(deg, 32);
+
+	if (build_mod_tables(bch, g))
+		goto fail;
+
+	kfree(g);
+	return bch;
+
+fail:
+	kfree(g);
+	free_bch(bch);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(init_bch);
+
+/**
+ * free_bch - free the BCH control structure
+ * @bch:	BCH control structure to release, may be NULL
+ */
+void free_bch(struct bch_control *bch)
+{
+	if (bch) {
+		kfree(bch->a_pow_tab);
+		kfree(bch->a_log_tab);
+		kfree(bch->mod_tab);
+		kfree(bch->ecc_buf);
+		kfree(bch->ecc_buf2);
+		kfree(bch->syn);
+		kfree(bch->elp);
+		kfree(bch->elp_b);
+		kfree(bch->elp_t);
+		kfree(bch->chien);
+		kfree(bch);
+	}
+}
+EXPORT_SYMBOL_GPL(free_bch);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Binary BCH encoder/decoder");
@@ -0,0 +1,93 @@
+/*
+ *  linux/mm/cleancache.c
+ *
+ *  Hooks between the page cache and a cleancache backend: see
+ *  include/linux/cleancache.h and Documentation/vm/zcache.txt.
+ *
+ *  The page cache calls in here with the page locked, and put and flush
+ *  also with the mapping's tree_lock held and interrupts disabled: the
+ *  backend must neither sleep nor take locks with interrupts enabled.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/cleancache.h>
+
+int cleancache_enabled __read_mostly;
+EXPORT_SYMBOL(cleancache_enabled);
+
+static struct cleancache_ops cleancache_ops __read_mostly;
+
+/*
+ * Register a backend, returning the previous one.  Filesystems mounted
+ * before that have no pool, and are not cached until mounted again.
+ */
+struct cleancache_ops cleancache_register_ops(struct cleancache_ops *ops)
+{
+	struct cleancache_ops old = cleancache_ops;
+
+	cleancache_ops = *ops;
+	cleancache_enabled = 1;
+	return old;
+}
+EXPORT_SYMBOL(cleancache_register_ops);
+
+/* Called at mount by filesystems whose pages cleancache may keep */
+void __cleancache_init_fs(struct super_block *sb)
+{
+	sb->cleancache_poolid = (*cleancache_ops.init_fs)(PAGE_SIZE);
+}
+EXPORT_SYMBOL(__cleancache_init_fs);
+
+int __cleancache_get_page(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+
+	VM_BUG_ON(!PageLocked(page));
+	return (*cleancache_ops.get_page)(inode->i_sb->cleancache_poolid,
+					  inode->i_ino, page->index, page);
+}
+EXPORT_SYMBOL(__cleancache_get_page);
+
+void __cleancache_put_page(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+
+	VM_BUG_ON(!PageLocked(page));
+	(*cleancache_ops.put_page)(inode->i_sb->cleancache_poolid,
+				   inode->i_ino, page->index, page);
+}
+EXPORT_SYMBOL(__cleancache_put_page);
+
+void __cleancache_flush_page(struct address_space *mapping, struct page *page)
+{
+	struct inode *inode = mapping->host;
+
+	VM_BUG_ON(!PageLocked(page));
+	(*cleancache_ops.flush_page)(inode->i_sb->cleancache_poolid,
+				     inode->i_ino, page->index);
+}
+EXPORT_SYMBOL(__cleancache_flush_page);
+
+void __cleancache_flush_inode(struct address_space *mapping)
+{
+	struct inode *inode = mapping->host;
+
+	(*cleancache_ops.flush_inode)(inode->i_sb->cleancache_poolid,
+				      inode->i_ino);
+}
+EXPORT_SYMBOL(__cleancache_flush_inode);
+
+/* Called at unmount: the pool goes away with everything in it */
+void __cleancache_flush_fs(struct super_block *sb)
+{
+	int pool_id = sb->cleancache_poolid;
+
+	if (pool_id >= 0) {
+		sb->cleancache_poolid = -1;
+		(*cleancache_ops.flush_fs)(pool_id);
+	}
+}
+EXPORT_SYMBOL(__cleancache_flush_fs);
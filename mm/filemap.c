@@ -34,6 +34,7 @@
 #include <linux/hardirq.h> /* for BUG_ON(!in_atomic()) only */
 #include <linux/memcontrol.h>
 #include <linux/mm_inline.h> /* for page_is_file_cache() */
+#include <linux/cleancache.h>
 #include "internal.h"
 
 /*
@@ -91,7 +92,7 @@
  *    ->page_table_lock or pte_lock	(anon_vma_prepare and various)
  *
  *  ->page_table_lock or pte_lock
- *    ->swap_lock		(try_to_unmap_one)
+ *    ->swap_cluster_info->lock	(try_to_unmap_one)
  *    ->private_lock		(try_to_unmap_one)
  *    ->tree_lock		(try_to_unmap_one)
  *    ->zone.lru_lock		(follow_page->mark_page_accessed)
@@ -119,6 +120,15 @@ void __remove_from_page_cache(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
 
+	/*
+	 * A clean page read from disk may get a second chance in cleancache;
+	 * otherwise any older copy there is stale.
+	 */
+	if (PageUptodate(page) && PageMappedToDisk(page))
+		cleancache_put_page(page);
+	else
+		cleancache_flush_page(mapping, page);
+
 	radix_tree_delete(&mapping->page_tree, page->index);
 	page->mapping = NULL;
 	mapping->nrpages--;
@@ -2196,6 +2206,12 @@ generic_file_direct_write(struct kiocb *iocb, const struct iovec *iov,
 					      pos >> PAGE_CACHE_SHIFT, end);
 	}
 
+	/*
+	 * Cleancache may hold old copies of the pages written even when
+	 * none are left in the page cache: drop them all.
+	 */
+	cleancache_flush_inode(mapping);
+
 	if (written > 0) {
 		pos += written;
 		if (pos > i_size_read(inode) && !S_ISBLK(inode->i_mode)) {
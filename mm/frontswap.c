@@ -0,0 +1,89 @@
+/*
+ *  linux/mm/frontswap.c
+ *
+ *  Hooks between swap and a frontswap backend: see
+ *  include/linux/frontswap.h and Documentation/vm/zcache.txt.
+ *
+ *  Each swap area keeps a bitmap of the slots the backend holds, so that
+ *  swap_readpage() and the freeing of slots only call the backend for
+ *  those.  Bits are set and cleared with the page locked, or once the slot
+ *  is free, so nothing else touches them concurrently.
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/frontswap.h>
+
+int frontswap_enabled __read_mostly;
+EXPORT_SYMBOL(frontswap_enabled);
+
+static struct frontswap_ops frontswap_ops __read_mostly;
+
+/*
+ * Register a backend, returning the previous one.  Only areas swapped on
+ * after that use it.
+ */
+struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops)
+{
+	struct frontswap_ops old = frontswap_ops;
+
+	frontswap_ops = *ops;
+	frontswap_enabled = 1;
+	return old;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+void __frontswap_init(struct swap_info_struct *sis)
+{
+	(*frontswap_ops.init)(sis->type);
+}
+
+int __frontswap_put_page(struct page *page)
+{
+	struct swap_info_struct *sis = page_swap_info(page);
+	swp_entry_t entry = { .val = page_private(page), };
+	pgoff_t offset = swp_offset(entry);
+	int dup;
+	int ret;
+
+	VM_BUG_ON(!PageLocked(page));
+	if (!sis->frontswap_map)
+		return -1;
+
+	dup = test_bit(offset, sis->frontswap_map);
+	ret = (*frontswap_ops.put_page)(sis->type, offset, page);
+	if (ret == 0)
+		set_bit(offset, sis->frontswap_map);
+	else if (dup) {
+		/* the page goes to disk: the backend's copy is stale */
+		(*frontswap_ops.flush_page)(sis->type, offset);
+		clear_bit(offset, sis->frontswap_map);
+	}
+	return ret;
+}
+
+int __frontswap_get_page(struct page *page)
+{
+	struct swap_info_struct *sis = page_swap_info(page);
+	swp_entry_t entry = { .val = page_private(page), };
+	pgoff_t offset = swp_offset(entry);
+
+	VM_BUG_ON(!PageLocked(page));
+	if (!sis->frontswap_map || !test_bit(offset, sis->frontswap_map))
+		return -1;
+	return (*frontswap_ops.get_page)(sis->type, offset, page);
+}
+
+void __frontswap_flush_page(struct swap_info_struct *sis, pgoff_t offset)
+{
+	(*frontswap_ops.flush_page)(sis->type, offset);
+	clear_bit(offset, sis->frontswap_map);
+}
+
+void __frontswap_flush_area(struct swap_info_struct *sis)
+{
+	(*frontswap_ops.flush_area)(sis->type);
+	bitmap_zero(sis->frontswap_map, sis->max);
+}
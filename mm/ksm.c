@@ -427,7 +427,7 @@ static struct page *get_mergeable_page(struct rmap_item *rmap_item)
 	if (!(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
 		goto out;
 
-	page = follow_page(vma, addr, FOLL_GET);
+	page = follow_page(vma, addr, FOLL_GET | FOLL_SPLIT);
 	if (IS_ERR_OR_NULL(page))
 		goto out;
 	if (PageAnon(page)) {
@@ -1276,7 +1276,9 @@ next_mm:
 		while (ksm_scan.address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			/* KSM merges small pages only */
+			*page = follow_page(vma, ksm_scan.address,
+					    FOLL_GET | FOLL_SPLIT);
 			if (!IS_ERR_OR_NULL(*page) && PageAnon(*page)) {
 				flush_anon_page(vma, *page, ksm_scan.address);
 				flush_dcache_page(*page);
@@ -1428,9 +1428,21 @@ static int mem_cgroup_hierarchical_reclaim(struct mem_cgroup *root_mem,
 		if (check_soft)
 			ret = mem_cgroup_shrink_node_zone(victim, gfp_mask,
 				noswap, get_swappiness(victim), zone);
-		else
+		else {
 			ret = try_to_free_mem_cgroup_pages(victim, gfp_mask,
 						noswap, get_swappiness(victim));
+			/*
+			 * Nothing left on the LRU may be hugepages: split
+			 * one for its subpages to be reclaimed.
+			 */
+			if (!ret && !noswap && nr_swap_pages > 0 &&
+			    split_huge_pages_memcg(victim, 1)) {
+				lru_add_drain();
+				ret = try_to_free_mem_cgroup_pages(victim,
+						gfp_mask, noswap,
+						get_swappiness(victim));
+			}
+		}
 		css_put(&victim->css);
 		/*
 		 * At shrinking usage, we can't check we should stop here or
@@ -2277,12 +2289,48 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 	return 0;
 }
 
+static struct mem_cgroup *
+__mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype);
+
+/*
+ * A transparent hugepage is charged one subpage at a time, so that it can
+ * be split without touching the charges.  It is charged fully or not at
+ * all: the caller falls back to small pages, without invoking the OOM
+ * killer, if the cgroup cannot take all of it.
+ */
+static int mem_cgroup_charge_huge(struct page *page, struct mm_struct *mm,
+				  gfp_t gfp_mask)
+{
+	struct mem_cgroup *mem;
+	struct page_cgroup *pc;
+	int i, ret;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pc = lookup_page_cgroup(page + i);
+		if (unlikely(!pc))
+			continue;
+		mem = NULL;
+		ret = __mem_cgroup_try_charge(mm, gfp_mask, &mem, false);
+		if (ret)
+			goto undo;
+		__mem_cgroup_commit_charge(mem, pc,
+					   MEM_CGROUP_CHARGE_TYPE_MAPPED);
+	}
+	return 0;
+
+undo:
+	while (--i >= 0)
+		__mem_cgroup_uncharge_common(page + i,
+					     MEM_CGROUP_CHARGE_TYPE_MAPPED);
+	return ret;
+}
+
 int mem_cgroup_newpage_charge(struct page *page,
 			      struct mm_struct *mm, gfp_t gfp_mask)
 {
 	if (mem_cgroup_disabled())
 		return 0;
-	if (PageCompound(page))
+	if (PageCompound(page) && !PageTransHuge(page))
 		return 0;
 	/*
 	 * If already mapped, we don't have to account.
@@ -2295,6 +2343,8 @@ int mem_cgroup_newpage_charge(struct page *page,
 		return 0;
 	if (unlikely(!mm))
 		mm = &init_mm;
+	if (PageTransHuge(page))
+		return mem_cgroup_charge_huge(page, mm, gfp_mask);
 	return mem_cgroup_charge_common(page, mm, gfp_mask,
 				MEM_CGROUP_CHARGE_TYPE_MAPPED);
 }
@@ -2596,6 +2646,16 @@ void mem_cgroup_uncharge_page(struct page *page)
 		return;
 	if (page->mapping && !PageAnon(page))
 		return;
+	if (PageTransHuge(page)) {
+		int i;
+
+		mem_cgroup_uncharge_start();
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			__mem_cgroup_uncharge_common(page + i,
+					MEM_CGROUP_CHARGE_TYPE_MAPPED);
+		mem_cgroup_uncharge_end();
+		return;
+	}
 	__mem_cgroup_uncharge_common(page, MEM_CGROUP_CHARGE_TYPE_MAPPED);
 }
 
@@ -2606,6 +2666,18 @@ void mem_cgroup_uncharge_cache_page(struct page *page)
 	__mem_cgroup_uncharge_common(page, MEM_CGROUP_CHARGE_TYPE_CACHE);
 }
 
+/*
+ * Whether the transparent hugepage @page is charged to @mem.  Hugepages are
+ * not on the LRU, so memcg cannot reclaim or move them until they are split:
+ * this picks the ones to split.  Read without lock_page_cgroup(), as a hint.
+ */
+bool mem_cgroup_huge_page_charged(struct page *page, struct mem_cgroup *mem)
+{
+	struct page_cgroup *pc = lookup_page_cgroup(page);
+
+	return pc && PageCgroupUsed(pc) && pc->mem_cgroup == mem;
+}
+
 /*
  * Batch_start/batch_end is called in unmap_page_range/invlidate/trucate.
  * In that cases, pages are freed continuously and we can expect pages
@@ -3230,6 +3302,8 @@ move_account:
 		ret = -EINTR;
 		if (signal_pending(current))
 			goto out;
+		/* Hugepages are off the LRU: split them to move their charges */
+		split_huge_pages_memcg(mem, INT_MAX);
 		/* This is for making all *used* pages to be on LRU. */
 		lru_add_drain_all();
 		drain_all_stock_sync();
@@ -3267,6 +3341,7 @@ try_to_free:
 		goto out;
 	}
 	/* we call try-to-free pages for make this cgroup empty */
+	split_huge_pages_memcg(mem, INT_MAX);
 	lru_add_drain_all();
 	/* try to free all pages in this cgroup */
 	shrink = 1;
@@ -4624,6 +4699,11 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	/* charges are moved page by page: look at the small pages */
+	split_huge_page_pmd(walk->mm, pmd);
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
+
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
 		if (is_target_pte_for_mc(vma, addr, *pte, NULL))
@@ -4789,6 +4869,9 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	split_huge_page_pmd(walk->mm, pmd);
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
 retry:
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; addr += PAGE_SIZE) {
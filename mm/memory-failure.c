@@ -1012,6 +1012,29 @@ int __memory_failure(unsigned long pfn, int trapno, int flags)
 		}
 	}
 
+	/*
+	 * Split a transparent hugepage, and carry on with the poisoned
+	 * subpage alone: the others go back to normal use.
+	 */
+	if (PageTransHuge(hpage) && !PageHuge(hpage) && PageAnon(hpage)) {
+		/* the caller pinned p itself, or we pinned the head above */
+		struct page *pinned = (flags & MF_COUNT_INCREASED) ? p : hpage;
+
+		split_huge_page(hpage);
+		if (PageCompound(p)) {
+			action_result(pfn, "transparent hugepage", IGNORED);
+			put_page(pinned);
+			return -EBUSY;
+		}
+		if (p != pinned) {
+			get_page(p);
+			put_page(pinned);
+		}
+		hpage = p;
+		atomic_long_sub(nr_pages - 1, &mce_bad_pages);
+		nr_pages = 1;
+	}
+
 	/*
 	 * We ignore non-LRU pages for good reasons.
 	 * - PG_locked is only well defined for LRU pages and a few others
@@ -170,7 +170,8 @@ static long __mlock_vma_pages_range(struct vm_area_struct *vma,
 	VM_BUG_ON(end   > vma->vm_end);
 	VM_BUG_ON(!rwsem_is_locked(&mm->mmap_sem));
 
-	gup_flags = FOLL_TOUCH | FOLL_GET;
+	/* Only small pages are mlocked: split hugepages */
+	gup_flags = FOLL_TOUCH | FOLL_GET | FOLL_SPLIT;
 	if (vma->vm_flags & VM_WRITE)
 		gup_flags |= FOLL_WRITE;
 
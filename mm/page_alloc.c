@@ -93,6 +93,11 @@ EXPORT_SYMBOL(node_states);
 unsigned long totalram_pages __read_mostly;
 unsigned long totalreserve_pages __read_mostly;
 int percpu_pagelist_fraction;
+/*
+ * Pages of each order from 1 to PCP_MAX_ORDER a cpu may keep on its pcp
+ * lists for a zone, at most the zone's order-0 pcp->high.  0 disables.
+ */
+int percpu_order_pages = 64;
 gfp_t gfp_allowed_mask __read_mostly = GFP_BOOT_MASK;
 
 #ifdef CONFIG_PM_SLEEP
@@ -336,7 +341,7 @@ out:
  * This usage means that zero-order pages may not be compound.
  */
 
-static void free_compound_page(struct page *page)
+void free_compound_page(struct page *page)
 {
 	__free_pages_ok(page, compound_order(page));
 }
@@ -581,7 +586,7 @@ static inline int free_pages_check(struct page *page)
 /*
  * Frees a number of pages from the PCP lists
  * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * count is the number of blocks of that order to free.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -590,7 +595,7 @@ static inline int free_pages_check(struct page *page)
  * pinned" detection logic.
  */
 static void free_pcppages_bulk(struct zone *zone, int count,
-					struct per_cpu_pages *pcp)
+			       struct list_head *lists, unsigned int order)
 {
 	int migratetype = 0;
 	int batch_free = 0;
@@ -615,7 +620,7 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			batch_free++;
 			if (++migratetype == MIGRATE_PCPTYPES)
 				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			list = &lists[migratetype];
 		} while (list_empty(list));
 
 		do {
@@ -623,11 +628,12 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order,
+						 page_private(page));
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, count << order);
 	spin_unlock(&zone->lock);
 }
 
@@ -643,6 +649,78 @@ static void free_one_page(struct zone *zone, struct page *page, int order,
 	spin_unlock(&zone->lock);
 }
 
+/*
+ * Blocks of order 1 to PCP_MAX_ORDER this pcp may hold: 0 if the cache is
+ * disabled for the order, as it is on the boot pagesets.
+ */
+static inline int pcp_order_high(struct per_cpu_pages *pcp, unsigned int order)
+{
+	return min(pcp->high, percpu_order_pages) >> order;
+}
+
+static inline int pcp_order_batch(int high)
+{
+	return max(1, high / 4);
+}
+
+/*
+ * Free a block of order 1 to PCP_MAX_ORDER to this cpu's pcp lists rather
+ * than to the buddy lists, draining a batch of blocks if it holds too many.
+ * Returns false if the block is to be freed to the buddy lists instead.
+ * Called with interrupts disabled.
+ */
+static bool free_pcp_order_page(struct zone *zone, struct page *page,
+				unsigned int order, int migratetype)
+{
+	struct per_cpu_pages *pcp;
+	struct per_cpu_order_pages *opcp;
+	int high;
+
+	/* As in free_hot_cold_page() */
+	if (migratetype >= MIGRATE_PCPTYPES) {
+		if (unlikely(migratetype == MIGRATE_ISOLATE))
+			return false;
+		migratetype = MIGRATE_MOVABLE;
+	}
+
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	high = pcp_order_high(pcp, order);
+	if (!high)
+		return false;
+
+	/* __free_one_page() would do it: a cached block is no longer compound */
+	if (unlikely(PageCompound(page)))
+		if (unlikely(destroy_compound_page(page, order)))
+			return true;
+
+	opcp = &pcp->orders[order - 1];
+	list_add(&page->lru, &opcp->lists[migratetype]);
+	opcp->count++;
+	if (opcp->count >= high) {
+		int batch = pcp_order_batch(high);
+
+		free_pcppages_bulk(zone, batch, opcp->lists, order);
+		opcp->count -= batch;
+	}
+	return true;
+}
+
+/* Free all blocks of order above 0 on a pcp, with interrupts disabled */
+static void drain_pcp_orders(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned int order;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_order_pages *opcp = &pcp->orders[order - 1];
+
+		if (opcp->count) {
+			free_pcppages_bulk(zone, opcp->count, opcp->lists,
+					   order);
+			opcp->count = 0;
+		}
+	}
+}
+
 static bool free_pages_prepare(struct page *page, unsigned int order)
 {
 	int i;
@@ -675,17 +753,26 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
+	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
 	if (!free_pages_prepare(page, order))
 		return;
 
+	migratetype = get_pageblock_migratetype(page);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
 	__count_vm_events(PGFREE, 1 << order);
-	free_one_page(page_zone(page), page, order,
-					get_pageblock_migratetype(page));
+	if (order <= PCP_MAX_ORDER) {
+		/* __free_one_page() wants the migratetype the block came from */
+		set_page_private(page, migratetype);
+		if (free_pcp_order_page(page_zone(page), page, order,
+					migratetype))
+			goto out;
+	}
+	free_one_page(page_zone(page), page, order, migratetype);
+out:
 	local_irq_restore(flags);
 }
 
@@ -1069,8 +1156,9 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		to_drain = pcp->batch;
 	else
 		to_drain = pcp->count;
-	free_pcppages_bulk(zone, to_drain, pcp);
+	free_pcppages_bulk(zone, to_drain, pcp->lists, 0);
 	pcp->count -= to_drain;
+	drain_pcp_orders(zone, pcp);
 	local_irq_restore(flags);
 }
 #endif
@@ -1095,8 +1183,9 @@ static void drain_pages(unsigned int cpu)
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
 		pcp = &pset->pcp;
-		free_pcppages_bulk(zone, pcp->count, pcp);
+		free_pcppages_bulk(zone, pcp->count, pcp->lists, 0);
 		pcp->count = 0;
+		drain_pcp_orders(zone, pcp);
 		local_irq_restore(flags);
 	}
 }
@@ -1197,7 +1286,7 @@ void free_hot_cold_page(struct page *page, int cold)
 		list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
+		free_pcppages_bulk(zone, pcp->batch, pcp->lists, 0);
 		pcp->count -= pcp->batch;
 	}
 
@@ -1278,6 +1367,47 @@ int split_free_page(struct page *page)
 	return 1 << order;
 }
 
+/*
+ * Take a block of order 1 to PCP_MAX_ORDER from this cpu's pcp lists,
+ * refilling them with a batch of blocks under a single hold of zone->lock
+ * when empty.  Returns NULL if the cache is disabled for the order, or if
+ * the zone has no block of the order left.  Called with interrupts disabled.
+ */
+static struct page *rmqueue_pcp_order(struct zone *zone, unsigned int order,
+				      int migratetype, int cold)
+{
+	struct per_cpu_pages *pcp;
+	struct per_cpu_order_pages *opcp;
+	struct list_head *list;
+	struct page *page;
+	int high;
+
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	high = pcp_order_high(pcp, order);
+	if (!high)
+		return NULL;
+
+	opcp = &pcp->orders[order - 1];
+	list = &opcp->lists[migratetype];
+	if (list_empty(list)) {
+		opcp->count += rmqueue_bulk(zone, order, pcp_order_batch(high),
+					    list, migratetype, cold);
+		if (unlikely(list_empty(list)))
+			return NULL;
+		__count_vm_event(PCP_ORDER1_REFILL - 1 + order);
+	} else
+		__count_vm_event(PCP_ORDER1_HIT - 1 + order);
+
+	if (cold)
+		page = list_entry(list->prev, struct page, lru);
+	else
+		page = list_entry(list->next, struct page, lru);
+
+	list_del(&page->lru);
+	opcp->count--;
+	return page;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1329,12 +1459,19 @@ again:
 			 */
 			WARN_ON_ONCE(order > 1);
 		}
-		spin_lock_irqsave(&zone->lock, flags);
-		page = __rmqueue(zone, order, migratetype);
-		spin_unlock(&zone->lock);
-		if (!page)
-			goto failed;
-		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
+		local_irq_save(flags);
+		page = NULL;
+		if (order <= PCP_MAX_ORDER)
+			page = rmqueue_pcp_order(zone, order, migratetype, cold);
+		if (!page) {
+			spin_lock(&zone->lock);
+			page = __rmqueue(zone, order, migratetype);
+			spin_unlock(&zone->lock);
+			if (!page)
+				goto failed;
+			__mod_zone_page_state(zone, NR_FREE_PAGES,
+					      -(1 << order));
+		}
 	}
 
 	__count_zone_vm_events(PGALLOC, zone, 1 << order);
@@ -2022,7 +2159,8 @@ __alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
 		goto nopage;
 
 restart:
-	wake_all_kswapd(order, zonelist, high_zoneidx);
+	if (!(gfp_mask & __GFP_NO_KSWAPD))
+		wake_all_kswapd(order, zonelist, high_zoneidx);
 
 	/*
 	 * OK, we're below the kswapd watermark and have kicked background
@@ -3378,7 +3516,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int migratetype, order;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3388,6 +3526,13 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->batch = max(1UL, 1 * batch);
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_order_pages *opcp = &pcp->orders[order - 1];
+
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES;
+		     migratetype++)
+			INIT_LIST_HEAD(&opcp->lists[migratetype]);
+	}
 }
 
 /*
@@ -3494,7 +3639,8 @@ static int __zone_pcp_update(void *data)
 		pcp = &pset->pcp;
 
 		local_irq_save(flags);
-		free_pcppages_bulk(zone, pcp->count, pcp);
+		free_pcppages_bulk(zone, pcp->count, pcp->lists, 0);
+		drain_pcp_orders(zone, pcp);
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -4094,7 +4240,6 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
-	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -5126,6 +5271,23 @@ int percpu_pagelist_fraction_sysctl_handler(ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * percpu_order_pages - sizes the pcp lists of orders 1 to PCP_MAX_ORDER.
+ * All cpus drain them afterwards: a cpu freeing a block meanwhile has
+ * interrupts disabled, so none is left cached against the new size.
+ */
+int percpu_order_pages_sysctl_handler(ctl_table *table, int write,
+	void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!write || ret < 0)
+		return ret;
+	drain_all_pages();
+	return 0;
+}
+
 int hashdist = HASHDIST_DEFAULT;
 
 #ifdef CONFIG_NUMA
@@ -59,8 +59,73 @@ static void __page_cache_release(struct page *page)
 	free_hot_cold_page(page, 0);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A reference taken through a tail page is also counted on the tail, and
+ * __split_huge_page_refcount() moves it from the head to the tail: the head
+ * is pinned and its compound_lock taken to hold off the split while both
+ * counts change.  Once the page was split, the reference is on the page.
+ */
+bool __get_page_tail(struct page *page)
+{
+	struct page *page_head = page->first_page;
+	unsigned long flags;
+	bool got = false;
+
+	/* a tail page still after the barrier had a good first_page */
+	smp_rmb();
+	if (likely(PageTail(page) && get_page_unless_zero(page_head))) {
+		flags = compound_lock_irqsave(page_head);
+		if (likely(PageTail(page))) {
+			/* the head reference just taken is the caller's */
+			atomic_inc(&page->_count);
+			got = true;
+		}
+		compound_unlock_irqrestore(page_head, flags);
+		if (unlikely(!got))
+			put_page(page_head);
+	}
+	return got;
+}
+EXPORT_SYMBOL(__get_page_tail);
+
+static bool put_page_tail(struct page *page)
+{
+	struct page *page_head = page->first_page;
+	unsigned long flags;
+
+	smp_rmb();
+	if (likely(PageTail(page) && get_page_unless_zero(page_head))) {
+		flags = compound_lock_irqsave(page_head);
+		if (likely(PageTail(page))) {
+			VM_BUG_ON(atomic_read(&page->_count) <= 0);
+			atomic_dec(&page->_count);
+			/* cannot drop to zero: we hold a reference too */
+			atomic_dec(&page_head->_count);
+			compound_unlock_irqrestore(page_head, flags);
+			put_page(page_head);
+			return true;
+		}
+		compound_unlock_irqrestore(page_head, flags);
+		/* split meanwhile: page_head is no compound page any more */
+		put_page(page_head);
+	}
+	return false;
+}
+#endif
+
 static void put_compound_page(struct page *page)
 {
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (unlikely(PageTail(page))) {
+		if (likely(put_page_tail(page)))
+			return;
+		/* the page was split: the reference is its own */
+		if (put_page_testzero(page))
+			__page_cache_release(page);
+		return;
+	}
+#endif
 	page = compound_head(page);
 	if (put_page_testzero(page)) {
 		compound_page_dtor *dtor;
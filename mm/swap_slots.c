@@ -0,0 +1,236 @@
+/*
+ *  linux/mm/swap_slots.c
+ *
+ *  Per-cpu caches of swap slots.
+ *
+ *  Allocating and freeing swap slots one page at a time takes swap_lock
+ *  for every page, which reclaiming cpus contend on when swapping to a
+ *  fast device.  Instead each cpu keeps a cache of slots allocated in a
+ *  batch by get_swap_pages(), from which get_swap_page() hands them out,
+ *  and a cache of slots whose last reference went away, given back in a
+ *  batch by swapcache_free_entries().
+ *
+ *  Slots in either cache stay marked SWAP_HAS_CACHE in their swap_map,
+ *  and count as in use.  So that they do not make swap allocation fail
+ *  elsewhere, the caches are only used while there is plenty of free
+ *  swap; and swapoff, to which they would look in use, drains them and
+ *  keeps them disabled until it is done.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/init.h>
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr and cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;		/* slots left, from cur on */
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret and n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/* Serializes changes to swap_slot_cache_active and swap_slot_cache_enabled */
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+/* There is enough free swap for the caches */
+static bool swap_slot_cache_active;
+/* Set once the caches are initialized, cleared during swapoff */
+bool swap_slot_cache_enabled;
+
+/*
+ * The caches are activated when free swap goes above ACTIVATE slots per
+ * online cpu, deactivated and drained when it falls below DEACTIVATE.
+ */
+#define SWAP_SLOTS_CACHE_ACTIVATE	(5 * SWAP_SLOTS_CACHE_SIZE)
+#define SWAP_SLOTS_CACHE_DEACTIVATE	(2 * SWAP_SLOTS_CACHE_SIZE)
+
+/*
+ * Read without swap_slots_cache_mutex, so a stale answer is possible:
+ * users check again under the lock of the cache they are about to fill.
+ */
+static inline bool use_swap_slot_cache(void)
+{
+	return swap_slot_cache_active && swap_slot_cache_enabled;
+}
+
+static void drain_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	if (cache->nr) {
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+	}
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	if (cache->n_ret) {
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	spin_unlock(&cache->free_lock);
+}
+
+/*
+ * Called with swap_slots_cache_mutex held, after clearing one of the flags
+ * use_swap_slot_cache() tests: a task that saw it still set before taking
+ * a cache's lock has done with the cache by the time it is drained here.
+ */
+static void drain_all_slots_caches(void)
+{
+	unsigned int cpu;
+
+	/* offline cpus too: a task may have been preempted off one */
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+}
+
+/*
+ * Activate or deactivate the caches according to free swap.  swapoff
+ * holds swap_slots_cache_mutex for long, and leaves the caches disabled
+ * meanwhile: no need to wait for it then.
+ */
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled)
+		return false;
+
+	pages = nr_swap_pages;
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() * SWAP_SLOTS_CACHE_ACTIVATE &&
+		    mutex_trylock(&swap_slots_cache_mutex)) {
+			swap_slot_cache_active = true;
+			mutex_unlock(&swap_slots_cache_mutex);
+		}
+	} else if (pages < num_online_cpus() * SWAP_SLOTS_CACHE_DEACTIVATE &&
+		   mutex_trylock(&swap_slots_cache_mutex)) {
+		swap_slot_cache_active = false;
+		drain_all_slots_caches();
+		mutex_unlock(&swap_slots_cache_mutex);
+	}
+
+	return use_swap_slot_cache();
+}
+
+/**
+ * get_swap_page - allocate a swap entry for the swap cache
+ *
+ * Returns an entry marked SWAP_HAS_CACHE, or an entry of 0 if there is
+ * no free swap.  May sleep.
+ */
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	entry.val = 0;
+
+	if (check_cache_active()) {
+		/*
+		 * We may be preempted and move to another cpu while using
+		 * this one's cache: alloc_lock keeps that correct.
+		 */
+		cache = __this_cpu_ptr(&swp_slots);
+
+		mutex_lock(&cache->alloc_lock);
+		if (!cache->nr && use_swap_slot_cache()) {
+			cache->cur = 0;
+			cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
+						   cache->slots);
+		}
+		if (cache->nr) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+		}
+		mutex_unlock(&cache->alloc_lock);
+
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+	return entry;
+}
+
+/**
+ * free_swap_slot - give back a swap slot nothing references any more
+ * @entry: the slot, reserved as SWAP_HAS_CACHE by swap_entry_free()
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	if (use_swap_slot_cache()) {
+		cache = __this_cpu_ptr(&swp_slots);
+
+		spin_lock(&cache->free_lock);
+		if (use_swap_slot_cache()) {
+			if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE) {
+				swapcache_free_entries(cache->slots_ret,
+						       cache->n_ret);
+				cache->n_ret = 0;
+			}
+			cache->slots_ret[cache->n_ret++] = entry;
+			spin_unlock(&cache->free_lock);
+			return;
+		}
+		spin_unlock(&cache->free_lock);
+	}
+
+	swapcache_free_entries(&entry, 1);
+}
+
+/*
+ * swapoff: drain the caches, and keep them unused until
+ * reenable_swap_slots_cache_unlock().
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_enabled = false;
+	drain_all_slots_caches();
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					     unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+	return 0;
+}
+subsys_initcall(swap_slots_init);
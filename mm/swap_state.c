@@ -314,6 +314,14 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	/* seems racy */
 			radix_tree_preload_end();
+			/*
+			 * Unless nothing references the entry: then it may be
+			 * held in a per-cpu swap slots cache, where no page
+			 * will ever show up for it.  Only readahead gets here
+			 * for such an entry, and can do without it.
+			 */
+			if (!__swap_count(entry) && swap_slot_cache_enabled)
+				break;
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
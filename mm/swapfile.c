@@ -31,6 +31,7 @@
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
 #include <linux/poll.h>
+#include <linux/frontswap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -42,6 +43,12 @@ static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 static void free_swap_count_continuations(struct swap_info_struct *);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
 
+/*
+ * swap_lock protects swap_list, the swap_info_structs and their allocation
+ * state, nr_swap_pages and total_swap_pages.  Reference counts in swap_map
+ * are changed under the lock of their cluster instead, see lock_cluster();
+ * slots only change between free and in use under both.
+ */
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
 long nr_swap_pages;
@@ -63,11 +70,29 @@ static DECLARE_WAIT_QUEUE_HEAD(proc_poll_wait);
 /* Activity counter to indicate that a swapon or swapoff has occurred */
 static atomic_t proc_poll_event = ATOMIC_INIT(0);
 
+#define SWAPFILE_CLUSTER	256
+#define LATENCY_LIMIT		256
+
 static inline unsigned char swap_count(unsigned char ent)
 {
 	return ent & ~SWAP_HAS_CACHE;	/* may include SWAP_HAS_CONT flag */
 }
 
+static inline struct swap_cluster_info *lock_cluster(
+		struct swap_info_struct *si, unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	ci = si->cluster_info + offset / SWAPFILE_CLUSTER;
+	spin_lock(&ci->lock);
+	return ci;
+}
+
+static inline void unlock_cluster(struct swap_cluster_info *ci)
+{
+	spin_unlock(&ci->lock);
+}
+
 /* returns 1 if swap entry is freed */
 static int
 __try_to_reclaim_swap(struct swap_info_struct *si, unsigned long offset)
@@ -209,12 +234,53 @@ static int wait_for_discard(void *word)
 	return 0;
 }
 
-#define SWAPFILE_CLUSTER	256
-#define LATENCY_LIMIT		256
+/*
+ * Find a slot in the cluster this cpu allocates from, or else start on a
+ * new free cluster.  Returns 0 when no cluster is entirely free.  A free
+ * cluster is one whose slots are all free, as the count kept in its
+ * swap_cluster_info tells without looking at swap_map.
+ */
+static unsigned long scan_swap_cluster(struct swap_info_struct *si)
+{
+	struct percpu_cluster *cluster = this_cpu_ptr(si->percpu_cluster);
+	unsigned long nr_clusters = DIV_ROUND_UP(si->max, SWAPFILE_CLUSTER);
+	unsigned long offset, idx, i;
+
+	for (offset = cluster->next; offset < cluster->end; offset++) {
+		if (!si->swap_map[offset]) {
+			cluster->next = offset + 1;
+			return offset;
+		}
+	}
+
+	/*
+	 * Look for a free cluster from where allocation last went, so that
+	 * it moves all over the device, as the SSD case below does.
+	 */
+	idx = si->cluster_next / SWAPFILE_CLUSTER;
+	for (i = 0; i < nr_clusters; i++, idx++) {
+		if (idx >= nr_clusters)
+			idx = 0;
+		if (!si->cluster_info[idx].count)
+			break;
+	}
+	if (i == nr_clusters) {
+		cluster->next = cluster->end = 0;
+		return 0;
+	}
+
+	/* cluster 0 holds the header, so offset can't be 0 here */
+	offset = idx * SWAPFILE_CLUSTER;
+	cluster->next = offset + 1;
+	cluster->end = min_t(unsigned long, offset + SWAPFILE_CLUSTER,
+			     si->max);
+	return offset;
+}
 
 static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 					  unsigned char usage)
 {
+	struct swap_cluster_info *ci;
 	unsigned long offset;
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
@@ -235,6 +301,12 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	if (si->percpu_cluster) {
+		/* else no free cluster is left: take the first free slot */
+		offset = scan_swap_cluster(si) ? : scan_base;
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -344,7 +416,10 @@ checks:
 		si->lowest_bit = si->max;
 		si->highest_bit = 0;
 	}
+	ci = lock_cluster(si, offset);
+	ci->count++;
 	si->swap_map[offset] = usage;
+	unlock_cluster(ci);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
@@ -441,17 +516,25 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to n swap entries for the swap cache, returning how many
+ * were.  get_swap_page() gets them a batch at a time for its per-cpu
+ * caches, consecutive slots as far as possible.
+ */
+int get_swap_pages(int n, swp_entry_t entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int nr = 0;
 
 	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (n > nr_swap_pages)
+		n = nr_swap_pages;
+	nr_swap_pages -= n;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -469,18 +552,17 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
-		}
+		while (nr < n && (offset = scan_swap_map(si, SWAP_HAS_CACHE)))
+			entries[nr++] = swp_entry(type, offset);
+		if (nr == n)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n - nr;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return nr;
 }
 
 /* The only caller of this function is now susupend routine */
@@ -523,7 +605,6 @@ static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
 	return p;
 
 bad_free:
@@ -541,6 +622,11 @@ out:
 	return NULL;
 }
 
+/*
+ * Drop a reference to a swap entry, with its cluster locked.  Returns the
+ * usage left: when none is, the slot stays reserved as SWAP_HAS_CACHE and
+ * the caller hands it to free_swap_slot() once the cluster is unlocked.
+ */
 static unsigned char swap_entry_free(struct swap_info_struct *p,
 				     swp_entry_t entry, unsigned char usage)
 {
@@ -575,28 +661,55 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 		mem_cgroup_uncharge_swap(entry);
 
 	usage = count | has_cache;
-	p->swap_map[offset] = usage;
-
-	/* free if no reference */
-	if (!usage) {
-		struct gendisk *disk = p->bdev->bd_disk;
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (swap_list.next >= 0 &&
-		    p->prio > swap_info[swap_list.next]->prio)
-			swap_list.next = p->type;
-		nr_swap_pages++;
-		p->inuse_pages--;
-		if ((p->flags & SWP_BLKDEV) &&
-				disk->fops->swap_slot_free_notify)
-			disk->fops->swap_slot_free_notify(p->bdev, offset);
-	}
+	p->swap_map[offset] = usage ? : SWAP_HAS_CACHE;
 
 	return usage;
 }
 
+/*
+ * Return a slot reserved by swap_entry_free() or get_swap_pages() to the
+ * free slots.  Called with swap_lock held.
+ */
+static void swap_slot_free(struct swap_info_struct *p, unsigned long offset)
+{
+	struct gendisk *disk = p->bdev->bd_disk;
+	struct swap_cluster_info *ci;
+
+	ci = lock_cluster(p, offset);
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	ci->count--;
+	unlock_cluster(ci);
+
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	if (swap_list.next >= 0 &&
+	    p->prio > swap_info[swap_list.next]->prio)
+		swap_list.next = p->type;
+	nr_swap_pages++;
+	p->inuse_pages--;
+	frontswap_flush_page(p, offset);
+	if ((p->flags & SWP_BLKDEV) &&
+			disk->fops->swap_slot_free_notify)
+		disk->fops->swap_slot_free_notify(p->bdev, offset);
+}
+
+/*
+ * Free a batch of reserved swap slots, taking swap_lock once.
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	int i;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_slot_free(swap_info[swp_type(entries[i])],
+			       swp_offset(entries[i]));
+	spin_unlock(&swap_lock);
+}
+
 /*
  * Caller has made sure that the swapdevice corresponding to entry
  * is still around or has not been recycled.
@@ -604,11 +717,16 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
+	unsigned char usage;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
-		spin_unlock(&swap_lock);
+		ci = lock_cluster(p, swp_offset(entry));
+		usage = swap_entry_free(p, entry, 1);
+		unlock_cluster(ci);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
@@ -618,17 +736,32 @@ void swap_free(swp_entry_t entry)
 void swapcache_free(swp_entry_t entry, struct page *page)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	unsigned char count;
 
 	p = swap_info_get(entry);
 	if (p) {
+		ci = lock_cluster(p, swp_offset(entry));
 		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
-		spin_unlock(&swap_lock);
+		unlock_cluster(ci);
+		if (!count)
+			free_swap_slot(entry);
 	}
 }
 
+/*
+ * The swap count of an entry, without the SWAP_HAS_CACHE flag: a racy
+ * snapshot, for callers that only need a hint.
+ */
+int __swap_count(swp_entry_t entry)
+{
+	struct swap_info_struct *si = swap_info[swp_type(entry)];
+
+	return swap_count(si->swap_map[swp_offset(entry)]);
+}
+
 /*
  * How many references to page are currently swapped out?
  * This does not give an exact answer when swap count is continued,
@@ -638,13 +771,15 @@ static inline int page_swapcount(struct page *page)
 {
 	int count = 0;
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	swp_entry_t entry;
 
 	entry.val = page_private(page);
 	p = swap_info_get(entry);
 	if (p) {
+		ci = lock_cluster(p, swp_offset(entry));
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		unlock_cluster(ci);
 	}
 	return count;
 }
@@ -718,21 +853,27 @@ int try_to_free_swap(struct page *page)
 int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	struct page *page = NULL;
+	unsigned char usage;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, 1) == SWAP_HAS_CACHE) {
+		ci = lock_cluster(p, swp_offset(entry));
+		usage = swap_entry_free(p, entry, 1);
+		unlock_cluster(ci);
+		if (!usage)
+			free_swap_slot(entry);
+		else if (usage == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
 	}
 	if (page) {
 		/*
@@ -765,6 +906,7 @@ int mem_cgroup_count_swap_user(swp_entry_t ent, struct page **pagep)
 {
 	struct page *page;
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	int count = 0;
 
 	page = find_get_page(&swapper_space, ent.val);
@@ -772,8 +914,9 @@ int mem_cgroup_count_swap_user(swp_entry_t ent, struct page **pagep)
 		count += page_mapcount(page);
 	p = swap_info_get(ent);
 	if (p) {
+		ci = lock_cluster(p, swp_offset(ent));
 		count += swap_count(p->swap_map[swp_offset(ent)]);
-		spin_unlock(&swap_lock);
+		unlock_cluster(ci);
 	}
 
 	*pagep = page;
@@ -964,7 +1107,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		/* transparent hugepages are never swapped: skip them */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
@@ -1360,6 +1504,18 @@ sector_t map_swap_page(struct page *page, struct block_device **bdev)
 	return map_swap_entry(entry, bdev);
 }
 
+/*
+ * The swap area of a page in the swap cache.
+ */
+struct swap_info_struct *page_swap_info(struct page *page)
+{
+	swp_entry_t entry;
+
+	VM_BUG_ON(!PageSwapCache(page));
+	entry.val = page_private(page);
+	return swap_info[swp_type(entry)];
+}
+
 /*
  * Free all of a swapdev's extent information
  */
@@ -1552,6 +1708,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster __percpu *percpu_cluster;
+	unsigned long *frontswap_map;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1614,10 +1773,19 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	/*
+	 * Slots held in the per-cpu caches would look in use to
+	 * try_to_unuse(): release them, and keep them from being cached
+	 * again until it is done.
+	 */
+	disable_swap_slots_cache_lock();
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
 
+	reenable_swap_slots_cache_unlock();
+
 	if (err) {
 		/* re-insert swap space back into swap_list */
 		spin_lock(&swap_lock);
@@ -1648,6 +1816,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	destroy_swap_extents(p);
 	if (p->flags & SWP_CONTINUED)
 		free_swap_count_continuations(p);
+	frontswap_flush_area(p);
 
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
@@ -1661,15 +1830,29 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		spin_lock(&swap_lock);
 	}
 
+	/* and for __swap_duplicate(), which only checks max under RCU */
+	p->max = 0;
+	spin_unlock(&swap_lock);
+	synchronize_rcu();
+	spin_lock(&swap_lock);
+
 	swap_file = p->swap_file;
 	p->swap_file = NULL;
-	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
+	frontswap_map = frontswap_map_get(p);
+	frontswap_map_set(p, NULL);
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
+	vfree(frontswap_map);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1864,6 +2047,10 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages;
 	unsigned long swapfilepages;
 	unsigned char *swap_map = NULL;
+	struct swap_cluster_info *cluster_info = NULL;
+	struct percpu_cluster __percpu *percpu_cluster = NULL;
+	unsigned long *frontswap_map = NULL;
+	unsigned long nr_clusters, offset;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -2086,6 +2273,21 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		goto bad_swap;
 	}
 
+	nr_clusters = DIV_ROUND_UP(p->max, SWAPFILE_CLUSTER);
+	cluster_info = vmalloc(nr_clusters * sizeof(*cluster_info));
+	if (!cluster_info) {
+		error = -ENOMEM;
+		goto bad_swap;
+	}
+	for (offset = 0; offset < nr_clusters; offset++) {
+		spin_lock_init(&cluster_info[offset].lock);
+		cluster_info[offset].count = 0;
+	}
+	/* the header and bad pages count as in use */
+	for (offset = 0; offset < p->max; offset++)
+		if (swap_map[offset])
+			cluster_info[offset / SWAPFILE_CLUSTER].count++;
+
 	if (p->bdev) {
 		if (blk_queue_nonrot(bdev_get_queue(p->bdev))) {
 			p->flags |= SWP_SOLIDSTATE;
@@ -2095,6 +2297,26 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	/*
+	 * Where seeks are cheap, let each cpu allocate from a cluster of
+	 * its own.  Not with discard, whose handling in scan_swap_map()
+	 * relies on all allocations going through its cluster search.
+	 */
+	if ((p->flags & (SWP_SOLIDSTATE | SWP_DISCARDABLE)) == SWP_SOLIDSTATE) {
+		percpu_cluster = alloc_percpu(struct percpu_cluster);
+		if (!percpu_cluster) {
+			error = -ENOMEM;
+			goto bad_swap;
+		}
+	}
+	spin_lock_init(&p->cont_lock);
+
+	/* without its map, the area simply does without frontswap */
+	if (frontswap_enabled)
+		frontswap_map = vzalloc(BITS_TO_LONGS(p->max) * sizeof(long));
+	frontswap_map_set(p, frontswap_map);
+	frontswap_init(p);
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -2103,6 +2325,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
+	p->cluster_info = cluster_info;
+	p->percpu_cluster = percpu_cluster;
 	p->flags |= SWP_WRITEOK;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
@@ -2146,6 +2370,8 @@ bad_swap_2:
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -2194,6 +2420,7 @@ void si_swapinfo(struct sysinfo *val)
 static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	unsigned long offset, type;
 	unsigned char count;
 	unsigned char has_cache;
@@ -2208,9 +2435,15 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	p = swap_info[type];
 	offset = swp_offset(entry);
 
-	spin_lock(&swap_lock);
+	/*
+	 * swapcache_prepare() may race with swapoff of a stale entry's area:
+	 * swapoff clears max, then waits for an RCU grace period before it
+	 * tears down swap_map and cluster_info.
+	 */
+	rcu_read_lock();
 	if (unlikely(offset >= p->max))
-		goto unlock_out;
+		goto rcu_out;
+	ci = lock_cluster(p, offset);
 
 	count = p->swap_map[offset];
 	has_cache = count & SWAP_HAS_CACHE;
@@ -2242,8 +2475,9 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 
 	p->swap_map[offset] = count | has_cache;
 
-unlock_out:
-	spin_unlock(&swap_lock);
+	unlock_cluster(ci);
+rcu_out:
+	rcu_read_unlock();
 out:
 	return err;
 
@@ -2360,6 +2594,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 {
 	struct swap_info_struct *si;
+	struct swap_cluster_info *ci;
 	struct page *head;
 	struct page *page;
 	struct page *list_page;
@@ -2382,7 +2617,11 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 		goto outer;
 	}
 
+	/* swap_lock for si->flags, the cluster for the count */
+	spin_lock(&swap_lock);
 	offset = swp_offset(entry);
+	ci = lock_cluster(si, offset);
+	spin_lock(&si->cont_lock);
 	count = si->swap_map[offset] & ~SWAP_HAS_CACHE;
 
 	if ((count & ~COUNT_CONTINUED) != SWAP_MAP_MAX) {
@@ -2395,6 +2634,8 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	}
 
 	if (!page) {
+		spin_unlock(&si->cont_lock);
+		unlock_cluster(ci);
 		spin_unlock(&swap_lock);
 		return -ENOMEM;
 	}
@@ -2443,6 +2684,8 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	list_add_tail(&page->lru, &head->lru);
 	page = NULL;			/* now it's attached, don't free it */
 out:
+	spin_unlock(&si->cont_lock);
+	unlock_cluster(ci);
 	spin_unlock(&swap_lock);
 outer:
 	if (page)
@@ -2456,7 +2699,8 @@ outer:
  * into, carry if so, or else fail until a new continuation page is allocated;
  * when the original swap_map count is decremented from 0 with continuation,
  * borrow from the continuation and report whether it still holds more.
- * Called while __swap_duplicate() or swap_entry_free() holds swap_lock.
+ * Called while __swap_duplicate() or swap_entry_free() holds the cluster lock;
+ * the continuation list is shared with other clusters, under si->cont_lock.
  */
 static bool swap_count_continued(struct swap_info_struct *si,
 				 pgoff_t offset, unsigned char count)
@@ -2464,6 +2708,7 @@ static bool swap_count_continued(struct swap_info_struct *si,
 	struct page *head;
 	struct page *page;
 	unsigned char *map;
+	bool ret;
 
 	head = vmalloc_to_page(si->swap_map + offset);
 	if (page_private(head) != SWP_CONTINUED) {
@@ -2471,6 +2716,7 @@ static bool swap_count_continued(struct swap_info_struct *si,
 		return false;		/* need to add count continuation */
 	}
 
+	spin_lock(&si->cont_lock);
 	offset &= ~PAGE_MASK;
 	page = list_entry(head->lru.next, struct page, lru);
 	map = kmap_atomic(page, KM_USER0) + offset;
@@ -2491,8 +2737,10 @@ static bool swap_count_continued(struct swap_info_struct *si,
 		if (*map == SWAP_CONT_MAX) {
 			kunmap_atomic(map, KM_USER0);
 			page = list_entry(page->lru.next, struct page, lru);
-			if (page == head)
-				return false;	/* add count continuation */
+			if (page == head) {
+				ret = false;	/* add count continuation */
+				goto out;
+			}
 			map = kmap_atomic(page, KM_USER0) + offset;
 init_map:		*map = 0;		/* we didn't zero the page */
 		}
@@ -2505,7 +2753,7 @@ init_map:		*map = 0;		/* we didn't zero the page */
 			kunmap_atomic(map, KM_USER0);
 			page = list_entry(page->lru.prev, struct page, lru);
 		}
-		return true;			/* incremented */
+		ret = true;			/* incremented */
 
 	} else {				/* decrementing */
 		/*
@@ -2531,8 +2779,11 @@ init_map:		*map = 0;		/* we didn't zero the page */
 			kunmap_atomic(map, KM_USER0);
 			page = list_entry(page->lru.prev, struct page, lru);
 		}
-		return count == COUNT_CONTINUED;
+		ret = count == COUNT_CONTINUED;
 	}
+out:
+	spin_unlock(&si->cont_lock);
+	return ret;
 }
 
 /*
@@ -98,6 +98,12 @@ struct scan_control {
 	 * are scanned.
 	 */
 	nodemask_t	*nodemask;
+
+	/*
+	 * kswapd: the number of threads reclaiming the node, each of which
+	 * scans its share of every LRU list.  0 for other reclaimers.
+	 */
+	int nr_kswapd;
 };
 
 #define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
@@ -136,6 +142,13 @@ struct scan_control {
 int vm_swappiness = 60;
 long vm_total_pages;	/* The total number of pages which the VM controls */
 
+/*
+ * kswapd threads per node, from 1 .. MAX_KSWAPD_THREADS.  kswapd_lock
+ * serializes starting and stopping them.
+ */
+int kswapd_threads = 1;
+static DEFINE_MUTEX(kswapd_lock);
+
 static LIST_HEAD(shrinker_list);
 static DECLARE_RWSEM(shrinker_rwsem);
 
@@ -1799,6 +1812,8 @@ out:
 			scan >>= priority;
 			scan = div64_u64(scan * fraction[file], denominator);
 		}
+		if (sc->nr_kswapd > 1)
+			scan = DIV_ROUND_UP(scan, sc->nr_kswapd);
 		nr[l] = nr_scan_try_batch(scan,
 					  &reclaim_stat->nr_saved_scan[l]);
 	}
@@ -2030,6 +2045,7 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask)
 {
 	unsigned long nr_reclaimed;
+	ktime_t start;
 	struct scan_control sc = {
 		.gfp_mask = gfp_mask,
 		.may_writepage = !laptop_mode,
@@ -2046,7 +2062,10 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				sc.may_writepage,
 				gfp_mask);
 
+	start = ktime_get();
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
+	count_vm_events(ALLOCSTALL_USECS,
+			ktime_us_delta(ktime_get(), start));
 
 	trace_mm_vmscan_direct_reclaim_end(nr_reclaimed);
 
@@ -2153,7 +2172,8 @@ static int sleeping_prematurely(pg_data_t *pgdat, int order, long remaining)
 
 /*
  * For kswapd, balance_pgdat() will work across all this node's zones until
- * they are all at high_wmark_pages(zone).
+ * they are all at high_wmark_pages(zone).  All the node's kswapd threads
+ * do so at the same time, each scanning its share of every LRU list.
  *
  * Returns the number of pages which were actually freed.
  *
@@ -2193,6 +2213,7 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order)
 		.mem_cgroup = NULL,
 	};
 loop_again:
+	sc.nr_kswapd = pgdat->nr_kswapd;
 	total_scanned = 0;
 	sc.nr_reclaimed = 0;
 	sc.may_writepage = !laptop_mode;
@@ -2387,7 +2408,8 @@ out:
 static int kswapd(void *p)
 {
 	unsigned long order;
-	pg_data_t *pgdat = (pg_data_t*)p;
+	struct kswapd_thread *kt = p;
+	pg_data_t *pgdat = kt->pgdat;
 	struct task_struct *tsk = current;
 	DEFINE_WAIT(wait);
 	struct reclaim_state reclaim_state = {
@@ -2422,8 +2444,8 @@ static int kswapd(void *p)
 		int ret;
 
 		prepare_to_wait(&pgdat->kswapd_wait, &wait, TASK_INTERRUPTIBLE);
-		new_order = pgdat->kswapd_max_order;
-		pgdat->kswapd_max_order = 0;
+		new_order = kt->max_order;
+		kt->max_order = 0;
 		if (order < new_order) {
 			/*
 			 * Don't sleep if someone wants a larger 'order'
@@ -2459,7 +2481,7 @@ static int kswapd(void *p)
 				}
 			}
 
-			order = pgdat->kswapd_max_order;
+			order = kt->max_order;
 		}
 		finish_wait(&pgdat->kswapd_wait, &wait);
 
@@ -2472,19 +2494,24 @@ static int kswapd(void *p)
 		 * after returning from the refrigerator
 		 */
 		if (!ret) {
+			ktime_t start = ktime_get();
+
 			trace_mm_vmscan_kswapd_wake(pgdat->node_id, order);
 			balance_pgdat(pgdat, order);
+			count_vm_events(KSWAPD_RUN_USECS,
+					ktime_us_delta(ktime_get(), start));
 		}
 	}
 	return 0;
 }
 
 /*
- * A zone is low on free memory, so wake its kswapd task to service it.
+ * A zone is low on free memory, so wake its kswapd threads to service it.
  */
 void wakeup_kswapd(struct zone *zone, int order)
 {
 	pg_data_t *pgdat;
+	int i;
 
 	if (!populated_zone(zone))
 		return;
@@ -2492,8 +2519,9 @@ void wakeup_kswapd(struct zone *zone, int order)
 	if (!cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))
 		return;
 	pgdat = zone->zone_pgdat;
-	if (pgdat->kswapd_max_order < order)
-		pgdat->kswapd_max_order = order;
+	for (i = 0; i < pgdat->nr_kswapd; i++)
+		if (pgdat->kswapd[i].max_order < order)
+			pgdat->kswapd[i].max_order = order;
 	if (!waitqueue_active(&pgdat->kswapd_wait))
 		return;
 	if (zone_watermark_ok_safe(zone, order, low_wmark_pages(zone), 0, 0))
@@ -2586,9 +2614,10 @@ unsigned long shrink_all_memory(unsigned long nr_to_reclaim)
 static int __devinit cpu_callback(struct notifier_block *nfb,
 				  unsigned long action, void *hcpu)
 {
-	int nid;
+	int nid, i;
 
 	if (action == CPU_ONLINE || action == CPU_ONLINE_FROZEN) {
+		mutex_lock(&kswapd_lock);
 		for_each_node_state(nid, N_HIGH_MEMORY) {
 			pg_data_t *pgdat = NODE_DATA(nid);
 			const struct cpumask *mask;
@@ -2597,31 +2626,61 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 
 			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
 				/* One of our CPUs online: restore mask */
-				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+				for (i = 0; i < pgdat->nr_kswapd; i++)
+					set_cpus_allowed_ptr(
+						pgdat->kswapd[i].task, mask);
 		}
+		mutex_unlock(&kswapd_lock);
 	}
 	return NOTIFY_OK;
 }
 
+/* Called with kswapd_lock held */
+static void kswapd_stop_one(pg_data_t *pgdat)
+{
+	struct kswapd_thread *kt = &pgdat->kswapd[pgdat->nr_kswapd - 1];
+
+	/* the others take over its share from their next pass */
+	pgdat->nr_kswapd--;
+	kthread_stop(kt->task);
+	kt->task = NULL;
+}
+
 /*
  * This kswapd start function will be called by init and node-hot-add.
  * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
+ * It also starts or stops threads to leave kswapd_threads running.
  */
 int kswapd_run(int nid)
 {
 	pg_data_t *pgdat = NODE_DATA(nid);
 	int ret = 0;
 
-	if (pgdat->kswapd)
-		return 0;
+	mutex_lock(&kswapd_lock);
+	while (pgdat->nr_kswapd < kswapd_threads) {
+		struct kswapd_thread *kt = &pgdat->kswapd[pgdat->nr_kswapd];
 
-	pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
-	if (IS_ERR(pgdat->kswapd)) {
-		/* failure at boot is fatal */
-		BUG_ON(system_state == SYSTEM_BOOTING);
-		printk("Failed to start kswapd on node %d\n",nid);
-		ret = -1;
+		kt->pgdat = pgdat;
+		kt->id = pgdat->nr_kswapd;
+		kt->max_order = 0;
+		if (!kt->id)
+			kt->task = kthread_run(kswapd, kt, "kswapd%d", nid);
+		else
+			kt->task = kthread_run(kswapd, kt, "kswapd%d:%d",
+					       nid, kt->id);
+		if (IS_ERR(kt->task)) {
+			/* failure at boot is fatal */
+			BUG_ON(system_state == SYSTEM_BOOTING);
+			printk("Failed to start kswapd on node %d\n",nid);
+			kt->task = NULL;
+			ret = -1;
+			break;
+		}
+		pgdat->nr_kswapd++;
 	}
+	while (pgdat->nr_kswapd > kswapd_threads)
+		kswapd_stop_one(pgdat);
+	mutex_unlock(&kswapd_lock);
 	return ret;
 }
 
@@ -2630,10 +2689,33 @@ int kswapd_run(int nid)
  */
 void kswapd_stop(int nid)
 {
-	struct task_struct *kswapd = NODE_DATA(nid)->kswapd;
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	mutex_lock(&kswapd_lock);
+	while (pgdat->nr_kswapd)
+		kswapd_stop_one(pgdat);
+	mutex_unlock(&kswapd_lock);
+}
+
+/*
+ * kswapd_threads - the number of kswapd threads reclaiming each node.
+ * Threads are started or stopped on all nodes with memory to match.
+ */
+int kswapd_threads_sysctl_handler(ctl_table *table, int write,
+				  void __user *buffer, size_t *length,
+				  loff_t *ppos)
+{
+	int nid, ret;
 
-	if (kswapd)
-		kthread_stop(kswapd);
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!write || ret < 0)
+		return ret;
+
+	lock_memory_hotplug();
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kswapd_run(nid);
+	unlock_memory_hotplug();
+	return 0;
 }
 
 static int __init kswapd_init(void)
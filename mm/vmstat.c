@@ -412,7 +412,7 @@ void refresh_cpu_vm_stats(int cpu)
 		 * Check if there are pages remaining in this pageset
 		 * if not then there is nothing to expire.
 		 */
-		if (!p->expire || !p->pcp.count)
+		if (!p->expire || !pcp_pages(&p->pcp))
 			continue;
 
 		/*
@@ -427,8 +427,7 @@ void refresh_cpu_vm_stats(int cpu)
 		if (p->expire)
 			continue;
 
-		if (p->pcp.count)
-			drain_zone_pages(zone, &p->pcp);
+		drain_zone_pages(zone, &p->pcp);
 #endif
 	}
 
@@ -816,6 +815,7 @@ static const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"nr_anon_transparent_hugepages",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -839,6 +839,12 @@ static const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pcp_order1_hit",
+	"pcp_order2_hit",
+	"pcp_order3_hit",
+	"pcp_order1_refill",
+	"pcp_order2_refill",
+	"pcp_order3_refill",
 
 	"pgfault",
 	"pgmajfault",
@@ -860,6 +866,8 @@ static const char * const vmstat_text[] = {
 	"kswapd_skip_congestion_wait",
 	"pageoutrun",
 	"allocstall",
+	"kswapd_run_usecs",
+	"allocstall_usecs",
 
 	"pgrotated",
 
@@ -884,6 +892,14 @@ static const char * const vmstat_text[] = {
 	"unevictable_pgs_cleared",
 	"unevictable_pgs_stranded",
 	"unevictable_pgs_mlockfreed",
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	"thp_fault_alloc",
+	"thp_fault_fallback",
+	"thp_collapse_alloc",
+	"thp_collapse_alloc_failed",
+	"thp_split",
+#endif
 #endif
 };
 
@@ -922,6 +938,7 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		   "\n  pagesets");
 	for_each_online_cpu(i) {
 		struct per_cpu_pageset *pageset;
+		int order;
 
 		pageset = per_cpu_ptr(zone->pageset, i);
 		seq_printf(m,
@@ -933,6 +950,10 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
 			   pageset->pcp.batch);
+		seq_printf(m, "\n              orders:");
+		for (order = 1; order <= PCP_MAX_ORDER; order++)
+			seq_printf(m, " %i",
+				   pageset->pcp.orders[order - 1].count);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
@@ -0,0 +1,777 @@
+/*
+ *  linux/mm/zcache.c
+ *
+ *  A compressed in-memory cache behind cleancache and frontswap.
+ *
+ *  Pages put are compressed with LZO into a per-cpu buffer, then stored
+ *  in "zbud" pages: each zbud page holds at most two compressed pages,
+ *  one packed after its header from the start, one from the end.  Pages
+ *  with a single buddy sit on unbuddied lists by free space, and a new
+ *  compressed page goes to the one which leaves least space over, so that
+ *  freeing a zbud page never means moving data around.
+ *
+ *  Cleancache pages are ephemeral: they are kept on an LRU list, and the
+ *  oldest are dropped when the cache reaches max_pool_percent of memory,
+ *  or when the shrinker is asked for memory.  Frontswap pages are the only
+ *  copy of their data, so they are persistent: kept until frontswap flushes
+ *  them, their puts refused once nothing ephemeral is left to drop.
+ *
+ *  Everything is under zcache_lock, taken with interrupts disabled since
+ *  cleancache puts come under the mapping's tree_lock.  Compression and
+ *  decompression are done outside it, in per-cpu buffers.  Pages are named by
+ *  pool, object (an inode number, 0 for swap) and index: each pool has an
+ *  rbtree of objects, each object a radix tree of entries.
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/highmem.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/lzo.h>
+#include <linux/swap.h>
+#include <linux/cleancache.h>
+#include <linux/frontswap.h>
+
+/*
+ * Allocations with interrupts disabled, on behalf of reclaim: never wait,
+ * never dip into the emergency reserves, and fail quietly.
+ */
+#define ZCACHE_GFP_MASK \
+	(GFP_NOWAIT | __GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC)
+
+/* Pages compressing worse than this go to disk, or nowhere */
+#define ZCACHE_MAX_SIZE		(PAGE_SIZE * 3 / 4)
+
+#define ZCACHE_MAX_CLEANCACHE_POOLS	32
+
+#define ZBUD_CHUNK_SHIFT	6
+#define ZBUD_CHUNK_SIZE		(1 << ZBUD_CHUNK_SHIFT)
+#define ZBUD_NR_CHUNKS		(PAGE_SIZE >> ZBUD_CHUNK_SHIFT)
+
+/* Header of a zbud page, in its first chunk */
+struct zbud_page {
+	struct list_head list;		/* unbuddied, if one buddy is free */
+	unsigned short size[2];		/* bytes of first and last, or 0 */
+};
+
+struct zpool {
+	struct rb_root objects;
+	int ephemeral;			/* cleancache, not frontswap */
+};
+
+struct zobject {
+	struct rb_node rb_node;		/* in the pool's objects */
+	struct zpool *pool;
+	unsigned long oid;
+	struct radix_tree_root entries;
+	unsigned long nr_entries;
+};
+
+struct zentry {
+	struct list_head lru;		/* on zcache_lru, if ephemeral */
+	struct zobject *obj;
+	pgoff_t index;
+	struct zbud_page *zbpg;
+	int last;			/* packed at the end of zbpg */
+};
+
+static DEFINE_SPINLOCK(zcache_lock);
+
+static struct list_head zbud_unbuddied[ZBUD_NR_CHUNKS];
+static LIST_HEAD(zcache_lru);		/* ephemeral entries, oldest first */
+
+static struct kmem_cache *zcache_object_cache;
+static struct kmem_cache *zcache_entry_cache;
+
+static unsigned int zcache_max_pool_percent = 20;
+static unsigned long zcache_max_pool_pages;
+
+/* Statistics, under zcache_lock */
+static unsigned long zcache_pool_pages;
+static unsigned long zcache_ephemeral_pages;
+static unsigned long zcache_persistent_pages;
+static unsigned long zcache_cleancache_hits;
+static unsigned long zcache_cleancache_misses;
+static unsigned long zcache_evicted;
+static unsigned long zcache_poor_compression;
+static unsigned long zcache_put_failed;
+
+/* Per-cpu compression buffers, used with interrupts disabled */
+static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
+static DEFINE_PER_CPU(void *, zcache_workmem);
+
+static inline unsigned int zbud_chunks(unsigned int size)
+{
+	return DIV_ROUND_UP(size, ZBUD_CHUNK_SIZE);
+}
+
+/* Chunks left free in a zbud page by a buddy of @size bytes */
+static inline unsigned int zbud_free_chunks(unsigned int size)
+{
+	return ZBUD_NR_CHUNKS - 1 - zbud_chunks(size);
+}
+
+static inline void *zbud_data(struct zbud_page *zbpg, int last)
+{
+	if (last)
+		return (void *)zbpg + PAGE_SIZE -
+			(zbud_chunks(zbpg->size[1]) << ZBUD_CHUNK_SHIFT);
+	return (void *)zbpg + ZBUD_CHUNK_SIZE;
+}
+
+/*
+ * Find room for @size bytes: in the unbuddied page with the least space
+ * which is enough, else in a new page if the pool may grow.
+ */
+static struct zbud_page *zbud_alloc(unsigned int size, int *last)
+{
+	struct zbud_page *zbpg;
+	struct page *page;
+	unsigned int i;
+
+	for (i = zbud_chunks(size); i < ZBUD_NR_CHUNKS; i++) {
+		if (list_empty(&zbud_unbuddied[i]))
+			continue;
+		zbpg = list_first_entry(&zbud_unbuddied[i],
+					struct zbud_page, list);
+		list_del_init(&zbpg->list);
+		*last = !!zbpg->size[0];
+		zbpg->size[*last] = size;
+		return zbpg;
+	}
+
+	if (zcache_pool_pages >= zcache_max_pool_pages)
+		return NULL;
+	page = alloc_page(ZCACHE_GFP_MASK);
+	if (!page)
+		return NULL;
+	zcache_pool_pages++;
+
+	zbpg = page_address(page);
+	zbpg->size[0] = size;
+	zbpg->size[1] = 0;
+	list_add(&zbpg->list, &zbud_unbuddied[zbud_free_chunks(size)]);
+	*last = 0;
+	return zbpg;
+}
+
+static void zbud_free(struct zbud_page *zbpg, int last)
+{
+	unsigned int other;
+
+	zbpg->size[last] = 0;
+	other = zbpg->size[!last];
+	if (!other) {
+		list_del(&zbpg->list);
+		free_page((unsigned long)zbpg);
+		zcache_pool_pages--;
+	} else
+		list_add(&zbpg->list, &zbud_unbuddied[zbud_free_chunks(other)]);
+}
+
+static struct zobject *zcache_object_find(struct zpool *pool,
+					  unsigned long oid)
+{
+	struct rb_node *node = pool->objects.rb_node;
+	struct zobject *obj;
+
+	while (node) {
+		obj = rb_entry(node, struct zobject, rb_node);
+		if (oid < obj->oid)
+			node = node->rb_left;
+		else if (oid > obj->oid)
+			node = node->rb_right;
+		else
+			return obj;
+	}
+	return NULL;
+}
+
+/* Find the object @oid of @pool, creating it if need be */
+static struct zobject *zcache_object_get(struct zpool *pool,
+					 unsigned long oid)
+{
+	struct rb_node **link = &pool->objects.rb_node;
+	struct rb_node *parent = NULL;
+	struct zobject *obj;
+
+	while (*link) {
+		parent = *link;
+		obj = rb_entry(parent, struct zobject, rb_node);
+		if (oid < obj->oid)
+			link = &parent->rb_left;
+		else if (oid > obj->oid)
+			link = &parent->rb_right;
+		else
+			return obj;
+	}
+
+	obj = kmem_cache_alloc(zcache_object_cache, ZCACHE_GFP_MASK);
+	if (!obj)
+		return NULL;
+	obj->pool = pool;
+	obj->oid = oid;
+	INIT_RADIX_TREE(&obj->entries, ZCACHE_GFP_MASK);
+	obj->nr_entries = 0;
+	rb_link_node(&obj->rb_node, parent, link);
+	rb_insert_color(&obj->rb_node, &pool->objects);
+	return obj;
+}
+
+static void zcache_object_free(struct zobject *obj)
+{
+	rb_erase(&obj->rb_node, &obj->pool->objects);
+	kmem_cache_free(zcache_object_cache, obj);
+}
+
+/* Remove @entry, and its object with it if it was the last entry */
+static void zcache_entry_delete(struct zentry *entry)
+{
+	struct zobject *obj = entry->obj;
+
+	radix_tree_delete(&obj->entries, entry->index);
+	if (obj->pool->ephemeral) {
+		list_del(&entry->lru);
+		zcache_ephemeral_pages--;
+	} else
+		zcache_persistent_pages--;
+	zbud_free(entry->zbpg, entry->last);
+	kmem_cache_free(zcache_entry_cache, entry);
+
+	if (!--obj->nr_entries)
+		zcache_object_free(obj);
+}
+
+static void zcache_object_delete(struct zobject *obj)
+{
+	struct zentry *batch[16];
+	unsigned long nr = obj->nr_entries;
+	unsigned int i, n;
+
+	/* deleting the last entry frees obj: count down, don't look again */
+	while (nr) {
+		n = radix_tree_gang_lookup(&obj->entries, (void **)batch, 0,
+					   ARRAY_SIZE(batch));
+		for (i = 0; i < n; i++)
+			zcache_entry_delete(batch[i]);
+		nr -= n;
+	}
+}
+
+static struct zentry *zcache_entry_find(struct zpool *pool,
+					unsigned long oid, pgoff_t index)
+{
+	struct zobject *obj = zcache_object_find(pool, oid);
+
+	if (!obj)
+		return NULL;
+	return radix_tree_lookup(&obj->entries, index);
+}
+
+/* Drop the oldest ephemeral page: returns 0 if there was none */
+static int zcache_evict_one(void)
+{
+	if (list_empty(&zcache_lru))
+		return 0;
+	zcache_entry_delete(list_first_entry(&zcache_lru, struct zentry, lru));
+	zcache_evicted++;
+	return 1;
+}
+
+/*
+ * Store @size compressed bytes under (@pool, @oid, @index), which must
+ * be free, dropping old ephemeral pages to make room.
+ */
+static int zcache_store(struct zpool *pool, unsigned long oid,
+			pgoff_t index, void *data, unsigned int size)
+{
+	struct zbud_page *zbpg;
+	struct zobject *obj;
+	struct zentry *entry;
+	int last;
+
+	/* max_pool_percent may have been lowered */
+	while (zcache_pool_pages > zcache_max_pool_pages && zcache_evict_one())
+		;
+	while (!(zbpg = zbud_alloc(size, &last)))
+		if (!zcache_evict_one())
+			return -ENOMEM;
+	memcpy(zbud_data(zbpg, last), data, size);
+
+	entry = kmem_cache_alloc(zcache_entry_cache, ZCACHE_GFP_MASK);
+	if (!entry)
+		goto free_zbud;
+	obj = zcache_object_get(pool, oid);
+	if (!obj)
+		goto free_entry;
+	if (radix_tree_insert(&obj->entries, index, entry)) {
+		if (!obj->nr_entries)
+			zcache_object_free(obj);
+		goto free_entry;
+	}
+	obj->nr_entries++;
+
+	entry->obj = obj;
+	entry->index = index;
+	entry->zbpg = zbpg;
+	entry->last = last;
+	if (pool->ephemeral) {
+		list_add_tail(&entry->lru, &zcache_lru);
+		zcache_ephemeral_pages++;
+	} else
+		zcache_persistent_pages++;
+	return 0;
+
+free_entry:
+	kmem_cache_free(zcache_entry_cache, entry);
+free_zbud:
+	zbud_free(zbpg, last);
+	return -ENOMEM;
+}
+
+/*
+ * The operations below find their pool through @poolp under zcache_lock,
+ * which keeps it from being destroyed meanwhile.
+ */
+static int zcache_put(struct zpool **poolp, unsigned long oid,
+		      pgoff_t index, struct page *page)
+{
+	struct zpool *pool;
+	struct zentry *entry;
+	unsigned long flags;
+	unsigned char *dst;
+	size_t size;
+	void *src;
+	int ret;
+
+	/* with interrupts disabled, this cpu's buffers are ours */
+	local_irq_save(flags);
+	dst = __get_cpu_var(zcache_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &size,
+			       __get_cpu_var(zcache_workmem));
+	kunmap_atomic(src, KM_USER0);
+
+	spin_lock(&zcache_lock);
+	pool = *poolp;
+	if (!pool) {
+		ret = -1;
+		goto out;
+	}
+
+	/* whatever was stored under the same name is stale now */
+	entry = zcache_entry_find(pool, oid, index);
+	if (entry)
+		zcache_entry_delete(entry);
+
+	if (ret != LZO_E_OK || size > ZCACHE_MAX_SIZE) {
+		zcache_poor_compression++;
+		ret = -1;
+	} else if (zcache_store(pool, oid, index, dst, size)) {
+		zcache_put_failed++;
+		ret = -1;
+	}
+out:
+	spin_unlock(&zcache_lock);
+	local_irq_restore(flags);
+	return ret;
+}
+
+/* An ephemeral page is back in the page cache: it is dropped from here */
+static int zcache_get(struct zpool **poolp, unsigned long oid,
+		      pgoff_t index, struct page *page)
+{
+	struct zpool *pool;
+	struct zentry *entry = NULL;
+	unsigned long flags;
+	size_t size = PAGE_SIZE;
+	unsigned int zsize = 0;
+	unsigned char *src;
+	void *dst;
+	int ret;
+
+	/*
+	 * Copy the compressed page to this cpu's buffer under the lock,
+	 * and decompress it from there once the lock is dropped.
+	 */
+	local_irq_save(flags);
+	src = __get_cpu_var(zcache_dstmem);
+	spin_lock(&zcache_lock);
+	pool = *poolp;
+	if (pool)
+		entry = zcache_entry_find(pool, oid, index);
+	if (entry) {
+		zsize = entry->zbpg->size[entry->last];
+		memcpy(src, zbud_data(entry->zbpg, entry->last), zsize);
+		if (pool->ephemeral)
+			zcache_entry_delete(entry);
+	}
+	if (pool && pool->ephemeral) {
+		if (entry)
+			zcache_cleancache_hits++;
+		else
+			zcache_cleancache_misses++;
+	}
+	spin_unlock(&zcache_lock);
+
+	if (entry) {
+		dst = kmap_atomic(page, KM_USER0);
+		ret = lzo1x_decompress_safe(src, zsize, dst, &size);
+		kunmap_atomic(dst, KM_USER0);
+		BUG_ON(ret != LZO_E_OK || size != PAGE_SIZE);
+	}
+	local_irq_restore(flags);
+	return entry ? 0 : -1;
+}
+
+static void zcache_flush_page(struct zpool **poolp, unsigned long oid,
+			      pgoff_t index)
+{
+	struct zentry *entry = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	if (*poolp)
+		entry = zcache_entry_find(*poolp, oid, index);
+	if (entry)
+		zcache_entry_delete(entry);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static struct zpool *zcache_new_pool(int ephemeral)
+{
+	struct zpool *pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+
+	if (pool) {
+		pool->objects = RB_ROOT;
+		pool->ephemeral = ephemeral;
+	}
+	return pool;
+}
+
+/* Replace *@poolp by @pool, destroying the old pool and its contents */
+static void zcache_replace_pool(struct zpool **poolp, struct zpool *pool)
+{
+	struct zpool *old;
+	struct rb_node *node;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	old = *poolp;
+	*poolp = pool;
+	if (old) {
+		while ((node = rb_first(&old->objects)))
+			zcache_object_delete(rb_entry(node, struct zobject,
+						      rb_node));
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+	kfree(old);
+}
+
+#ifdef CONFIG_CLEANCACHE
+static struct zpool *zcache_cleancache_pools[ZCACHE_MAX_CLEANCACHE_POOLS];
+
+static void zcache_flush_object(struct zpool **poolp, unsigned long oid)
+{
+	struct zobject *obj = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	if (*poolp)
+		obj = zcache_object_find(*poolp, oid);
+	if (obj)
+		zcache_object_delete(obj);
+	spin_unlock_irqrestore(&zcache_lock, flags);
+}
+
+static int zcache_cleancache_init_fs(size_t pagesize)
+{
+	struct zpool *pool;
+	unsigned long flags;
+	int pool_id;
+
+	if (pagesize != PAGE_SIZE)
+		return -1;
+	pool = zcache_new_pool(1);
+	if (!pool)
+		return -1;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	for (pool_id = 0; pool_id < ZCACHE_MAX_CLEANCACHE_POOLS; pool_id++) {
+		if (!zcache_cleancache_pools[pool_id]) {
+			zcache_cleancache_pools[pool_id] = pool;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	if (pool_id == ZCACHE_MAX_CLEANCACHE_POOLS) {
+		kfree(pool);
+		return -1;
+	}
+	return pool_id;
+}
+
+static int zcache_cleancache_get_page(int pool_id, ino_t ino,
+				      pgoff_t index, struct page *page)
+{
+	return zcache_get(&zcache_cleancache_pools[pool_id], ino, index, page);
+}
+
+static void zcache_cleancache_put_page(int pool_id, ino_t ino,
+				       pgoff_t index, struct page *page)
+{
+	zcache_put(&zcache_cleancache_pools[pool_id], ino, index, page);
+}
+
+static void zcache_cleancache_flush_page(int pool_id, ino_t ino,
+					 pgoff_t index)
+{
+	zcache_flush_page(&zcache_cleancache_pools[pool_id], ino, index);
+}
+
+static void zcache_cleancache_flush_inode(int pool_id, ino_t ino)
+{
+	zcache_flush_object(&zcache_cleancache_pools[pool_id], ino);
+}
+
+static void zcache_cleancache_flush_fs(int pool_id)
+{
+	zcache_replace_pool(&zcache_cleancache_pools[pool_id], NULL);
+}
+
+static struct cleancache_ops zcache_cleancache_ops = {
+	.init_fs	= zcache_cleancache_init_fs,
+	.get_page	= zcache_cleancache_get_page,
+	.put_page	= zcache_cleancache_put_page,
+	.flush_page	= zcache_cleancache_flush_page,
+	.flush_inode	= zcache_cleancache_flush_inode,
+	.flush_fs	= zcache_cleancache_flush_fs,
+};
+#endif /* CONFIG_CLEANCACHE */
+
+#ifdef CONFIG_FRONTSWAP
+static struct zpool *zcache_frontswap_pools[MAX_SWAPFILES];
+
+/* A swap area is one object, 0, indexed by swap offset */
+static void zcache_frontswap_init(unsigned type)
+{
+	zcache_replace_pool(&zcache_frontswap_pools[type], zcache_new_pool(0));
+}
+
+static int zcache_frontswap_put_page(unsigned type, pgoff_t offset,
+				     struct page *page)
+{
+	return zcache_put(&zcache_frontswap_pools[type], 0, offset, page);
+}
+
+static int zcache_frontswap_get_page(unsigned type, pgoff_t offset,
+				     struct page *page)
+{
+	return zcache_get(&zcache_frontswap_pools[type], 0, offset, page);
+}
+
+static void zcache_frontswap_flush_page(unsigned type, pgoff_t offset)
+{
+	zcache_flush_page(&zcache_frontswap_pools[type], 0, offset);
+}
+
+static void zcache_frontswap_flush_area(unsigned type)
+{
+	zcache_replace_pool(&zcache_frontswap_pools[type], NULL);
+}
+
+static struct frontswap_ops zcache_frontswap_ops = {
+	.init		= zcache_frontswap_init,
+	.put_page	= zcache_frontswap_put_page,
+	.get_page	= zcache_frontswap_get_page,
+	.flush_page	= zcache_frontswap_flush_page,
+	.flush_area	= zcache_frontswap_flush_area,
+};
+#endif /* CONFIG_FRONTSWAP */
+
+/*
+ * Under memory pressure, give back what ephemeral pages hold: oldest
+ * first, as when the pool is full.
+ */
+static int zcache_shrink(struct shrinker *shrink, int nr_to_scan,
+			 gfp_t gfp_mask)
+{
+	unsigned long flags;
+	int nr;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	while (nr_to_scan-- > 0 && zcache_evict_one())
+		;
+	nr = zcache_ephemeral_pages;
+	spin_unlock_irqrestore(&zcache_lock, flags);
+	return nr;
+}
+
+static struct shrinker zcache_shrinker = {
+	.shrink = zcache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int zcache_cpu_alloc(long cpu)
+{
+	int node = cpu_to_node(cpu);
+
+	per_cpu(zcache_dstmem, cpu) =
+		kmalloc_node(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL, node);
+	per_cpu(zcache_workmem, cpu) =
+		kmalloc_node(LZO1X_MEM_COMPRESS, GFP_KERNEL, node);
+	if (!per_cpu(zcache_dstmem, cpu) || !per_cpu(zcache_workmem, cpu))
+		return -ENOMEM;
+	return 0;
+}
+
+static void zcache_cpu_free(long cpu)
+{
+	kfree(per_cpu(zcache_dstmem, cpu));
+	per_cpu(zcache_dstmem, cpu) = NULL;
+	kfree(per_cpu(zcache_workmem, cpu));
+	per_cpu(zcache_workmem, cpu) = NULL;
+}
+
+static int __cpuinit zcache_cpu_callback(struct notifier_block *nfb,
+					 unsigned long action, void *hcpu)
+{
+	long cpu = (long)hcpu;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+	case CPU_UP_PREPARE_FROZEN:
+		if (zcache_cpu_alloc(cpu)) {
+			zcache_cpu_free(cpu);
+			return notifier_from_errno(-ENOMEM);
+		}
+		break;
+	case CPU_UP_CANCELED:
+	case CPU_UP_CANCELED_FROZEN:
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		zcache_cpu_free(cpu);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t max_pool_percent_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", zcache_max_pool_percent);
+}
+
+static ssize_t max_pool_percent_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	unsigned long percent;
+	unsigned long flags;
+	int err;
+
+	err = strict_strtoul(buf, 10, &percent);
+	if (err || percent > 100)
+		return -EINVAL;
+
+	spin_lock_irqsave(&zcache_lock, flags);
+	zcache_max_pool_percent = percent;
+	zcache_max_pool_pages = totalram_pages * percent / 100;
+	spin_unlock_irqrestore(&zcache_lock, flags);
+
+	return count;
+}
+static struct kobj_attribute max_pool_percent_attr =
+	__ATTR(max_pool_percent, 0644, max_pool_percent_show,
+	       max_pool_percent_store);
+
+#define ZCACHE_ATTR_RO(_name)						\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%lu\n", zcache_##_name);			\
+}									\
+static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+
+ZCACHE_ATTR_RO(pool_pages);
+ZCACHE_ATTR_RO(ephemeral_pages);
+ZCACHE_ATTR_RO(persistent_pages);
+ZCACHE_ATTR_RO(cleancache_hits);
+ZCACHE_ATTR_RO(cleancache_misses);
+ZCACHE_ATTR_RO(evicted);
+ZCACHE_ATTR_RO(poor_compression);
+ZCACHE_ATTR_RO(put_failed);
+
+static struct attribute *zcache_attr[] = {
+	&max_pool_percent_attr.attr,
+	&pool_pages_attr.attr,
+	&ephemeral_pages_attr.attr,
+	&persistent_pages_attr.attr,
+	&cleancache_hits_attr.attr,
+	&cleancache_misses_attr.attr,
+	&evicted_attr.attr,
+	&poor_compression_attr.attr,
+	&put_failed_attr.attr,
+	NULL,
+};
+
+static struct attribute_group zcache_attr_group = {
+	.attrs = zcache_attr,
+	.name = "zcache",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init zcache_init(void)
+{
+	unsigned int i;
+	long cpu;
+
+	BUILD_BUG_ON(sizeof(struct zbud_page) > ZBUD_CHUNK_SIZE);
+
+	for (i = 0; i < ZBUD_NR_CHUNKS; i++)
+		INIT_LIST_HEAD(&zbud_unbuddied[i]);
+	zcache_max_pool_pages = totalram_pages * zcache_max_pool_percent / 100;
+
+	zcache_object_cache = KMEM_CACHE(zobject, 0);
+	zcache_entry_cache = KMEM_CACHE(zentry, 0);
+	if (!zcache_object_cache || !zcache_entry_cache)
+		goto out;
+
+	for_each_online_cpu(cpu)
+		if (zcache_cpu_alloc(cpu))
+			goto out_cpu;
+	hotcpu_notifier(zcache_cpu_callback, 0);
+
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &zcache_attr_group))
+		printk(KERN_ERR "zcache: failed to register sysfs group\n");
+#endif
+	register_shrinker(&zcache_shrinker);
+#ifdef CONFIG_CLEANCACHE
+	cleancache_register_ops(&zcache_cleancache_ops);
+#endif
+#ifdef CONFIG_FRONTSWAP
+	frontswap_register_ops(&zcache_frontswap_ops);
+#endif
+	return 0;
+
+out_cpu:
+	for_each_online_cpu(cpu)
+		zcache_cpu_free(cpu);
+out:
+	if (zcache_entry_cache)
+		kmem_cache_destroy(zcache_entry_cache);
+	if (zcache_object_cache)
+		kmem_cache_destroy(zcache_object_cache);
+	printk(KERN_ERR "zcache: not enough memory\n");
+	return -ENOMEM;
+}
+module_init(zcache_init)